@@ -4,28 +4,25 @@
 
 # example:
 # bash ./run.sh -live 2 30
+# bash ./run.sh -synthetic 2 30
 # sudo kill -9 $(pidof meili)
 
 BINARY="./build/meili"
 EAL_SUFFIX="-n 1 -a 0000:03:00.0,class=net:regex:compress,rxq_cqe_comp_en=0 -a 0000:03:00.1,class=net --file-prefix dpdk0"
 REGEX_RULE_SET="-r ./rulesets/teakettle.rof2.binary"
 CMD_SUFFIX_LIVE="--input-mode dpdk_port --dpdk-primary-port 0000:03:00.0 --dpdk-second-port 0000:03:00.1 -d rxp"
+# no NIC needed, traffic is generated in process on null ports
+EAL_SUFFIX_SYNTHETIC="-n 1 --no-pci --vdev net_null0 --vdev net_null1 --file-prefix dpdk0"
+CMD_SUFFIX_SYNTHETIC="--input-mode synthetic --dpdk-primary-port net_null0 --dpdk-second-port net_null1 -d hs -R ./rulesets/teakettle_2500.rules --gen-profile http_64"
 
 # Check the argument value and run the corresponding command
 case $1 in
    -live) 
-        case $2 in 
-            1) COREMASK="-l0";;
-            2) COREMASK="-l0,1";;
-            3) COREMASK="-l0,1,2";;
-            4) COREMASK="-l0,1,2,3";;
-            5) COREMASK="-l0,1,2,3,4";;
-            6) COREMASK="-l0,1,2,3,4,5";;
-            7) COREMASK="-l0,1,2,3,4,5,6";;
-            8) COREMASK="-l0,1,2,3,4,5,6,7";;
-            *) echo "Invalid # of cores.";;
-        esac;
+        COREMASK="-l0-$(($2 - 1))";
         CMD="$BINARY -D \"$COREMASK $EAL_SUFFIX \" $CMD_SUFFIX_LIVE $REGEX_RULE_SET -c $2 -s $3";;
+   -synthetic)
+        COREMASK="-l0-$(($2 - 1))";
+        CMD="$BINARY -D \"$COREMASK $EAL_SUFFIX_SYNTHETIC \" $CMD_SUFFIX_SYNTHETIC -c $2 -s $3";;
    *) echo "Invalid argument.";;
 esac
 
@@ -0,0 +1,194 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* Microbenchmarks of data plane primitives, built with 'make bench'.
+ * Every benchmark is repeated warmup + trials times on the main lcore (workers
+ * for the ring suite), EAL pins each lcore to its core.
+ *
+ * example:
+ * ./build/meili-bench -l 0-4 -n 1 --no-pci -- -t 20 -R ./rulesets/teakettle_2500.rules
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+
+#include "bench.h"
+#include "../lib/log/meili_log.h"
+
+/* runtime objects linked in with the primitives expect the main binary's globals */
+volatile bool force_quit;
+
+/* two sided 95% student t quantiles for 1 to 30 degrees of freedom */
+static const double bench_t95[] = {
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201,	2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080,	2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+struct bench_suite {
+	const char *name;
+	int (*run)(struct bench_conf *conf);
+};
+
+static const struct bench_suite bench_suites[] = {
+	{"flow_table",	bench_flow_table},
+	{"reorder",	bench_reorder},
+	{"ring",	bench_ring},
+	{"pkt",		bench_pkt},
+	{"sha",		bench_sha},
+	{"regex",	bench_regex},
+};
+
+void
+bench_print_header(const char *suite)
+{
+	fprintf(stdout, "\n[%s]\n%-44s %12s %10s %12s %10s\n", suite, "benchmark", "cycles/op", "+-95%", "min", "ns/op");
+}
+
+int
+bench_run(struct bench_conf *conf, const char *name, bench_fn_t fn, void *arg)
+{
+	const double ns_per_cycle = 1000000000.0 / rte_get_tsc_hz();
+	double samples[BENCH_MAX_TRIALS];
+	double mean = 0, var = 0, min = 0;
+	uint64_t start, ops;
+	double t, ci;
+	uint32_t i;
+
+	for (i = 0; i < conf->warmup; i++)
+		fn(arg);
+
+	for (i = 0; i < conf->trials; i++) {
+		start = rte_rdtsc_precise();
+		ops = fn(arg);
+		samples[i] = (double)(rte_rdtsc_precise() - start) / (ops ? ops : 1);
+		mean += samples[i];
+		if (!i || samples[i] < min)
+			min = samples[i];
+	}
+	mean /= conf->trials;
+
+	for (i = 0; i < conf->trials; i++)
+		var += (samples[i] - mean) * (samples[i] - mean);
+	if (conf->trials > 1) {
+		var /= conf->trials - 1;
+		t = conf->trials - 1 <= RTE_DIM(bench_t95) ? bench_t95[conf->trials - 2] : 1.960;
+		ci = t * sqrt(var / conf->trials);
+	} else {
+		ci = 0;
+	}
+
+	fprintf(stdout, "%-44s %12.2f %10.2f %12.2f %10.2f\n", name, mean, ci, min, mean * ns_per_cycle);
+
+	return 0;
+}
+
+static void
+bench_usage(const char *prgname)
+{
+	fprintf(stdout,
+		"%s [EAL options] -- [options...]\n"
+		"\t--trials (-t): measured repetitions per benchmark (default %u)\n"
+		"\t--warmup (-w): unmeasured repetitions per benchmark (default %u)\n"
+		"\t--suite (-s): only run one of flow_table, reorder, ring, pkt, sha or regex\n"
+		"\t--raw-rules (-R): regex rules file for the regex suite\n"
+		"\t--help (-h): print options\n",
+		prgname, BENCH_DEFAULT_TRIALS, BENCH_DEFAULT_WARMUP);
+}
+
+static int
+bench_parse_args(struct bench_conf *conf, int argc, char **argv)
+{
+	static struct option opts_long[] = {
+		{"trials", required_argument, 0, 't'},
+		{"warmup", required_argument, 0, 'w'},
+		{"suite", required_argument, 0, 's'},
+		{"raw-rules", required_argument, 0, 'R'},
+		{"help", no_argument, 0, 'h'},
+		{NULL, 0, NULL, 0}};
+	int opt;
+
+	conf->trials = BENCH_DEFAULT_TRIALS;
+	conf->warmup = BENCH_DEFAULT_WARMUP;
+
+	while ((opt = getopt_long(argc, argv, "t:w:s:R:h", opts_long, NULL)) != EOF) {
+		switch (opt) {
+		case 't':
+			conf->trials = atoi(optarg);
+			break;
+		case 'w':
+			conf->warmup = atoi(optarg);
+			break;
+		case 's':
+			conf->suite = optarg;
+			break;
+		case 'R':
+			conf->rules_file = optarg;
+			break;
+		case 'h':
+			bench_usage(argv[0]);
+			rte_exit(EXIT_SUCCESS, NULL);
+		default:
+			bench_usage(argv[0]);
+			return -EINVAL;
+		}
+	}
+
+	if (!conf->trials || conf->trials > BENCH_MAX_TRIALS) {
+		MEILI_LOG_ERR("Trials must be in [1, %u].", BENCH_MAX_TRIALS);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bench_conf conf = {0};
+	bool found = false;
+	uint32_t i;
+	int ret;
+
+	ret = rte_eal_init(argc, argv);
+	if (ret < 0)
+		rte_exit(EXIT_FAILURE, "Failed to init EAL\n");
+	argc -= ret;
+	argv += ret;
+
+	ret = bench_parse_args(&conf, argc, argv);
+	if (ret)
+		rte_exit(EXIT_FAILURE, "Invalid arguments\n");
+
+	conf.pool = rte_pktmbuf_pool_create("BENCH POOL", BENCH_NB_MBUFS, 256, 0, RTE_MBUF_DEFAULT_BUF_SIZE,
+					    rte_socket_id());
+	if (!conf.pool)
+		rte_exit(EXIT_FAILURE, "Failed to create mbuf pool\n");
+
+	MEILI_LOG_INFO("TSC %lu Hz, %u trials after %u warmup runs, main lcore %u, %u workers.", rte_get_tsc_hz(),
+		       conf.trials, conf.warmup, rte_get_main_lcore(), rte_lcore_count() - 1);
+
+	for (i = 0; i < RTE_DIM(bench_suites); i++) {
+		if (conf.suite && strcmp(conf.suite, bench_suites[i].name))
+			continue;
+		found = true;
+		ret = bench_suites[i].run(&conf);
+		if (ret)
+			MEILI_LOG_ERR("Suite %s failed: %d.", bench_suites[i].name, ret);
+	}
+
+	if (!found)
+		MEILI_LOG_ERR("Unknown suite %s.", conf.suite);
+
+	rte_mempool_free(conf.pool);
+	rte_eal_cleanup();
+
+	return 0;
+}
@@ -0,0 +1,40 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_BENCH_H_
+#define _INCLUDE_BENCH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_mempool.h>
+
+#define BENCH_DEFAULT_TRIALS	10
+#define BENCH_DEFAULT_WARMUP	2
+#define BENCH_MAX_TRIALS	1000
+#define BENCH_BURST		64
+#define BENCH_NB_MBUFS		8191
+
+struct bench_conf {
+	uint32_t trials;		/* measured repetitions of each benchmark */
+	uint32_t warmup;		/* unmeasured repetitions before the trials */
+	const char *suite;		/* only run this suite if set */
+	const char *rules_file;		/* raw regex rules for the regex suite */
+	struct rte_mempool *pool;	/* mbufs shared by the pkt based suites */
+};
+
+/* One repetition of a benchmark, returns the number of operations done. */
+typedef uint64_t (*bench_fn_t)(void *arg);
+
+/* Run warmup + trials of fn and print cycles per op with a 95% confidence interval. */
+int bench_run(struct bench_conf *conf, const char *name, bench_fn_t fn, void *arg);
+
+void bench_print_header(const char *suite);
+
+int bench_flow_table(struct bench_conf *conf);
+int bench_reorder(struct bench_conf *conf);
+int bench_ring(struct bench_conf *conf);
+int bench_pkt(struct bench_conf *conf);
+int bench_sha(struct bench_conf *conf);
+int bench_regex(struct bench_conf *conf);
+
+#endif /* _INCLUDE_BENCH_H_ */
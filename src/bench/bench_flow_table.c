@@ -0,0 +1,131 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* meili_flow_table insert/lookup/remove at varying occupancy */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../lib/net/meili_flow.h"
+
+#define BENCH_FT_ENTRIES	(1 << 16)
+#define BENCH_FT_OPS		(1 << 14)
+
+struct bench_ft {
+	meili_flow_table *ft;
+	struct ipv4_5tuple *keys;	/* keys[0, nb_keys) are in the table */
+	struct ipv4_5tuple *miss;	/* keys never inserted */
+	uint32_t nb_keys;
+	uint32_t idx;
+};
+
+static void
+bench_ft_fill_key(struct ipv4_5tuple *key, uint32_t i, uint8_t proto)
+{
+	key->proto = proto;
+	key->src_addr = rte_cpu_to_be_32(RTE_IPV4(10, 0, 0, 0) + i);
+	key->dst_addr = rte_cpu_to_be_32(RTE_IPV4(100, 100, 100, 1));
+	key->src_port = rte_cpu_to_be_16(1024 + (i & 0x7fff));
+	key->dst_port = rte_cpu_to_be_16(80);
+}
+
+static uint64_t
+bench_ft_lookup_hit(void *arg)
+{
+	struct bench_ft *b = arg;
+	char *data;
+	uint32_t i;
+
+	for (i = 0; i < BENCH_FT_OPS; i++) {
+		flow_table_lookup_key(b->ft, &b->keys[b->idx], &data);
+		b->idx = b->idx + 1 == b->nb_keys ? 0 : b->idx + 1;
+	}
+
+	return BENCH_FT_OPS;
+}
+
+static uint64_t
+bench_ft_lookup_miss(void *arg)
+{
+	struct bench_ft *b = arg;
+	char *data;
+	uint32_t i;
+
+	for (i = 0; i < BENCH_FT_OPS; i++)
+		flow_table_lookup_key(b->ft, &b->miss[i], &data);
+
+	return BENCH_FT_OPS;
+}
+
+/* insert a new flow and remove it again so occupancy stays constant */
+static uint64_t
+bench_ft_insert_remove(void *arg)
+{
+	struct bench_ft *b = arg;
+	char *data;
+	uint32_t i;
+
+	for (i = 0; i < BENCH_FT_OPS; i++) {
+		flow_table_add_key(b->ft, &b->miss[i], &data);
+		flow_table_remove_key(b->ft, &b->miss[i]);
+	}
+
+	return BENCH_FT_OPS;
+}
+
+int
+bench_flow_table(struct bench_conf *conf)
+{
+	static const uint32_t occupancy[] = {25, 50, 75, 90};
+	struct bench_ft b = {0};
+	char name[64];
+	char *data;
+	uint32_t i, o;
+	int ret = 0;
+
+	bench_print_header("flow_table");
+
+	b.keys = calloc(BENCH_FT_ENTRIES, sizeof(*b.keys));
+	b.miss = calloc(BENCH_FT_OPS, sizeof(*b.miss));
+	if (!b.keys || !b.miss) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < BENCH_FT_ENTRIES; i++)
+		bench_ft_fill_key(&b.keys[i], i, IP_PROTO_TCP);
+	for (i = 0; i < BENCH_FT_OPS; i++)
+		bench_ft_fill_key(&b.miss[i], i, IP_PROTO_UDP);
+
+	for (o = 0; o < RTE_DIM(occupancy); o++) {
+		b.ft = flow_table_create(BENCH_FT_ENTRIES, 64);
+		if (!b.ft) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		b.nb_keys = BENCH_FT_ENTRIES / 100 * occupancy[o];
+		b.idx = 0;
+		for (i = 0; i < b.nb_keys; i++) {
+			if (flow_table_add_key(b.ft, &b.keys[i], &data) < 0) {
+				b.nb_keys = i;
+				break;
+			}
+		}
+
+		snprintf(name, sizeof(name), "lookup hit, %u%% full", occupancy[o]);
+		bench_run(conf, name, bench_ft_lookup_hit, &b);
+		snprintf(name, sizeof(name), "lookup miss, %u%% full", occupancy[o]);
+		bench_run(conf, name, bench_ft_lookup_miss, &b);
+		snprintf(name, sizeof(name), "insert + remove, %u%% full", occupancy[o]);
+		bench_run(conf, name, bench_ft_insert_remove, &b);
+
+		flow_table_free(b.ft);
+		b.ft = NULL;
+	}
+
+out:
+	free(b.keys);
+	free(b.miss);
+
+	return ret;
+}
@@ -0,0 +1,86 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* Per burst work of the main core: sequencing and timestamping */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+
+#include "bench.h"
+#include "../runtime/pipeline.h"
+#include "../packet_ordering/packet_ordering.h"
+#include "../packet_timestamping/packet_timestamping.h"
+
+#define BENCH_PKT_BURSTS	4096
+
+struct bench_pkt {
+	struct pipeline_stage seq_stage;
+	struct rte_mbuf *mbufs[BENCH_BURST];
+	int ts_offset;
+};
+
+static uint64_t
+bench_pkt_seq(void *arg)
+{
+	struct bench_pkt *b = arg;
+	uint32_t i;
+
+	for (i = 0; i < BENCH_PKT_BURSTS; i++)
+		seq_exec(&b->seq_stage, b->mbufs, BENCH_BURST);
+
+	return BENCH_PKT_BURSTS * BENCH_BURST;
+}
+
+static uint64_t
+bench_pkt_ts(void *arg)
+{
+	struct bench_pkt *b = arg;
+	uint32_t i;
+
+	for (i = 0; i < BENCH_PKT_BURSTS; i++)
+		pkt_ts_exec(b->ts_offset, b->mbufs, BENCH_BURST);
+
+	return BENCH_PKT_BURSTS * BENCH_BURST;
+}
+
+int
+bench_pkt(struct bench_conf *conf)
+{
+	struct rte_reorder_buffer *ro_buf;
+	struct bench_pkt b;
+	int ret;
+
+	bench_print_header("pkt (cycles per pkt)");
+
+	memset(&b, 0, sizeof(b));
+	ret = rte_pktmbuf_alloc_bulk(conf->pool, b.mbufs, BENCH_BURST);
+	if (ret)
+		return -ENOMEM;
+
+	ret = seq_init(&b.seq_stage);
+	if (ret)
+		goto out;
+	ret = pkt_ts_init(&b.ts_offset);
+	if (ret)
+		goto out_seq;
+
+	/* seqn dynfield is registered along with a reorder buffer, as in pipeline init */
+	ro_buf = rte_reorder_create("BENCH_SEQ", rte_socket_id(), REORDER_BUFFER_SIZE);
+	if (!ro_buf) {
+		ret = -ENOMEM;
+		goto out_seq;
+	}
+	rte_reorder_free(ro_buf);
+
+	bench_run(conf, "seq_exec, burst 64", bench_pkt_seq, &b);
+	bench_run(conf, "pkt_ts_exec, burst 64", bench_pkt_ts, &b);
+
+out_seq:
+	seq_free(&b.seq_stage);
+out:
+	rte_pktmbuf_free_bulk(b.mbufs, BENCH_BURST);
+
+	return ret;
+}
@@ -0,0 +1,183 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* Software regex backend (hyperscan block mode) over the raw rules files in
+ * rulesets/. The BlueField regex device is only reachable through a running
+ * pipeline and is measured with the throughput search in src/control.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../lib/log/meili_log.h"
+
+#ifdef USE_HYPERSCAN
+#include <hs.h>
+
+#define BENCH_REGEX_SCANS	1024
+#define BENCH_REGEX_MAX_LEN	1500
+#define BENCH_REGEX_MAX_RULES	10000
+#define BENCH_REGEX_LINE_LEN	4096
+
+struct bench_regex {
+	hs_database_t *db;
+	hs_scratch_t *scratch;
+	char data[BENCH_REGEX_MAX_LEN];
+	uint32_t len;
+	uint64_t matches;
+};
+
+struct bench_regex_rules {
+	char **exprs;
+	unsigned int *flags;
+	unsigned int *ids;
+	uint32_t nb_rules;
+};
+
+static int
+bench_regex_on_match(unsigned int id __rte_unused, unsigned long long from __rte_unused,
+		     unsigned long long to __rte_unused, unsigned int flags __rte_unused, void *ctx)
+{
+	((struct bench_regex *)ctx)->matches++;
+
+	return 0;
+}
+
+static uint64_t
+bench_regex_scan(void *arg)
+{
+	struct bench_regex *b = arg;
+	uint32_t i;
+
+	for (i = 0; i < BENCH_REGEX_SCANS; i++)
+		hs_scan(b->db, b->data, b->len, 0, b->scratch, bench_regex_on_match, b);
+
+	return BENCH_REGEX_SCANS;
+}
+
+/* Parse "id, /expr/flags" lines of the raw rules files. */
+static int
+bench_regex_load_rules(const char *file, struct bench_regex_rules *rules)
+{
+	char line[BENCH_REGEX_LINE_LEN];
+	char *start, *end, *f;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		MEILI_LOG_ERR("Failed to open rules file %s.", file);
+		return -EINVAL;
+	}
+
+	rules->exprs = calloc(BENCH_REGEX_MAX_RULES, sizeof(char *));
+	rules->flags = calloc(BENCH_REGEX_MAX_RULES, sizeof(unsigned int));
+	rules->ids = calloc(BENCH_REGEX_MAX_RULES, sizeof(unsigned int));
+	if (!rules->exprs || !rules->flags || !rules->ids) {
+		fclose(fp);
+		return -ENOMEM;
+	}
+
+	while (fgets(line, sizeof(line), fp) && rules->nb_rules < BENCH_REGEX_MAX_RULES) {
+		start = strchr(line, '/');
+		end = strrchr(line, '/');
+		if (!start || end == start)
+			continue;
+
+		*end = '\0';
+		rules->ids[rules->nb_rules] = strtoul(line, NULL, 10);
+		rules->exprs[rules->nb_rules] = strdup(start + 1);
+		if (!rules->exprs[rules->nb_rules])
+			break;
+		for (f = end + 1; *f && *f != '\n'; f++) {
+			if (*f == 'i')
+				rules->flags[rules->nb_rules] |= HS_FLAG_CASELESS;
+			else if (*f == 's')
+				rules->flags[rules->nb_rules] |= HS_FLAG_DOTALL;
+			else if (*f == 'm')
+				rules->flags[rules->nb_rules] |= HS_FLAG_MULTILINE;
+		}
+		rules->nb_rules++;
+	}
+	fclose(fp);
+
+	return rules->nb_rules ? 0 : -EINVAL;
+}
+
+static void
+bench_regex_free_rules(struct bench_regex_rules *rules)
+{
+	uint32_t i;
+
+	for (i = 0; rules->exprs && i < rules->nb_rules; i++)
+		free(rules->exprs[i]);
+	free(rules->exprs);
+	free(rules->flags);
+	free(rules->ids);
+}
+
+int
+bench_regex(struct bench_conf *conf)
+{
+	static const char http_hdr[] = "GET / HTTP/1.1\r\nHost: www.ab.com\r\n\r\n";
+	static const uint32_t lens[] = {64, 512, BENCH_REGEX_MAX_LEN};
+	struct bench_regex_rules rules = {0};
+	hs_compile_error_t *compile_err;
+	struct bench_regex b = {0};
+	char name[64];
+	uint32_t i;
+	int ret;
+
+	bench_print_header("regex (cycles per scan)");
+
+	if (!conf->rules_file) {
+		MEILI_LOG_INFO("Skipping regex suite, no --raw-rules given.");
+		return 0;
+	}
+
+	ret = bench_regex_load_rules(conf->rules_file, &rules);
+	if (ret)
+		goto out;
+
+	if (hs_compile_multi((const char *const *)rules.exprs, rules.flags, rules.ids, rules.nb_rules, HS_MODE_BLOCK,
+			     NULL, &b.db, &compile_err) != HS_SUCCESS) {
+		MEILI_LOG_ERR("Hyperscan compile failed: %s.", compile_err->message);
+		hs_free_compile_error(compile_err);
+		ret = -EINVAL;
+		goto out;
+	}
+	if (hs_alloc_scratch(b.db, &b.scratch) != HS_SUCCESS) {
+		ret = -ENOMEM;
+		goto out_db;
+	}
+
+	/* same payloads as the synthetic traffic profiles */
+	memset(b.data, 'A', sizeof(b.data));
+	memcpy(b.data, http_hdr, strlen(http_hdr));
+
+	for (i = 0; i < RTE_DIM(lens); i++) {
+		b.len = lens[i];
+		snprintf(name, sizeof(name), "hyperscan, %u rules, %u bytes", rules.nb_rules, lens[i]);
+		bench_run(conf, name, bench_regex_scan, &b);
+	}
+
+	hs_free_scratch(b.scratch);
+out_db:
+	hs_free_database(b.db);
+out:
+	bench_regex_free_rules(&rules);
+
+	return ret;
+}
+
+#else
+
+int
+bench_regex(struct bench_conf *conf __rte_unused)
+{
+	MEILI_LOG_INFO("Skipping regex suite, built without hyperscan.");
+
+	return 0;
+}
+
+#endif /* USE_HYPERSCAN */
@@ -0,0 +1,103 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* rte_reorder insert/drain of in order and out of order bursts */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+
+#include "bench.h"
+#include "../packet_ordering/packet_ordering.h"
+#include "../utils/rte_reorder/rte_reorder.h"
+
+#define BENCH_RO_BURSTS		1024
+
+struct bench_ro {
+	struct rte_reorder_buffer *buf;
+	struct rte_mbuf *mbufs[BENCH_BURST];
+	uint32_t perm[BENCH_BURST];	/* seqn offsets within a burst */
+	uint32_t seqn;
+};
+
+static uint64_t
+bench_ro_insert_drain(void *arg)
+{
+	struct bench_ro *b = arg;
+	struct rte_mbuf *out[BENCH_BURST];
+	uint32_t i, j;
+
+	for (i = 0; i < BENCH_RO_BURSTS; i++) {
+		for (j = 0; j < BENCH_BURST; j++) {
+			*rte_reorder_seqn(b->mbufs[j]) = b->seqn + b->perm[j];
+			rte_reorder_insert(b->buf, b->mbufs[j]);
+		}
+		/* the whole burst drains once its lowest seqn arrived */
+		rte_reorder_drain(b->buf, out, BENCH_BURST);
+		b->seqn += BENCH_BURST;
+	}
+
+	return BENCH_RO_BURSTS * BENCH_BURST;
+}
+
+/* Fisher-Yates shuffle of the burst within a window of size window. */
+static void
+bench_ro_shuffle(uint32_t *perm, uint32_t window)
+{
+	uint32_t i, j, k, tmp;
+
+	for (i = 0; i < BENCH_BURST; i++)
+		perm[i] = i;
+
+	for (k = 0; k < BENCH_BURST; k += window) {
+		for (i = RTE_MIN(k + window, BENCH_BURST) - 1; i > k; i--) {
+			j = k + rand() % (i - k + 1);
+			tmp = perm[i];
+			perm[i] = perm[j];
+			perm[j] = tmp;
+		}
+	}
+}
+
+int
+bench_reorder(struct bench_conf *conf)
+{
+	static const uint32_t windows[] = {1, 4, 16, BENCH_BURST};
+	struct bench_ro b = {0};
+	char name[64];
+	uint32_t w;
+	int ret;
+
+	bench_print_header("reorder");
+
+	b.buf = rte_reorder_create("BENCH_RO", rte_socket_id(), REORDER_BUFFER_SIZE);
+	if (!b.buf)
+		return -ENOMEM;
+
+	ret = rte_pktmbuf_alloc_bulk(conf->pool, b.mbufs, BENCH_BURST);
+	if (ret) {
+		rte_reorder_free(b.buf);
+		return -ENOMEM;
+	}
+
+	srand(0);
+	for (w = 0; w < RTE_DIM(windows); w++) {
+		bench_ro_shuffle(b.perm, windows[w]);
+		rte_reorder_reset(b.buf);
+		rte_reorder_min_seqn_set(b.buf, 0);
+		b.seqn = 0;
+
+		if (windows[w] == 1)
+			snprintf(name, sizeof(name), "insert + drain, in order");
+		else
+			snprintf(name, sizeof(name), "insert + drain, shuffled in %u", windows[w]);
+		bench_run(conf, name, bench_ro_insert_drain, &b);
+	}
+
+	/* every burst was drained, the buffer holds no mbufs */
+	rte_pktmbuf_free_bulk(b.mbufs, BENCH_BURST);
+	rte_reorder_free(b.buf);
+
+	return 0;
+}
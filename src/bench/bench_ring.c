@@ -0,0 +1,204 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* Inter-stage ring topologies between producer and consumer lcores: one shared
+ * HTS ring, one shared RTS ring (the alternative commented in the pipeline) and
+ * a per pair SPSC mesh as used when stages do not share buffers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <rte_launch.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_ring.h>
+
+#include "bench.h"
+#include "../lib/log/meili_log.h"
+#include "../runtime/pipeline.h"
+
+#define BENCH_RING_OBJS		(1 << 20)	/* objs per producer per trial */
+#define BENCH_RING_MAX_SIDE	8
+
+enum bench_ring_topo {
+	BENCH_RING_HTS,
+	BENCH_RING_RTS,
+	BENCH_RING_SPSC_MESH,
+};
+
+struct bench_ring {
+	enum bench_ring_topo topo;
+	uint32_t nb_prod;
+	uint32_t nb_cons;
+	/* shared topologies only use rings[0][0] */
+	struct rte_ring *rings[BENCH_RING_MAX_SIDE][BENCH_RING_MAX_SIDE];
+	uint64_t consumed __rte_cache_aligned;
+};
+
+struct bench_ring_worker {
+	struct bench_ring *b;
+	uint32_t idx;
+	bool prod;
+} __rte_cache_aligned;
+
+static struct bench_ring_worker bench_ring_workers[RTE_MAX_LCORE];
+
+static int
+bench_ring_prod(struct bench_ring *b, uint32_t p)
+{
+	void *objs[BENCH_BURST];
+	struct rte_ring *r;
+	uint64_t sent = 0;
+	uint32_t c = 0;
+	uint32_t i;
+
+	for (i = 0; i < BENCH_BURST; i++)
+		objs[i] = (void *)(uintptr_t)(i + 1);
+
+	while (sent < BENCH_RING_OBJS) {
+		r = b->topo == BENCH_RING_SPSC_MESH ? b->rings[p][c] : b->rings[0][0];
+		sent += rte_ring_enqueue_burst(r, objs, RTE_MIN((uint64_t)BENCH_BURST, BENCH_RING_OBJS - sent), NULL);
+		c = c + 1 == b->nb_cons ? 0 : c + 1;
+	}
+
+	return 0;
+}
+
+static int
+bench_ring_cons(struct bench_ring *b, uint32_t c)
+{
+	const uint64_t total = (uint64_t)BENCH_RING_OBJS * b->nb_prod;
+	void *objs[BENCH_BURST];
+	struct rte_ring *r;
+	uint32_t p = 0;
+	uint32_t nb;
+
+	while (__atomic_load_n(&b->consumed, __ATOMIC_RELAXED) < total) {
+		r = b->topo == BENCH_RING_SPSC_MESH ? b->rings[p][c] : b->rings[0][0];
+		nb = rte_ring_dequeue_burst(r, objs, BENCH_BURST, NULL);
+		if (nb)
+			__atomic_add_fetch(&b->consumed, nb, __ATOMIC_RELAXED);
+		p = p + 1 == b->nb_prod ? 0 : p + 1;
+	}
+
+	return 0;
+}
+
+static int
+bench_ring_worker(void *arg)
+{
+	struct bench_ring_worker *w = arg;
+
+	return w->prod ? bench_ring_prod(w->b, w->idx) : bench_ring_cons(w->b, w->idx);
+}
+
+/* One trial: launch producers and consumers and wait for every obj to be consumed. */
+static uint64_t
+bench_ring_trial(void *arg)
+{
+	struct bench_ring *b = arg;
+	uint32_t n = 0;
+	unsigned int lcore_id;
+
+	b->consumed = 0;
+	RTE_LCORE_FOREACH_WORKER(lcore_id) {
+		if (n == b->nb_prod + b->nb_cons)
+			break;
+		bench_ring_workers[lcore_id].b = b;
+		bench_ring_workers[lcore_id].prod = n < b->nb_prod;
+		bench_ring_workers[lcore_id].idx = n < b->nb_prod ? n : n - b->nb_prod;
+		rte_eal_remote_launch(bench_ring_worker, &bench_ring_workers[lcore_id], lcore_id);
+		n++;
+	}
+	rte_eal_mp_wait_lcore();
+
+	return (uint64_t)BENCH_RING_OBJS * b->nb_prod;
+}
+
+static void
+bench_ring_free(struct bench_ring *b)
+{
+	uint32_t p, c;
+
+	for (p = 0; p < BENCH_RING_MAX_SIDE; p++) {
+		for (c = 0; c < BENCH_RING_MAX_SIDE; c++) {
+			rte_ring_free(b->rings[p][c]);
+			b->rings[p][c] = NULL;
+		}
+	}
+}
+
+static int
+bench_ring_create(struct bench_ring *b)
+{
+	char name[RTE_RING_NAMESIZE];
+	uint32_t p, c;
+
+	if (b->topo == BENCH_RING_HTS) {
+		b->rings[0][0] = rte_ring_create("bench_hts", RING_SIZE, rte_socket_id(),
+						 RING_F_MP_HTS_ENQ | RING_F_MC_HTS_DEQ);
+		return b->rings[0][0] ? 0 : -ENOMEM;
+	}
+	if (b->topo == BENCH_RING_RTS) {
+		b->rings[0][0] = rte_ring_create("bench_rts", RING_SIZE, rte_socket_id(),
+						 RING_F_MP_RTS_ENQ | RING_F_MC_RTS_DEQ);
+		return b->rings[0][0] ? 0 : -ENOMEM;
+	}
+
+	for (p = 0; p < b->nb_prod; p++) {
+		for (c = 0; c < b->nb_cons; c++) {
+			snprintf(name, sizeof(name), "bench_spsc_%u_%u", p, c);
+			b->rings[p][c] = rte_ring_create(name, RING_SIZE, rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
+			if (!b->rings[p][c])
+				return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+int
+bench_ring(struct bench_conf *conf)
+{
+	static const uint32_t sides[][2] = {{1, 1}, {1, 2}, {2, 1}, {2, 2}, {4, 4}};
+	static const char *const topo_names[] = {"shared hts", "shared rts", "spsc mesh"};
+	const uint32_t nb_workers = rte_lcore_count() - 1;
+	struct bench_ring *b;
+	char name[64];
+	uint32_t s, t;
+	int ret = 0;
+
+	bench_print_header("ring (cycles per obj, wall clock)");
+
+	b = rte_zmalloc(NULL, sizeof(*b), RTE_CACHE_LINE_SIZE);
+	if (!b)
+		return -ENOMEM;
+
+	for (s = 0; s < RTE_DIM(sides); s++) {
+		if (sides[s][0] + sides[s][1] > nb_workers) {
+			MEILI_LOG_INFO("Skipping %ux%u ring benchmarks, %u worker lcores available.", sides[s][0],
+				       sides[s][1], nb_workers);
+			continue;
+		}
+
+		for (t = 0; t < RTE_DIM(topo_names); t++) {
+			b->topo = t;
+			b->nb_prod = sides[s][0];
+			b->nb_cons = sides[s][1];
+			ret = bench_ring_create(b);
+			if (ret) {
+				bench_ring_free(b);
+				goto out;
+			}
+
+			snprintf(name, sizeof(name), "%s, %u prod x %u cons", topo_names[t], b->nb_prod, b->nb_cons);
+			bench_run(conf, name, bench_ring_trial, b);
+			bench_ring_free(b);
+		}
+	}
+
+out:
+	rte_free(b);
+
+	return ret;
+}
@@ -0,0 +1,50 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* SHA1 of example apps over typical payload sizes */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../example/libs/sha/sha1.h"
+
+#define BENCH_SHA_CALLS		1024
+#define BENCH_SHA_MAX_LEN	1500
+
+struct bench_sha {
+	char data[BENCH_SHA_MAX_LEN];
+	char hash[SHA_HASH_SIZE + 1];
+	int len;
+};
+
+static uint64_t
+bench_sha_run(void *arg)
+{
+	struct bench_sha *b = arg;
+	uint32_t i;
+
+	for (i = 0; i < BENCH_SHA_CALLS; i++)
+		SHA1(b->hash, b->data, b->len);
+
+	return BENCH_SHA_CALLS;
+}
+
+int
+bench_sha(struct bench_conf *conf)
+{
+	static const int lens[] = {64, 512, BENCH_SHA_MAX_LEN};
+	struct bench_sha b;
+	char name[64];
+	uint32_t i;
+
+	bench_print_header("sha (cycles per call)");
+
+	memset(b.data, 'A', sizeof(b.data));
+	for (i = 0; i < RTE_DIM(lens); i++) {
+		b.len = lens[i];
+		snprintf(name, sizeof(name), "SHA1, %d bytes", lens[i]);
+		bench_run(conf, name, bench_sha_run, &b);
+	}
+
+	return 0;
+}
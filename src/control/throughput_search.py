@@ -0,0 +1,132 @@
+# Copyright (c) 2024, Meili Authors
+
+# Zero-loss throughput search (RFC 2544 style).
+# For every (frame size, core count) point the offered rate is binary searched
+# for the highest rate with loss <= tolerance. Each trial runs the pipeline
+# against a local source (synthetic traffic on net_null by default) with the
+# ingress rate limiter and reads back the --stats-json report.
+#
+# example:
+# python3 src/control/throughput_search.py --sizes 64,512,1514 --cores 2,4 -o report.json
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+DEFAULT_EAL = "-n 1 --no-pci --vdev net_null0 --vdev net_null1 --file-prefix bench"
+DEFAULT_ARGS = ("--input-mode synthetic --dpdk-primary-port net_null0 --dpdk-second-port net_null1 "
+                "-d hs -R ./rulesets/teakettle_2500.rules")
+
+
+def run_trial(args, size, cores, rate_kpps):
+    """Run the pipeline once, rate_kpps = 0 runs without rate limit. Returns the stats json."""
+    fd, stats_file = tempfile.mkstemp(prefix="meili_stats_", suffix=".json")
+    os.close(fd)
+
+    eal = "-l 0-%d %s" % (cores - 1, args.eal)
+    cmd = [args.binary, "-D", eal] + args.app_args.split() + [
+        "-c", str(cores),
+        "-s", str(args.duration),
+        "--gen-sizes", str(size),
+        "--latency-probe", str(args.probe),
+        "--stats-json", stats_file,
+    ]
+    if rate_kpps:
+        cmd += ["--rate-limit-kpps", str(int(rate_kpps)), "--rate-limit-burst", str(args.burst_us)]
+
+    try:
+        with open(os.devnull, "w") as null:
+            subprocess.run(cmd, stdout=null if not args.verbose else None, check=True)
+        with open(stats_file) as f:
+            return json.load(f)
+    finally:
+        os.unlink(stats_file)
+
+
+def summarize(trial, rate_kpps):
+    lat = trial.get("latency_us")
+    return {
+        "offered_kpps": rate_kpps,
+        "loss_ratio": trial["loss_ratio"],
+        "rx_mpps": trial["rx"]["pkts"] / trial["duration"] / 1e6,
+        "tx_mpps": trial["tx"]["mpps"],
+        "tx_gbps": trial["tx"]["gbps"],
+        "p99_us": lat["p99"] if lat else None,
+        "stages": [{"lcore": s["lcore"], "type": s["type"], "utilization": s["utilization"],
+                    "idle": s["idle"], "stalled": s["stalled"], "cycles_per_pkt": s["cycles_per_pkt"]}
+                   for s in trial["stages"]],
+    }
+
+
+def search_point(args, size, cores):
+    """Binary search the zero loss rate of one frame size and core count."""
+    trials = []
+
+    # an unlimited run bounds the search from above
+    peak = run_trial(args, size, cores, 0)
+    hi = peak["rx"]["pkts"] / peak["duration"] / 1e3 * (1 + args.precision)
+    if args.max_kpps:
+        hi = min(hi, args.max_kpps)
+    lo = 0.0
+    best = None
+
+    while hi - lo > hi * args.precision and len(trials) < args.max_trials:
+        rate = (lo + hi) / 2
+        res = summarize(run_trial(args, size, cores, rate), rate)
+        res["pass"] = res["loss_ratio"] <= args.loss
+        trials.append(res)
+        print("size %5d cores %2d rate %10.1f kpps loss %.6f -> %s" %
+              (size, cores, rate, res["loss_ratio"], "pass" if res["pass"] else "fail"), file=sys.stderr)
+        if res["pass"]:
+            lo = rate
+            best = res
+        else:
+            hi = rate
+
+    return {
+        "frame_size": size,
+        "cores": cores,
+        "zero_loss_kpps": best["offered_kpps"] if best else 0,
+        "throughput_mpps": best["tx_mpps"] if best else 0,
+        "throughput_gbps": best["tx_gbps"] if best else 0,
+        "p99_us": best["p99_us"] if best else None,
+        "stages": best["stages"] if best else [],
+        "unlimited": summarize(peak, 0),
+        "trials": trials,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Zero loss throughput search for Meili pipelines")
+    parser.add_argument("--binary", default="./build/meili")
+    parser.add_argument("--eal", default=DEFAULT_EAL, help="dpdk eal params without core list")
+    parser.add_argument("--app-args", default=DEFAULT_ARGS, help="meili params selecting input and regex device")
+    parser.add_argument("--sizes", default="64,128,256,512,1024,1280,1514", help="frame sizes in bytes")
+    parser.add_argument("--cores", default="2", help="core counts including the main core")
+    parser.add_argument("--duration", type=int, default=10, help="secs per trial")
+    parser.add_argument("--loss", type=float, default=0.0, help="accepted loss ratio")
+    parser.add_argument("--precision", type=float, default=0.01, help="relative search resolution")
+    parser.add_argument("--max-kpps", type=float, default=0, help="upper bound of offered rate")
+    parser.add_argument("--max-trials", type=int, default=16, help="max trials per point")
+    parser.add_argument("--burst-us", type=int, default=100,
+                        help="rate limiter depth, emulates the rx ring a NIC would overflow")
+    parser.add_argument("--probe", type=int, default=1000, help="measure the latency of 1 in N pkts")
+    parser.add_argument("-o", "--output", default="throughput_report.json")
+    parser.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args()
+
+    report = {"duration": args.duration, "loss_tolerance": args.loss, "points": []}
+    for cores in [int(c) for c in args.cores.split(",")]:
+        for size in [int(s) for s in args.sizes.split(",")]:
+            report["points"].append(search_point(args, size, cores))
+
+    with open(args.output, "w") as f:
+        json.dump(report, f, indent=2)
+    print("Report written to %s" % args.output, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,96 @@
+# Copyright (c) 2024, Meili Authors
+
+# Decoder of the flight recorder dumps written with --trace (see src/utils/trace).
+# Prints the records of all lcores merged in time order, relative to the newest
+# record of the dump.
+#
+# example:
+# python3 src/control/trace_decode.py /tmp/meili.trc --last 200 --lcore 1
+
+import argparse
+import struct
+import sys
+
+FILE_HDR = struct.Struct("<8sIIQII")
+RING_HDR = struct.Struct("<IIQ")
+REC = struct.Struct("<QHHIQQ")
+MAGIC = b"MEILITRC"
+VERSION = 1
+
+# Keep in sync with enum trace_event in src/utils/trace/trace.h.
+TRACE_EVENTS = [
+    ("none", None),
+    ("rx_burst", "port={a} pkts={b}"),
+    ("tx_burst", "port={a} sent={b} dropped={c}"),
+    ("stage_burst", "qid={a} pkts={b} busy_cycles={c}"),
+    ("ring_full", "qid={a} left={b} ring_free={c}"),
+    ("reorder_gap", "reason={a} seqn={b} expected={c}"),
+    ("regex_enq", "qid={a} enqueued={b} requested={c}"),
+    ("regex_deq", "qid={a} dequeued={b}"),
+    ("mode", "mode={a} b={b} c={c}"),
+]
+REORDER_GAPS = ["early", "no_space", "out_of_order"]
+MODES = ["run_start", "run_stop", "rate_limit", "scale", "migrate", "hold_full"]
+
+
+def read_dump(path):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    magic, version, nb_rings, tsc_hz, ring_size, rec_size = FILE_HDR.unpack_from(data, 0)
+    if magic != MAGIC or version != VERSION or rec_size != REC.size:
+        sys.exit("%s: not a version %d trace dump" % (path, VERSION))
+
+    recs = []
+    off = FILE_HDR.size
+    for _ in range(nb_rings):
+        lcore, _, head = RING_HDR.unpack_from(data, off)
+        off += RING_HDR.size
+        # the ring holds the last min(head, ring_size) records, oldest at head
+        first = max(0, head - ring_size)
+        for seq in range(first, head):
+            tsc, event, rec_lcore, a, b, c = REC.unpack_from(data, off + (seq % ring_size) * REC.size)
+            # a slot being written during the dump may be torn
+            if event == 0 or event >= len(TRACE_EVENTS) or rec_lcore != lcore:
+                continue
+            recs.append((tsc, lcore, seq, event, a, b, c))
+        off += ring_size * REC.size
+
+    recs.sort()
+    return tsc_hz, recs
+
+
+def format_rec(event, a, b, c):
+    name, fmt = TRACE_EVENTS[event]
+    if name == "reorder_gap" and a < len(REORDER_GAPS):
+        a = REORDER_GAPS[a]
+    elif name == "mode" and a < len(MODES):
+        a = MODES[a]
+    return "%-12s %s" % (name, fmt.format(a=a, b=b, c=c))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a flight recorder dump.")
+    parser.add_argument("dump", help="file written by --trace")
+    parser.add_argument("--lcore", type=int, help="only show records of this lcore")
+    parser.add_argument("--event", help="only show records of this event, e.g. ring_full")
+    parser.add_argument("--last", type=int, default=0, help="only show the newest N records")
+    args = parser.parse_args()
+
+    tsc_hz, recs = read_dump(args.dump)
+    if args.lcore is not None:
+        recs = [r for r in recs if r[1] == args.lcore]
+    if args.event:
+        recs = [r for r in recs if TRACE_EVENTS[r[3]][0] == args.event]
+    if args.last:
+        recs = recs[-args.last:]
+    if not recs:
+        return
+
+    end = recs[-1][0]
+    for tsc, lcore, seq, event, a, b, c in recs:
+        print("%14.3f us  lcore %3d  #%-10d %s" % ((tsc - end) * 1e6 / tsc_hz, lcore, seq, format_rec(event, a, b, c)))
+
+
+if __name__ == "__main__":
+    main()
@@ -8,21 +8,22 @@
 
 
 MEILI_INIT(EXAMPLE)
-/* allocate space for pipeline state */
-self->state = (struct EXAMPLE_state *)malloc(sizeof(struct EXAMPLE_state));
+/* allocate space for pipeline state, zeroed and on the numa node of the stage core */
+self->state = (struct EXAMPLE_state *)meili_malloc(self, sizeof(struct EXAMPLE_state));
 // printf("initializing example app\n");
 struct EXAMPLE_state *mystate = (struct EXAMPLE_state *)self->state;
 if(!mystate){
     return -ENOMEM;
 }
 
-memset(self->state, 0x00, sizeof(struct EXAMPLE_state));
-
 mystate->threshold = DDOS_DEFAULT_THRESH;
 mystate->p_window = DDOS_DEFAULT_WINDOW;
-mystate->p_set = calloc(mystate->p_window, sizeof(uint32_t));
-mystate->p_tot = calloc(mystate->p_window, sizeof(uint32_t));
-mystate->p_entropy = calloc(mystate->p_window, sizeof(uint32_t));
+mystate->p_set = meili_calloc(self, mystate->p_window, sizeof(uint32_t));
+mystate->p_tot = meili_calloc(self, mystate->p_window, sizeof(uint32_t));
+mystate->p_entropy = meili_calloc(self, mystate->p_window, sizeof(uint32_t));
+if(!mystate->p_set || !mystate->p_tot || !mystate->p_entropy){
+    return -ENOMEM;
+}
 mystate->head = 0;
 
 return 0;
@@ -30,11 +31,8 @@ MEILI_END_DECLS
 
 
 MEILI_FREE(EXAMPLE)
-struct EXAMPLE_state *mystate = (struct EXAMPLE_state *)self->state;
-free(mystate->p_set);
-free(mystate->p_tot);
-free(mystate->p_entropy);
-free(mystate);
+/* state lives in the stage arena, released by the runtime after this */
+self->state = NULL;
 return 0;
 MEILI_END_DECLS
 
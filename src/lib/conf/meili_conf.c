@@ -29,6 +29,7 @@
 #include "../log/meili_log.h"
 #include "../../runtime/meili_runtime.h"
 #include "../../utils/str/str_helpers.h"
+#include "../../utils/rate_limit/rate_limit.h"
 
 #define MEILI_VERSION        "1.0"
 
@@ -52,6 +53,10 @@ conf_init(pl_conf *conf)
 	/* User is required to specify device and input mode. */
 	conf->regex_dev_type = REGEX_DEV_UNKNOWN;
 	conf->input_mode = INPUT_UNKNOWN;
+	conf->run_mode = RUN_MODE_UNKNOWN;
+	conf->latency_type = LATENCY_TYPE_UNKNOWN;
+	conf->gen_profile = GEN_PROFILE_UNKNOWN;
+	conf->prefetch_dist = PL_PREFETCH_DIST_UNSET;
 
 	conf_file = NULL;
 }
@@ -212,9 +217,14 @@ pipeline_usage(const char *prgname)
 		"\t--dpdk-eal (-D): dpdk params as quoted string (\"..\")\n"
 		"\t--verbose (-V): create match files (1: csv 2: hex 3: ascii)\n"
 		"\t--cores (-c): number of CPU cores to use\n"
+		"\t--stats-json (-j): write end of run stats to the given file as json\n"
+		"\t--metrics (-e): serve prometheus metrics on a unix socket path or a 127.0.0.1 tcp port\n"
+		"\t--trace (-k): record per core events, dumped to the given file on SIGUSR1 and exit\n"
+		"\t--control (-q): accept control commands on a unix socket path or a 127.0.0.1 tcp port\n"
+		"\t--perf-counters (-a): count instructions, cycles and cache, branch and tlb misses per stage\n"
 		"Configuration:\n"
 		"\t--regex-dev (-d): 'regex_dpdk'/'rxp', 'hyperscan'/'hs' or 'doca_regex'/'doca'\n"
-		"\t--input-mode (-m): 'dpdk_port', 'pcap_file', 'text_file', 'job_format' or 'remote_mmap'\n"
+		"\t--input-mode (-m): 'dpdk_port', 'pcap_file', 'text_file', 'job_format', 'remote_mmap' or 'synthetic'\n"
 		"\t--input-file (-f): pcap, text file, job directory, or remote memory export definition to use\n"
 		"\t--rules (-r): regex rules file (compiled)\n"
 		"\t--raw-rules (-R): regex rules file (uncompiled)\n"
@@ -231,7 +241,7 @@ pipeline_usage(const char *prgname)
 		"\t--buf-group (-g): num of buffers in group/batch to process\n"
 		"\t--sliding-window (-w): overlap if job > max size and needs split (doca regex mode)\n"
 		"Regex DPDK/DOCA Specific:\n"
-		"\t--latency-mode (-8): run in mode focusing on latency over throughput (rxp or doca mode)\n"
+		"\t--latency-mode (-8): run in mode focusing on latency over throughput (per pkt pipeline, rxp or doca mode)\n"
 		"Hyperscan Specific:\n"
 		"\t--hs-singlematch (-H): (no arg) apply HS_FLAG_SINGLEMATCH\n"
 		"\t--hs-leftmost (-L): (no arg) apply HS_FLAGS_SOM_LEFTMOST\n"
@@ -244,6 +254,32 @@ pipeline_usage(const char *prgname)
 		"DPDK Port Specific:\n"
 		"\t--dpdk-primary-port (-1): dpdk port to use in live mode\n"
 		"\t--dpdk-second-port (-2): second dpdk port to use\n"
+		"Synthetic Traffic Specific:\n"
+		"\t--gen-profile (-y): generated traffic 'http_64' (default), 'http_1500' or 'microbenchmark'\n"
+		"\t--gen-sizes (-Z): frame size mix as len:weight list, e.g. '64:7,570:4,1514:1'\n"
+		"\t--gen-flows (-N): num of distinct flows (src ip) to generate (default 1)\n"
+		"\t--gen-zipf (-z): zipf exponent of flow popularity, 0 for uniform (default 0)\n"
+		"Pipeline Run Mode:\n"
+		"\t--run-mode (-M): 'meili' (default), 'baseline' or 'all_remote' (all traffic remote on arrival)\n"
+		"\t--latency-type (-T): latency recorded in latency mode: 'end2end' (default), 'partition' or 'aggregation'\n"
+		"\t--latency-sample (-E): (no arg) keep per packet latency samples to view tail latency (on in latency mode)\n"
+		"\t--latency-probe (-I): measure the latency of 1 in N pkts at full batch size and rate (not in latency mode)\n"
+		"\t--rate-limit-mbps (-G): limit ingress rate of each input port to the given Mbps\n"
+		"\t--rate-limit-kpps (-P): limit ingress rate of each input port to the given Kpps\n"
+		"\t--rate-limit-burst (-K): rate limiter burst in usecs of traffic (default 10)\n"
+		"\t--stage-batch (-B): num of pkts a pipeline stage processes per batch\n"
+		"\t--adaptive-batch (-J): grow batches under load and shrink them on idle rings, keeping the batching delay of the pipeline under the given usecs (stage-batch/buf-group are the initial sizes)\n"
+		"\t--shared-buffer (-U): (no arg) stages share one MPMC ring instead of a mesh of SPSC rings\n"
+		"\t--fan-in (-W): num of producers sharing one MPSC ring to a consumer, 1 for a full SPSC mesh (default: auto, at most 8 rings per consumer)\n"
+		"\t--prio (-Q): high priority class with its own rings polled first in small bursts, comma separated dscp:N, port:N (tcp/udp src or dst) and flag (apps promote pkts with meili_pkt_set_prio)\n"
+		"\t--prefetch (-3): prefetch distance of the stages, in pkts ahead of the one being processed whose mbuf and headers are prefetched (default 4, 0 = off, max 32)\n"
+		"\t--dispatchers (-4): num of lcores receiving pkts, each on an rx queue of its own with its own sequence space, the main core included (default 1, throughput mode only)\n"
+		"\t--egress-lcore (-5): (no arg) reorder, timestamp, account and transmit or free pkts leaving the pipeline on a worker lcore of its own, the main core only receives and dispatches (throughput mode only)\n"
+		"\t--flow-affinity (-6): (no arg) dispatch each pkt to the first stage instance its flow hashes to instead of round-robin chunks\n"
+		"\t--elephant-kpps (-7): with flow-affinity, flows above this rate are elephants and spread over instances flowlet by flowlet (default 0 = off)\n"
+		"\t--graph (-Y): (no arg) run all stages of a pipeline instance on one lcore as a graph of nodes, rings only to/from the main core\n"
+		"\t--only-main (-O): (no arg) run the main loop only, without enqueue/dequeue to stages\n"
+		"\t--remote-after-processing (-X): (no arg) transmit pkts to remote pipelines after local processing\n"
 		"Support:\n"
 		"\t--help (-h): print rxpbench options\n"
 		"\t--version (-v): return version information and exit\n"
@@ -266,6 +302,11 @@ static struct option conf_opts_long[] = {
 	{"dpdk-eal", required_argument, 0, 'D'},
 	{"verbose", required_argument, 0, 'V'},
 	{"cores", required_argument, 0, 'c'},
+	{"stats-json", required_argument, 0, 'j'},
+	{"metrics", required_argument, 0, 'e'},
+	{"trace", required_argument, 0, 'k'},
+	{"control", required_argument, 0, 'q'},
+	{"perf-counters", no_argument, 0, 'a'},
 
 	/* required input. */
 	{"regex-dev", required_argument, 0, 'd'},
@@ -307,13 +348,41 @@ static struct option conf_opts_long[] = {
 	{"dpdk-primary-port", required_argument, 0, '1'},
 	{"dpdk-second-port", required_argument, 0, '2'},
 
+	/* synthetic traffic specific. */
+	{"gen-profile", required_argument, 0, 'y'},
+	{"gen-sizes", required_argument, 0, 'Z'},
+	{"gen-flows", required_argument, 0, 'N'},
+	{"gen-zipf", required_argument, 0, 'z'},
+
+	/* pipeline run mode. */
+	{"run-mode", required_argument, 0, 'M'},
+	{"latency-type", required_argument, 0, 'T'},
+	{"latency-sample", no_argument, 0, 'E'},
+	{"latency-probe", required_argument, 0, 'I'},
+	{"rate-limit-mbps", required_argument, 0, 'G'},
+	{"rate-limit-kpps", required_argument, 0, 'P'},
+	{"rate-limit-burst", required_argument, 0, 'K'},
+	{"stage-batch", required_argument, 0, 'B'},
+	{"adaptive-batch", required_argument, 0, 'J'},
+	{"shared-buffer", no_argument, 0, 'U'},
+	{"fan-in", required_argument, 0, 'W'},
+	{"prefetch", required_argument, 0, '3'},
+	{"dispatchers", required_argument, 0, '4'},
+	{"egress-lcore", no_argument, 0, '5'},
+	{"flow-affinity", no_argument, 0, '6'},
+	{"elephant-kpps", required_argument, 0, '7'},
+	{"graph", no_argument, 0, 'Y'},
+	{"prio", required_argument, 0, 'Q'},
+	{"only-main", no_argument, 0, 'O'},
+	{"remote-after-processing", no_argument, 0, 'X'},
+
 	{"help", no_argument, 0, 'h'},
 	{"version", no_argument, 0, 'v'},
 
 	/* required at end */
 	{NULL, 0, NULL, 0}};
 
-static const char *conf_opts_short = "C:D:FV:c:d:m:f:r:R:s:n:p:b:Al:t:o:g:w:8HLSiux1:2:hv";
+static const char *conf_opts_short = "C:D:FV:c:j:e:k:q:aI:d:m:f:r:R:s:n:p:b:Al:t:o:g:w:8HLSiux1:2:y:Z:N:z:M:T:EG:P:K:B:J:UW:3:4:567:YQ:OXhv";
 
 /* Parse given args into the run_conf. */
 static int
@@ -322,6 +391,7 @@ conf_parse_args(pl_conf *run_conf, int argc, char **argv)
 	char *prgname = argv[0];
 	static int idx;
 	uint32_t *dest;
+	char *end;
 	int ret = 0;
 	int opt;
 
@@ -353,6 +423,31 @@ conf_parse_args(pl_conf *run_conf, int argc, char **argv)
 			ret = conf_set_uint32_t(dest, opt, optarg);
 			break;
 
+		/* stats-json */
+		case 'j':
+			ret = conf_set_string(&run_conf->stats_json_file, optarg);
+			break;
+
+		/* metrics */
+		case 'e':
+			ret = conf_set_string(&run_conf->metrics_addr, optarg);
+			break;
+
+		/* trace */
+		case 'k':
+			ret = conf_set_string(&run_conf->trace_file, optarg);
+			break;
+
+		/* control */
+		case 'q':
+			ret = conf_set_string(&run_conf->control_addr, optarg);
+			break;
+
+		/* perf-counters */
+		case 'a':
+			run_conf->perf_counters = true;
+			break;
+
 		/* regex-dev */
 		case 'd':
 			if (run_conf->regex_dev_type != REGEX_DEV_UNKNOWN)
@@ -384,6 +479,8 @@ conf_parse_args(pl_conf *run_conf, int argc, char **argv)
 				run_conf->input_mode = INPUT_JOB_FORMAT;
 			else if (strcmp(optarg, "remote_mmap") == 0)
 				run_conf->input_mode = INPUT_REMOTE_MMAP;
+			else if (strcmp(optarg, "synthetic") == 0)
+				run_conf->input_mode = INPUT_SYNTHETIC;
 			else {
 				MEILI_LOG_ERR("Invalid input type.");
 				pipeline_usage(prgname);
@@ -515,6 +612,184 @@ conf_parse_args(pl_conf *run_conf, int argc, char **argv)
 			ret = conf_set_string(&run_conf->port2, optarg);
 			break;
 
+		/* gen-profile */
+		case 'y':
+			if (run_conf->gen_profile != GEN_PROFILE_UNKNOWN)
+				break;
+			if (strcmp(optarg, "http_64") == 0)
+				run_conf->gen_profile = GEN_PROFILE_HTTP_64;
+			else if (strcmp(optarg, "http_1500") == 0)
+				run_conf->gen_profile = GEN_PROFILE_HTTP_1500;
+			else if (strcmp(optarg, "microbenchmark") == 0)
+				run_conf->gen_profile = GEN_PROFILE_MICROBENCHMARK;
+			else {
+				MEILI_LOG_ERR("Invalid generator profile.");
+				pipeline_usage(prgname);
+				return -EINVAL;
+			}
+			break;
+
+		/* gen-sizes */
+		case 'Z':
+			ret = conf_set_string(&run_conf->gen_sizes, optarg);
+			break;
+
+		/* gen-flows */
+		case 'N':
+			dest = &run_conf->gen_flows;
+			ret = conf_set_uint32_t(dest, opt, optarg);
+			break;
+
+		/* gen-zipf */
+		case 'z':
+			if (run_conf->gen_zipf)
+				break;
+			run_conf->gen_zipf = strtod(optarg, &end);
+			if (end == optarg || *end || run_conf->gen_zipf < 0) {
+				MEILI_LOG_ERR("Invalid gen-zipf %s.", optarg);
+				return -EINVAL;
+			}
+			break;
+
+		/* run-mode */
+		case 'M':
+			if (run_conf->run_mode != RUN_MODE_UNKNOWN)
+				break;
+			if (strcmp(optarg, "meili") == 0)
+				run_conf->run_mode = RUN_MODE_MEILI;
+			else if (strcmp(optarg, "baseline") == 0)
+				run_conf->run_mode = RUN_MODE_BASELINE;
+			else if (strcmp(optarg, "all_remote") == 0)
+				run_conf->run_mode = RUN_MODE_ALL_REMOTE_ON_ARRIVAL;
+			else {
+				MEILI_LOG_ERR("Invalid run mode.");
+				pipeline_usage(prgname);
+				return -EINVAL;
+			}
+			break;
+
+		/* latency-type */
+		case 'T':
+			if (run_conf->latency_type != LATENCY_TYPE_UNKNOWN)
+				break;
+			if (strcmp(optarg, "end2end") == 0)
+				run_conf->latency_type = LATENCY_TYPE_END2END;
+			else if (strcmp(optarg, "partition") == 0)
+				run_conf->latency_type = LATENCY_TYPE_PARTITION;
+			else if (strcmp(optarg, "aggregation") == 0)
+				run_conf->latency_type = LATENCY_TYPE_AGGREGATION;
+			else {
+				MEILI_LOG_ERR("Invalid latency type.");
+				pipeline_usage(prgname);
+				return -EINVAL;
+			}
+			break;
+
+		/* latency-sample */
+		case 'E':
+			run_conf->latency_sample = true;
+			break;
+
+		/* latency-probe */
+		case 'I':
+			dest = &run_conf->latency_probe;
+			ret = conf_set_uint32_t(dest, opt, optarg);
+			break;
+
+		/* rate-limit-mbps */
+		case 'G':
+			dest = &run_conf->rate_limit_mbps;
+			ret = conf_set_uint32_t(dest, opt, optarg);
+			break;
+
+		/* rate-limit-kpps */
+		case 'P':
+			dest = &run_conf->rate_limit_kpps;
+			ret = conf_set_uint32_t(dest, opt, optarg);
+			break;
+
+		/* rate-limit-burst */
+		case 'K':
+			dest = &run_conf->rate_limit_burst_us;
+			ret = conf_set_uint32_t(dest, opt, optarg);
+			break;
+
+		/* stage-batch */
+		case 'B':
+			dest = &run_conf->stage_batch_size;
+			ret = conf_set_uint32_t(dest, opt, optarg);
+			break;
+
+		/* adaptive-batch */
+		case 'J':
+			dest = &run_conf->adaptive_batch_us;
+			ret = conf_set_uint32_t(dest, opt, optarg);
+			break;
+
+		/* shared-buffer */
+		case 'U':
+			run_conf->shared_buffer = true;
+			break;
+
+		/* fan-in */
+		case 'W':
+			dest = &run_conf->fan_in;
+			ret = conf_set_uint32_t(dest, opt, optarg);
+			break;
+
+		/* prefetch, 0 is a valid distance */
+		case '3':
+			if (run_conf->prefetch_dist != PL_PREFETCH_DIST_UNSET)
+				break;
+			run_conf->prefetch_dist = strtoul(optarg, &end, 10);
+			if (end == optarg || *end || run_conf->prefetch_dist > PL_PREFETCH_DIST_MAX) {
+				MEILI_LOG_ERR("Invalid prefetch %s (max: %u).", optarg, PL_PREFETCH_DIST_MAX);
+				return -EINVAL;
+			}
+			break;
+
+		/* dispatchers */
+		case '4':
+			dest = &run_conf->dispatchers;
+			ret = conf_set_uint32_t(dest, opt, optarg);
+			break;
+
+		/* egress-lcore */
+		case '5':
+			run_conf->egress_lcore = true;
+			break;
+
+		/* flow-affinity */
+		case '6':
+			run_conf->flow_affinity = true;
+			break;
+
+		/* elephant-kpps */
+		case '7':
+			dest = &run_conf->elephant_kpps;
+			ret = conf_set_uint32_t(dest, opt, optarg);
+			break;
+
+		/* graph */
+		case 'Y':
+			run_conf->graph_mode = true;
+			break;
+
+		/* prio */
+		case 'Q':
+			ret = conf_set_string(&run_conf->prio, optarg);
+			break;
+
+		/* only-main */
+		case 'O':
+			run_conf->only_main_mode = true;
+			break;
+
+		/* remote-after-processing */
+		case 'X':
+			run_conf->remote_after_processing = true;
+			break;
+
 		/* help */
 		case 'h':
 			pipeline_usage(prgname);
@@ -712,7 +987,7 @@ conf_validate(pl_conf *run_conf)
 			MEILI_LOG_ERR("Remote mmap mode is only supported with DOCA regex");
 			return -EINVAL;
 		}
-	} else if (run_conf->input_mode == INPUT_LIVE) {
+	} else if (run_conf->input_mode == INPUT_LIVE || run_conf->input_mode == INPUT_SYNTHETIC) {
 		if (!run_conf->port1) {
 			MEILI_LOG_ERR("No specified primary port.");
 			return -EINVAL;
@@ -740,8 +1015,6 @@ conf_validate(pl_conf *run_conf)
 			MEILI_LOG_ERR("Hyperscan leftmost and single incompatible.");
 			return -EINVAL;
 		}
-		if (run_conf->latency_mode)
-			conf_validation_dev_warning(run_conf, "hyperscan", "latency-mode");
 
 	} else if (run_conf->regex_dev_type == REGEX_DEV_DPDK_REGEX ||
 		   run_conf->regex_dev_type == REGEX_DEV_DOCA_REGEX) {
@@ -760,6 +1033,118 @@ conf_validate(pl_conf *run_conf)
 		return -EINVAL;
 	}
 
+	if (run_conf->input_mode != INPUT_SYNTHETIC) {
+		if (run_conf->gen_profile != GEN_PROFILE_UNKNOWN)
+			conf_validation_mode_warning(run_conf, "NON synthetic", "gen-profile");
+		if (run_conf->gen_sizes)
+			conf_validation_mode_warning(run_conf, "NON synthetic", "gen-sizes");
+		if (run_conf->gen_flows || run_conf->gen_zipf)
+			conf_validation_mode_warning(run_conf, "NON synthetic", "gen-flows/gen-zipf");
+	}
+
+	if (run_conf->input_mode != INPUT_LIVE && run_conf->input_mode != INPUT_SYNTHETIC) {
+		if (run_conf->run_mode != RUN_MODE_UNKNOWN)
+			conf_validation_mode_warning(run_conf, "NON dpdk_port", "run-mode");
+		if (run_conf->rate_limit_mbps || run_conf->rate_limit_kpps)
+			conf_validation_mode_warning(run_conf, "NON dpdk_port", "rate-limit");
+	}
+
+	if (run_conf->rate_limit_burst_us > RATE_LIMIT_MAX_BURST_US) {
+		MEILI_LOG_ERR("rate-limit-burst exceeds max of %u usecs.", RATE_LIMIT_MAX_BURST_US);
+		return -EINVAL;
+	}
+
+	if (run_conf->latency_mode && (run_conf->rate_limit_mbps || run_conf->rate_limit_kpps || run_conf->only_main_mode)) {
+		MEILI_LOG_ERR("latency-mode is exclusive with rate-limit and only-main.");
+		return -EINVAL;
+	}
+
+	if (run_conf->latency_mode && run_conf->latency_probe) {
+		MEILI_LOG_ERR("latency-mode measures every pkt, latency-probe is for throughput mode.");
+		return -EINVAL;
+	}
+
+	if (run_conf->latency_probe && (run_conf->run_mode == RUN_MODE_BASELINE ||
+					run_conf->run_mode == RUN_MODE_ALL_REMOTE_ON_ARRIVAL || run_conf->only_main_mode))
+		conf_validation_mode_warning(run_conf, "baseline/all_remote/only-main", "latency-probe");
+
+	if (run_conf->fan_in && run_conf->shared_buffer)
+		conf_validation_mode_warning(run_conf, "shared-buffer", "fan-in");
+
+	if (run_conf->adaptive_batch_us && (run_conf->latency_mode || run_conf->only_main_mode))
+		conf_validation_mode_warning(run_conf, "latency/only-main", "adaptive-batch");
+
+	if (run_conf->prio && (run_conf->latency_mode || run_conf->run_mode == RUN_MODE_BASELINE ||
+				run_conf->only_main_mode))
+		conf_validation_mode_warning(run_conf, "latency/baseline/only-main", "prio");
+
+	if (run_conf->graph_mode && (run_conf->run_mode == RUN_MODE_BASELINE || run_conf->only_main_mode))
+		conf_validation_mode_warning(run_conf, "baseline/only-main", "graph");
+
+	if (run_conf->dispatchers > 1 &&
+	    ((run_conf->input_mode != INPUT_LIVE && run_conf->input_mode != INPUT_SYNTHETIC) ||
+	     run_conf->run_mode == RUN_MODE_BASELINE || run_conf->run_mode == RUN_MODE_ALL_REMOTE_ON_ARRIVAL ||
+	     run_conf->latency_mode || run_conf->only_main_mode || run_conf->rate_limit_mbps ||
+	     run_conf->rate_limit_kpps)) {
+		MEILI_LOG_ERR("dispatchers needs live or synthetic input in meili throughput mode without rate-limit.");
+		return -EINVAL;
+	}
+
+	/* the stages need at least one lcore next to the dispatchers and the egress lcore */
+	if ((run_conf->run_mode == RUN_MODE_MEILI || run_conf->run_mode == RUN_MODE_UNKNOWN) &&
+	    !run_conf->only_main_mode &&
+	    (run_conf->cores ? run_conf->cores : DEFAULT_CORES) <=
+	    RTE_MAX(run_conf->dispatchers, 1U) + run_conf->egress_lcore) {
+		MEILI_LOG_ERR("cores must exceed dispatchers plus the egress lcore, no lcore is left for the stages.");
+		return -EINVAL;
+	}
+
+	if (run_conf->egress_lcore &&
+	    ((run_conf->input_mode != INPUT_LIVE && run_conf->input_mode != INPUT_SYNTHETIC) ||
+	     run_conf->run_mode == RUN_MODE_BASELINE || run_conf->run_mode == RUN_MODE_ALL_REMOTE_ON_ARRIVAL ||
+	     run_conf->latency_mode || run_conf->only_main_mode)) {
+		MEILI_LOG_ERR("egress-lcore needs live or synthetic input in meili throughput mode.");
+		return -EINVAL;
+	}
+
+	if (run_conf->flow_affinity &&
+	    ((run_conf->input_mode != INPUT_LIVE && run_conf->input_mode != INPUT_SYNTHETIC) ||
+	     run_conf->run_mode == RUN_MODE_BASELINE || run_conf->run_mode == RUN_MODE_ALL_REMOTE_ON_ARRIVAL ||
+	     run_conf->only_main_mode || run_conf->shared_buffer)) {
+		MEILI_LOG_ERR("flow-affinity needs live or synthetic input in meili mode with a ring per stage instance.");
+		return -EINVAL;
+	}
+
+	if (run_conf->elephant_kpps && !run_conf->flow_affinity) {
+		MEILI_LOG_ERR("elephant-kpps needs flow-affinity.");
+		return -EINVAL;
+	}
+
+	if (run_conf->only_main_mode && (run_conf->rate_limit_mbps || run_conf->rate_limit_kpps)) {
+		MEILI_LOG_ERR("only-main is exclusive with rate-limit.");
+		return -EINVAL;
+	}
+
+	if (run_conf->run_mode == RUN_MODE_ALL_REMOTE_ON_ARRIVAL && run_conf->remote_after_processing) {
+		MEILI_LOG_ERR("all_remote run mode and remote-after-processing are exclusive.");
+		return -EINVAL;
+	}
+
+	if (run_conf->run_mode == RUN_MODE_BASELINE || run_conf->run_mode == RUN_MODE_ALL_REMOTE_ON_ARRIVAL) {
+		if (run_conf->only_main_mode)
+			conf_validation_mode_warning(run_conf, "baseline/all_remote", "only-main");
+		if (run_conf->remote_after_processing)
+			conf_validation_mode_warning(run_conf, "baseline/all_remote", "remote-after-processing");
+	}
+
+	if (!run_conf->latency_mode && run_conf->latency_type != LATENCY_TYPE_UNKNOWN)
+		conf_validation_mode_warning(run_conf, "NON latency", "latency-type");
+
+	if (run_conf->stage_batch_size > MAX_PKTS_BURST) {
+		MEILI_LOG_ERR("stage-batch too large (max: %u).", MAX_PKTS_BURST);
+		return -EINVAL;
+	}
+
 	/* Doca regex impliments sliding window so can have input buffers > MAX job size. */
 	if (run_conf->regex_dev_type != REGEX_DEV_DOCA_REGEX && run_conf->input_buf_len > MAX_REGEX_BUF_SIZE) {
 		MEILI_LOG_ERR("buf-length %u exceeds max of %u.", run_conf->input_buf_len, MAX_REGEX_BUF_SIZE);
@@ -785,7 +1170,7 @@ conf_set_defaults(pl_conf *run_conf)
 		run_conf->input_buf_len = DEFAULT_BUF_LEN;
 
 	if (!run_conf->input_batches)
-		run_conf->input_batches = DEFAULT_BATCH_SIZE;
+		run_conf->input_batches = run_conf->latency_mode ? LATENCY_BATCH_SIZE : DEFAULT_BATCH_SIZE;
 
 	if (!run_conf->cores)
 		run_conf->cores = DEFAULT_CORES;
@@ -793,8 +1178,36 @@ conf_set_defaults(pl_conf *run_conf)
 	if (!run_conf->sliding_window)
 		run_conf->sliding_window = DEFAULT_SLIDING_WINDOW;
 
-	/* set the number of queues per port */
-    run_conf->nb_queues_per_port =  NB_QUEUE_PER_PORT;
+	if (!run_conf->dispatchers)
+		run_conf->dispatchers = 1;
+
+	/* set the number of queues per port, one rx/tx pair per dispatcher */
+    run_conf->nb_queues_per_port = RTE_MAX(NB_QUEUE_PER_PORT, run_conf->dispatchers);
+
+	if (run_conf->run_mode == RUN_MODE_UNKNOWN)
+		run_conf->run_mode = RUN_MODE_MEILI;
+
+	if (run_conf->latency_type == LATENCY_TYPE_UNKNOWN)
+		run_conf->latency_type = LATENCY_TYPE_END2END;
+
+	/* Latency mode processes pkts one by one and samples their latency. */
+	if (!run_conf->stage_batch_size)
+		run_conf->stage_batch_size = run_conf->latency_mode ? LATENCY_BATCH_SIZE : DEFAULT_BATCH_SIZE;
+
+	if (run_conf->prefetch_dist == PL_PREFETCH_DIST_UNSET)
+		run_conf->prefetch_dist = PL_PREFETCH_DIST;
+
+	if (run_conf->latency_mode || run_conf->latency_probe)
+		run_conf->latency_sample = true;
+
+	if (!run_conf->rate_limit_burst_us)
+		run_conf->rate_limit_burst_us = RATE_LIMIT_DEFAULT_BURST_US;
+
+	if (run_conf->gen_profile == GEN_PROFILE_UNKNOWN)
+		run_conf->gen_profile = GEN_PROFILE_HTTP_64;
+
+	if (!run_conf->gen_flows)
+		run_conf->gen_flows = 1;
 }
 
 int
@@ -855,5 +1268,11 @@ conf_clean(pl_conf *run_conf)
 	free(run_conf->raw_rules_file);
 	free(run_conf->port1);
 	free(run_conf->port2);
+	free(run_conf->gen_sizes);
+	free(run_conf->prio);
+	free(run_conf->stats_json_file);
+	free(run_conf->metrics_addr);
+	free(run_conf->trace_file);
+	free(run_conf->control_addr);
 	free(conf_file);
 }
@@ -57,9 +57,34 @@ enum rxpbench_input_type
 	INPUT_LIVE,
 	INPUT_JOB_FORMAT,
 	INPUT_REMOTE_MMAP,
+	INPUT_SYNTHETIC,
 	INPUT_UNKNOWN
 };
 
+enum meili_gen_profile
+{
+	GEN_PROFILE_HTTP_64,
+	GEN_PROFILE_HTTP_1500,
+	GEN_PROFILE_MICROBENCHMARK,
+	GEN_PROFILE_UNKNOWN
+};
+
+enum meili_run_mode
+{
+	RUN_MODE_MEILI,
+	RUN_MODE_BASELINE,
+	RUN_MODE_ALL_REMOTE_ON_ARRIVAL,
+	RUN_MODE_UNKNOWN
+};
+
+enum meili_latency_type
+{
+	LATENCY_TYPE_END2END,
+	LATENCY_TYPE_PARTITION,
+	LATENCY_TYPE_AGGREGATION,
+	LATENCY_TYPE_UNKNOWN
+};
+
 typedef struct _pl_conf {
 	/* Config: general ops. */
 	int dpdk_argc;
@@ -125,6 +150,55 @@ typedef struct _pl_conf {
 	char *port2;
 	int nb_queues_per_port;
 
+	/* Config: machine readable end of run report. */
+	char *stats_json_file;
+	/* Config: metrics export, unix socket path or loopback tcp port. */
+	char *metrics_addr;
+	/* Config: flight recorder dump file. */
+	char *trace_file;
+	/* Config: control commands, unix socket path or loopback tcp port. */
+	char *control_addr;
+	/* Config: per stage hardware counters. */
+	bool perf_counters;
+
+	/* Config: synthetic traffic generator. */
+	enum meili_gen_profile gen_profile;
+	uint32_t gen_flows;
+	double gen_zipf;
+	char *gen_sizes;
+
+	/* Config: pipeline run mode. */
+	enum meili_run_mode run_mode;
+	enum meili_latency_type latency_type;
+	uint32_t rate_limit_mbps;
+	uint32_t rate_limit_kpps;
+	uint32_t rate_limit_burst_us;
+	uint32_t stage_batch_size;
+	/* Config: latency target of adaptive batch sizing in usecs, 0 = fixed batches. */
+	uint32_t adaptive_batch_us;
+	bool latency_sample;
+	/* Config: sample the latency of 1 in N pkts in throughput mode, 0 = off. */
+	uint32_t latency_probe;
+	bool shared_buffer;
+	/* Config: producers sharing one ring to a consumer, 0 = auto. */
+	uint32_t fan_in;
+	/* Config: pkts a stage prefetches ahead of the one it processes. */
+	uint32_t prefetch_dist;
+	/* Config: lcores polling rx queues and feeding the first stages, the main core included. */
+	uint32_t dispatchers;
+	/* Config: drain the pipeline on an lcore of its own instead of the main core. */
+	bool egress_lcore;
+	/* Config: dispatch pkts to the first stage instance of their flow instead of round-robin. */
+	bool flow_affinity;
+	/* Config: rate making a flow an elephant, sprayed by flowlet with flow affinity, 0 = off. */
+	uint32_t elephant_kpps;
+	/* Config: run the stages of an instance on one lcore as a graph. */
+	bool graph_mode;
+	/* Config: classifier of the high priority class, NULL = single class. */
+	char *prio;
+	bool only_main_mode;
+	bool remote_after_processing;
+
 	/* Function pointers for each module */
 	input_func_t *input_funcs;
 	regex_func_t *regex_dev_funcs;
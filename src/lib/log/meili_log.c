@@ -13,19 +13,70 @@
 /* Modified by Meili Authors */
 /* Copyright (c) 2024, Meili Authors */
 
+#include <errno.h>
+#include <inttypes.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
 
 #include "meili_log.h"
 
 #define ALERT_MARKER	"\n******************************************************************\n"
 
+#define MEILI_LOG_RING_SIZE	256	/* queued messages per lcore, power of 2 */
+#define MEILI_LOG_RING_MASK	(MEILI_LOG_RING_SIZE - 1)
+#define MEILI_LOG_MAX_ARGS	8
+#define MEILI_LOG_BUF_LEN	256	/* %s copies, or the message if it could not be deferred */
+#define MEILI_LOG_LINE_LEN	1024
+#define MEILI_LOG_SPEC_LEN	32
+#define MEILI_LOG_DRAIN_US	1000
+
+/* Serializes direct printing with the drain thread, never taken on an lcore once started. */
 pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
 
+union meili_log_val {
+	int64_t i;
+	uint64_t u;
+	double d;
+	const void *p;
+	uint32_t str;		/* offset of a %s copy in buf */
+};
+
+/* A message whose arguments were read from the va_list but not formatted. */
+struct meili_log_rec {
+	const char *format;	/* NULL when buf holds the formatted message */
+	uint8_t level;
+	uint8_t nb_args;
+	uint32_t suppressed;
+	union meili_log_val args[MEILI_LOG_MAX_ARGS];
+	char buf[MEILI_LOG_BUF_LEN];
+};
+
+/* Single producer (the lcore), single consumer (the drain thread). */
+struct meili_log_ring {
+	uint32_t head __rte_cache_aligned;
+	uint64_t dropped;
+	uint32_t tail __rte_cache_aligned;
+	uint64_t reported;
+	struct meili_log_rec recs[MEILI_LOG_RING_SIZE] __rte_cache_aligned;
+};
+
+static struct meili_log_ring *log_rings[RTE_MAX_LCORE];
+static bool log_async;
+static volatile bool log_quit;
+static pthread_t log_tid;
+
 /* Store any warnings for inclusion in end of run output. */
 static void
 meili_log_record(pl_conf *run_conf, const char *warning)
@@ -48,16 +99,278 @@ meili_log_record(pl_conf *run_conf, const char *warning)
 	run_conf->no_conf_warnings = conf_pos + 1;
 }
 
+/* Print a formatted message, callers hold log_lock. */
+static void
+meili_log_print(enum meili_log_level level, const char *msg, uint32_t suppressed)
+{
+	FILE *output = level == MEILI_LOG_LEVEL_ERROR ? stderr : stdout;
+	char note[64] = "";
+
+	if (suppressed)
+		snprintf(note, sizeof(note), " (%u similar messages suppressed)", suppressed);
+
+	switch (level) {
+	case MEILI_LOG_LEVEL_ERROR:
+		fprintf(output, "<< ERROR: %s%s >>\n", msg, note);
+		break;
+	case MEILI_LOG_LEVEL_WARNING:
+		fprintf(output, "<< WARNING: %s%s >>\n", msg, note);
+		break;
+	case MEILI_LOG_LEVEL_INFO:
+		fprintf(output, "INFO: %s%s\n", msg, note);
+		break;
+	case MEILI_LOG_LEVEL_ALERT:
+		fprintf(output, ALERT_MARKER "ALERT: %s%s" ALERT_MARKER, msg, note);
+		break;
+	}
+}
+
+/* Length modifiers of a conversion spec. */
+enum meili_log_len {
+	LOG_LEN_NONE,
+	LOG_LEN_HH,
+	LOG_LEN_H,
+	LOG_LEN_L,
+	LOG_LEN_LL,
+	LOG_LEN_J,
+	LOG_LEN_Z,
+	LOG_LEN_T,
+	LOG_LEN_LD,
+};
+
+/* Parse the conversion spec at p (pointing at '%'). Returns the spec length or
+ * 0 for specs that cannot be deferred ('*' width/precision, %n, unknown).
+ */
+static size_t
+meili_log_spec(const char *p, char *conv, enum meili_log_len *len)
+{
+	const char *q = p + 1;
+
+	*len = LOG_LEN_NONE;
+	while (*q && strchr("-+ #0'", *q))
+		q++;
+	while (*q >= '0' && *q <= '9')
+		q++;
+	if (*q == '.') {
+		q++;
+		while (*q >= '0' && *q <= '9')
+			q++;
+	}
+	if (*q == '*')
+		return 0;
+
+	if (q[0] == 'h' && q[1] == 'h') {
+		*len = LOG_LEN_HH;
+		q += 2;
+	} else if (q[0] == 'l' && q[1] == 'l') {
+		*len = LOG_LEN_LL;
+		q += 2;
+	} else if (*q && strchr("hljztL", *q)) {
+		*len = *q == 'h' ? LOG_LEN_H : *q == 'l' ? LOG_LEN_L : *q == 'j' ? LOG_LEN_J :
+		       *q == 'z' ? LOG_LEN_Z : *q == 't' ? LOG_LEN_T : LOG_LEN_LD;
+		q++;
+	}
+
+	if (!*q || !strchr("diouxXcfFeEgGaAsp%", *q))
+		return 0;
+	*conv = *q;
+
+	return q - p + 1;
+}
+
+/* Pull the arguments of format from params into rec without formatting them. */
+static int
+meili_log_capture(struct meili_log_rec *rec, const char *format, va_list params)
+{
+	enum meili_log_len len;
+	union meili_log_val *v;
+	uint32_t str_off = 0;
+	const char *p, *str;
+	size_t spec, n;
+	char conv;
+
+	rec->nb_args = 0;
+	for (p = format; *p; p++) {
+		if (*p != '%')
+			continue;
+		spec = meili_log_spec(p, &conv, &len);
+		if (!spec)
+			return -1;
+		p += spec - 1;
+		if (conv == '%')
+			continue;
+		if (rec->nb_args == MEILI_LOG_MAX_ARGS)
+			return -1;
+
+		v = &rec->args[rec->nb_args++];
+		switch (conv) {
+		case 'd':
+		case 'i':
+			v->i = len == LOG_LEN_L ? va_arg(params, long) :
+			       len == LOG_LEN_LL ? va_arg(params, long long) :
+			       len == LOG_LEN_J ? va_arg(params, intmax_t) :
+			       len == LOG_LEN_Z ? va_arg(params, ssize_t) :
+			       len == LOG_LEN_T ? va_arg(params, ptrdiff_t) : va_arg(params, int);
+			break;
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'c':
+			v->u = len == LOG_LEN_L ? va_arg(params, unsigned long) :
+			       len == LOG_LEN_LL ? va_arg(params, unsigned long long) :
+			       len == LOG_LEN_J ? va_arg(params, uintmax_t) :
+			       len == LOG_LEN_Z ? va_arg(params, size_t) :
+			       len == LOG_LEN_T ? (uint64_t)va_arg(params, ptrdiff_t) : va_arg(params, unsigned int);
+			break;
+		case 's':
+			str = va_arg(params, const char *);
+			if (!str)
+				str = "(null)";
+			n = strlen(str) + 1;
+			if (str_off + n > MEILI_LOG_BUF_LEN)
+				return -1;
+			memcpy(&rec->buf[str_off], str, n);
+			v->str = str_off;
+			str_off += n;
+			break;
+		case 'p':
+			v->p = va_arg(params, void *);
+			break;
+		default:
+			v->d = len == LOG_LEN_LD ? (double)va_arg(params, long double) : va_arg(params, double);
+			break;
+		}
+	}
+	rec->format = format;
+
+	return 0;
+}
+
+/* Format a captured message, run by the drain thread. */
 static void
-__meili_log(pl_conf *run_conf, enum meili_log_level level, const char *format, va_list params)
+meili_log_render(const struct meili_log_rec *rec, char *out, size_t size)
 {
-	FILE *output;
+	char spec_buf[MEILI_LOG_SPEC_LEN];
+	const union meili_log_val *v;
+	enum meili_log_len len;
+	size_t pos = 0, spec;
+	const char *p;
+	int arg = 0;
+	char conv;
+	int n;
+
+	if (!rec->format) {
+		snprintf(out, size, "%s", rec->buf);
+		return;
+	}
+
+	for (p = rec->format; *p && pos < size - 1; p++) {
+		if (*p != '%') {
+			out[pos++] = *p;
+			continue;
+		}
+		spec = meili_log_spec(p, &conv, &len);
+		if (conv == '%') {
+			out[pos++] = '%';
+			p += spec - 1;
+			continue;
+		}
+		if (spec >= sizeof(spec_buf))
+			break;
+		memcpy(spec_buf, p, spec);
+		spec_buf[spec] = '\0';
+		p += spec - 1;
+
+		v = &rec->args[arg++];
+		switch (conv) {
+		case 'd':
+		case 'i':
+			n = len == LOG_LEN_L ? snprintf(&out[pos], size - pos, spec_buf, (long)v->i) :
+			    len == LOG_LEN_LL ? snprintf(&out[pos], size - pos, spec_buf, (long long)v->i) :
+			    len == LOG_LEN_J ? snprintf(&out[pos], size - pos, spec_buf, (intmax_t)v->i) :
+			    len == LOG_LEN_Z ? snprintf(&out[pos], size - pos, spec_buf, (ssize_t)v->i) :
+			    len == LOG_LEN_T ? snprintf(&out[pos], size - pos, spec_buf, (ptrdiff_t)v->i) :
+			    snprintf(&out[pos], size - pos, spec_buf, (int)v->i);
+			break;
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'c':
+			n = len == LOG_LEN_L ? snprintf(&out[pos], size - pos, spec_buf, (unsigned long)v->u) :
+			    len == LOG_LEN_LL ? snprintf(&out[pos], size - pos, spec_buf, (unsigned long long)v->u) :
+			    len == LOG_LEN_J ? snprintf(&out[pos], size - pos, spec_buf, (uintmax_t)v->u) :
+			    len == LOG_LEN_Z ? snprintf(&out[pos], size - pos, spec_buf, (size_t)v->u) :
+			    len == LOG_LEN_T ? snprintf(&out[pos], size - pos, spec_buf, (ptrdiff_t)v->u) :
+			    snprintf(&out[pos], size - pos, spec_buf, (unsigned int)v->u);
+			break;
+		case 's':
+			n = snprintf(&out[pos], size - pos, spec_buf, &rec->buf[v->str]);
+			break;
+		case 'p':
+			n = snprintf(&out[pos], size - pos, spec_buf, v->p);
+			break;
+		default:
+			n = len == LOG_LEN_LD ? snprintf(&out[pos], size - pos, spec_buf, (long double)v->d) :
+			    snprintf(&out[pos], size - pos, spec_buf, v->d);
+			break;
+		}
+		if (n < 0)
+			break;
+		pos = RTE_MIN(pos + n, size - 1);
+	}
+	out[pos] = '\0';
+}
+
+/* Queue a message on the calling lcore, false if it must be printed directly. */
+static bool
+meili_log_enqueue(enum meili_log_level level, uint32_t suppressed, const char *format, va_list params)
+{
+	const unsigned int lcore_id = rte_lcore_id();
+	struct meili_log_ring *ring;
+	struct meili_log_rec *rec;
+	va_list params_copy;
+	uint32_t head;
+
+	if (!__atomic_load_n(&log_async, __ATOMIC_ACQUIRE) || lcore_id >= RTE_MAX_LCORE)
+		return false;
+	ring = log_rings[lcore_id];
+	if (!ring)
+		return false;
+
+	head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == MEILI_LOG_RING_SIZE) {
+		__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+		return true;
+	}
+
+	rec = &ring->recs[head & MEILI_LOG_RING_MASK];
+	rec->level = level;
+	rec->suppressed = suppressed;
+	va_copy(params_copy, params);
+	if (meili_log_capture(rec, format, params_copy)) {
+		/* not deferrable, format in place, still without locking */
+		vsnprintf(rec->buf, sizeof(rec->buf), format, params);
+		rec->format = NULL;
+	}
+	va_end(params_copy);
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static void
+__meili_log(pl_conf *run_conf, enum meili_log_level level, uint32_t suppressed, const char *format,
+	    va_list params)
+{
+	char msg[MEILI_LOG_LINE_LEN];
 
 	/* Only allow recording of warnings in initialisation phase - thread safe. */
-	/* Shoafeng Note: here may affect our performance */
 	if (run_conf && !run_conf->running) {
 		char warn_str[MAX_WARNING_LEN];
-		va_list params_copy = {0};
+		va_list params_copy;
 		int size;
 
 		va_copy(params_copy, params);
@@ -68,33 +381,12 @@ __meili_log(pl_conf *run_conf, enum meili_log_level level, const char *format, v
 		va_end(params_copy);
 	}
 
-	output = level == MEILI_LOG_LEVEL_ERROR ? stderr : stdout;
+	if (meili_log_enqueue(level, suppressed, format, params))
+		return;
 
+	vsnprintf(msg, sizeof(msg), format, params);
 	pthread_mutex_lock(&log_lock);
-
-	switch (level) {
-	case MEILI_LOG_LEVEL_ERROR:
-		fprintf(output, "<< ERROR: ");
-		vfprintf(output, format, params);
-		fprintf(output, " >>\n");
-		break;
-	case MEILI_LOG_LEVEL_WARNING:
-		fprintf(output, "<< WARNING: ");
-		vfprintf(output, format, params);
-		fprintf(output, " >>\n");
-		break;
-	case MEILI_LOG_LEVEL_INFO:
-		fprintf(output, "INFO: ");
-		vfprintf(output, format, params);
-		fprintf(output, "\n");
-		break;
-	case MEILI_LOG_LEVEL_ALERT:
-		fprintf(output, ALERT_MARKER"ALERT: ");
-		vfprintf(output, format, params);
-		fprintf(output, ALERT_MARKER);
-		break;
-	}
-
+	meili_log_print(level, msg, suppressed);
 	pthread_mutex_unlock(&log_lock);
 }
 
@@ -104,6 +396,129 @@ meili_log(pl_conf *run_conf, enum meili_log_level level, const char *message, ..
 	va_list params;
 
 	va_start(params, message);
-	__meili_log(run_conf, level, message, params);
+	__meili_log(run_conf, level, 0, message, params);
 	va_end(params);
 }
+
+/* Allow MEILI_LOG_RL_BURST messages per interval and count the rest, which
+ * are reported with the next message of the site that gets through.
+ */
+void
+meili_log_rl(struct meili_log_site *site, enum meili_log_level level, const char *message, ...)
+{
+	const uint64_t interval = rte_get_tsc_hz() * MEILI_LOG_RL_INTERVAL_SEC;
+	const uint64_t now = rte_rdtsc();
+	uint64_t start = __atomic_load_n(&site->window_tsc, __ATOMIC_RELAXED);
+	uint32_t suppressed;
+	va_list params;
+
+	if (now - start > interval &&
+	    __atomic_compare_exchange_n(&site->window_tsc, &start, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		__atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+
+	if (__atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED) > MEILI_LOG_RL_BURST) {
+		__atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+
+	va_start(params, message);
+	__meili_log(NULL, level, suppressed, message, params);
+	va_end(params);
+}
+
+/* Print everything queued so far, returns the number of messages. */
+static uint32_t
+meili_log_drain(void)
+{
+	char msg[MEILI_LOG_LINE_LEN];
+	struct meili_log_ring *ring;
+	struct meili_log_rec *rec;
+	uint32_t head, tail, n = 0;
+	uint64_t dropped;
+	unsigned int i;
+
+	for (i = 0; i < RTE_MAX_LCORE; i++) {
+		ring = log_rings[i];
+		if (!ring)
+			continue;
+
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+		if (head == ring->tail && dropped == ring->reported)
+			continue;
+
+		pthread_mutex_lock(&log_lock);
+		for (tail = ring->tail; tail != head; tail++) {
+			rec = &ring->recs[tail & MEILI_LOG_RING_MASK];
+			meili_log_render(rec, msg, sizeof(msg));
+			meili_log_print(rec->level, msg, rec->suppressed);
+			/* free the slot as soon as it is printed */
+			__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+			n++;
+		}
+		if (dropped != ring->reported) {
+			snprintf(msg, sizeof(msg), "%" PRIu64 " log messages of lcore %u dropped, buffer full",
+				 dropped - ring->reported, i);
+			meili_log_print(MEILI_LOG_LEVEL_WARNING, msg, 0);
+			ring->reported = dropped;
+		}
+		pthread_mutex_unlock(&log_lock);
+	}
+
+	return n;
+}
+
+static void *
+meili_log_thread(void *arg __rte_unused)
+{
+	while (!log_quit) {
+		if (!meili_log_drain())
+			usleep(MEILI_LOG_DRAIN_US);
+	}
+
+	return NULL;
+}
+
+int
+meili_log_start(void)
+{
+	unsigned int lcore_id;
+	int ret;
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		log_rings[lcore_id] = calloc(1, sizeof(struct meili_log_ring));
+		if (!log_rings[lcore_id]) {
+			meili_log_stop();
+			return -ENOMEM;
+		}
+	}
+
+	log_quit = false;
+	ret = rte_ctrl_thread_create(&log_tid, "meili-log", NULL, meili_log_thread, NULL);
+	if (ret) {
+		meili_log_stop();
+		return -ret;
+	}
+	__atomic_store_n(&log_async, true, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+void
+meili_log_stop(void)
+{
+	unsigned int i;
+
+	if (__atomic_load_n(&log_async, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&log_async, false, __ATOMIC_RELEASE);
+		log_quit = true;
+		pthread_join(log_tid, NULL);
+		meili_log_drain();
+	}
+
+	for (i = 0; i < RTE_MAX_LCORE; i++) {
+		free(log_rings[i]);
+		log_rings[i] = NULL;
+	}
+}
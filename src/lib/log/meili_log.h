@@ -25,9 +25,37 @@ enum meili_log_level {
 	MEILI_LOG_LEVEL_ALERT,
 };
 
-void meili_log(pl_conf *run_conf, enum meili_log_level level, const char *message, ...);
+/* Messages logged from a call site per MEILI_LOG_RL_INTERVAL_SEC before the
+ * rest are dropped and counted.
+ */
+#define MEILI_LOG_RL_BURST		10
+#define MEILI_LOG_RL_INTERVAL_SEC	1
+
+/* Rate limiting state of one call site, shared by all lcores using it. */
+struct meili_log_site {
+	uint64_t window_tsc;
+	uint32_t count;
+	uint32_t suppressed;
+};
+
+void meili_log(pl_conf *run_conf, enum meili_log_level level, const char *message, ...)
+	__attribute__((format(printf, 3, 4)));
+void meili_log_rl(struct meili_log_site *site, enum meili_log_level level, const char *message, ...)
+	__attribute__((format(printf, 3, 4)));
+
+/* Once started, messages of EAL lcores are queued to per lcore buffers and
+ * printed by a background thread, formatting included. Other threads and the
+ * initialisation phase print directly. Stop only after all lcores returned.
+ */
+int meili_log_start(void);
+void meili_log_stop(void);
 
 #define MEILI_LOG(run_conf, level, format...)		meili_log(run_conf, MEILI_LOG_LEVEL_##level, format)
+#define MEILI_LOG_RL(level, format...)					\
+	do {								\
+		static struct meili_log_site __meili_log_site;		\
+		meili_log_rl(&__meili_log_site, MEILI_LOG_LEVEL_##level, format); \
+	} while (0)
 
 
 #define MEILI_LOG_ERR(format...)					MEILI_LOG(NULL, ERROR, format)
@@ -36,4 +64,8 @@ void meili_log(pl_conf *run_conf, enum meili_log_level level, const char *messag
 #define MEILI_LOG_ALERT(format...)					MEILI_LOG(NULL, ALERT, format)
 #define MEILI_LOG_WARN_REC(run_conf, format...)		MEILI_LOG(run_conf, WARNING, format)
 
+/* For data path errors that can repeat per packet. */
+#define MEILI_LOG_ERR_RL(format...)					MEILI_LOG_RL(ERROR, format)
+#define MEILI_LOG_WARN_RL(format...)				MEILI_LOG_RL(WARNING, format)
+
 #endif /* _INCLUDE_LOG_H_ */
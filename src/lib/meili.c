@@ -14,6 +14,7 @@
 #include "./net/meili_pkt.h"
 #include "./regex/meili_regex.h"
 #include "./log/meili_log.h"
+#include "../utils/stats/stats.h"
 
 /* pkt_trans
 *   - Run a packet transformation operation specified by UCO.  
@@ -102,8 +103,8 @@ void regex(struct pipeline_stage *self, meili_pkt *pkt){
     
     int qid = self->worker_qid;
     struct pipeline *pl = (struct pipeline *)(self->pl);
-    regex_stats_t temp_stats;
     pl_conf *run_conf = &(pl->conf);
+    regex_stats_t *regex_stats = &run_conf->stats->regex_stats[qid];
 
 	int to_send = 0;
 	int ret;
@@ -111,17 +112,17 @@ void regex(struct pipeline_stage *self, meili_pkt *pkt){
 
 
     /* Prepare ops in regex_dev_search_live */
-    to_send = regex_dev_search_live(run_conf, qid, pkt, &temp_stats);
+    to_send = regex_dev_search_live(run_conf, qid, pkt, regex_stats);
     // if (ret)
     //     return ret;
 
     /* If to_send signal is set, push the batch( and pull at the same time to avoid full queue) */
     if (to_send) {
-        regex_dev_force_batch_push(run_conf, qid, &temp_stats, &nb_dequeued_op, NULL);
+        regex_dev_force_batch_push(run_conf, qid, regex_stats, &nb_dequeued_op, NULL);
     }	
 	else{
 		/* If batch is not full, pull finished ops */
-		regex_dev_force_batch_pull(run_conf, qid, &temp_stats, &nb_dequeued_op, NULL);	
+		regex_dev_force_batch_pull(run_conf, qid, regex_stats, &nb_dequeued_op, NULL);	
 	}
 	return;        
 };
@@ -4,6 +4,8 @@
 #define _INCLUDE_MEILI_H_
 
 #include "./net/meili_pkt.h"
+#include "./mem/meili_mem.h"
+#include "./mem/meili_flow_state.h"
 #include "../runtime/pipeline.h"
 
 #define MEILI_STATE_DECLS(x) struct x##_state {
@@ -0,0 +1,218 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* Per flow state, see meili_flow_state.h.
+ *
+ * example:
+ * MEILI_INIT(APP)
+ * meili_flow_state_decl(self, sizeof(struct APP_flow), APP_MAX_FLOWS);
+ * ...
+ * MEILI_EXEC(APP)
+ * struct APP_flow *flow = meili_flow_state(self, pkt);
+ * if (flow)
+ *     flow->pkts++;
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_hash.h>
+#include <rte_malloc.h>
+
+#include "meili_flow_state.h"
+#include "meili_mem.h"
+#include "../log/meili_log.h"
+#include "../../runtime/pipeline.h"
+#include "../../utils/flow_dispatch/flow_dispatch.h"
+
+int
+meili_flow_state_decl(struct pipeline_stage *self, size_t size, uint32_t max_flows)
+{
+	struct pipeline *pl = self->pl;
+	struct rte_hash_parameters params = {0};
+	struct meili_flow_state *fs;
+	char name[RTE_HASH_NAMESIZE];
+
+	if (self->flow_state) {
+		MEILI_LOG_ERR("Stage %d declared its flow state twice.", self->stage_id);
+		return -EEXIST;
+	}
+	if (!size || !max_flows) {
+		MEILI_LOG_ERR("Flow state needs entries and flows, got %zu bytes for %u flows.", size, max_flows);
+		return -EINVAL;
+	}
+
+	fs = meili_malloc(self, sizeof(*fs));
+	if (!fs)
+		return -ENOMEM;
+	fs->entries = meili_calloc(self, max_flows, size);
+	fs->flow_hash = meili_calloc(self, max_flows, sizeof(*fs->flow_hash));
+	if (!fs->entries || !fs->flow_hash)
+		return -ENOMEM;
+
+	snprintf(name, sizeof(name), "flow_state_%d_%d", self->stage_id, self->inst_id);
+	params.name = name;
+	params.entries = max_flows;
+	params.key_len = sizeof(struct ipv4_5tuple);
+	params.hash_func = DEFAULT_HASH_FUNC;
+	params.socket_id = self->socket_id;
+	/* a full bucket spills over instead of turning new flows away early */
+	params.extra_flag = RTE_HASH_EXTRA_FLAGS_EXT_TABLE;
+	fs->hash = rte_hash_create(&params);
+	if (!fs->hash) {
+		MEILI_LOG_ERR("Failed to create flow state table %s.", name);
+		return -ENOMEM;
+	}
+	fs->entry_size = size;
+	fs->max_flows = max_flows;
+	self->flow_state = fs;
+
+	if (pl->conf.flow_affinity && self->stage_id && !pl->conf.graph_mode)
+		MEILI_LOG_WARN("Flow state of stage %d is not migrated on scale events, only first stages keep their flows.",
+			       self->stage_id);
+
+	return 0;
+}
+
+void *
+meili_flow_state(struct pipeline_stage *self, struct rte_mbuf *pkt)
+{
+	struct meili_flow_state *fs = self->flow_state;
+	struct ipv4_5tuple key;
+	int32_t pos;
+
+	if (flow_table_fill_key_symmetric(&key, pkt) < 0)
+		return NULL;
+
+	pos = rte_hash_lookup(fs->hash, &key);
+	if (pos >= 0)
+		return &fs->entries[pos * fs->entry_size];
+
+	pos = rte_hash_add_key(fs->hash, &key);
+	if (pos < 0) {
+		fs->nb_full++;
+		return NULL;
+	}
+	/* slots of deleted flows are reused */
+	memset(&fs->entries[pos * fs->entry_size], 0, fs->entry_size);
+	fs->flow_hash[pos] = flow_dispatch_hash(pkt);
+	fs->nb_flows++;
+
+	return &fs->entries[pos * fs->entry_size];
+}
+
+void
+meili_flow_state_del(struct pipeline_stage *self, struct rte_mbuf *pkt)
+{
+	struct meili_flow_state *fs = self->flow_state;
+	struct ipv4_5tuple key;
+
+	if (flow_table_fill_key_symmetric(&key, pkt) < 0)
+		return;
+	if (rte_hash_del_key(fs->hash, &key) >= 0)
+		fs->nb_flows--;
+}
+
+/* A flow leaving the instance, see meili_flow_state_export(). */
+struct meili_flow_state_move {
+	struct ipv4_5tuple key;
+	int32_t pos;
+	uint32_t inst;
+};
+
+uint32_t
+meili_flow_state_export(struct pipeline_stage *self, const struct flow_map *map, meili_flow_state_send_t *send)
+{
+	struct meili_flow_state *fs = self->flow_state;
+	struct meili_flow_state_move *moves;
+	struct meili_flow_state_msg *msg;
+	const void *key;
+	void *data;
+	uint32_t next = 0;
+	uint32_t nb = 0;
+	uint32_t inst, i;
+	int32_t pos;
+
+	if (!fs || !fs->nb_flows)
+		return 0;
+
+	moves = rte_malloc("flow_state_moves", fs->nb_flows * sizeof(*moves), 0);
+	if (!moves) {
+		MEILI_LOG_ERR("Failed to migrate the flow state of stage %d instance %d.", self->stage_id,
+			      self->inst_id);
+		return 0;
+	}
+
+	/* the table is walked first and changed last: send may install entries of
+	 * flows coming in, which moves keys between buckets but never between slots
+	 */
+	while ((pos = rte_hash_iterate(fs->hash, &key, &data, &next)) >= 0) {
+		inst = flow_map_lookup(map, fs->flow_hash[pos]);
+		if (inst == (uint32_t)self->inst_id)
+			continue;
+		memcpy(&moves[nb].key, key, sizeof(moves[nb].key));
+		moves[nb].pos = pos;
+		moves[nb].inst = inst;
+		nb++;
+	}
+
+	for (i = 0; i < nb; i++) {
+		msg = rte_malloc("flow_state_msg", sizeof(*msg) + fs->entry_size, 0);
+		if (!msg) {
+			/* the rest starts over on the new instances */
+			MEILI_LOG_WARN("Out of memory migrating flow state, %u flows start over.", nb - i);
+			break;
+		}
+		msg->stage_id = self->stage_id;
+		msg->flow_hash = fs->flow_hash[moves[i].pos];
+		msg->key = moves[i].key;
+		memcpy(msg->data, &fs->entries[moves[i].pos * fs->entry_size], fs->entry_size);
+		send(self, moves[i].inst, msg);
+	}
+
+	for (i = 0; i < nb; i++)
+		rte_hash_del_key(fs->hash, &moves[i].key);
+	rte_free(moves);
+	fs->nb_flows -= nb;
+	fs->nb_out += nb;
+
+	return nb;
+}
+
+void
+meili_flow_state_import(struct pipeline_stage *self, const struct meili_flow_state_msg *msg)
+{
+	struct meili_flow_state *fs = self->flow_state;
+	int32_t pos;
+
+	pos = rte_hash_lookup(fs->hash, &msg->key);
+	if (pos < 0) {
+		pos = rte_hash_add_key(fs->hash, &msg->key);
+		if (pos < 0) {
+			fs->nb_full++;
+			return;
+		}
+		fs->nb_flows++;
+	}
+	/* pkts released on timeout may have started the flow over here, its history wins */
+	memcpy(&fs->entries[pos * fs->entry_size], msg->data, fs->entry_size);
+	fs->flow_hash[pos] = msg->flow_hash;
+	fs->nb_in++;
+}
+
+void
+meili_flow_state_free(struct pipeline_stage *self)
+{
+	struct meili_flow_state *fs = self->flow_state;
+
+	if (!fs)
+		return;
+	MEILI_LOG_INFO("Stage %d instance %d flow state: %u flows, %" PRIu64 " migrated out, %" PRIu64
+		       " in, %" PRIu64 " pkts untracked (table full).",
+		       self->stage_id, self->inst_id, fs->nb_flows, fs->nb_out, fs->nb_in, fs->nb_full);
+	/* the entries go with the arena */
+	rte_hash_free(fs->hash);
+	self->flow_state = NULL;
+}
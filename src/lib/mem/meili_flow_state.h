@@ -0,0 +1,79 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_MEILI_FLOW_STATE_H_
+#define _INCLUDE_MEILI_FLOW_STATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <rte_mbuf.h>
+
+#include "../net/meili_flow.h"
+
+/* Per flow state. Instead of keeping flows in self->state, an app declares a
+ * fixed size entry per flow in MEILI_INIT and looks it up by pkt in
+ * MEILI_EXEC. The table belongs to the stage instance like its arena, but the
+ * runtime knows which flow each entry belongs to, so when the scale control
+ * command remaps flows (--flow-affinity) it moves their entries along:
+ *
+ *  1. dispatchers switch to the new map and hold the pkts of moved flows;
+ *  2. each first stage instance finishes the pkts it was handed before the
+ *     switch, then sends the entries of the flows it lost, key and bytes, to
+ *     the migration rings of their new instances and reports the map done;
+ *  3. new instances install received entries before processing their next
+ *     burst, dispatchers release the held pkts once all instances are done or
+ *     FLOW_DISPATCH_HOLD_US passed.
+ *
+ * Entries are copied byte by byte, they must not point into the arena. Flows
+ * only stay on one instance at the first stage, or at every stage in graph
+ * mode, the tables of other stages are not migrated.
+ */
+
+#define FLOW_STATE_RING_SIZE	1024	/* entries in flight to an instance */
+#define FLOW_STATE_BURST	32	/* entries installed at once */
+
+struct pipeline_stage;
+
+struct meili_flow_state {
+	struct rte_hash *hash;		/* symmetric 5-tuple to entry index, both directions share an entry */
+	char *entries;			/* in the stage arena */
+	uint32_t *flow_hash;		/* dispatch hash of each entry, picks its instance */
+	size_t entry_size;
+	uint32_t max_flows;
+	uint32_t nb_flows;
+	uint64_t nb_full;		/* pkts of new flows not tracked, table full */
+	uint64_t nb_out;		/* entries migrated away */
+	uint64_t nb_in;			/* entries installed from other instances */
+};
+
+/* An entry in flight between instances. */
+struct meili_flow_state_msg {
+	uint32_t stage_id;
+	uint32_t flow_hash;
+	struct ipv4_5tuple key;
+	char data[];
+};
+
+/* Declare entries of size bytes for up to max_flows flows, in MEILI_INIT. */
+int meili_flow_state_decl(struct pipeline_stage *self, size_t size, uint32_t max_flows);
+
+/* Entry of the flow of pkt, zeroed for a new flow. NULL for non-ipv4 pkts and
+ * new flows once the table is full.
+ */
+void *meili_flow_state(struct pipeline_stage *self, struct rte_mbuf *pkt);
+
+/* Forget the flow of pkt, e.g. once it is closed. */
+void meili_flow_state_del(struct pipeline_stage *self, struct rte_mbuf *pkt);
+
+/* Called by the runtime: hand the entries of the flows map assigns to other
+ * instances to send (which owns the msg from then on) and forget them, install
+ * a received entry, and free the table before the arena goes.
+ */
+struct flow_map;
+typedef void (meili_flow_state_send_t)(struct pipeline_stage *self, uint32_t inst, struct meili_flow_state_msg *msg);
+uint32_t meili_flow_state_export(struct pipeline_stage *self, const struct flow_map *map,
+				 meili_flow_state_send_t *send);
+void meili_flow_state_import(struct pipeline_stage *self, const struct meili_flow_state_msg *msg);
+void meili_flow_state_free(struct pipeline_stage *self);
+
+#endif /* _INCLUDE_MEILI_FLOW_STATE_H_ */
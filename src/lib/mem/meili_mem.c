@@ -0,0 +1,184 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* Stage arenas, see meili_mem.h.
+ *
+ * example:
+ * MEILI_INIT(APP)
+ * self->state = meili_malloc(self, sizeof(struct APP_state));
+ * mystate->table = meili_calloc(self, APP_TABLE_SIZE, sizeof(uint32_t));
+ * ...
+ * MEILI_FREE(APP)
+ * return 0;   (the arena is released by the runtime)
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_malloc.h>
+#include <rte_memory.h>
+
+#include "meili_mem.h"
+#include "../log/meili_log.h"
+#include "../../runtime/pipeline.h"
+
+struct meili_arena_chunk {
+	struct meili_arena_chunk *next;
+	size_t size;				/* including this header */
+	size_t off;				/* next free byte */
+};
+
+#define MEILI_ARENA_HDR_SIZE	RTE_CACHE_LINE_ROUNDUP(sizeof(struct meili_arena_chunk))
+
+void
+meili_arena_init(struct meili_arena *arena, int socket_id)
+{
+	memset(arena, 0, sizeof(*arena));
+	arena->socket_id = socket_id;
+}
+
+static struct meili_arena_chunk *
+meili_arena_grow(struct meili_arena *arena, size_t size)
+{
+	struct meili_arena_chunk *chunk;
+
+	size = RTE_MAX(size + MEILI_ARENA_HDR_SIZE, MEILI_ARENA_CHUNK_SIZE);
+	chunk = rte_zmalloc_socket("meili_arena", size, RTE_CACHE_LINE_SIZE, arena->socket_id);
+	if (!chunk && arena->socket_id != SOCKET_ID_ANY) {
+		/* better remote hugepages than none */
+		MEILI_LOG_WARN("No hugepages left on socket %d for stage state, using any socket.", arena->socket_id);
+		chunk = rte_zmalloc_socket("meili_arena", size, RTE_CACHE_LINE_SIZE, SOCKET_ID_ANY);
+	}
+	if (!chunk)
+		return NULL;
+
+	chunk->size = size;
+	chunk->off = MEILI_ARENA_HDR_SIZE;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	arena->reserved += size;
+	arena->nb_chunks++;
+
+	return chunk;
+}
+
+void *
+meili_malloc(struct pipeline_stage *self, size_t size)
+{
+	struct meili_arena *arena = &self->arena;
+	struct meili_arena_chunk *chunk = arena->chunks;
+	void *p;
+
+	if (!size)
+		return NULL;
+	size = RTE_CACHE_LINE_ROUNDUP(size);
+
+	if (!chunk || chunk->size - chunk->off < size) {
+		chunk = meili_arena_grow(arena, size);
+		if (!chunk) {
+			MEILI_LOG_ERR("Failed to allocate %zu bytes of stage state.", size);
+			return NULL;
+		}
+		/* an oversized chunk is full right away, keep bumping the previous one */
+		if (chunk->size - chunk->off == size && chunk->next) {
+			arena->chunks = chunk->next;
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		}
+	}
+
+	/* chunks come zeroed from the heap and are never reused */
+	p = (char *)chunk + chunk->off;
+	chunk->off += size;
+	arena->used += size;
+	arena->nb_allocs++;
+
+	return p;
+}
+
+void *
+meili_calloc(struct pipeline_stage *self, size_t nb, size_t size)
+{
+	if (size && nb > SIZE_MAX / size)
+		return NULL;
+
+	return meili_malloc(self, nb * size);
+}
+
+struct meili_slab *
+meili_slab_create(struct pipeline_stage *self, size_t obj_size, uint32_t nb_grow)
+{
+	struct meili_slab *slab;
+
+	if (!obj_size || !nb_grow)
+		return NULL;
+
+	slab = meili_malloc(self, sizeof(*slab));
+	if (!slab)
+		return NULL;
+
+	slab->self = self;
+	/* a free object holds the link of the free list */
+	slab->obj_size = RTE_ALIGN_CEIL(RTE_MAX(obj_size, sizeof(void *)), sizeof(void *));
+	slab->nb_grow = nb_grow;
+
+	return slab;
+}
+
+static int
+meili_slab_grow(struct meili_slab *slab)
+{
+	char *objs;
+	uint32_t i;
+
+	objs = meili_calloc(slab->self, slab->nb_grow, slab->obj_size);
+	if (!objs)
+		return -ENOMEM;
+
+	for (i = 0; i < slab->nb_grow; i++) {
+		*(void **)(objs + i * slab->obj_size) = slab->free_list;
+		slab->free_list = objs + i * slab->obj_size;
+	}
+	slab->nb_objs += slab->nb_grow;
+
+	return 0;
+}
+
+void *
+meili_slab_get(struct meili_slab *slab)
+{
+	void *obj;
+
+	if (!slab->free_list && meili_slab_grow(slab))
+		return NULL;
+
+	obj = slab->free_list;
+	slab->free_list = *(void **)obj;
+	memset(obj, 0, slab->obj_size);
+	slab->nb_used++;
+
+	return obj;
+}
+
+void
+meili_slab_put(struct meili_slab *slab, void *obj)
+{
+	if (!obj)
+		return;
+
+	*(void **)obj = slab->free_list;
+	slab->free_list = obj;
+	slab->nb_used--;
+}
+
+void
+meili_arena_release(struct meili_arena *arena)
+{
+	struct meili_arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		rte_free(chunk);
+	}
+	meili_arena_init(arena, arena->socket_id);
+}
@@ -0,0 +1,55 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_MEILI_MEM_H_
+#define _INCLUDE_MEILI_MEM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Stage state memory. Each stage instance owns an arena of hugepage chunks
+ * taken from the DPDK heap on the NUMA node of its lcore. Apps allocate from
+ * it in MEILI_INIT (or on their own lcore in MEILI_EXEC) instead of
+ * malloc/calloc; nothing is freed one by one, the runtime releases the whole
+ * arena after MEILI_FREE. An arena is not thread safe, only its stage uses it.
+ */
+
+struct pipeline_stage;
+
+/* One hugepage, allocations larger than a chunk get a chunk of their own. */
+#define MEILI_ARENA_CHUNK_SIZE	(2UL << 20)
+
+struct meili_arena_chunk;
+
+struct meili_arena {
+	struct meili_arena_chunk *chunks;	/* newest first, allocations bump the head */
+	int socket_id;
+	size_t used;				/* bytes handed out */
+	size_t reserved;			/* bytes taken from the heap */
+	uint32_t nb_allocs;
+	uint32_t nb_chunks;
+};
+
+/* Fixed size objects carved from the arena, put back objects are reused. */
+struct meili_slab {
+	struct pipeline_stage *self;
+	void *free_list;
+	size_t obj_size;
+	uint32_t nb_grow;			/* objects added when the free list is empty */
+	uint32_t nb_objs;
+	uint32_t nb_used;
+};
+
+/* Zeroed, cache line aligned memory of the stage arena, NULL on failure. */
+void *meili_malloc(struct pipeline_stage *self, size_t size);
+void *meili_calloc(struct pipeline_stage *self, size_t nb, size_t size);
+
+struct meili_slab *meili_slab_create(struct pipeline_stage *self, size_t obj_size, uint32_t nb_grow);
+/* Zeroed object, NULL if the arena cannot grow. */
+void *meili_slab_get(struct meili_slab *slab);
+void meili_slab_put(struct meili_slab *slab, void *obj);
+
+/* Called by the runtime: arena of a new stage and release after MEILI_FREE. */
+void meili_arena_init(struct meili_arena *arena, int socket_id);
+void meili_arena_release(struct meili_arena *arena);
+
+#endif /* _INCLUDE_MEILI_MEM_H_ */
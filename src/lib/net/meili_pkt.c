@@ -20,6 +20,7 @@
 #include <rte_memcpy.h>
 #include <rte_mempool.h>
 
+uint64_t meili_pkt_prio_flag;
 
 struct rte_ether_hdr*
 meili_ether_hdr_safe(meili_pkt* pkt) {
@@ -35,6 +35,10 @@ int meili_pkt_is_tcp(meili_pkt* pkt);
 int meili_pkt_is_udp(meili_pkt* pkt);
 int meili_pkt_is_ipv4(meili_pkt* pkt);
 
+/* move the pkt to the high priority class from the next stage on (--prio), no-op if classes are off */
+extern uint64_t meili_pkt_prio_flag;
+#define meili_pkt_set_prio(x)   ((x)->ol_flags |= meili_pkt_prio_flag)
+
 
 #else      
 typedef struct _meili_pkt{
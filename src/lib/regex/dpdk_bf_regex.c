@@ -31,6 +31,7 @@
 #include "meili_regex.h"
 #include "meili_regex_stats.h"
 #include "../../utils/str/str_helpers.h"
+#include "../../utils/trace/trace.h"
 
 /* Number of dpdk queue descriptors is 1024 so need more mbuf pool entries. */
 #define MBUF_POOL_SIZE		     2047 /* Should be n = (2^q - 1)*/
@@ -431,20 +432,20 @@ regex_dev_dpdk_bf_process_resp(int qid, struct rte_regex_ops *resp, regex_stats_
 		// 	regex_dev_dpdk_bf_exp_matches(resp, rxp_stats, res_flags);
 
 
-		printf("response flags available\n");		
+		MEILI_LOG_WARN_RL("Response flags available (%u).", res_flags);
 		return;
 	}
 
-	// stats->rx_valid++;
+	stats->rx_valid++;
 
-	// const uint16_t num_matches = resp->nb_matches;
-	// if (num_matches) {
-	// 	stats->rx_buf_match_cnt++;
-	// 	stats->rx_total_match += num_matches;
+	const uint16_t num_matches = resp->nb_matches;
+	if (num_matches) {
+		stats->rx_buf_match_cnt++;
+		stats->rx_total_match += num_matches;
 
-	// 	if (verbose)
-	// 		regex_dev_dpdk_bf_matches(qid, resp->user_ptr, num_matches, resp->matches);
-	// }
+		// if (verbose)
+		// 	regex_dev_dpdk_bf_matches(qid, resp->user_ptr, num_matches, resp->matches);
+	}
 
 	// if (input_exp_matches)
 	// 	regex_dev_dpdk_bf_exp_matches(resp, rxp_stats, res_flags);
@@ -471,6 +472,10 @@ regex_dev_dpdk_bf_dequeue(int qid, regex_stats_t *stats, uint16_t wait_on_dequeu
 	do {
 
 		num_dequeued = rte_regexdev_dequeue_burst(0, qid, ops, max_batch_size);
+		if (num_dequeued)
+			trace_record(TRACE_EV_REGEX_DEQ, qid, num_dequeued, 0);
+	if (num_dequeued)
+		trace_record(TRACE_EV_REGEX_DEQ, qid, num_dequeued, 0);
 		
 		time = rte_get_timer_cycles();
 
@@ -557,6 +562,8 @@ regex_dev_dpdk_bf_dequeue_pipeline(int qid, regex_stats_t *stats, uint16_t wait_
 
 
 	num_dequeued = rte_regexdev_dequeue_burst(0, qid, ops, max_batch_size);
+	if (num_dequeued)
+		trace_record(TRACE_EV_REGEX_DEQ, qid, num_dequeued, 0);
 	
 	// time = rte_get_timer_cycles();
 
@@ -658,6 +665,7 @@ regex_dev_dpdk_bf_send_ops_pipeline(int qid, regex_stats_t *stats, int *nb_deque
 		ops = &ops_arr_tx[num_enqueued + q_offset];
 		num_ops = to_enqueue - num_enqueued;
 		ret = rte_regexdev_enqueue_burst(0, qid, ops, num_ops);
+		trace_record(TRACE_EV_REGEX_ENQ, qid, ret, num_ops);
 		if (ret) {
 
 			/* Queue is now free so note any tx busy time. */
@@ -696,7 +704,6 @@ regex_dev_dpdk_bf_prep_op(int qid, struct rte_regex_ops *op)
 
 	
 	if (input_subset_ids) {
-		printf("input_subset_ids has valid value\n");
 		const int job_offset = regex_dev_dpdk_bf_get_array_offset(core_vars[qid].buf_id);
 
 		op->group_id0 = input_subset_ids[job_offset][0];
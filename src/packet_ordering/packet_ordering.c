@@ -28,6 +28,7 @@
 #include "../utils/rte_reorder/rte_reorder.h"
 
 #include "../lib/log/meili_log.h"
+#include "../utils/trace/trace.h"
 
 
 int
@@ -127,13 +128,15 @@ reorder_exec(struct pipeline_stage *self, struct rte_mbuf **mbuf, int nb_mbuf, s
         ret = rte_reorder_insert(mystate->reorder_buf, mbuf[i]);
         if (unlikely(ret == -1 && rte_errno == ERANGE)) {
             /* Too early pkts should be transmitted out directly */
+            trace_record(TRACE_EV_REORDER_GAP, TRACE_REORDER_EARLY, seq_num, 0);
 
-            printf("%s():Cannot reorder early packet, seq=%d\n", __func__, *rte_reorder_seqn(mbuf[i]));
+            MEILI_LOG_WARN_RL("%s():Cannot reorder early packet, seq=%d", __func__, seq_num);
         } else if (unlikely(ret == -1 && rte_errno == ENOSPC)) {
             /**
                 * Early pkts just outside of window should be dropped
                 */
-            printf("%s():No space in reorder buffer, seq=%d\n", __func__,*rte_reorder_seqn(mbuf[i]));
+            trace_record(TRACE_EV_REORDER_GAP, TRACE_REORDER_NO_SPACE, seq_num, 0);
+            MEILI_LOG_WARN_RL("%s():No space in reorder buffer, seq=%d", __func__, seq_num);
 
         }
         // debug 
@@ -182,12 +185,16 @@ int reorder_verify(struct pipeline_stage *self, struct rte_mbuf **mbuf, int nb_m
     }
 
     if((*rte_reorder_seqn(mbuf[0])) != mystate->last_seq_nb+1){
-        MEILI_LOG_ERR("Error seq order, seq_num=%d, %d", mystate->last_seq_nb,*rte_reorder_seqn(mbuf[0]));
+        trace_record(TRACE_EV_REORDER_GAP, TRACE_REORDER_OUT_OF_ORDER, *rte_reorder_seqn(mbuf[0]),
+                     mystate->last_seq_nb + 1);
+        MEILI_LOG_ERR_RL("Error seq order, seq_num=%u, %u", mystate->last_seq_nb,*rte_reorder_seqn(mbuf[0]));
     }
 
     for(int i=1; i<nb_mbuf; i++){
         if((*rte_reorder_seqn(mbuf[i-1])+1) != *rte_reorder_seqn(mbuf[i])){
-            MEILI_LOG_ERR("Error seq order, seq_num=%d, %d", *rte_reorder_seqn(mbuf[i-1]),*rte_reorder_seqn(mbuf[i]));
+            trace_record(TRACE_EV_REORDER_GAP, TRACE_REORDER_OUT_OF_ORDER, *rte_reorder_seqn(mbuf[i]),
+                         *rte_reorder_seqn(mbuf[i-1]) + 1);
+            MEILI_LOG_ERR_RL("Error seq order, seq_num=%u, %u", *rte_reorder_seqn(mbuf[i-1]),*rte_reorder_seqn(mbuf[i]));
         }  
     }		
     
@@ -50,6 +50,25 @@ pkt_ts_init(int *offset)
     return 0;
 }
 
+/* Register the ol_flags bit marking latency probes. */
+int
+pkt_ts_probe_init(uint64_t *flag)
+{
+    static const struct rte_mbuf_dynflag desc = {
+        .name = PKT_TS_PROBE_FLAG_NAME,
+    };
+    int bit;
+
+    bit = rte_mbuf_dynflag_register(&desc);
+    if (bit < 0) {
+        MEILI_LOG_ERR("Failed to register mbuf flag for latency probes, rte_errno: %i", rte_errno);
+        return -ENOMEM;
+    }
+    *flag = 1ULL << bit;
+
+    return 0;
+}
+
 int
 pkt_ts_free()
 {
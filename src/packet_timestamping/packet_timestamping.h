@@ -5,6 +5,7 @@
 
 #include "../runtime/meili_runtime.h"
 #include <stdint.h>
+#include <rte_cycles.h>
 #include <rte_mbuf.h>
 #include <rte_mbuf_dyn.h>
 
@@ -24,9 +25,38 @@ struct pkt_ts_state{
 
 
 
+#define PKT_TS_PROBE_FLAG_NAME "meili_dynflag_latency_probe"
+
 int pkt_ts_exec(int offset, struct rte_mbuf **mbuf, int nb_mbuf);
 int pkt_ts_free();
 int pkt_ts_init(int *offset);
+int pkt_ts_probe_init(uint64_t *flag);
+
+/* Mark every rate-th pkt as a latency probe and stamp it. Unlike pkt_ts_exec
+ * only the probes are written, so this is cheap enough for throughput mode.
+ * The flag lives in ol_flags, which drivers reset on rx, so a recycled mbuf
+ * never shows up as a stale probe.
+ */
+static inline void
+pkt_ts_probe_exec(int offset, uint64_t flag, uint32_t rate, uint32_t *countdown, struct rte_mbuf **mbuf,
+                  int nb_mbuf)
+{
+    uint64_t time;
+    int i;
+
+    if (*countdown >= (uint32_t)nb_mbuf) {
+        *countdown -= nb_mbuf;
+        return;
+    }
+
+    time = rte_get_timer_cycles();
+    for (i = *countdown; i < nb_mbuf; i += rate) {
+        mbuf[i]->ol_flags |= flag;
+        *RTE_MBUF_DYNFIELD(mbuf[i], offset, uint64_t *) = time;
+    }
+    /* pkts left to skip before the next probe */
+    *countdown = i - nb_mbuf;
+}
 
 
 #endif /* _PACKET_TIMESTAMPING_H */
\ No newline at end of file
@@ -0,0 +1,66 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_BATCH_CTL_H_
+#define _INCLUDE_BATCH_CTL_H_
+
+#include <stdint.h>
+
+#include <rte_common.h>
+
+/* Adaptive batch sizing (--adaptive-batch). Each stage, and the main core for
+ * the chunks it hands to the stages, sizes its next burst from what the last
+ * one found:
+ *  - a full burst means pkts are queueing, the size grows by BATCH_CTL_STEP to
+ *    amortize the per burst overhead;
+ *  - a burst less than a quarter full means the ring is nearly empty, the size
+ *    halves so pkts do not wait behind a large batch;
+ *  - the size never exceeds the pkts processed within the latency budget of
+ *    the hop, estimated from a moving average of the cycles per pkt.
+ * The controller is private to its lcore.
+ */
+
+#define BATCH_CTL_STEP		8	/* pkts added after a full burst */
+#define BATCH_CTL_EWMA_SHIFT	4	/* newest cycles per pkt weigh 1/16 */
+
+struct batch_ctl {
+	uint32_t size;		/* next burst size */
+	uint32_t max;
+	uint64_t budget;	/* cycles a burst may take, 0 = no bound */
+	uint64_t cpp;		/* moving average of the cycles per pkt */
+};
+
+static inline void
+batch_ctl_init(struct batch_ctl *bc, uint32_t size, uint32_t max, uint64_t budget)
+{
+	bc->max = RTE_MAX(max, 1U);
+	bc->size = RTE_MIN(RTE_MAX(size, 1U), bc->max);
+	bc->budget = budget;
+	bc->cpp = 0;
+}
+
+/* Account a burst of nb pkts that was busy for cycles, returns the next size. */
+static inline uint32_t
+batch_ctl_update(struct batch_ctl *bc, uint32_t nb, uint64_t cycles)
+{
+	uint32_t size = bc->size;
+	uint64_t cap = bc->max;
+	uint64_t cpp;
+
+	if (nb) {
+		cpp = cycles / nb;
+		bc->cpp = bc->cpp ? bc->cpp - (bc->cpp >> BATCH_CTL_EWMA_SHIFT) + (cpp >> BATCH_CTL_EWMA_SHIFT) : cpp;
+	}
+
+	if (nb >= size)
+		size += BATCH_CTL_STEP;
+	else if (nb < size / 4)
+		size /= 2;
+
+	if (bc->budget && bc->cpp)
+		cap = RTE_MIN(cap, bc->budget / bc->cpp);
+	bc->size = RTE_MAX(RTE_MIN((uint64_t)size, cap), 1);
+
+	return bc->size;
+}
+
+#endif /* _INCLUDE_BATCH_CTL_H_ */
@@ -0,0 +1,162 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* Graph mode, see graph.h.
+ *
+ * example:
+ * ./build/meili ... --graph
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+
+#include "graph.h"
+#include "../lib/log/meili_log.h"
+
+static const char *graph_node_kind_names[] = {
+	[GRAPH_NODE_STAGE] = "stage",
+	[GRAPH_NODE_OUT] = "out",
+	[GRAPH_NODE_DROP] = "drop",
+};
+
+struct graph *
+graph_create(struct pipeline *pl, int inst, int socket_id)
+{
+	int nb_stages = pl->nb_pl_stages;
+	struct graph_node *node;
+	struct graph *g;
+	int i;
+
+	g = rte_zmalloc_socket("pipeline_graph", sizeof(*g) + (nb_stages + 2) * sizeof(struct graph_node),
+			       RTE_CACHE_LINE_SIZE, socket_id);
+	if (!g)
+		return NULL;
+
+	g->pl = pl;
+	g->nb_nodes = nb_stages + 2;
+	g->out = nb_stages;
+	g->drop = nb_stages + 1;
+
+	for (i = 0; i < nb_stages; i++) {
+		node = &g->nodes[i];
+		node->kind = GRAPH_NODE_STAGE;
+		node->stage = pl->stages[i][inst];
+		node->exec = node->stage->funcs->pipeline_stage_exec;
+		if (!node->exec) {
+			MEILI_LOG_ERR("Stage %d has no execution function.", i);
+			rte_free(g);
+			return NULL;
+		}
+		/* nodes only ever pass pkts to higher ids, one walk in id order visits all */
+		node->next[MEILI_PASS] = i + 1;
+		node->next[MEILI_DROP] = g->drop;
+		node->next[MEILI_BYPASS] = g->out;
+	}
+	g->nodes[g->out].kind = GRAPH_NODE_OUT;
+	g->nodes[g->drop].kind = GRAPH_NODE_DROP;
+
+	return g;
+}
+
+void
+graph_free(struct graph *g)
+{
+	rte_free(g);
+}
+
+static __rte_always_inline void
+graph_node_stage(struct graph *g, struct graph_node *node, struct rte_mbuf **objs, uint16_t nb)
+{
+	int (*exec)(struct pipeline_stage *self, meili_pkt *pkt) = node->exec;
+	struct pipeline_stage *stage = node->stage;
+	struct graph_node *next;
+	unsigned int verdict;
+	uint32_t prefetch = stage->prefetch;
+	uint16_t i;
+
+	/* pkts of later nodes were touched by the node before, only the source vector is cold */
+	if (node != g->nodes)
+		prefetch = 0;
+	pipeline_prefetch_start(objs, nb, prefetch);
+	for (i = 0; i < nb; i++) {
+		pipeline_prefetch_ahead(objs, i, nb, prefetch);
+		verdict = exec(stage, objs[i]);
+		/* anything else, e.g. an error code, keeps the pkt going */
+		if (unlikely(verdict >= MEILI_NB_VERDICTS))
+			verdict = MEILI_PASS;
+		next = &g->nodes[node->next[verdict]];
+		next->objs[next->nb_objs++] = objs[i];
+	}
+	node->pkts += nb;
+	node->vectors++;
+}
+
+uint32_t
+graph_walk(struct graph *g, struct rte_mbuf **pkts, uint32_t nb, struct rte_mbuf **out)
+{
+	struct graph_node *node;
+	uint32_t nb_out = 0;
+	uint16_t n, nb_objs;
+	uint32_t off;
+	int i;
+
+	for (off = 0; off < nb; off += n) {
+		n = RTE_MIN(nb - off, (uint32_t)GRAPH_VECTOR_SIZE);
+
+		/* the source vector is the burst itself */
+		graph_node_stage(g, &g->nodes[0], &pkts[off], n);
+		for (i = 1; i < g->out; i++) {
+			node = &g->nodes[i];
+			nb_objs = node->nb_objs;
+			if (!nb_objs)
+				continue;
+			node->nb_objs = 0;
+			graph_node_stage(g, node, node->objs, nb_objs);
+		}
+
+		node = &g->nodes[g->out];
+		if (node->nb_objs) {
+			memcpy(&out[nb_out], node->objs, node->nb_objs * sizeof(*out));
+			nb_out += node->nb_objs;
+			node->pkts += node->nb_objs;
+			node->vectors++;
+			node->nb_objs = 0;
+		}
+
+		node = &g->nodes[g->drop];
+		if (node->nb_objs) {
+			rte_pktmbuf_free_bulk(node->objs, node->nb_objs);
+			/* the main core counts them as done, it would wait for them in latency mode */
+			__atomic_fetch_add(&g->pl->dropped, node->nb_objs, __ATOMIC_RELEASE);
+			node->pkts += node->nb_objs;
+			node->vectors++;
+			node->nb_objs = 0;
+		}
+	}
+
+	return nb_out;
+}
+
+void
+graph_dump(struct graph *g)
+{
+	struct graph_node *node;
+	char type[32];
+	int i;
+
+	for (i = 0; i < g->nb_nodes; i++) {
+		node = &g->nodes[i];
+		if (node->kind == GRAPH_NODE_STAGE) {
+			GET_STAGE_TYPE_STRING(node->stage->type, type);
+		} else {
+			snprintf(type, sizeof(type), "-");
+		}
+		MEILI_LOG_INFO("graph node %d (%s %s): %" PRIu64 " pkts in %" PRIu64 " vectors, %.1f pkts/vector", i,
+			       graph_node_kind_names[node->kind], type, node->pkts, node->vectors,
+			       node->vectors ? (double)node->pkts / node->vectors : 0.0);
+	}
+}
@@ -0,0 +1,66 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_GRAPH_H_
+#define _INCLUDE_GRAPH_H_
+
+#include <stdint.h>
+
+#include <rte_mbuf.h>
+
+#include "pipeline.h"
+
+/* Graph mode (--graph): the stages of a pipeline instance run on one lcore as
+ * nodes of a graph instead of one lcore per stage with rings in between. Each
+ * node processes a whole vector of pkts before the next node runs, so its code
+ * stays in the icache, and hands every pkt to the next node picked by the
+ * verdict pipeline_stage_exec returned:
+ *
+ *   ring_in -> stage 0 -> stage 1 -> ... -> stage n-1 -> out -> ring_out
+ *                 |          |                  |
+ *                 +----------+------ drop ------+        (MEILI_DROP)
+ *                 +----------+------- out ------+        (MEILI_BYPASS)
+ *
+ * Rings are only used where pkts cross lcores, i.e. from and to the main core.
+ */
+
+/* Pkts a node processes at once, bursts are split into vectors of this size. */
+#define GRAPH_VECTOR_SIZE	256
+
+enum graph_node_kind {
+	GRAPH_NODE_STAGE,
+	GRAPH_NODE_OUT,		/* sink, pkts leave through the ring_out of the head stage */
+	GRAPH_NODE_DROP,	/* sink, pkts are freed */
+};
+
+struct graph_node {
+	enum graph_node_kind kind;
+	uint16_t nb_objs;			/* pkts waiting in objs */
+	uint16_t next[MEILI_NB_VERDICTS];	/* node id per verdict */
+	struct pipeline_stage *stage;
+	int (*exec)(struct pipeline_stage *self, meili_pkt *pkt);
+	uint64_t pkts;				/* pkts processed */
+	uint64_t vectors;			/* calls with a non-empty vector */
+	struct rte_mbuf *objs[GRAPH_VECTOR_SIZE];
+} __rte_cache_aligned;
+
+struct graph {
+	struct pipeline *pl;
+	uint16_t nb_nodes;
+	uint16_t out;				/* id of the out node */
+	uint16_t drop;				/* id of the drop node */
+	struct graph_node nodes[];		/* stage nodes in pipeline order, then out and drop */
+};
+
+/* Graph of instance inst of every pipeline stage, on the node of socket_id. */
+struct graph *graph_create(struct pipeline *pl, int inst, int socket_id);
+void graph_free(struct graph *g);
+
+/* Run nb pkts through the graph. Pkts reaching the out node are stored in out
+ * (room for nb), dropped pkts are freed. Returns the num of pkts in out.
+ */
+uint32_t graph_walk(struct graph *g, struct rte_mbuf **pkts, uint32_t nb, struct rte_mbuf **out);
+
+/* Log the pkts and vectors handled by each node. */
+void graph_dump(struct graph *g);
+
+#endif /* _INCLUDE_GRAPH_H_ */
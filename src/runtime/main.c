@@ -29,6 +29,9 @@
 
 #include "../utils/utils.h"
 #include "../utils/input_mode/input.h"
+#include "../utils/housekeeping/housekeeping.h"
+#include "../utils/metrics/metrics.h"
+#include "../utils/trace/trace.h"
 
 volatile bool force_quit;
 
@@ -95,11 +98,36 @@ main(int argc, char **argv)
 
 	run_conf->shinfo.free_cb = extbuf_free_cb;
 
+	/* from here on lcores queue their log messages instead of printing them */
+	ret = meili_log_start();
+	if (ret) {
+		snprintf(err, ERR_STR_SIZE, "Failed to start logger");
+		goto clean_pipeline;
+	}
+
 
 	/* Main core gets regex queue 0 and stats position 0. */
 	stats = run_conf->stats;
 	stats->rm_stats[0].lcore_id = rte_get_main_lcore();
 
+	ret = trace_init(run_conf);
+	if (ret) {
+		snprintf(err, ERR_STR_SIZE, "Failed to init flight recorder");
+		goto clean_log;
+	}
+
+	ret = metrics_init(&pl);
+	if (ret) {
+		snprintf(err, ERR_STR_SIZE, "Failed to start metrics export");
+		goto clean_trace;
+	}
+
+	/* stats printing, metrics and control commands run off the data plane for the whole run */
+	ret = housekeeping_start(&pl);
+	if (ret) {
+		snprintf(err, ERR_STR_SIZE, "Failed to start housekeeping");
+		goto clean_metrics;
+	}
 
 	MEILI_LOG_INFO("Beginning Processing...");
 	start_cycles = rte_get_timer_cycles();
@@ -110,12 +138,23 @@ main(int argc, char **argv)
 
 	end_cycles = rte_get_timer_cycles();
 	run_time = ((double)end_cycles - start_cycles) / rte_get_timer_hz();
+	/* the end of run print below reuses the split state of the periodic one */
+	housekeeping_stop();
 
 	stats_print_end_of_run(run_conf, run_time);
+	if (run_conf->stats_json_file)
+		stats_write_json(run_conf, run_time);
+	trace_dump();
 
 
 // clean_regex:
 // 	regex_dev_clean_regex(run_conf);
+clean_metrics:
+	metrics_clean();
+clean_trace:
+	trace_clean();
+clean_log:
+	meili_log_stop();
 clean_pipeline:
 	pipeline_free(&pl);
 clean_input:
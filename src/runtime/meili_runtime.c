@@ -70,6 +70,7 @@ int meili_runtime_init(struct pipeline *pl, pl_conf *run_conf, char *err){
      * 3) INPUT_LIVE            Use dpdk port to receive pkts. 
      * 4) INPUT_JOB_FORMAT      N/A
      * 5) INPUT_REMOTE_MMAP     N/A
+     * 6) INPUT_SYNTHETIC       Generate pkts in process on a dpdk port, i.e. a net_null vdev.
     */
 	ret = input_register(run_conf);
 	if (ret) {
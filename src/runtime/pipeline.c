@@ -1,19 +1,27 @@
 /* Copyright (c) 2024, Meili Authors */
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <rte_cycles.h>
 #include <rte_errno.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
 
 #include "pipeline.h"
+#include "batch_ctl.h"
+#include "graph.h"
 #include "run_mode.h"
 #include "../utils/utils.h"
 
+#include "../lib/mem/meili_flow_state.h"
 #include "../packet_ordering/packet_ordering.h"
 #include "../packet_timestamping/packet_timestamping.h"
 #include "../utils/input_mode/input.h"
+#include "../utils/trace/trace.h"
 
 
 typedef int (*pl_register_functions)(struct pipeline_stage *);
@@ -47,25 +55,177 @@ typedef int (*pl_register_functions)(struct pipeline_stage *);
 
 
 
+/* Send pkts of the high priority class on to the next consumer, round-robin over the consumers. */
+static inline void pipeline_prio_send(struct pipeline_stage *self, struct rte_mbuf **pkts, int nb, int *prio_out_index){
+    struct pipeline *pl = (struct pipeline *)self->pl;
+    struct rte_ring *ring = self->prio_ring_out[*prio_out_index];
+    int nb_enq = 0;
+
+    /* the main core or egress lcore stops draining prio_ring_out at the end of the run */
+    while(nb_enq < nb && !force_quit && __atomic_load_n(&pl->conf.running, __ATOMIC_RELAXED)){
+        nb_enq += rte_ring_enqueue_burst(ring, (void **)&pkts[nb_enq], nb - nb_enq, NULL);
+    }
+    if(unlikely(nb_enq < nb)){
+        rte_pktmbuf_free_bulk(&pkts[nb_enq], nb - nb_enq);
+    }
+    *prio_out_index = (*prio_out_index+1)%self->nb_prio_ring_out;
+}
+
+/* Install the flow state entries other instances sent to this one. Called right
+ * after each dequeue: an entry is sent before the dispatchers release the pkts
+ * of its flow, so it is in place before the first of them is processed.
+ */
+static void pipeline_flow_state_recv(struct pipeline_stage *self){
+    struct pipeline *pl = (struct pipeline *)self->pl;
+    struct meili_flow_state_msg *msgs[FLOW_STATE_BURST];
+    unsigned int nb;
+
+    do{
+        nb = rte_ring_dequeue_burst(self->flow_state_ring, (void **)msgs, FLOW_STATE_BURST, NULL);
+        for(unsigned int i=0; i<nb; i++){
+            /* graph stages share the ring of their head */
+            meili_flow_state_import(pl->stages[msgs[i]->stage_id][self->inst_id], msgs[i]);
+            rte_free(msgs[i]);
+        }
+    }while(nb == FLOW_STATE_BURST);
+}
+
+/* Hand a flow state entry to instance inst, installing the ones sent to this
+ * instance while its ring is full, two instances never wait on each other.
+ */
+static void pipeline_flow_state_send(struct pipeline_stage *self, uint32_t inst, struct meili_flow_state_msg *msg){
+    struct pipeline *pl = (struct pipeline *)self->pl;
+
+    while(rte_ring_enqueue(pl->flow_state_rings[inst], msg)){
+        if(force_quit || !pl->conf.running){
+            rte_free(msg);
+            return;
+        }
+        pipeline_flow_state_recv(self);
+    }
+}
+
+/* Flow state migration after a scale event, see meili_flow_state.h. The pkts the
+ * dispatchers queued before they switched maps end at the input ring tails seen
+ * on the first call, once they are done the entries of the flows the new map
+ * moves go to their instances, those of the whole graph in graph mode.
+ */
+static void pipeline_flow_state_migrate(struct pipeline_stage *self){
+    struct pipeline *pl = (struct pipeline *)self->pl;
+    uint32_t gen = __atomic_load_n(&pl->flow_state_gen, __ATOMIC_ACQUIRE);
+    struct rte_ring *prio = self->prio_ring_in;
+    uint32_t nb = 0;
+
+    if(gen != self->flow_gen){
+        self->flow_gen = gen;
+        self->flow_mark[0] = __atomic_load_n(&self->ring_in[0]->prod.tail, __ATOMIC_ACQUIRE);
+        self->flow_mark[1] = prio ? __atomic_load_n(&prio->prod.tail, __ATOMIC_ACQUIRE) : 0;
+    }
+    /* zero-copy slots go back only once their pkts moved on */
+    if((int32_t)(self->ring_in[0]->cons.tail - self->flow_mark[0]) < 0 ||
+       (prio && (int32_t)(prio->cons.tail - self->flow_mark[1]) < 0)){
+        return;
+    }
+
+    if(self->graph){
+        for(int i=0; i<pl->nb_pl_stages; i++){
+            nb += meili_flow_state_export(pl->stages[i][self->inst_id], pl->flow_state_map, pipeline_flow_state_send);
+        }
+    }
+    else{
+        nb = meili_flow_state_export(self, pl->flow_state_map, pipeline_flow_state_send);
+    }
+    trace_record(TRACE_EV_MODE, TRACE_MODE_MIGRATE, self->worker_qid, nb);
+    /* the entries are on their rings, the dispatchers may let the pkts go */
+    __atomic_store_n(&self->flow_gen_done, gen, __ATOMIC_RELEASE);
+}
+
+/* Poll the high priority ring: a small burst, processed and sent on before any bulk burst. */
+static inline int pipeline_stage_prio(struct pipeline_stage *self, int (*stage_exec)(struct pipeline_stage *self, meili_pkt *pkt),
+                                      int *prio_out_index){
+    struct rte_mbuf *pkts[PRIO_BURST_SIZE];
+    struct rte_mbuf *out[PRIO_BURST_SIZE];
+    int nb, nb_out;
+
+    nb = rte_ring_dequeue_burst(self->prio_ring_in, (void **)pkts, PRIO_BURST_SIZE, NULL);
+    if(!nb){
+        return 0;
+    }
+    if(self->flow_state_ring){
+        pipeline_flow_state_recv(self);
+    }
+
+    if(self->graph){
+        nb_out = graph_walk(self->graph, pkts, nb, out);
+    }
+    else{
+        for(int i=0; i<nb; i++){
+            stage_exec(self, pkts[i]);
+            out[i] = pkts[i];
+        }
+        nb_out = nb;
+    }
+    if(nb_out){
+        pipeline_prio_send(self, out, nb_out, prio_out_index);
+    }
+
+    return nb;
+}
+
+/* Enqueue nb pkts to ring_out[index] in chunks of burst_size, retrying while the
+ * ring is full. Returns the tsc the ring was first found full, stall_tsc if set.
+ */
+static __rte_always_inline uint64_t pipeline_stage_enqueue(struct pipeline_stage *self, int index,
+                                                           struct rte_mbuf **pkts, int nb, int burst_size,
+                                                           uint64_t stall_tsc){
+    struct rte_ring *ring_out = self->ring_out[index];
+    uint64_t *ready = self->ring_out_ready[index];
+    int to_enq, nb_enq;
+    int tot_enq = 0;
+
+    while(tot_enq < nb) {
+        to_enq = RTE_MIN(nb - tot_enq, burst_size);
+        nb_enq = rte_ring_enqueue_burst(ring_out, (void *)(&pkts[tot_enq]), to_enq, NULL);
+        /* flag the ring on every partial enqueue, the consumer may be waiting for it to free space */
+        if (nb_enq && ready)
+            pipeline_ready_set(ready, self->ring_out_bit[index]);
+        /* the next stage is not keeping up, time spent retrying is stalled */
+        if (nb_enq < to_enq && !stall_tsc) {
+            stall_tsc = rte_rdtsc();
+            trace_record_tsc(stall_tsc, TRACE_EV_RING_FULL, self->worker_qid, nb - tot_enq - nb_enq,
+                             rte_ring_free_count(ring_out));
+        }
+        tot_enq += nb_enq;
+    }
+
+    return stall_tsc;
+}
+
 /* worker function for a pipeline */
 int pipeline_stage_run_safe(struct pipeline_stage *self){
     int burst_size = self->batch_size;
     struct rte_ring **ring_in_array = self->ring_in;
-    struct rte_ring **ring_out_array = self->ring_out;
-    struct rte_ring *ring_in = NULL;
-    struct rte_ring *ring_out = NULL;
     int nb_ring_in = self->nb_ring_in;
     int nb_ring_out = self->nb_ring_out;
     int ring_in_index = 0;
     int ring_out_index = 0;
 
-    
-
+    /* pkts are processed in the slots of ring_in (zero-copy dequeue), in two
+     * pieces where they wrap around the end of the ring, and copied once into
+     * ring_out. Only a graph, which may drop pkts, writes them to mbufs_out.
+     * Shared rings have several consumers, which a zero-copy dequeue would
+     * block until the burst is done, they are dequeued into mbufs_in instead.
+     */
+    struct rte_ring_zc_data zcd;
+    struct rte_mbuf **seg[2];
+    uint32_t seg_nb[2];
     struct rte_mbuf *mbufs_in[MAX_PKTS_BURST];
-    struct rte_mbuf *mbufs_out_static[MAX_PKTS_BURST];
-
-    struct rte_mbuf **mbufs_out = mbufs_out_static;
-
+    bool zc;
+    struct rte_mbuf *mbufs_out[MAX_PKTS_BURST];
+    /* pkts an app promoted to the high priority class while in the bulk class */
+    struct rte_mbuf *mbufs_prio[MAX_PKTS_BURST];
+    int prio_out_index = 0;
+    uint32_t nb_prio;
 
     int out_num = 0;
 
@@ -75,72 +235,585 @@ int pipeline_stage_run_safe(struct pipeline_stage *self){
     int qid = self->worker_qid;
     rb_stats_t *stats = conf->stats;
 	run_mode_stats_t *rm_stats = &stats->rm_stats[qid];
+    const uint64_t prio_flag = self->prio_ring_in ? pl->prio.flag : 0;
+    const uint32_t prefetch = self->prefetch;
+    const bool flow_state = self->flow_state_ring != NULL;
 
     if(!nb_ring_in || !nb_ring_out){
         return -EINVAL;
     }
+    /* all input rings of an instance have the same consumer mode */
+    zc = ring_in_array[0]->cons.sync_type == RTE_RING_SYNC_ST;
 
     int nb_deq = 0;
-    int nb_enq = 0;
-    int to_enq = 0;
-    int tot_enq = 0;
+    uint64_t tsc, now, stall_tsc, busy;
+    struct perf_group perf;
+    bool perf_on = false;
+    /* latency mode measures fixed batches */
+    bool adaptive = conf->adaptive_batch_us && !conf->latency_mode;
+    struct batch_ctl bc;
     
     struct pipeline_func *funcs =  self->funcs;
+    int (*stage_exec)(struct pipeline_stage *self, meili_pkt *pkt);
 
     if(!funcs){
         MEILI_LOG_WARN("Invalid functions");
         return -EINVAL;
     }
 
-	if (!funcs->pipeline_stage_exec){
+    /* funcs sits in the cold part of the stage, read it once */
+    stage_exec = funcs->pipeline_stage_exec;
+	if (!stage_exec){
         MEILI_LOG_WARN("Invalid execution function");
         return -EINVAL;
     }
 
+    /* counters follow the calling thread, so they are opened on the worker itself */
+    if (conf->perf_counters)
+        perf_on = !perf_group_open(&perf);
+
+    if (adaptive)
+        batch_ctl_init(&bc, burst_size, MAX_PKTS_BURST, pl->batch_budget);
+
     // main loop of pipeline stage
     while(!force_quit && conf->running == true){
-        /* read packets from ring_in in a round-robin manner */
-        ring_in = ring_in_array[ring_in_index];
-        nb_deq = rte_ring_dequeue_burst(ring_in, (void *)mbufs_in, burst_size, NULL);
-        ring_in_index = (ring_in_index+1)%nb_ring_in;
+        /* the dispatchers hold the pkts of moved flows until their state is sent on */
+        if (flow_state && unlikely(__atomic_load_n(&pl->flow_state_gen, __ATOMIC_RELAXED) != self->flow_gen_done))
+            pipeline_flow_state_migrate(self);
+
+        /* high priority pkts first, they never wait behind a bulk burst in this stage */
+        if (prio_flag) {
+            tsc = rte_rdtsc();
+            nb_deq = pipeline_stage_prio(self, stage_exec, &prio_out_index);
+            if (nb_deq) {
+                rm_stats->prio_buf_cnt += nb_deq;
+                rm_stats->busy_cycles += rte_rdtsc() - tsc;
+            }
+        }
+
+        /* read packets from ring_in in a round-robin manner, skipping rings producers did not flag */
+        tsc = rte_rdtsc();
+        if (zc)
+            nb_deq = pipeline_dequeue_ready_zc_start(ring_in_array, nb_ring_in, &self->ready, &ring_in_index, &zcd,
+                                                     burst_size);
+        else
+            nb_deq = pipeline_dequeue_ready(ring_in_array, nb_ring_in, &self->ready, &ring_in_index,
+                                            (void **)mbufs_in, burst_size);
+        /* also while starved, another instance may be waiting on the ring */
+        if (flow_state)
+            pipeline_flow_state_recv(self);
+
+        if (!nb_deq) {
+            /* empty poll, the stage is starved */
+            now = rte_rdtsc();
+            rm_stats->idle_cycles += now - tsc;
+            stats_publish(stats, qid, now);
+            continue;
+        }
+        if (zc) {
+            seg[0] = zcd.ptr1;
+            seg_nb[0] = zcd.n1;
+            seg[1] = zcd.ptr2;
+            seg_nb[1] = nb_deq - zcd.n1;
+        } else {
+            seg[0] = mbufs_in;
+            seg_nb[0] = nb_deq;
+            seg[1] = mbufs_in;
+            seg_nb[1] = 0;
+        }
+
+        if (perf_on)
+            perf_group_begin(&perf);
 
         //pkt_ts_exec(self->ts_start_offset, mbufs_in, nb_deq);
         /* process packets */
         //pipeline_stage_exec_safe(self, mbufs_in, nb_deq, &mbufs_out, &out_num);
-        for(int i=0; i<nb_deq; i++){
-            funcs->pipeline_stage_exec(self, mbufs_in[i]);
-            mbufs_out[i] = mbufs_in[i];  
-            out_num++;
+        if(self->graph){
+            /* all stages of this instance run here, dropped pkts never reach ring_out */
+            out_num = graph_walk(self->graph, seg[0], seg_nb[0], mbufs_out);
+            out_num += graph_walk(self->graph, seg[1], seg_nb[1], &mbufs_out[out_num]);
+            seg[0] = mbufs_out;
+            seg_nb[0] = out_num;
+            seg_nb[1] = 0;
+        }
+        else{
+            for(uint32_t s=0; s<2; s++){
+                pipeline_prefetch_start(seg[s], seg_nb[s], prefetch);
+                for(uint32_t i=0; i<seg_nb[s]; i++){
+                    pipeline_prefetch_ahead(seg[s], i, seg_nb[s], prefetch);
+                    stage_exec(self, seg[s][i]);
+                }
+            }
         }
         
         
         //pkt_ts_exec(self->ts_end_offset, mbufs_out, out_num);
 
-        /* put packets into ring_out in a round-robin manner */
-        ring_out = ring_out_array[ring_out_index];
-        
-        tot_enq = 0;
-        while(out_num > 0) {
-            to_enq = RTE_MIN(out_num, burst_size);
-            nb_enq = rte_ring_enqueue_burst(ring_out, (void *)(&mbufs_out[tot_enq]), to_enq, NULL);
-            tot_enq += nb_enq;
-            out_num -= nb_enq;
+        if (prio_flag) {
+            nb_prio = prio_split(seg[0], &seg_nb[0], prio_flag, mbufs_prio);
+            nb_prio += prio_split(seg[1], &seg_nb[1], prio_flag, &mbufs_prio[nb_prio]);
+            if (nb_prio)
+                pipeline_prio_send(self, mbufs_prio, nb_prio, &prio_out_index);
+        }
+
+        /* update statics, before the next stage owns the pkts */
+        out_num = seg_nb[0] + seg_nb[1];
+        for(uint32_t s=0; s<2; s++){
+            for(uint32_t k=0; k<seg_nb[s]; k++){
+                rm_stats->tx_buf_bytes += seg[s][k]->data_len;
+            }
         }
+
+        /* put packets into ring_out in a round-robin manner */
+        stall_tsc = pipeline_stage_enqueue(self, ring_out_index, seg[0], seg_nb[0], burst_size, 0);
+        stall_tsc = pipeline_stage_enqueue(self, ring_out_index, seg[1], seg_nb[1], burst_size, stall_tsc);
         ring_out_index = (ring_out_index+1)%nb_ring_out;
-        /* update statics */
-        for(int k=0; k<tot_enq ; k++){
-            //printf("updating stats for core %d\n",qid);
-            rm_stats->tx_buf_bytes += mbufs_out[k]->data_len;
+
+        /* all pkts moved on, hand the slots back to the producers */
+        if (zc)
+            pipeline_dequeue_ready_zc_finish(ring_in_array, nb_ring_in, &self->ready, &ring_in_index, nb_deq,
+                                             burst_size);
+
+        if (perf_on)
+            perf_group_end(&perf, rm_stats->perf);
+        rm_stats->tx_buf_cnt += out_num;
+        rm_stats->rx_buf_cnt += nb_deq;
+        rm_stats->rx_batch_cnt++;
+
+        now = rte_rdtsc();
+        if (stall_tsc) {
+            rm_stats->stall_cycles += now - stall_tsc;
+            busy = stall_tsc - tsc;
+        } else {
+            busy = now - tsc;
         }
-        rm_stats->tx_buf_cnt += tot_enq;
+        rm_stats->busy_cycles += busy;
+        /* size the next burst from what this one found in the rings */
+        if (adaptive)
+            burst_size = batch_ctl_update(&bc, nb_deq, busy);
+        rm_stats->burst_hist[stats_hist_bucket(nb_deq)]++;
+        rm_stats->cpp_hist[stats_hist_bucket(busy / nb_deq)]++;
+        rm_stats->cpp_sum += busy / nb_deq;
+        trace_record_tsc(now, TRACE_EV_STAGE_BURST, qid, nb_deq, busy);
+        stats_publish(stats, qid, now);
     }
 
+    if (perf_on)
+        perf_group_close(&perf);
+
+    if (self->graph)
+        graph_dump(self->graph);
+    if (adaptive)
+        MEILI_LOG_INFO("Worker %d final batch size %d, %" PRIu64 " cycles/pkt", self->worker_qid, burst_size, bc.cpp);
+
     printf("Worker %d exiting\n",self->worker_qid);
     return 0;
 }
 
 
 
+/* Stages connected by rings: all of them, or only the graph heads in graph mode
+ * where the other stages run inside the graphs of the heads.
+ */
+static int pipeline_nb_ring_stages(struct pipeline *pl){
+    return pl->conf.graph_mode ? RTE_MIN(pl->nb_pl_stages, 1) : pl->nb_pl_stages;
+}
+
+/* Producers of one stage boundary sharing a ring to each consumer. */
+static int pipeline_fan_in(struct pipeline *pl, int nb_prod){
+    int fan_in = pl->conf.fan_in;
+
+    if(!fan_in){
+        fan_in = (nb_prod + PL_FAN_IN_AUTO - 1) / PL_FAN_IN_AUTO;
+    }
+    /* no consumer polls more rings than its ready mask has bits */
+    fan_in = RTE_MAX(fan_in, (nb_prod + PL_MAX_FAN_IN - 1) / PL_MAX_FAN_IN);
+
+    return RTE_MAX(RTE_MIN(fan_in, nb_prod), 1);
+}
+
+/* Input rings of each consumer of nb_prod producers */
+static int pipeline_nb_groups(struct pipeline *pl, int nb_prod){
+    int fan_in = pipeline_fan_in(pl, nb_prod);
+
+    return (nb_prod + fan_in - 1) / fan_in;
+}
+
+static void *pipeline_ring_array(const char *name, int nb, size_t size, int socket_id){
+    return rte_zmalloc_socket(name, RTE_MAX(nb, 1) * size, RTE_CACHE_LINE_SIZE, socket_id);
+}
+
+/* Ring arrays of the main core and of every stage instance, sized for the topology.
+ * The arrays of a stage live on its node with the stage.
+ */
+static int pipeline_topo_alloc(struct pipeline *pl, bool shared){
+    int nb_pl_stages = pipeline_nb_ring_stages(pl);
+    int *nb_inst_per_pl_stage = pl->nb_inst_per_pl_stage;
+    struct pipeline_stage *self = NULL;
+    int nb_in, nb_out;
+
+    nb_in = nb_pl_stages && !shared ? nb_inst_per_pl_stage[0] : 1;
+    nb_out = nb_pl_stages && !shared ? pipeline_nb_groups(pl, nb_inst_per_pl_stage[nb_pl_stages-1]) : 1;
+    pl->ring_in = pipeline_ring_array("pl_ring_in", nb_in, sizeof(struct rte_ring *), rte_socket_id());
+    pl->ring_out = pipeline_ring_array("pl_ring_out", nb_out, sizeof(struct rte_ring *), rte_socket_id());
+    if(!pl->ring_in || !pl->ring_out){
+        return -ENOMEM;
+    }
+
+    for(int i=0; i<nb_pl_stages; i++){
+        nb_in = i > 0 && !shared ? pipeline_nb_groups(pl, nb_inst_per_pl_stage[i-1]) : 1;
+        nb_out = i < nb_pl_stages-1 && !shared ? nb_inst_per_pl_stage[i+1] : 1;
+        for(int j=0; j<nb_inst_per_pl_stage[i]; j++){
+            self = pl->stages[i][j];
+            self->ring_in = pipeline_ring_array("stage_ring_in", nb_in, sizeof(struct rte_ring *), self->socket_id);
+            self->ring_out = pipeline_ring_array("stage_ring_out", nb_out, sizeof(struct rte_ring *), self->socket_id);
+            self->ring_out_ready = pipeline_ring_array("stage_ring_ready", nb_out, sizeof(uint64_t *), self->socket_id);
+            self->ring_out_bit = pipeline_ring_array("stage_ring_bit", nb_out, sizeof(uint64_t), self->socket_id);
+            if(!self->ring_in || !self->ring_out || !self->ring_out_ready || !self->ring_out_bit){
+                return -ENOMEM;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Connect the instances of stage i to their consumers: stage i+1, or the main
+ * core after the last stage. Producers are split in groups of fan_in that share
+ * one ring to each consumer, SP/SC for groups of one (the full mesh) and MP/SC
+ * above, so a consumer polls nb_groups rings instead of one per producer.
+ * Producers still enqueue a whole burst at once and spread bursts over all
+ * consumers in a round-robin manner.
+ */
+static int pipeline_topo_fan_in(struct pipeline *pl, int i){
+    bool to_main = i == pipeline_nb_ring_stages(pl)-1;
+    int nb_prod = pl->nb_inst_per_pl_stage[i];
+    int nb_cons = to_main ? 1 : pl->nb_inst_per_pl_stage[i+1];
+    int fan_in = pipeline_fan_in(pl, nb_prod);
+    int nb_groups = pipeline_nb_groups(pl, nb_prod);
+    struct pipeline_stage *self = NULL;
+    struct pipeline_stage *child = NULL;
+    struct rte_ring *ring;
+    uint64_t *ready;
+    char ring_name[RTE_RING_NAMESIZE];
+
+    for(int k=0; k<nb_cons; k++){
+        child = to_main ? NULL : pl->stages[i+1][k];
+        /* a consumer with a single input ring polls it without the ready mask */
+        ready = nb_groups == 1 ? NULL : to_main ? &pl->ready : &child->ready;
+
+        for(int g=0; g<nb_groups; g++){
+            if(to_main){
+                snprintf(ring_name, sizeof(ring_name), "tail_ring_out_%d", g);
+            }
+            else{
+                snprintf(ring_name, sizeof(ring_name), "inter_worker_ring_%d_%d_%d", i, g, k);
+            }
+            /* rings live on the node of their consumer */
+            ring = rte_ring_create(ring_name, RING_SIZE, to_main ? (int)rte_socket_id() : child->socket_id,
+                                   RING_F_SC_DEQ | (fan_in == 1 ? RING_F_SP_ENQ : 0));
+            if(!ring){
+                return -ENOMEM;
+            }
+            if(to_main){
+                pl->ring_out[pl->nb_ring_out++] = ring;
+            }
+            else{
+                child->ring_in[child->nb_ring_in++] = ring;
+            }
+
+            for(int j=g*fan_in; j<RTE_MIN((g+1)*fan_in, nb_prod); j++){
+                self = pl->stages[i][j];
+                self->ring_out[self->nb_ring_out] = ring;
+                self->ring_out_ready[self->nb_ring_out] = ready;
+                self->ring_out_bit[self->nb_ring_out] = 1ULL << g;
+                self->nb_ring_out++;
+            }
+        }
+    }
+    MEILI_LOG_INFO("Stage %d: %d producer(s) in groups of %d, %d input ring(s) per consumer", i, nb_prod, fan_in,
+                   nb_groups);
+
+    return 0;
+}
+
+/* Enqueue mode of the rings fed by the dispatchers, they are single producer unless more dispatchers share them */
+static unsigned int pipeline_head_ring_enq(struct pipeline *pl){
+    if(pl->conf.shared_buffer){
+        return pl->nb_dispatchers > 1 ? RING_F_MP_HTS_ENQ : RING_F_SP_ENQ;
+    }
+    return pl->nb_dispatchers > 1 ? 0 : RING_F_SP_ENQ;
+}
+
+/* Shared rings: one MPMC ring between each pair of stages, used through index 0 of the ring arrays. */
+static int pipeline_topo_shared(struct pipeline *pl){
+    int nb_pl_stages = pipeline_nb_ring_stages(pl);
+    int *nb_inst_per_pl_stage = pl->nb_inst_per_pl_stage;
+    struct pipeline_stage *self = NULL;
+    char ring_name[64];
+
+    pl->ring_in[0] = rte_ring_create("head_ring_in", RING_SIZE, rte_socket_id(),
+                                     pipeline_head_ring_enq(pl) | RING_F_MC_HTS_DEQ);
+    /* another mode of shared rte ring */
+    //pl->ring_in[0] = rte_ring_create("head_ring_in", RING_SIZE, rte_socket_id(),RING_F_SP_ENQ | RING_F_MC_RTS_DEQ);
+    if(!pl->ring_in[0]){
+        return -ENOMEM;
+    }
+    pl->nb_ring_in = 1;
+    pl->nb_ring_out = 1;
+
+    if(nb_pl_stages == 0){
+        /* no worker stages */
+        pl->ring_out[0] = pl->ring_in[0];
+        return 0;
+    }
+
+    pl->ring_out[0] = rte_ring_create("tail_ring_out", RING_SIZE, rte_socket_id(),RING_F_MP_HTS_ENQ | RING_F_SC_DEQ);
+    //pl->ring_out[0] = rte_ring_create("tail_ring_out", RING_SIZE, rte_socket_id(),RING_F_MP_RTS_ENQ | RING_F_SC_DEQ);
+    if(!pl->ring_out[0]){
+        return -ENOMEM;
+    }
+
+    /* connect head ring_in to first stages */
+    for(int j=0; j<nb_inst_per_pl_stage[0]; j++){
+        self = pl->stages[0][j];
+        self->ring_in[0] = pl->ring_in[0];
+        self->nb_ring_in = 1;
+    }
+
+    /* connect tail ring_out to last stages */
+    for(int j=0; j<nb_inst_per_pl_stage[nb_pl_stages-1]; j++){
+        self = pl->stages[nb_pl_stages-1][j];
+        self->ring_out[0] = pl->ring_out[0];
+        self->nb_ring_out = 1;
+    }
+    MEILI_LOG_INFO("Main thread in_ring/out_ring initialized");
+
+    /* For intermediatte stages, allocate ring_in/ring_out and connect */
+    /* TODO(optional): add a field that record parent/child */
+    for(int i=0; i<nb_pl_stages-1 ; i++){
+        if(nb_inst_per_pl_stage[i] < nb_inst_per_pl_stage[i+1]){
+            for(int j=0; j<nb_inst_per_pl_stage[i]; j++){
+                self = pl->stages[i][j];
+
+                /* allocate space for ring_out */
+                snprintf(ring_name,64,"inter_stage_ring_%d_%d", i, j);
+                self->ring_out[0] = rte_ring_create(ring_name, RING_SIZE, rte_socket_id(),RING_F_SP_ENQ | RING_F_MC_HTS_DEQ);
+                //self->ring_out[0] = rte_ring_create(ring_name, RING_SIZE, rte_socket_id(),RING_F_SP_ENQ | RING_F_MC_RTS_DEQ);
+                if (self->ring_out[0] == NULL){
+                    return -ENOMEM;
+                }
+                self->nb_ring_out = 1;
+            }
+
+            for(int j=0; j<nb_inst_per_pl_stage[i+1]; j++){
+                self = pl->stages[i+1][j];
+                /* connect ring_in to previous ring_out */
+                self->ring_in[0] = pl->stages[i][j%nb_inst_per_pl_stage[i]]->ring_out[0];
+                self->nb_ring_in = 1;
+            }
+        }
+        else{
+            for(int j=0; j<nb_inst_per_pl_stage[i+1]; j++){
+                self = pl->stages[i+1][j];
+
+                /* allocate space for ring_in */
+                snprintf(ring_name,64,"inter_stage_ring_%d_%d", i+1, j);
+                self->ring_in[0] = rte_ring_create(ring_name, RING_SIZE, rte_socket_id(),RING_F_MP_HTS_ENQ | RING_F_SC_DEQ);
+                //self->ring_in[0] = rte_ring_create(ring_name, RING_SIZE, rte_socket_id(),RING_F_MP_RTS_ENQ | RING_F_SC_DEQ);
+                if (self->ring_in[0] == NULL){
+                    return -ENOMEM;
+                }
+                self->nb_ring_in = 1;
+            }
+
+            for(int j=0; j<nb_inst_per_pl_stage[i]; j++){
+                self = pl->stages[i][j];
+                /* connect ring_out to next ring_in */
+                self->ring_out[0] = pl->stages[i+1][j%nb_inst_per_pl_stage[i+1]]->ring_in[0];
+                self->nb_ring_out = 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Separate rings: the main core feeds each first stage instance through its own
+ * sp/sc ring, later boundaries are grouped fan-in (a full sp/sc mesh while a
+ * consumer has at most PL_FAN_IN_AUTO producers).
+ */
+static int pipeline_topo_separate(struct pipeline *pl){
+    int nb_pl_stages = pipeline_nb_ring_stages(pl);
+    int *nb_inst_per_pl_stage = pl->nb_inst_per_pl_stage;
+    struct pipeline_stage *self = NULL;
+    char ring_name[RTE_RING_NAMESIZE];
+    int ret;
+
+    if(nb_pl_stages == 0){
+        /* no worker stages */
+        pl->ring_in[0] = rte_ring_create("head_ring_in", RING_SIZE, rte_socket_id(),
+                                         pipeline_head_ring_enq(pl) | RING_F_SC_DEQ);
+        if(!pl->ring_in[0]){
+            return -ENOMEM;
+        }
+        pl->ring_out[0] = pl->ring_in[0];
+        pl->nb_ring_in = 1;
+        pl->nb_ring_out = 1;
+        return 0;
+    }
+
+    /* connect head ring_in to first stages */
+    for(int j=0; j<nb_inst_per_pl_stage[0]; j++){
+        self = pl->stages[0][j];
+        snprintf(ring_name, sizeof(ring_name), "head_ring_in_%d", j);
+        pl->ring_in[j] = rte_ring_create(ring_name, RING_SIZE, self->socket_id,
+                                         pipeline_head_ring_enq(pl) | RING_F_SC_DEQ);
+
+        if(!pl->ring_in[j]){
+            return -ENOMEM;
+        }
+        self->ring_in[0] = pl->ring_in[j];
+        self->nb_ring_in++;
+    }
+    pl->nb_ring_in = nb_inst_per_pl_stage[0];
+
+    /* connect each stage to the next one, the last one to the tail ring_out */
+    /* TODO(optional): when assigning cores to workers, take into consideration the microarch, i.e., core 2 and core 3 worker should have connection.  */
+    for(int i=0; i<nb_pl_stages; i++){
+        ret = pipeline_topo_fan_in(pl, i);
+        if(ret){
+            return ret;
+        }
+    }
+    MEILI_LOG_INFO("Main thread in_ring/out_ring initialized");
+
+    return 0;
+}
+
+/* High priority class: each consumer gets one MP/SC prio ring on its node,
+ * shared by all its producers next to the bulk topology. Prio traffic is light,
+ * so a consumer polls a single extra ring and producers rarely contend on it.
+ */
+static int pipeline_topo_prio(struct pipeline *pl){
+    int nb_pl_stages = pipeline_nb_ring_stages(pl);
+    int *nb_inst_per_pl_stage = pl->nb_inst_per_pl_stage;
+    struct pipeline_stage *self = NULL;
+    char ring_name[RTE_RING_NAMESIZE];
+    bool to_main;
+    int nb_prod, nb_cons;
+
+    /* tail ring to the main core, also the only ring without worker stages */
+    nb_prod = nb_pl_stages ? nb_inst_per_pl_stage[nb_pl_stages-1] : pl->nb_dispatchers;
+    pl->prio_ring_out = rte_ring_create("prio_ring_out", PRIO_RING_SIZE, rte_socket_id(),
+                                        RING_F_SC_DEQ | (nb_prod == 1 ? RING_F_SP_ENQ : 0));
+    nb_cons = nb_pl_stages ? nb_inst_per_pl_stage[0] : 1;
+    pl->prio_ring_in = pipeline_ring_array("pl_prio_ring_in", nb_cons, sizeof(struct rte_ring *), rte_socket_id());
+    if(!pl->prio_ring_out || !pl->prio_ring_in){
+        return -ENOMEM;
+    }
+    if(nb_pl_stages == 0){
+        pl->prio_ring_in[0] = pl->prio_ring_out;
+        pl->nb_prio_ring_in = 1;
+        return 0;
+    }
+
+    /* input rings, the first stage is fed by the dispatchers */
+    for(int i=0; i<nb_pl_stages; i++){
+        nb_prod = i > 0 ? nb_inst_per_pl_stage[i-1] : pl->nb_dispatchers;
+        for(int j=0; j<nb_inst_per_pl_stage[i]; j++){
+            self = pl->stages[i][j];
+            snprintf(ring_name, sizeof(ring_name), "prio_ring_%d_%d", i, j);
+            self->prio_ring_in = rte_ring_create(ring_name, PRIO_RING_SIZE, self->socket_id,
+                                                 RING_F_SC_DEQ | (nb_prod == 1 ? RING_F_SP_ENQ : 0));
+            if(!self->prio_ring_in){
+                return -ENOMEM;
+            }
+        }
+    }
+    for(int j=0; j<nb_inst_per_pl_stage[0]; j++){
+        pl->prio_ring_in[j] = pl->stages[0][j]->prio_ring_in;
+    }
+    pl->nb_prio_ring_in = nb_inst_per_pl_stage[0];
+
+    /* output rings, every producer reaches every consumer */
+    for(int i=0; i<nb_pl_stages; i++){
+        to_main = i == nb_pl_stages-1;
+        nb_cons = to_main ? 1 : nb_inst_per_pl_stage[i+1];
+        for(int j=0; j<nb_inst_per_pl_stage[i]; j++){
+            self = pl->stages[i][j];
+            self->prio_ring_out = pipeline_ring_array("stage_prio_ring_out", nb_cons, sizeof(struct rte_ring *),
+                                                      self->socket_id);
+            if(!self->prio_ring_out){
+                return -ENOMEM;
+            }
+            for(int k=0; k<nb_cons; k++){
+                self->prio_ring_out[k] = to_main ? pl->prio_ring_out : pl->stages[i+1][k]->prio_ring_in;
+            }
+            self->nb_prio_ring_out = nb_cons;
+        }
+    }
+    MEILI_LOG_INFO("High priority class rings initialized");
+
+    return 0;
+}
+
+/* Flow state migration: each first stage instance gets one MP/SC ring on its node
+ * for the entries other instances send it on scale events. Only set up if the
+ * first stages, or any stage of a graph, keep flow state.
+ */
+static int pipeline_topo_flow_state(struct pipeline *pl){
+    int nb_stages = pl->conf.graph_mode ? pl->nb_pl_stages : 1;
+    struct pipeline_stage *self = NULL;
+    char ring_name[RTE_RING_NAMESIZE];
+    bool keep = false;
+
+    for(int i=0; i<nb_stages; i++){
+        keep |= pl->stages[i][0]->flow_state != NULL;
+    }
+    if(!keep){
+        return 0;
+    }
+
+    pl->flow_state_rings = pipeline_ring_array("pl_flow_state_rings", pl->nb_inst_per_pl_stage[0],
+                                               sizeof(struct rte_ring *), rte_socket_id());
+    if(!pl->flow_state_rings){
+        return -ENOMEM;
+    }
+    for(int j=0; j<pl->nb_inst_per_pl_stage[0]; j++){
+        self = pl->stages[0][j];
+        snprintf(ring_name, sizeof(ring_name), "flow_state_ring_%d", j);
+        pl->flow_state_rings[j] = rte_ring_create(ring_name, FLOW_STATE_RING_SIZE, self->socket_id, RING_F_SC_DEQ);
+        if(!pl->flow_state_rings[j]){
+            return -ENOMEM;
+        }
+        self->flow_state_ring = pl->flow_state_rings[j];
+    }
+    pl->flow_state_map = pl->flow_map;
+    MEILI_LOG_INFO("Flow state follows flows on scale events");
+
+    return 0;
+}
+
+/* NUMA node of the lcore pipeline_run() assigns to the n-th stage instance,
+ * the first worker lcores go to the dispatchers other than the main core and
+ * the egress lcore
+ */
+static int
+pipeline_stage_socket(struct pipeline *pl, int n)
+{
+    unsigned int lcore_id;
+
+    n += pl->conf.dispatchers - 1 + pl->conf.egress_lcore;
+
+    RTE_LCORE_FOREACH_WORKER(lcore_id) {
+        if (n-- == 0)
+            return rte_lcore_to_socket_id(lcore_id);
+    }
+
+    return SOCKET_ID_ANY;
+}
+
 int pipeline_init_safe(struct pipeline *pl){
     /* TODO optional: connect pipeline stages based on DAG, currently we connect them using very simple topo(fully connected topo) */
     
@@ -148,9 +821,7 @@ int pipeline_init_safe(struct pipeline *pl){
     enum pipeline_type *stage_types =NULL;
     int *nb_inst_per_pl_stage = NULL;
     struct pipeline_stage *self = NULL;
-    struct pipeline_stage *child = NULL;
-
-    char ring_name[64];
+    int socket_id;
 
     pl_conf *run_conf = &(pl->conf);
 
@@ -159,11 +830,31 @@ int pipeline_init_safe(struct pipeline *pl){
     pl->nb_pl_stage_inst = 0;
     
     pl->mbuf_pool = NULL;
+    memset(pl->stages, 0x00, sizeof(pl->stages));
+    pl->ring_in = NULL;
+    pl->ring_out = NULL;
+    pl->nb_ring_in = 0;
+    pl->nb_ring_out = 0;
+    pl->prio_ring_in = NULL;
+    pl->prio_ring_out = NULL;
+    pl->nb_prio_ring_in = 0;
+    memset(&pl->prio, 0x00, sizeof(pl->prio));
+    pl->ready = 0;
+    pl->dropped = 0;
+    pl->batch_budget = 0;
 
     pl->ts_start_offset = 0;
     pl->ts_end_offset = 0;
 
-    memset(&pl->seq_stage, 0x00, sizeof(struct pipeline_stage));
+    pl->dispatchers = NULL;
+    pl->nb_dispatchers = 0;
+    pl->egress_core_id = -1;
+    pl->egress_qid = 0;
+    pl->flow_map = NULL;
+    pl->flow_map_prev = NULL;
+    pl->flow_state_rings = NULL;
+    pl->flow_state_map = NULL;
+    pl->flow_state_gen = 0;
     memset(&pl->reorder_stage, 0x00, sizeof(struct pipeline_stage));
 
 
@@ -175,11 +866,17 @@ int pipeline_init_safe(struct pipeline *pl){
     /* ---------------control plane specified values------------------ */
     pl->nb_pl_stages = 1;
     pl->stage_types[0] = PL_MAIN;
-    pl->nb_inst_per_pl_stage[0] = run_conf->cores-1;
+    pl->nb_inst_per_pl_stage[0] = run_conf->cores - run_conf->dispatchers - run_conf->egress_lcore;
 
     nb_pl_stages = pl->nb_pl_stages;
     stage_types = pl->stage_types;
     nb_inst_per_pl_stage = pl->nb_inst_per_pl_stage;
+
+    /* the latency target covers the whole pipeline, split it evenly over the main core and the ring hops */
+    if(run_conf->adaptive_batch_us){
+        pl->batch_budget = (uint64_t)run_conf->adaptive_batch_us * rte_get_timer_hz() / 1000000 /
+                           (pipeline_nb_ring_stages(pl) + 1);
+    }
     
     
     /* Allocate space for mempool if using local run mode */
@@ -206,6 +903,15 @@ int pipeline_init_safe(struct pipeline *pl){
     if(nb_pl_stages > NB_PIPELINE_STAGE_MAX || nb_pl_stages < 0 ){
         return -EINVAL;
     }
+    /* in graph mode instance j of every stage shares the lcore of instance j of the head stage */
+    if(run_conf->graph_mode){
+        for(int i=1; i<nb_pl_stages; i++){
+            if(nb_inst_per_pl_stage[i] != nb_inst_per_pl_stage[0]){
+                MEILI_LOG_ERR("Graph mode needs the same number of instances for all stages");
+                return -EINVAL;
+            }
+        }
+    }
 
     /* Init each stage */
     for(int i=0; i<nb_pl_stages ; i++){
@@ -214,12 +920,25 @@ int pipeline_init_safe(struct pipeline *pl){
         || nb_inst_per_pl_stage[i] < 0){
             return -EINVAL;
         }
+        pl->stages[i] = rte_zmalloc("pipeline_stages", RTE_MAX(nb_inst_per_pl_stage[i], 1) * sizeof(struct pipeline_stage *), 0);
+        if(!pl->stages[i]){
+            return -ENOMEM;
+        }
         
         for(int j=0; j<nb_inst_per_pl_stage[i]; j++){
-             /* allocated space for each stage */
-            self = (struct pipeline_stage *)malloc(sizeof(struct pipeline_stage));
-            
+             /* allocated space for each stage, on the node of its worker and on cache lines of its own */
+            socket_id = pipeline_stage_socket(pl, run_conf->graph_mode ? j : pl->nb_pl_stage_inst + j);
+            self = rte_zmalloc_socket("pipeline_stage", sizeof(struct pipeline_stage), RTE_CACHE_LINE_SIZE, socket_id);
+            if(!self){
+                MEILI_LOG_ERR("Failed to allocate pipeline stage");
+                return -ENOMEM;
+            }
+
             self->pl = (void *)pl;
+            self->socket_id = socket_id;
+            self->stage_id = i;
+            self->inst_id = j;
+            meili_arena_init(&self->arena, socket_id);
 
             ret = pipeline_stage_init_safe(self, stage_types[i]);
 
@@ -233,11 +952,13 @@ int pipeline_init_safe(struct pipeline *pl){
             pl->stages[i][j] = self;
             
         }
-        pl->nb_pl_stage_inst += nb_inst_per_pl_stage[i];
+        /* co-located stages take no lcore of their own */
+        if(!run_conf->graph_mode || i == 0){
+            pl->nb_pl_stage_inst += nb_inst_per_pl_stage[i];
+        }
     }
 
     /* Init special stages: timestamping start/end, sequencing and reordering */
-    pl->seq_stage.type = PL_MAIN;
     pl->reorder_stage.type = PL_MAIN;
 
     ret = pkt_ts_init(&pl->ts_start_offset);
@@ -248,11 +969,43 @@ int pipeline_init_safe(struct pipeline *pl){
 	if(ret){
 		return -EINVAL;
 	}
+    if (pl->conf.latency_probe) {
+        ret = pkt_ts_probe_init(&pl->probe_flag);
+        if (ret)
+            return -EINVAL;
+    }
 
-	ret = seq_init(&pl->seq_stage);
-	if(ret){
-		return -EINVAL;
-	}
+    /* each dispatcher numbers its pkts on its own */
+    pl->dispatchers = rte_zmalloc("pipeline_dispatchers", run_conf->dispatchers * sizeof(struct pipeline_dispatcher),
+                                  RTE_CACHE_LINE_SIZE);
+    if(!pl->dispatchers){
+        return -ENOMEM;
+    }
+    pl->nb_dispatchers = run_conf->dispatchers;
+    /* all instances take flows until the first scale event */
+    if(run_conf->flow_affinity){
+        pl->flow_map = flow_map_create(pl->nb_inst_per_pl_stage[0]);
+        if(!pl->flow_map){
+            return -ENOMEM;
+        }
+    }
+    for(int d=0; d<pl->nb_dispatchers; d++){
+        pl->dispatchers[d].pl = pl;
+        pl->dispatchers[d].id = d;
+        pl->dispatchers[d].seq_stage.type = PL_MAIN;
+        pl->dispatchers[d].seq_stage.pl = pl;
+        ret = seq_init(&pl->dispatchers[d].seq_stage);
+        if(ret){
+            return -EINVAL;
+        }
+        if(run_conf->flow_affinity){
+            pl->dispatchers[d].fd = flow_dispatch_create(pl->nb_inst_per_pl_stage[0], run_conf->elephant_kpps,
+                                                         pl->flow_map);
+            if(!pl->dispatchers[d].fd){
+                return -ENOMEM;
+            }
+        }
+    }
 	ret = reorder_init(&pl->reorder_stage);
 	if(ret){
 		return -EINVAL;
@@ -263,159 +1016,56 @@ int pipeline_init_safe(struct pipeline *pl){
     /*----------------------------End of per-stage initialization----------------------------------------*/
 
     /*----------------------------Start of topology construction-----------------------------------------*/
-    /* Create head ring_in/tail ring_out for PL. Rings are shared. */
-    #ifdef SHARED_BUFFER
-    MEILI_LOG_INFO("Using shared ring buffer for inter-core communication");
-    pl->ring_in = rte_ring_create("head_ring_in", RING_SIZE, rte_socket_id(),RING_F_SP_ENQ | RING_F_MC_HTS_DEQ);
-    /* another mode of shared rte ring */
-    //pl->ring_in = rte_ring_create("head_ring_in", RING_SIZE, rte_socket_id(),RING_F_SP_ENQ | RING_F_MC_RTS_DEQ);
-    
-    if(!pl->ring_in){
-        return -ENOMEM;
+    ret = pipeline_topo_alloc(pl, run_conf->shared_buffer);
+    if(ret){
+        return ret;
     }
 
-    if(nb_pl_stages == 0){
-        /* no worker stages */
-        pl->ring_out = pl->ring_in;
+    /* Create head ring_in/tail ring_out for PL. Rings are shared. */
+    if(run_conf->shared_buffer){
+        MEILI_LOG_INFO("Using shared ring buffer for inter-core communication");
+        ret = pipeline_topo_shared(pl);
     }
     else{
-        pl->ring_out = rte_ring_create("tail_ring_out", RING_SIZE, rte_socket_id(),RING_F_MP_HTS_ENQ | RING_F_SC_DEQ);
-        //pl->ring_out = rte_ring_create("tail_ring_out", RING_SIZE, rte_socket_id(),RING_F_MP_RTS_ENQ | RING_F_SC_DEQ);
-        if(!pl->ring_out){
-            return -ENOMEM;
-        }
-        
-        /* connect head ring_in to first stages */
-        for(int j=0; j<nb_inst_per_pl_stage[0]; j++){
-            self = pl->stages[0][j];
-            self->ring_in = pl->ring_in;
-        }
-
-        /* connect tail ring_out to last stages */
-        for(int j=0; j<nb_inst_per_pl_stage[nb_pl_stages-1]; j++){
-            self = pl->stages[nb_pl_stages-1][j];
-            self->ring_out = pl->ring_out;
-        }
+        MEILI_LOG_INFO("Using separated ring buffer for inter-core communication");
+        ret = pipeline_topo_separate(pl);
+    }
+    if(ret){
+        return ret;
     }
 
-    #else
-    /* Create head ring_in/tail ring_out for PL. Rings are NOT shared. */
-    MEILI_LOG_INFO("Using separated ring buffer for inter-core communication");
-    if(nb_pl_stages == 0){
-        /* no worker stages */
-        pl->ring_in[0] = rte_ring_create("head_ring_in", RING_SIZE, rte_socket_id(),RING_F_SP_ENQ | RING_F_SC_DEQ);
-        if(!pl->ring_in[0]){
-            return -ENOMEM;
+    /* Separate rings for the high priority class, next to the bulk ones */
+    if(run_conf->prio && !run_conf->latency_mode){
+        ret = prio_init(&pl->prio, run_conf->prio);
+        if(ret){
+            return ret;
+        }
+        ret = pipeline_topo_prio(pl);
+        if(ret){
+            return ret;
         }
-        pl->ring_out[0] = pl->ring_in[0];
     }
-    else{
-        /* connect head ring_in to first stages */
+
+    /* Fuse instance j of all stages into the graph of the head stage */
+    if(run_conf->graph_mode && nb_pl_stages){
+        MEILI_LOG_INFO("Using graph mode, %d stage(s) per lcore", nb_pl_stages);
         for(int j=0; j<nb_inst_per_pl_stage[0]; j++){
-            snprintf(ring_name,64,"head_ring_in_%d", j);
-            pl->ring_in[j] = rte_ring_create(ring_name, RING_SIZE, rte_socket_id(),RING_F_SP_ENQ | RING_F_SC_DEQ);
-    
-            if(!pl->ring_in[j]){
-                return -ENOMEM;
-            }
             self = pl->stages[0][j];
-            self->ring_in[0] = pl->ring_in[j];
-            self->nb_ring_in++;
-        }
-
-        /* connect tail ring_out to last stages */
-        for(int j=0; j<nb_inst_per_pl_stage[nb_pl_stages-1]; j++){
-            snprintf(ring_name,64,"tail_ring_out_%d", j);
-            pl->ring_out[j] = rte_ring_create(ring_name, RING_SIZE, rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
-            if(!pl->ring_out[j]){
+            self->graph = graph_create(pl, j, self->socket_id);
+            if(!self->graph){
+                MEILI_LOG_ERR("Failed to create graph for instance %d", j);
                 return -ENOMEM;
             }
-            self = pl->stages[nb_pl_stages-1][j];
-            self->ring_out[0] = pl->ring_out[j];
-            self->nb_ring_out++;
         }
     }
-    #endif
-    MEILI_LOG_INFO("Main thread in_ring/out_ring initialized");
-    
-
-    /* For intermediatte stages, allocate ring_in/ring_out and connect */
-    #ifdef SHARED_BUFFER 
-    /* Shared rings. */
-
-    /* TODO(optional): add a field that record parent/child */
-
-    for(int i=0; i<nb_pl_stages-1 ; i++){
-        if(nb_inst_per_pl_stage[i] < nb_inst_per_pl_stage[i+1]){
-            for(int j=0; j<nb_inst_per_pl_stage[i]; j++){
-                self = pl->stages[i][j];
-
-                /* allocate space for ring_out */
-                self->ring_out = rte_ring_create("", RING_SIZE, rte_socket_id(),RING_F_SP_ENQ | RING_F_MC_HTS_DEQ);
-                //self->ring_out = rte_ring_create("", RING_SIZE, rte_socket_id(),RING_F_SP_ENQ | RING_F_MC_RTS_DEQ);
-                
-                /* could be used to test if shared ring of main thread is the bottleneck (by using seprate ring between workers only) */
-                //self->ring_out = rte_ring_create("", RING_SIZE, rte_socket_id(),RING_F_SP_ENQ | RING_SC_DEQ);
-                if (self->ring_out == NULL){
-                    return -ENOMEM;
-                }
-            }
-
-            for(int j=0; j<nb_inst_per_pl_stage[i+1]; j++){
-                self = pl->stages[i+1][j];
-                /* connect ring_in to previous ring_out */
-                self->ring_in = pl->stages[i][j%nb_inst_per_pl_stage[i]]->ring_out;
-            }
-        }
-        else{
-            for(int j=0; j<nb_inst_per_pl_stage[i+1]; j++){
-                self = pl->stages[i+1][j];
 
-                /* allocate space for ring_out */
-                self->ring_in = rte_ring_create("", RING_SIZE, rte_socket_id(),RING_F_MP_HTS_ENQ | RING_F_SC_DEQ);
-                //self->ring_in = rte_ring_create("", RING_SIZE, rte_socket_id(),RING_F_MP_RTS_ENQ | RING_F_SC_DEQ);
-
-                /* could be used to test if shared ring of main thread is the bottleneck (by using seprate ring between workers only) */
-                //self->ring_out = rte_ring_create("", RING_SIZE, rte_socket_id(),RING_F_SP_ENQ | RING_F_SC_DEQ);
-                if (self->ring_in == NULL){
-                    return -ENOMEM;
-                }
-            }
-
-            for(int j=0; j<nb_inst_per_pl_stage[i]; j++){
-                self = pl->stages[i][j];
-                /* connect ring_in to previous ring_out */
-                self->ring_out = pl->stages[i+1][j%nb_inst_per_pl_stage[i+1]]->ring_in;
-            }
-        }
-    }
-    
-    #else
-    /* Separate rings. */
-    /* Queues are all sp/sc, so we adopt fully connected topo for (n,m) */
-    /* TODO(optional): when assigning cores to workers, take into consideration the microarch, i.e., core 2 and core 3 worker should have connection.  */
-    /* create i+1 ring_in, and put these rings into i ring_out */
-    for(int i=0; i<nb_pl_stages-1 ; i++){
-
-        for(int j=0; j<nb_inst_per_pl_stage[i]; j++){
-            self = pl->stages[i][j];
-            for(int k=0; k<nb_inst_per_pl_stage[i+1]; k++){
-                child = pl->stages[i+1][k];
-                snprintf(ring_name,64,"inter_worker_ring_%d_%d_%d_%d", i, i+1, j, k);
-                //debug
-                MEILI_LOG_INFO("creating inter-stage buffer:%s",ring_name);
-                self->ring_out[self->nb_ring_out] = rte_ring_create(ring_name, RING_SIZE, rte_socket_id(),RING_F_SP_ENQ | RING_F_SC_DEQ);
-                if (self->ring_out == NULL){
-                    return -ENOMEM;
-                }
-                
-                child->ring_in[child->nb_ring_in] = self->ring_out[self->nb_ring_out];
-                self->nb_ring_out++;
-                child->nb_ring_in++;
-            }
+    /* Migration rings for per flow state, scale events only happen with flow affinity */
+    if(run_conf->flow_affinity && nb_pl_stages && nb_inst_per_pl_stage[0]){
+        ret = pipeline_topo_flow_state(pl);
+        if(ret){
+            return ret;
         }
     }
-    #endif
 
     /*----------------------------End of topology construction-----------------------------------------*/
 
@@ -423,23 +1073,15 @@ int pipeline_init_safe(struct pipeline *pl){
     MEILI_LOG_INFO("Pipeline stages initialized");
     MEILI_LOG_INFO("Total %d stage(s)", nb_pl_stages);
     printf("%8s %16s %16s %16s %16s\n","Stage","Type","# Instance","# RING_IN","# RING_OUT");
-    #ifdef SHARED_BUFFER
-    for(int i=0; i<nb_pl_stages; i++){
-        self = pl->stages[i][0];
-        printf("%8d ", i);
-        PRINT_STAGE_TYPE(stage_types[i]);
-        printf("%16d %16d %16d\n", nb_inst_per_pl_stage[i], 1, 1);
-        
-    }
-    #else
     for(int i=0; i<nb_pl_stages; i++){
         self = pl->stages[i][0];
         printf("%8d ", i);
         PRINT_STAGE_TYPE(stage_types[i]);
-        printf("%16d %16d %16d\n", nb_inst_per_pl_stage[i], 1, 1);
+        printf("%16d %16d %16d\n", nb_inst_per_pl_stage[i],
+                nb_inst_per_pl_stage[i] ? self->nb_ring_in : 0,
+                nb_inst_per_pl_stage[i] ? self->nb_ring_out : 0);
         
     }
-    #endif
 
     return 0;
 }
@@ -482,14 +1124,10 @@ int pipeline_stage_init_safe(struct pipeline_stage *self, enum pipeline_type pp_
 
     /* general fields a pipeline stage must have */
     self->type = pp_type;
-    self->batch_size = DEFAULT_BATCH_SIZE;
-    #ifdef SHARED_BUFFER
-    self->ring_in = NULL;
-    self->ring_out = NULL;
-    #else
+    self->batch_size = ((struct pipeline *)self->pl)->conf.stage_batch_size;
+    self->prefetch = ((struct pipeline *)self->pl)->conf.prefetch_dist;
     self->nb_ring_in = 0;
     self->nb_ring_out = 0;
-    #endif
 
     /* register functions for this stage */
     pipeline_stage_register_safe(self, pp_type);
@@ -516,9 +1154,19 @@ int pipeline_stage_free_safe(struct pipeline_stage *self){
         return -EINVAL;
     }
 
+    /* app state allocated with meili_malloc() goes at once, the flow state table first */
+    meili_flow_state_free(self);
+    meili_arena_release(&self->arena);
+    graph_free(self->graph);
+    rte_free(self->ring_in);
+    rte_free(self->ring_out);
+    rte_free(self->ring_out_ready);
+    rte_free(self->ring_out_bit);
+    rte_free(self->prio_ring_out);
+
     free(self->funcs);
-    /* we assume all pp stages are allocated using malloc */
-    free(self);
+    /* pp stages are allocated with rte_zmalloc_socket() in pipeline_init_safe() */
+    rte_free(self);
 
     // if(self->ring_in){
     //     rte_ring_free(self->ring_in);
@@ -549,10 +1197,22 @@ int pipeline_free(struct pipeline *pl){
             //     return ret;
             // }
         }
+        rte_free(pl->stages[i]);
+        pl->stages[i] = NULL;
     }
+    rte_free(pl->ring_in);
+    rte_free(pl->ring_out);
+    rte_free(pl->prio_ring_in);
+    rte_free(pl->flow_state_rings);
 
     /* free stage-specific states */
-    seq_free(&pl->seq_stage);
+    for(int d=0; d<pl->nb_dispatchers; d++){
+        seq_free(&pl->dispatchers[d].seq_stage);
+        flow_dispatch_free(pl->dispatchers[d].fd);
+    }
+    rte_free(pl->dispatchers);
+    flow_map_free(pl->flow_map);
+    flow_map_free(pl->flow_map_prev);
     reorder_free(&pl->reorder_stage);
 
     /* free rings*/
@@ -585,6 +1245,26 @@ launch_worker(void *args)
 }
 
 
+static int
+launch_dispatcher(void *args)
+{
+	struct pipeline_dispatcher *disp = args;
+
+    MEILI_LOG_INFO("dispatcher %d on socket %d launched", disp->id, rte_socket_id());
+
+	return run_mode_dispatch(disp);
+}
+
+static int
+launch_egress(void *args)
+{
+	struct pipeline *pl = args;
+
+    MEILI_LOG_INFO("egress on socket %d launched", rte_socket_id());
+
+	return run_mode_egress(pl);
+}
+
 int pipeline_post_search(struct pipeline *pl){
     struct pipeline_stage *seq_stage;
 	struct pipeline_stage *reorder_stage = &pl->reorder_stage;
@@ -598,17 +1278,13 @@ int pipeline_post_search(struct pipeline *pl){
 	int nb_deq;
 
     int ring_out_index = 0;
-    int nb_ring_out = pl->nb_inst_per_pl_stage[pl->nb_pl_stages-1];
+    int nb_ring_out = pl->nb_ring_out;
 
     /* flush all packets from the pipeline */
     while(batch_cnt != 0){
         //test
-        #ifdef SHARED_BUFFER
-        batch_cnt = rte_ring_dequeue_burst(pl->ring_out,(void *)mbuf_out, batch_size, NULL);
-        #else
         batch_cnt = rte_ring_dequeue_burst(pl->ring_out[ring_out_index],(void *)mbuf_out, batch_size, NULL);
         ring_out_index = (ring_out_index+1)%nb_ring_out;
-        #endif
 
         // test
 	    //reorder_exec(reorder_stage, mbuf, batch_cnt, mbuf_out, &nb_deq);
@@ -625,10 +1301,71 @@ int pipeline_post_search(struct pipeline *pl){
             }
         }
     }
+
+    /* and the high priority class */
+    while(pl->prio_ring_out
+          && (batch_cnt = rte_ring_dequeue_burst(pl->prio_ring_out, (void *)mbuf_out, MAX_PKTS_BURST, NULL))){
+        rte_pktmbuf_free_bulk(mbuf_out, batch_cnt);
+    }
     
     return 0;
 }
 
+int pipeline_scale(struct pipeline *pl, uint32_t nb_active){
+    struct flow_map *map, *old;
+    struct flow_dispatch *fd;
+
+    if(!pl->flow_map){
+        return -ENOTSUP;
+    }
+    /* dispatchers have to be polling to let go of the old maps */
+    if(!pl->conf.running){
+        return -EAGAIN;
+    }
+    if(!nb_active || nb_active > (uint32_t)pl->nb_inst_per_pl_stage[0]){
+        return -EINVAL;
+    }
+    if(nb_active == pl->flow_map->nb_active){
+        return 0;
+    }
+    /* flow state is sent by the map it was queued for, one migration at a time */
+    if(pl->flow_state_rings){
+        for(int j=0; j<pl->nb_inst_per_pl_stage[0]; j++){
+            if(__atomic_load_n(&pl->stages[0][j]->flow_gen_done, __ATOMIC_ACQUIRE) != pl->flow_state_gen){
+                return -EBUSY;
+            }
+        }
+    }
+
+    map = flow_map_create(nb_active);
+    if(!map){
+        return -ENOMEM;
+    }
+    old = pl->flow_map;
+    map->gen = old->gen + 1;
+    __atomic_store_n(&pl->flow_map, map, __ATOMIC_RELEASE);
+
+    /* dispatchers pick the map up on their next poll, after that they only keep the one before as prev */
+    for(int d=0; d<pl->nb_dispatchers; d++){
+        fd = pl->dispatchers[d].fd;
+        while(__atomic_load_n(&fd->map, __ATOMIC_ACQUIRE) != map && pl->conf.running && !force_quit){
+            rte_delay_us_sleep(10);
+        }
+    }
+    flow_map_free(pl->flow_map_prev);
+    pl->flow_map_prev = old;
+
+    /* no pkt of a moved flow reaches its old instance from now on, the instances send its state on */
+    if(pl->flow_state_rings){
+        pl->flow_state_map = map;
+        __atomic_store_n(&pl->flow_state_gen, map->gen, __ATOMIC_RELEASE);
+    }
+
+    MEILI_LOG_INFO("Flows mapped to %u of %d first stage instances", nb_active, pl->nb_inst_per_pl_stage[0]);
+
+    return 0;
+}
+
 int pipeline_run(struct pipeline *pl){
     unsigned int lcore_id;
     /* main core takes 0 */
@@ -649,25 +1386,67 @@ int pipeline_run(struct pipeline *pl){
 
     int i=0;
     int j=0;
+    /* dispatcher 0 is the main core */
+    int d=1;
+    struct pipeline_dispatcher *disp = NULL;
 
     
     // launch workers and main core
     MEILI_LOG_INFO("Total cores: %d", conf->cores);
     MEILI_LOG_INFO("Total stage instances: %d", pl->nb_pl_stage_inst);
-    if (pl->nb_pl_stage_inst >= conf->cores){
+    MEILI_LOG_INFO("Total dispatchers: %d", pl->nb_dispatchers);
+    if (pl->nb_pl_stage_inst + pl->nb_dispatchers + conf->egress_lcore > conf->cores){
         MEILI_LOG_ERR("Not enough cores for workers");
         return -EINVAL; 
     }
 
     run_conf->running = true;
+    trace_record(TRACE_EV_MODE, TRACE_MODE_RUN_START, conf->run_mode, conf->input_mode);
 
     // allocate core for each pipeline stage
     // lcore_id - the id of assigned lcore
     // worker_qid - the id of stats recording
     worker_qid = 1;
     
+    /* graph mode launches the head stages only, the others run inside their graphs */
+    if(conf->graph_mode){
+        nb_pl_stages = RTE_MIN(nb_pl_stages, 1);
+    }
+
     RTE_LCORE_FOREACH_WORKER(lcore_id) {
 
+        /* the first worker lcores receive pkts next to the main core */
+        if(d < pl->nb_dispatchers){
+            disp = &pl->dispatchers[d++];
+            stats->rm_stats[worker_qid].lcore_id = lcore_id;
+            stats->rm_stats[worker_qid].self = &disp->seq_stage;
+            disp->core_id = lcore_id;
+            disp->worker_qid = worker_qid++;
+            MEILI_LOG_INFO("starting dispatcher %d on core %d, worker_qid %d", disp->id, lcore_id, disp->worker_qid);
+            ret = rte_eal_remote_launch(launch_dispatcher, disp, lcore_id);
+            if(ret){
+                MEILI_LOG_ERR("Failed to launch dispatcher %d on core %d", disp->id, lcore_id);
+                goto post_run;
+            }
+            continue;
+        }
+
+        /* followed by the lcore draining the pipeline */
+        if(conf->egress_lcore && pl->egress_core_id < 0){
+            stats->rm_stats[worker_qid].lcore_id = lcore_id;
+            stats->rm_stats[worker_qid].self = &pl->reorder_stage;
+            pl->egress_core_id = lcore_id;
+            pl->egress_qid = worker_qid++;
+            MEILI_LOG_INFO("starting egress on core %d, worker_qid %d", lcore_id, pl->egress_qid);
+            ret = rte_eal_remote_launch(launch_egress, pl, lcore_id);
+            if(ret){
+                MEILI_LOG_ERR("Failed to launch egress on core %d", lcore_id);
+                pl->egress_core_id = -1;
+                goto post_run;
+            }
+            continue;
+        }
+
         if(i >= nb_pl_stages){
             printf("Lcores more than # of PL stages\n");
             break;
@@ -680,17 +1459,24 @@ int pipeline_run(struct pipeline *pl){
 
 		self->core_id = lcore_id;
         self->worker_qid = worker_qid;
+        if(conf->graph_mode){
+            for(int k=1; k<pl->nb_pl_stages; k++){
+                pl->stages[k][j]->core_id = lcore_id;
+                pl->stages[k][j]->worker_qid = worker_qid;
+            }
+        }
 
 
         worker_qid++;
-        #ifndef BASELINE_MODE
-        MEILI_LOG_INFO("starting core %d, worker_qid %d", lcore_id, self->worker_qid);
-		ret = rte_eal_remote_launch(launch_worker, self, lcore_id);
-        if(ret){
-            MEILI_LOG_ERR("Failed to launch core %d, worker_qid %d", lcore_id, self->worker_qid);
-            goto post_run;
+        /* baseline mode processes everything on the main core */
+        if(conf->run_mode != RUN_MODE_BASELINE){
+            MEILI_LOG_INFO("starting core %d, worker_qid %d", lcore_id, self->worker_qid);
+            ret = rte_eal_remote_launch(launch_worker, self, lcore_id);
+            if(ret){
+                MEILI_LOG_ERR("Failed to launch core %d, worker_qid %d", lcore_id, self->worker_qid);
+                goto post_run;
+            }
         }
-        #endif
 
         /* launch next pl stage */
         j++;
@@ -704,7 +1490,10 @@ int pipeline_run(struct pipeline *pl){
 	/* Start processing on the main lcore. */
 	/* traffic is always received on main core and can be split to other cores */
 
-    stats->rm_stats[0].self = &pl->seq_stage;
+    disp = &pl->dispatchers[0];
+    disp->core_id = rte_get_main_lcore();
+    disp->worker_qid = 0;
+    stats->rm_stats[0].self = &disp->seq_stage;
 
     MEILI_LOG_INFO("Starting on main core...");
     ret = run_mode_launch(pl);
@@ -714,12 +1503,18 @@ int pipeline_run(struct pipeline *pl){
 post_run:
     /* set running flag to false to notice all workers of end of run */
     run_conf->running = false;
+    trace_record(TRACE_EV_MODE, TRACE_MODE_RUN_STOP, force_quit, 0);
 
 	if (ret) {
         MEILI_LOG_ERR("Failure in run mode");
 	}
 
     //printf("main thread running=%d, finished running\n",run_conf->running);
+
+    /* the egress lcore is the consumer of the rings pipeline_post_search() drains */
+    if(pl->egress_core_id >= 0 && rte_eal_wait_lcore(pl->egress_core_id)){
+        MEILI_LOG_ERR("Egress lcore %d returned a runtime error", pl->egress_core_id);
+    }
     
 	/* Wait on results from any ops that are in flight. */
 	pipeline_post_search(pl);
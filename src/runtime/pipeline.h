@@ -4,6 +4,8 @@
 #define _INCLUDE_PIPELINE_H
 
 #include <rte_mbuf.h>
+#include <rte_prefetch.h>
+#include <rte_ring.h>
 #include <sys/socket.h>
 #include <resolv.h>
 #include <sys/epoll.h>
@@ -12,6 +14,9 @@
 #include "../lib/conf/meili_conf.h"
 
 #include "../lib/net/meili_pkt.h"
+#include "../lib/mem/meili_mem.h"
+#include "../utils/prio/prio.h"
+#include "../utils/flow_dispatch/flow_dispatch.h"
 
 
 #define MEILI_MAX_EPOLL_EVENTS 1024
@@ -26,7 +31,6 @@
 
 
 /* ring and batch macros */
-#define NB_MAX_RING 16
 #define MAX_PKTS_BURST 8192
 #define RING_SIZE 8192
 
@@ -36,7 +40,7 @@
 
 /* pl stage macros */
 #define NB_PIPELINE_STAGE_MAX 8
-#define NB_INSTANCE_PER_PIPELINE_STAGE_MAX 8
+#define NB_INSTANCE_PER_PIPELINE_STAGE_MAX RTE_MAX_LCORE
 
 /* error message macros */
 #define ERR_STR_SIZE 50
@@ -44,6 +48,15 @@
 /* pl topo */
 #define CONFIG_BUF_LEN 512
 #define PL_CONFIG_PATH "./src/pl.conf"
+/* a consumer tracks its input rings with one bit each in a 64 bit ready mask */
+#define PL_MAX_FAN_IN 64
+/* --fan-in 0 (default) groups producers so that a consumer polls at most this many rings */
+#define PL_FAN_IN_AUTO 8
+/* pkts a stage prefetches ahead of the one it processes (--prefetch) */
+#define PL_PREFETCH_DIST 4
+#define PL_PREFETCH_DIST_MAX 32
+/* --prefetch not given, 0 turns prefetching off */
+#define PL_PREFETCH_DIST_UNSET UINT32_MAX
 
 
 enum pipeline_type {
@@ -145,53 +158,114 @@ enum pipeline_type {
                                     else if(strcmp(x,"PL_MAIN")==0)                 {*y = PL_MAIN;}\
                                     else{*y = -1;}
 
+struct graph;
+
+/* Layout: the fields read by the worker on every burst come first and start
+ * on their own cache line, configuration and control plane fields follow from
+ * the next cache line on. Instances are allocated one by one on the NUMA node
+ * of their lcore (see pipeline_init_safe), so two workers never share a line.
+ */
 struct pipeline_stage{
-    void *apis;
+    /* ---------------- hot: per burst ---------------- */
+    void *state;                /* stage private state */
+    void *pl;                   /* parent pipeline structure */
+    int batch_size;             /* stage batch size */
+    int prefetch;               /* prefetch distance in pkts, 0 = off, stage init may change it */
+    int worker_qid;             /* stage qid */
+    int nb_ring_in;
+    int nb_ring_out;
+
+    /* i/o buffers sized by the topology, a single shared ring at index 0 in shared buffer mode */
+    struct rte_ring **ring_in;
+    struct rte_ring **ring_out;
+    /* ready mask of the consumer of each ring_out and the bit of that ring in it,
+     * NULL for consumers with a single input ring
+     */
+    uint64_t **ring_out_ready;
+    uint64_t *ring_out_bit;
+
+    /* high priority class (--prio): one MP/SC ring per consumer, polled first, NULL if off */
+    struct rte_ring *prio_ring_in;
+    struct rte_ring **prio_ring_out;
+    int nb_prio_ring_out;
+
+    /* ---------------- cold: setup and control ---------------- */
+    RTE_MARKER cold __rte_cache_aligned;
 
     enum pipeline_type type;    /* stage workload type */
     //bool push_batch;
-    void *state;                /* stage private state */
     int core_id;                /* stage core id */
-    int worker_qid;             /* stage qid */
-    int batch_size;             /* stage batch size */
+    int socket_id;              /* NUMA node of the stage core */
+    int stage_id;               /* instance inst_id of stage stage_id */
+    int inst_id;
+
+    /* stage state memory, see meili_malloc() */
+    struct meili_arena arena;
+
+    /* per flow state, see meili_flow_state_decl(), NULL if none */
+    struct meili_flow_state *flow_state;
+
+    /* flow state migration on first stages, see meili_flow_state.h: ring of the entries sent
+     * to this instance (NULL if off), input ring tails marking the pkts queued before the
+     * last scale event, the event in progress and the last one done, read by the dispatchers
+     */
+    struct rte_ring *flow_state_ring;
+    uint32_t flow_mark[2];
+    uint32_t flow_gen;
+    uint32_t flow_gen_done;
+
+    /* functions for this pipeline stage, the worker keeps its own copy of exec */
+    struct pipeline_func *funcs;/* stage operator functions */
 
-    #ifdef SHARED_BUFFER 
-    /* i/o buffer */
-    struct rte_ring *ring_in;   /* stage input ring */
-	struct rte_ring *ring_out;  /* stage output ring */
-    #else
-    /* i/o buffer for first input and final output */
-    struct rte_ring *ring_in[NB_MAX_RING];
-	struct rte_ring *ring_out[NB_MAX_RING];
-    int nb_ring_in;
-    int nb_ring_out;
-    #endif
+    void *apis;
 
     /* socket processing */
     int sockfd;
     int epfd;
-    struct epoll_event events[MEILI_MAX_EPOLL_EVENTS];
 
     /* timestamping for this stage */
     int ts_start_offset;
     int ts_end_offset;
 
-    /* functions for this pipeline stage */
-    struct pipeline_func *funcs;/* stage operator functions */
-
     /* regex related confs */
     void *regex_conf;
 
-    /* parent */
+    /* graph of the stages co-located with this one in graph mode, head stages only */
+    struct graph *graph;
+
+    /* ---------------- written by the producers ---------------- */
+    RTE_MARKER shared __rte_cache_aligned;
+    uint64_t ready;             /* ring_in holding pkts, used if nb_ring_in > 1 */
+
+} __rte_cache_aligned;
+
+
+/* Ingress dispatcher (--dispatchers): polls one rx queue of each port and feeds
+ * the first stages. Dispatcher 0 is the main core, which also owns egress, the
+ * others run on the first worker lcores. Each numbers its pkts in a sequence
+ * space of its own, so pkts of a flow, kept on one rx queue by RSS, keep their
+ * order without dispatchers sharing a counter.
+ */
+struct pipeline_dispatcher{
     void *pl;                   /* parent pipeline structure */
+    int id;                     /* also the rx queue it polls */
+    int core_id;
+    int worker_qid;             /* stats */
 
-};
+    /* sampled latency in throughput mode, see --latency-probe */
+    uint32_t probe_countdown;
 
+    /* sequencing of the pkts received by this dispatcher */
+    struct pipeline_stage seq_stage;
+
+    /* per flow dispatch to the first stages with --flow-affinity, else NULL */
+    struct flow_dispatch *fd;
+} __rte_cache_aligned;
 
 /* pipeline */
 struct pipeline{
     /* fields for pipeline information */
-    struct pipeline_stage *stages[NB_PIPELINE_STAGE_MAX][NB_INSTANCE_PER_PIPELINE_STAGE_MAX]; 
+    struct pipeline_stage **stages[NB_PIPELINE_STAGE_MAX];
     enum pipeline_type stage_types[NB_PIPELINE_STAGE_MAX];
     int nb_inst_per_pl_stage[NB_PIPELINE_STAGE_MAX];
     int nb_pl_stages;
@@ -200,15 +274,17 @@ struct pipeline{
     /* mempool for storing preloaded mbufs in preloaded mode */
     struct rte_mempool *mbuf_pool;
 
-    #ifdef SHARED_BUFFER 
-    // /* i/o buffer for first input and final output */
-    struct rte_ring *ring_in;
-	struct rte_ring *ring_out;
-    #else
     /* i/o buffer for first input and final output */
-    struct rte_ring *ring_in[NB_MAX_RING];
-	struct rte_ring *ring_out[NB_MAX_RING];
-    #endif
+    struct rte_ring **ring_in;
+    struct rte_ring **ring_out;
+    int nb_ring_in;
+    int nb_ring_out;
+
+    /* high priority class rings to the first stage and from the last one, see --prio */
+    struct rte_ring **prio_ring_in;
+    struct rte_ring *prio_ring_out;
+    int nb_prio_ring_in;
+    struct prio_classifier prio;
 
     /* run config read from command line options */
     pl_conf conf;
@@ -217,12 +293,177 @@ struct pipeline{
     int ts_start_offset;
     int ts_end_offset;
 
-    /* sepcial stages: sequencing and reordering */
-    struct pipeline_stage seq_stage;
+    /* sampled latency in throughput mode, see --latency-probe */
+    uint64_t probe_flag;
+
+    /* cycles a burst may take on each hop with --adaptive-batch, 0 = no bound */
+    uint64_t batch_budget;
+
+    /* ingress lcores, dispatchers[0] is the main core */
+    struct pipeline_dispatcher *dispatchers;
+    int nb_dispatchers;
+
+    /* flows to first stage instances with --flow-affinity, written by the control thread,
+     * flow_map_prev is the map before, still used by dispatchers until the next scale event
+     */
+    struct flow_map *flow_map;
+    struct flow_map *flow_map_prev;
+
+    /* flow state migration: one MP/SC ring of entries per first stage instance, NULL if no
+     * stage keeps flow state, and the map all dispatchers switched to, whose gen follows it
+     */
+    struct rte_ring **flow_state_rings;
+    struct flow_map *flow_state_map;
+    uint32_t flow_state_gen;
+
+    /* lcore and stats queue draining the pipeline with --egress-lcore, else the main core and 0 */
+    int egress_core_id;
+    int egress_qid;
+
+    /* sepcial stages: reordering, sequencing is done by each dispatcher */
     struct pipeline_stage reorder_stage;
 
+    /* ring_out holding pkts, written by the last stage, used if nb_ring_out > 1 */
+    uint64_t ready __rte_cache_aligned;
+
+    /* pkts dropped by a graph (MEILI_DROP), taken by the main core as done */
+    uint64_t dropped __rte_cache_aligned;
+
 };
 
+/* Ready masks: a producer sets the bit of a ring after enqueuing to it, the
+ * consumer only visits rings with their bit set and clears it once it sees
+ * the ring drained. Both sides fence between the ring and the mask, so a ring
+ * is never left non-empty with its bit clear.
+ */
+static __rte_always_inline void
+pipeline_ready_set(uint64_t *ready, uint64_t bit)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    /* skip the write while the consumer has not cleared it, it is the contended line */
+    if (!(__atomic_load_n(ready, __ATOMIC_RELAXED) & bit))
+        __atomic_fetch_or(ready, bit, __ATOMIC_RELEASE);
+}
+
+static __rte_always_inline void
+pipeline_ready_clear(uint64_t *ready, uint64_t bit, struct rte_ring *r)
+{
+    __atomic_fetch_and(ready, ~bit, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    /* a producer enqueued before seeing the clear */
+    if (!rte_ring_empty(r))
+        __atomic_fetch_or(ready, bit, __ATOMIC_RELAXED);
+}
+
+/* Dequeue from the next ring with pkts at or after *index and advance it. */
+static __rte_always_inline unsigned int
+pipeline_dequeue_ready(struct rte_ring **rings, int nb_rings, uint64_t *ready, int *index, void **objs, unsigned int n)
+{
+    uint64_t mask, hi;
+    unsigned int nb;
+    int i = *index;
+
+    if (nb_rings > 1) {
+        mask = __atomic_load_n(ready, __ATOMIC_ACQUIRE);
+        if (!mask)
+            return 0;
+        hi = mask & (~0ULL << i);
+        i = __builtin_ctzll(hi ? hi : mask);
+    }
+
+    nb = rte_ring_dequeue_burst(rings[i], objs, n, NULL);
+    if (nb_rings > 1 && nb < n)
+        pipeline_ready_clear(ready, 1ULL << i, rings[i]);
+    *index = (i + 1) % nb_rings;
+
+    return nb;
+}
+
+/* Zero-copy variant of pipeline_dequeue_ready(): the pkts stay in the slots of
+ * the ring and zcd points at them, in two pieces where they wrap around the end
+ * of the ring. Stages process them in place, then release the slots with
+ * pipeline_dequeue_ready_zc_finish(), which is only needed if pkts were found.
+ * Only for single consumer rings: an HTS ring would accept it too, but holds
+ * off its other consumers until the finish.
+ */
+static __rte_always_inline unsigned int
+pipeline_dequeue_ready_zc_start(struct rte_ring **rings, int nb_rings, uint64_t *ready, int *index,
+                                struct rte_ring_zc_data *zcd, unsigned int n)
+{
+    uint64_t mask, hi;
+    unsigned int nb;
+    int i = *index;
+
+    if (nb_rings > 1) {
+        mask = __atomic_load_n(ready, __ATOMIC_ACQUIRE);
+        if (!mask)
+            return 0;
+        hi = mask & (~0ULL << i);
+        i = __builtin_ctzll(hi ? hi : mask);
+    }
+
+    nb = rte_ring_dequeue_zc_burst_start(rings[i], n, zcd, NULL);
+    if (!nb) {
+        if (nb_rings > 1)
+            pipeline_ready_clear(ready, 1ULL << i, rings[i]);
+        *index = (i + 1) % nb_rings;
+        return 0;
+    }
+    /* finish picks the ring up from here */
+    *index = i;
+
+    return nb;
+}
+
+static __rte_always_inline void
+pipeline_dequeue_ready_zc_finish(struct rte_ring **rings, int nb_rings, uint64_t *ready, int *index,
+                                 unsigned int nb, unsigned int n)
+{
+    int i = *index;
+
+    rte_ring_dequeue_zc_finish(rings[i], nb);
+    if (nb_rings > 1 && nb < n)
+        pipeline_ready_clear(ready, 1ULL << i, rings[i]);
+    *index = (i + 1) % nb_rings;
+}
+
+/* Software pipelining of a burst: while pkt i is processed, the first data
+ * cache lines of pkt i + dist, whose mbuf was prefetched dist pkts ago, and the
+ * mbuf of pkt i + 2 * dist are on their way. Each pkt then finds its mbuf and
+ * headers in cache instead of paying two DRAM misses in a row.
+ */
+static __rte_always_inline void
+pipeline_prefetch_data(struct rte_mbuf *m)
+{
+    char *data = rte_pktmbuf_mtod(m, char *);
+
+    rte_prefetch0(data);
+    rte_prefetch0(data + RTE_CACHE_LINE_SIZE);
+}
+
+/* Warm up the first pkts of a burst before pipeline_prefetch_ahead() takes over. */
+static __rte_always_inline void
+pipeline_prefetch_start(struct rte_mbuf **pkts, uint32_t nb, uint32_t dist)
+{
+    uint32_t i;
+
+    for (i = 0; i < RTE_MIN(2 * dist, nb); i++)
+        rte_prefetch0(pkts[i]);
+    for (i = 0; i < RTE_MIN(dist, nb); i++)
+        pipeline_prefetch_data(pkts[i]);
+}
+
+/* Call before processing pkt i of a burst started with pipeline_prefetch_start(). */
+static __rte_always_inline void
+pipeline_prefetch_ahead(struct rte_mbuf **pkts, uint32_t i, uint32_t nb, uint32_t dist)
+{
+    if (!dist)
+        return;
+    if (i + 2 * dist < nb)
+        rte_prefetch0(pkts[i + 2 * dist]);
+    if (i + dist < nb)
+        pipeline_prefetch_data(pkts[i + dist]);
+}
 
 /* Function pointers each pipeline stage should implement. 
    1. pipeline_stage_exec: process total number of nb_enq mbufs in mbuf, and store the number of mbufs in *nb_deq, and corresponding mbufs in *mbuf_out.
@@ -231,6 +472,16 @@ struct pipeline{
 
 */
 
+/* Return values of pipeline_stage_exec. Only graph mode branches on them,
+ * otherwise every pkt goes on to the next stage.
+ */
+enum meili_verdict {
+    MEILI_PASS,         /* next stage */
+    MEILI_DROP,         /* free the pkt */
+    MEILI_BYPASS,       /* skip the remaining stages */
+    MEILI_NB_VERDICTS
+};
+
 typedef struct pipeline_func {
     int (*pipeline_stage_init)(struct pipeline_stage *self);
     int (*pipeline_stage_free)(struct pipeline_stage *self);
@@ -286,6 +537,8 @@ int pipeline_init_safe(struct pipeline *pl);
 // int pipeline_init_safe(struct pipeline *pl, char *config_path);
 int pipeline_free(struct pipeline *pl);
 int pipeline_run(struct pipeline *pl);
+/* Map flows to the first nb_active instances of the first stage (--flow-affinity), called by the control thread. */
+int pipeline_scale(struct pipeline *pl, uint32_t nb_active);
 
 
 
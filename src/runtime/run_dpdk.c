@@ -23,6 +23,7 @@
 #include <unistd.h>
 #include "run_mode.h"
 #include "pipeline.h"
+#include "batch_ctl.h"
 
 #include "../utils/input_mode/dpdk_live_shared.h"
 #include "../utils/utils.h"
@@ -31,6 +32,8 @@
 #include "../packet_ordering/packet_ordering.h"
 #include "../packet_timestamping/packet_timestamping.h"
 #include "../utils/rte_reorder/rte_reorder.h"
+#include "../utils/rate_limit/rate_limit.h"
+#include "../utils/trace/trace.h"
 
 static uint16_t primary_port_id;
 static uint16_t second_port_id;
@@ -71,103 +74,19 @@ update_addr(struct rte_mbuf *m, unsigned dest_portid)
 
 }
 
-#ifdef MEILI_MODE
+/* Variant flags of the main loop. They are fixed once at registration so each
+ * variant is compiled with only the branches of its run mode. */
+#define RUN_F_LATENCY		(1 << 0)	/* per pkt latency measurement mode */
+#define RUN_F_ONLY_MAIN		(1 << 1)	/* only running main loop without enqueue/dequeue */
+#define RUN_F_REMOTE_TX		(1 << 2)	/* direct all traffic to remote pipelines after processing them locally */
+#define RUN_F_RATE_LIMIT	(1 << 3)	/* throughput mode with token bucket rate limit on */
+#define RUN_F_DISPATCH		(1 << 4)	/* ingress only, another lcore drains the pipeline */
+
+/* Look up rx/tx ports, the second port is for sending traffic out of the pipeline. */
 static int
-run_dpdk(struct pipeline *pl)
+run_dpdk_get_ports(pl_conf *run_conf, uint16_t *cur_rx, uint16_t *cur_tx)
 {
-	pl_conf *run_conf = &pl->conf;
-	/* always run on main core */
-	int qid = 0;
-	const uint32_t max_duration = run_conf->input_duration;
-	uint32_t batch_size = run_conf->input_batches;
-	uint32_t batch_size_in = 0;
-	uint32_t batch_size_out = 0;
-	int batch_cnt = 0;
-	int batch_cnt_enq = 0;
-	int batch_cnt_wait_on_enq = 0;
-	int batch_cnt_wait_on_deq = 0; /* used for throughput and latency mode. */
-	int batch_cnt_tot_enq = 0;
-	int batch_cnt_deq = 0;
-	int batch_cnt_tot_deq = 0;
-	int nb_out_ring_remain= 0;
-	rb_stats_t *stats = run_conf->stats;
-	run_mode_stats_t *rm_stats = &stats->rm_stats[qid];
-	// TODO: rename regex_stats_t to other names
-	//regex_stats_t *regex_stats = &stats->regex_stats[qid];
-
-	/* for packet transmission */	
-	uint16_t cur_rx, cur_tx, tx_port_id, rx_port_id;
-	const unsigned char *pkt;
-	pkt_stats_t *pkt_stats;
-	dpdk_egress_t *dpdk_tx;
-	bool dual_port;
-
-	/* time keeping */
-	uint64_t prev_cycles;
-	uint64_t prev_cycles_debug = 0;
-	uint64_t max_cycles;
-	uint64_t cycles;
-	double run_time;
-	uint64_t start;
-	double rate = 0;
-
-	bool main_lcore;
-	
 	int ret;
-	int flag = 0;
-
-	// for baseline implementation, each stage can only use one core 
-	/* special pipeline stages(have already been init in pipeline_init) */
-	struct pipeline_stage *seq_stage = &pl->seq_stage;
-	struct pipeline_stage *reorder_stage = &pl->reorder_stage;
-
-	struct rte_mbuf *mbuf_in[MAX_PKTS_BURST];
-	struct rte_mbuf *mbuf[MAX_PKTS_BURST];
-	// debug for not reordering 
-	//struct rte_mbuf *mbuf_out[MAX_PKTS_BURST];
-	struct rte_mbuf **mbuf_out;
-	int nb_enq;
-	int to_enq;
-	int tot_enq;
-
-	int nb_deq_reorder;
-
-	int nb_tx;
-	int to_tx;
-	int tot_tx;
-
-
-	//debug
-	int ring_in_index = 0;
-	int ring_out_index = 0;
-	int nb_first_stage = pl->nb_pl_stages? pl->nb_inst_per_pl_stage[0]:1;
-	int nb_last_stage = pl->nb_pl_stages? pl->nb_inst_per_pl_stage[pl->nb_pl_stages-1]:1;
-
-	int temp;
-
-	/* Keep coverity check happy by initialising. */
-	memset(&mbuf[0], '\0', sizeof(struct rte_mbuf *) * batch_size);
-	//debug for not reordering 
-	//memset(&mbuf_out[0], '\0', sizeof(struct rte_mbuf *) * batch_size);
-
-	/* Convert duration to cycles. */
-	max_cycles = max_duration * rte_get_timer_hz();
-	prev_cycles = 0;
-	cycles = 0;
-
-	main_lcore = rte_lcore_id() == rte_get_main_lcore();
-
-	printf("main lcore: %d\n", main_lcore);
-
-
-	/* Get ports */
-	pkt_stats = &rm_stats->pkt_stats;
-	dpdk_tx = rte_malloc(NULL, sizeof(*dpdk_tx), 64);
-	if (!dpdk_tx) {
-		MEILI_LOG_ERR("Memory failure on tx queue.");
-		return -ENOMEM;
-	}
-
 
 	MEILI_LOG_INFO("Checking port %s",run_conf->port1);
 	ret = rte_eth_dev_get_port_by_name(run_conf->port1, &primary_port_id);
@@ -181,8 +100,6 @@ run_dpdk(struct pipeline *pl)
 		return -EINVAL;
 	}
 
-	/* second port is for sending traffic out of the pipeline */
-	dual_port = false;
 	if (run_conf->port2) {
 		MEILI_LOG_INFO("Checking port %s",run_conf->port2);
 		ret = rte_eth_dev_get_port_by_name(run_conf->port2, &second_port_id);
@@ -192,934 +109,753 @@ run_dpdk(struct pipeline *pl)
 		}
 		ret = get_port_macaddr(second_port_id, &second_mac_addr);
 		if(ret){
-			MEILI_LOG_ERR("Cannot get port %s eth addr.", run_conf->port1);
+			MEILI_LOG_ERR("Cannot get port %s eth addr.", run_conf->port2);
 			return -EINVAL;
 		}
-		dual_port = true;
-	}
-
-	if(dual_port){
 		MEILI_LOG_INFO("Using dual port, %s-port %d-rx, %s-port %d-tx",run_conf->port1, primary_port_id, run_conf->port2, second_port_id);
 	}
 
-	
-		
-	// dpdk_tx->port_cnt[PRIM_PORT_IDX] = 0;
-	// dpdk_tx->port_cnt[SEC_PORT_IDX] = 0;
-
-	/* Default mode ingresses and egresses on the primary port. */
-	cur_rx = primary_port_id;
-	cur_tx = second_port_id;
-	// rx_port_id = PRIM_PORT_IDX;
-	// tx_port_id = SEC_PORT_IDX;
-
-		
-	/* several different versions of batch size */
-	//batch_size_in = 1;
-	// batch_size_in = nb_first_stage? batch_size * nb_first_stage:batch_size;
-	batch_size_in = batch_size;
+	/* Default mode ingresses on the primary port and egresses on the second port. */
+	*cur_rx = primary_port_id;
+	*cur_tx = second_port_id;
 
-	batch_size_out = MAX_PKTS_BURST;
-	//batch_size_out = batch_size * nb_last_stage;
-	//batch_size_out = batch_size;
+	return 0;
+}
 
+/* Transmit pkts on a port, mbufs that are not sent after force quit are freed. */
+static __rte_always_inline void
+run_dpdk_tx(uint16_t port, int qid, struct rte_mbuf **mbuf, int nb_pkts)
+{
+	int tot_tx = 0;
 
-	start = rte_rdtsc();
+	/* prefetch pkts to be redirected and modify their mac */
+	for(int i=0; i<nb_pkts; i++){
+		rte_prefetch0(rte_pktmbuf_mtod(mbuf[i], void *));
+		update_addr(mbuf[i], port);
+	}
 
-	MEILI_LOG_INFO("Eth batch size = %d, batch_size_in = %d, batch_size_out = %d",DEFAULT_ETH_BATCH_SIZE, batch_size_in, batch_size_out);
-
-	// /* temporary remedy for reorder bug */
-	// #ifdef RATE_LIMIT_BPS_ON
-	// #elif defined(RATE_LIMIT_PPS_ON)
-	// #elif defined(LATENCY_MODE_ON)
-	// #elif defined(ONLY_MAIN_MODE_ON)
-	// #else
-	// /* normal running mode */
-	// do{
-	// 	batch_cnt = rte_eth_rx_burst(cur_rx, qid, mbuf_in, 256);
-	// }while(!batch_cnt);
-	// /* put first batch directly into reorder to avoid bug */
-	// seq_exec(seq_stage, mbuf_in, batch_cnt);
-	// reorder_exec(reorder_stage, mbuf_in, batch_cnt, mbuf_out, &nb_deq_reorder);
-	// printf("first enq to/deq from reorder=%d/%d\n",batch_cnt,nb_deq_reorder);
-	// for (int i = 0; i < nb_deq_reorder; i++) {
-	// 	/* here we simply free the mbuf */
-	// 	rte_pktmbuf_free(mbuf_out[i]);
-	// }
-	// #endif
+	while(tot_tx < nb_pkts && !force_quit){
+		tot_tx += rte_eth_tx_burst(port, qid, &mbuf[tot_tx], nb_pkts - tot_tx);
+	}
+	if (nb_pkts)
+		trace_record(TRACE_EV_TX_BURST, port, tot_tx, nb_pkts - tot_tx);
 
+	for (int i = tot_tx; i < nb_pkts; i++) {
+		rte_pktmbuf_free(mbuf[i]);
+	}
+}
 
-	/* start reading packets from eth */
-	while (!force_quit 
-			&& (!max_cycles || cycles <= max_cycles)) 
-		{
+/* Account pkts leaving the pipeline, then transmit or free them. */
+static __rte_always_inline void
+run_dpdk_finish(struct rte_mbuf **mbuf, int nb_pkts, run_mode_stats_t *rm_stats,
+		uint16_t cur_tx, const uint32_t flags)
+{
+	if( likely(nb_pkts > 0) ) {
+		rm_stats->tx_batch_cnt ++;
+	}
+	for (int i = 0; i < nb_pkts; i++) {
+		rm_stats->tx_buf_cnt++;
+		rm_stats->tx_buf_bytes += mbuf[i]->data_len;
+	}
 
-			/* Hint: rte_eth_rx_burst(dpdk_port_id, queue_id, mbuf_pointer_array, batch_size) */
-			/* for main core, queue_id is always 0 */
-			#ifdef RATE_LIMIT_BPS_ON
-			/* limit the loading speed based on bps */
-			run_time = (double)cycles / rte_get_timer_hz();
-			rate = ((rm_stats->rx_buf_bytes * 8) / run_time)/ 1000000000.0;
-			if(rate < RATE_Gbps){
-				batch_cnt = rte_eth_rx_burst(cur_rx, qid, mbuf_in, DEFAULT_ETH_BATCH_SIZE);
-			}
-			else{;}
-			#elif defined(RATE_LIMIT_PPS_ON)
-			/* limit the loading speed based on pps */
-			run_time = (double)cycles / rte_get_timer_hz();
-			rate = ((rm_stats->rx_buf_cnt ) / run_time)/ 1000000.0;
-			if(rate < RATE_Mpps){
-				batch_cnt = rte_eth_rx_burst(cur_rx, qid, mbuf_in, DEFAULT_ETH_BATCH_SIZE);
-			}
-			else{;}
-			#elif defined(LATENCY_MODE_ON)
-			/* load pkts batch after previous batch finished to measure latency */
-			/* In latency mode, inner loop will only exit when batch_cnt_tot_deq == batch_cnt_tot_enq to ensure all pkts enqueued has been dequeued from the pipeline.  */
-			/* However, we do not count total # of pkts dequeued from reorder stage but count that from the last worker stages, as batch_cnt_tot_deq. This is because some pkts may remain in reorder stage until more pkts arrive. */
-			batch_cnt = rte_eth_rx_burst(cur_rx, qid, mbuf_in, DEFAULT_ETH_BATCH_SIZE);	
-			#elif defined(ONLY_MAIN_MODE_ON)
-			/* debug for not lauching work threads and only run the main thread, without any enqueuing/dequeuing */
-			batch_cnt = rte_eth_rx_burst(cur_rx, qid, mbuf, DEFAULT_ETH_BATCH_SIZE);
-			#else
-			/* normal running mode */
-			batch_cnt = rte_eth_rx_burst(cur_rx, qid, mbuf_in, DEFAULT_ETH_BATCH_SIZE);
-			#endif
-			
+	/* transmit pkts to destination, the driver frees them once sent */
+	if (flags & RUN_F_REMOTE_TX) {
+		run_dpdk_tx(cur_tx, 0, mbuf, nb_pkts);
+		return;
+	}
 
+	/* post-processing of pkts */
+	for (int i = 0; i < nb_pkts; i++) {
+		/* here we simply free the mbuf */
+		rte_pktmbuf_free(mbuf[i]);
+	}
+}
 
+/* Prefetch the second cache line of received mbufs, where seq_exec() and
+ * pkt_ts_exec() write their dynfields, and with data the headers the priority
+ * classifier reads. The driver just wrote the first line, and a burst from the
+ * port is short enough to be prefetched at once, ahead of all passes over it.
+ */
+static __rte_always_inline void
+run_dpdk_prefetch_rx(struct rte_mbuf **mbuf, int nb_pkts, bool data)
+{
+	for (int i = 0; i < nb_pkts; i++) {
+		rte_prefetch0(&mbuf[i]->cacheline1);
+		if (data)
+			pipeline_prefetch_data(mbuf[i]);
+	}
+}
 
-			if(batch_cnt <= 0){
-				/* no pkt received, directly goto get packets out if there is packet waiting to be dequeued */
-				//printf("no packet received, batch_cnt_wait_on_deq = %d\n",batch_cnt_wait_on_deq);
-				if(batch_cnt_wait_on_deq > 0){
-					goto aggregate_packets;
-				}
-				else{
-					continue;
-				}
-			}
+/* Enqueue the buckets flow_dispatch_split() filled to the rings of their instances. */
+static __rte_always_inline void
+run_dpdk_flow_send(struct pipeline *pl, struct flow_dispatch *fd, struct rte_ring **rings, int stats_qid)
+{
+	struct rte_mbuf **bucket;
+	uint32_t nb, nb_enq;
+
+	for (uint32_t i = 0; i < fd->nb_inst; i++) {
+		nb = fd->nb[i];
+		if (!nb)
+			continue;
+		bucket = &fd->bucket[i * FLOW_DISPATCH_BURST];
+		nb_enq = rte_ring_enqueue_burst(rings[i], (void **)bucket, nb, NULL);
+		if (unlikely(nb_enq < nb))
+			trace_record(TRACE_EV_RING_FULL, stats_qid, nb - nb_enq, 0);
+		/* the stages stop at the end of the run, nothing drains their rings then */
+		while (nb_enq < nb && !force_quit && __atomic_load_n(&pl->conf.running, __ATOMIC_RELAXED))
+			nb_enq += rte_ring_enqueue_burst(rings[i], (void **)&bucket[nb_enq], nb - nb_enq, NULL);
+		if (unlikely(nb_enq < nb))
+			rte_pktmbuf_free_bulk(&bucket[nb_enq], nb - nb_enq);
+		fd->nb[i] = 0;
+	}
+}
 
-			// // debug for eth device
-			// if(batch_cnt > 0){
-			// 	printf("pushing batch...\n");
-			// 	printf("batch_cnt=%d\n",batch_cnt);
-			// }
+/* Send on the pkts held for the flows the last remap moved once every first
+ * stage instance sent the state of its flows on, at the deadline, or early
+ * when the hold slots may not take the next rx burst. Held pkts of both
+ * classes take the bulk rings, the stages split them again.
+ */
+static void
+run_dpdk_flow_release(struct pipeline *pl, struct flow_dispatch *fd, run_mode_stats_t *rm_stats, int stats_qid)
+{
+	/* the pkts of one rx burst are split before the next check, FLOW_DISPATCH_BURST at most */
+	RTE_BUILD_BUG_ON(DEFAULT_ETH_BATCH_SIZE > FLOW_DISPATCH_BURST);
+	if (unlikely(flow_dispatch_hold_full(fd, FLOW_DISPATCH_BURST))) {
+		/* the moved flows start over on their new instances, as on timeout */
+		rm_stats->hold_full_cnt++;
+		trace_record(TRACE_EV_MODE, TRACE_MODE_HOLD_FULL, stats_qid, fd->nb_hold);
+	} else if (rte_rdtsc() < fd->hold_deadline) {
+		for (int j = 0; j < pl->nb_inst_per_pl_stage[0]; j++)
+			if (__atomic_load_n(&pl->stages[0][j]->flow_gen_done, __ATOMIC_ACQUIRE) != fd->map->gen)
+				return;
+	}
 
-			
-			for(int k=0; k<batch_cnt ; k++) {
-				rm_stats->rx_buf_cnt++;
-				#ifndef ONLY_MAIN_MODE_ON
-				rm_stats->rx_buf_bytes += mbuf_in[k]->data_len;
-				// // debug for correct pkt length
-				// printf("data_len = %d\n",mbuf_in[k]->data_len);
-				// printf("pkt_len = %d\n",mbuf_in[k]->pkt_len);
-				#else
-				rm_stats->rx_buf_bytes += mbuf[k]->data_len;
-				#endif		
-			}
+	/* all of them before new pkts of the same flows */
+	while (flow_dispatch_release(fd))
+		run_dpdk_flow_send(pl, fd, pl->ring_in, stats_qid);
+}
 
-			batch_cnt_wait_on_enq = batch_cnt;
-			batch_cnt_tot_enq = 0;
-			batch_cnt_tot_deq = 0;
-			/* Receiving packets is separated from enqueuing to pipeline stages. This inner loop is for enqueuing to pipeline stages */
-			/* Note that if latency mode is on, we must finish all processing of this batch, then proceed to next batch. 
-			 * This is done via inner-inner loop, which waits for all enqueued(a batch, for per-pkt latency, batch_size_in = 1) packets to dequeue. 
-			 */
-			while (!force_quit && batch_cnt_wait_on_enq > 0)
-			{
-				
-				/* # of pkts to enqueue this round. Note that ethernet device could receive less */
-				batch_cnt_enq = RTE_MIN(batch_size_in, batch_cnt_wait_on_enq);
-
-
-				//#ifdef LATENCY_MODE_ON
-				batch_cnt_wait_on_deq += batch_cnt_enq;
-				//#endif
-				// // debug
-				// printf("batch_cnt_wait_on_enq = %d\n",batch_cnt_wait_on_enq);
-
-				/* start of partition/end2end time keeping */ 
-				#ifndef LATENCY_AGGREGATION
-				#ifdef LATENCY_END2END
-				pkt_ts_exec(pl->ts_start_offset, &mbuf_in[batch_cnt_tot_enq], batch_cnt_enq);
-				#endif
-				#ifdef LATENCY_PARTITION
-				pkt_ts_exec(pl->ts_start_offset, &mbuf_in[batch_cnt_tot_enq], batch_cnt_enq);
-				#endif
-				#endif
-
-				
-
-				/* TODO: currently we do not consider different flows, should direct flows with less volume to remote workers based on a table */
-
-				/* put packets into first ring_in */
-				tot_enq = 0;
-				to_enq = batch_cnt_enq; /* batch_cnt_enq is always less equal than batch_size_in, no need to conduct RTE_MIN */
-				nb_enq = 0;
-				#ifndef ONLY_MAIN_MODE_ON
-					/* direct pkts to local/remote pipelines */
-					/* TODO: we temporarily distinguish two modes: all local pipeline and all remote pipeline. We should merge all run modes into one enqueue function.  */
-
-					// /* All packets should be forwarded to remote pipelines. ONLY for measurement of traffic routing throughput and latency.*/
-					// #ifdef ALL_REMOTE_ON_ARRIVAL 
-					// 	/* prefetch pkts to be redirected and modify their mac */
-					// 	for(int i=0; i<to_enq; i++){
-					// 		//rte_prefetch0(rte_pktmbuf_mtod(mbuf_in[batch_cnt_tot_enq+i], void *));
-					// 		//update_addr(mbuf_in[batch_cnt_tot_enq+i], cur_tx); 
-					// 		update_addr(mbuf_in[batch_cnt_tot_enq+i], cur_rx); 
-					// 		//printf("%d-%d ",mbuf_in[batch_cnt_tot_enq+i]->data_len, mbuf_in[batch_cnt_tot_enq+i]->pkt_len);
-					// 	}
-					// 	//printf("\n");
-					// 	/* Use second port to transmit packets */
-					// 	while(tot_enq < batch_cnt_enq){
-					// 		nb_enq = rte_eth_tx_burst(cur_rx, qid, &mbuf_in[batch_cnt_tot_enq+tot_enq], to_enq);
-					// 		// //debug 
-					// 		//printf("to_tx=%d, nb_txed=%d\n",to_enq,nb_enq);
-					// 		tot_enq += nb_enq;
-					// 		to_enq -= nb_enq;
-					// 	}
-					// 	#ifndef LATENCY_AGGREGATION
-					// 	#ifndef LATENCY_END2END
-					// 	#ifdef LATENCY_PARTITION
-					// 	pkt_ts_exec(pl->ts_end_offset, &mbuf_in[batch_cnt_tot_enq], batch_cnt_enq);
-					// 	stats_update_time_main(&mbuf_in[batch_cnt_tot_enq], batch_cnt_enq, pl);
-					// 	#endif
-					// 	#endif
-					// 	#endif
-
-					// 	batch_cnt_wait_on_deq = 0;
-					// 	/* pkts are all redirected to remote pipelines */
-					// 	/* stats recording for throughput */
-					// 	if( likely(batch_cnt_enq > 0) ) {
-					// 		rm_stats->tx_batch_cnt ++;
-					// 	}
-					// 	for (int i = 0; i < batch_cnt_enq; i++) {
-					// 		rm_stats->tx_buf_cnt++;
-					// 		rm_stats->tx_buf_bytes += mbuf_in[batch_cnt_tot_enq+i]->data_len;
-
-					// 		rte_pktmbuf_free(mbuf_in[batch_cnt_tot_enq+i]);
-					// 	}
-
-					// 	/* goto next pipeline batch without dequeuing from local rings, as pkts are ALL REMOTE */
-					// 	goto finish_pipeline_batch;
-					// #endif /* ALL_REMOTE_ON_ARRIVAL */
-					
-					/* sequencing packets that are processed locally */
-					seq_exec(seq_stage, &mbuf_in[batch_cnt_tot_enq], batch_cnt_enq);
-					//debug
-					//printf("enqueue batch\n");
-					#ifdef SHARED_BUFFER
-					while(tot_enq < batch_cnt_enq && !force_quit){
-						nb_enq = rte_ring_enqueue_burst(pl->ring_in, (void *)(&mbuf_in[batch_cnt_tot_enq+tot_enq]), to_enq, NULL);
-						tot_enq += nb_enq;
-						to_enq -= nb_enq;
-					}
-					#else
-					while(tot_enq < batch_cnt_enq && !force_quit){
-						nb_enq = rte_ring_enqueue_burst(pl->ring_in[ring_in_index], (void *)(&mbuf_in[batch_cnt_tot_enq+tot_enq]), to_enq, NULL);
-						tot_enq += nb_enq;
-						to_enq -= nb_enq;
-					}
+/* Hand pkts of the high priority class to the first stages, round-robin over their prio rings. */
+static __rte_always_inline void
+run_dpdk_prio_send(struct pipeline *pl, struct rte_mbuf **pkts, uint32_t nb, int *prio_in_index)
+{
+	struct rte_ring *ring = pl->prio_ring_in[*prio_in_index];
+	uint32_t nb_enq = 0;
+
+	while (nb_enq < nb && !force_quit && __atomic_load_n(&pl->conf.running, __ATOMIC_RELAXED))
+		nb_enq += rte_ring_enqueue_burst(ring, (void **)&pkts[nb_enq], nb - nb_enq, NULL);
+	/* the run ended, the rest is dropped */
+	if (unlikely(nb_enq < nb))
+		rte_pktmbuf_free_bulk(&pkts[nb_enq], nb - nb_enq);
+	*prio_in_index = (*prio_in_index + 1) % pl->nb_prio_ring_in;
+}
 
-				
-
-					// // debug
-					//printf("enqueue to ring %d\n",ring_in_index);
-
-					ring_in_index = (ring_in_index+1)%nb_first_stage;
-					/* debug for only using one pipeline */
-					//temp = (ring_in_index+1)%nb_first_stage;
-					#endif
-				#else 
-					#ifdef SHARED_BUFFER
-					;
-					#else
-					/* round-robin change the stage instance for each batch_size_in */
-					ring_in_index = (ring_in_index+1)%nb_first_stage;
-					#endif
-				#endif /* ifndef ONLY_MAIN_MODE_ON */
-				
-
-				/* end of partition time keeping */ 
-				#ifndef LATENCY_AGGREGATION
-				#ifndef LATENCY_END2END
-				#ifdef LATENCY_PARTITION
-				pkt_ts_exec(pl->ts_end_offset, &mbuf_in[batch_cnt_tot_enq], batch_cnt_enq);
-				#endif
-				#endif
-				#endif
-
-				/* start of aggregation time keeping */  
-				#ifndef LATENCY_PARTITION
-				#ifndef LATENCY_END2END
-				#ifdef LATENCY_AGGREGATION
-				pkt_ts_exec(pl->ts_start_offset, &mbuf_in[batch_cnt_tot_enq], batch_cnt_enq);
-				#endif
-				#endif
-				#endif
-
-
-				/* Note: 
-				* In latency mode, we want to acquire per-packet latency. So we keep waiting on the packet that has been enqueued in this inner-inner loop. 
-				* In throughput mode, we do not need to wait for inflight packets
-				*/
-				#ifdef LATENCY_MODE_ON /* start of inner-inner loop */
-				while(batch_cnt_wait_on_deq > 0){
-				#endif
-
-					/* read packets from last ring_out(reorder) */
-					/* reorder packets based on sequence number */
-				aggregate_packets:
-					#ifndef ONLY_MAIN_MODE_ON
-
-						#ifdef SHARED_BUFFER
-							batch_cnt_deq = rte_ring_dequeue_burst(pl->ring_out,(void *)mbuf, batch_size_out, NULL);
-						#else
-							//batch_cnt_deq = rte_ring_dequeue_burst(pl->ring_out[ring_out_index],(void *)mbuf, batch_size_out, NULL);
-							batch_cnt_deq = rte_ring_dequeue_burst(pl->ring_out[ring_out_index],(void *)mbuf, batch_size_out, &nb_out_ring_remain);
-							/* debug */
-							#ifdef LATENCY_MODE_ON 
-							/* In latency mode, do not change the ring buffer index in the inner-inner loop. Only change the index after inner-inner loop ends and simulate the mod operation here. */
-							temp = (ring_out_index+1)%nb_last_stage;
-							#else
-							/* debug for only using one pipeline */
-							//temp = (ring_out_index+1)%nb_last_stage;
-							ring_out_index = (ring_out_index+1)%nb_last_stage;
-							#endif
-						#endif
-
-					#else
-						#ifdef SHARED_BUFFER
-						;
-						#else
-						ring_out_index = (ring_out_index+1)%nb_last_stage;
-						#endif
-
-					#endif
-
-					//test
-					//reorder_exec(reorder_stage, mbuf, batch_cnt_deq, mbuf_out, &nb_deq_reorder);
-					// // if(batch_cnt_deq >0 && *rte_reorder_seqn(mbuf[0]) < 1024){
-					// // 	printf("sample seq num=%d\n",*rte_reorder_seqn(mbuf[0]));
-					// // }
-
-					// // debug for reorder
-					// cycles = rte_rdtsc() - start;
-					// if (cycles - prev_cycles_debug > STATS_INTERVAL_CYCLES) {
-					//printf("batch_cnt_deq = %d\n",batch_cnt_deq);
-					// 	printf("nb_out_ring_remain = %d\n",nb_out_ring_remain);
-					// 	printf("nb_deq_reorder = %d\n",nb_deq_reorder);
-					// 	prev_cycles_debug = cycles;
-					// }
-					mbuf_out = mbuf;
-					nb_deq_reorder = batch_cnt_deq;
-
-
-					/* end of aggregation/end2end time keeping */
-					#ifndef LATENCY_PARTITION
-					#ifdef LATENCY_END2END
-					pkt_ts_exec(pl->ts_end_offset, mbuf_out, nb_deq_reorder);
-					#endif
-					#ifdef LATENCY_AGGREGATION
-					pkt_ts_exec(pl->ts_end_offset, mbuf_out, nb_deq_reorder);
-					#endif
-					#endif
-
-
-				
-					#ifdef LATENCY_MODE_ON
-					/* Update stats including 1) main thread latency stats, 2) breakdown latency stats(if PKT_LATENCY_BREAKDOWN_ON is defined) 
-					 * and 3) collect pkt latency sample(if PKT_LATENCY_SAMPLE_ON is defined) 
-					 */
-					stats_update_time_main(mbuf_out, nb_deq_reorder, pl);
-					#endif
-
-					if( likely(nb_deq_reorder > 0) ) {
-						// printf("nb_deq_reorder=%d\n",nb_deq_reorder);
-						rm_stats->tx_batch_cnt ++;
-					}
-					for (int i = 0; i < nb_deq_reorder; i++) {
-						rm_stats->tx_buf_cnt++;
-						rm_stats->tx_buf_bytes += mbuf_out[i]->data_len;
-					}
+/* Time keeping of pkts leaving the pipeline, then finish them. */
+static __rte_always_inline void
+run_dpdk_egress_pkts(struct pipeline *pl, struct rte_mbuf **mbuf, int nb_pkts,
+		     run_mode_stats_t *rm_stats, uint16_t cur_tx, const uint32_t flags)
+{
+	if (!nb_pkts)
+		return;
+
+	/* reorder packets based on sequence number */
+	//test
+	//reorder_exec(reorder_stage, mbuf, nb_deq, mbuf_out, &nb_deq_reorder);
+
+	if (flags & RUN_F_LATENCY) {
+		/* end of aggregation/end2end time keeping */
+		if (pl->conf.latency_type != LATENCY_TYPE_PARTITION)
+			pkt_ts_exec(pl->ts_end_offset, mbuf, nb_pkts);
+
+		/* Update stats including 1) main thread latency stats, 2) breakdown latency stats
+		 * and 3) collect pkt latency sample(if latency sampling is on)
+		 */
+		stats_update_time_main(mbuf, nb_pkts, pl);
+	} else if (pl->probe_flag) {
+		/* end of probe time keeping */
+		stats_update_probe(mbuf, nb_pkts, pl);
+	}
 
-					/* transmit pkts to destination */
-					#ifdef ALL_REMOTE_AFTER_PROCESSING
-						to_tx = nb_deq_reorder;
-						tot_tx = 0;
-						/* prefetch pkts to be redirected and modify their mac */
-						for(int i=0; i<to_tx; i++){
-							rte_prefetch0(rte_pktmbuf_mtod(mbuf_out[i], void *));
-							update_addr(mbuf_out[i], cur_tx); 
-						}
+	run_dpdk_finish(mbuf, nb_pkts, rm_stats, cur_tx, flags);
+}
 
-						while(tot_tx < nb_deq_reorder){
-							nb_tx = rte_eth_tx_burst(cur_tx, qid, mbuf_out, to_tx);
-							// //debug 
-							// printf("to_tx=%d, nb_txed=%d\n",to_tx,nb_tx);
-							tot_tx += nb_tx;
-							to_tx -= nb_tx;
-						}
-					#endif /* ALL_REMOTE_AFTER_PROCESSING */
+/* Read packets from the next tail ring_out holding pkts and finish them. Bulk
+ * pkts are finished in the slots of the ring (zero-copy dequeue), which are
+ * only released once the pkts were sent or freed.
+ */
+static __rte_always_inline int
+run_dpdk_egress(struct pipeline *pl, int *ring_out_index, struct rte_mbuf **mbuf,
+		run_mode_stats_t *rm_stats, uint16_t cur_tx, const uint32_t flags)
+{
+	struct rte_ring_zc_data zcd;
+	int nb_prio = 0;
+	int nb_deq;
+
+	/* the high priority class leaves first */
+	if (pl->prio_ring_out) {
+		nb_prio = rte_ring_dequeue_burst(pl->prio_ring_out, (void **)mbuf, PRIO_RING_SIZE, NULL);
+		run_dpdk_egress_pkts(pl, mbuf, nb_prio, rm_stats, cur_tx, flags);
+	}
 
-					/* post-processing of pkts */ 
-					for (int i = 0; i < nb_deq_reorder; i++) {
-						/* here we simply free the mbuf */
-						rte_pktmbuf_free(mbuf_out[i]);
-					}
+	nb_deq = pipeline_dequeue_ready_zc_start(pl->ring_out, pl->nb_ring_out, &pl->ready, ring_out_index, &zcd,
+						 MAX_PKTS_BURST);
+	if (nb_deq) {
+		run_dpdk_egress_pkts(pl, zcd.ptr1, zcd.n1, rm_stats, cur_tx, flags);
+		run_dpdk_egress_pkts(pl, zcd.ptr2, nb_deq - zcd.n1, rm_stats, cur_tx, flags);
+		pipeline_dequeue_ready_zc_finish(pl->ring_out, pl->nb_ring_out, &pl->ready, ring_out_index, nb_deq,
+						 MAX_PKTS_BURST);
+	}
+	nb_deq += nb_prio;
 
-					/* change inner loop counters */
-					//debug
-					// if(batch_cnt > 0){
-					// 	printf("\n%d pkts received from ethernet\n",batch_cnt);
-					// 	printf("batch_cnt_enq = %d\n",batch_cnt_enq);
-					// 	printf("batch_cnt_wait_on_enq = %d\n",batch_cnt_wait_on_enq);
-					// 	printf("batch_cnt_tot_enq = %d\n",batch_cnt_tot_enq);
-					// 	printf("batch_cnt_deq = %d\n",batch_cnt_deq);
-					// 	printf("nb_deq_reorder = %d\n",nb_deq_reorder);
-					// 	printf("batch_cnt_tot_deq = %d\n",batch_cnt_tot_deq);
-					// 	printf("rx_buf_cnt = %ld, tx_buf_cnt = %ld\n",rm_stats->rx_buf_cnt, rm_stats->tx_buf_cnt);
-					// }
-
-				
-					
-
-					/* # of pkts still left in the pipeline */
-					batch_cnt_wait_on_deq -= nb_deq_reorder;
-
-
-					//debug 
-					// printf("wait on dequeue from ring %d\n",ring_out_index);
-					//printf("batch_cnt_wait_on_deq = %d, nb_deq_reorder = %d\n",batch_cnt_wait_on_deq, nb_deq_reorder);
-				#ifdef LATENCY_MODE_ON
-
-				}/* End of inner-inner loop. Proceed */
-
-				/* In latency mode, the inner-inner loop ends, move to next pair of rte_ring. */
-				/* In normal mode, simply move to next pair of rte_ring right after dequeue operation. */
-				ring_out_index = (ring_out_index+1)%nb_last_stage;
-				/* debug for only using one pipeline in latency mode */
-				//temp = (ring_out_index+1)%nb_last_stage;
-				#endif
-
-			finish_pipeline_batch:
-				/* # of pkts wait to be enqueued */
-				batch_cnt_wait_on_enq -= batch_cnt_enq; 
-				/* # of pkts already enqueued in total(this round) */
-				batch_cnt_tot_enq += batch_cnt_enq; 
-
-			}/* End of inner loop. Proceed to process next pipeline batch. */
-
-			/* Print pipeline stats every 1s */
-			cycles = rte_rdtsc() - start;
+	/* pkts dropped inside a graph are done as well */
+	if (pl->conf.graph_mode)
+		nb_deq += __atomic_exchange_n(&pl->dropped, 0, __ATOMIC_ACQUIRE);
 
-			if (!main_lcore){
-				continue;
-			}
-			
-			if (cycles - prev_cycles > STATS_INTERVAL_CYCLES) {
-				run_time = (double)cycles / rte_get_timer_hz();
-				prev_cycles = cycles;
-				stats_print_update(stats, run_conf->cores, run_time, false);
-			}
-		}/* End of outer loop. Proceed to receive and process next eth batch. */
-	printf("Exiting on main core\n");	
-	return 0;
+	return nb_deq;
 }
-#endif
-
 
-#ifdef ALL_REMOTE_ON_ARRIVAL
-static int
-run_dpdk(struct pipeline *pl)
+/* Ingress loop of a dispatcher, the main core also drains the pipeline unless
+ * an egress lcore does.
+ */
+static __rte_always_inline int
+run_dpdk_ingress(struct pipeline_dispatcher *disp, const uint32_t flags)
 {
+	struct pipeline *pl = disp->pl;
 	pl_conf *run_conf = &pl->conf;
-	/* always run on main core */
-	int qid = 0;
+	/* rx queue of the dispatcher, the main core takes 0 */
+	const int qid = disp->id;
+	const int stats_qid = disp->worker_qid;
 	const uint32_t max_duration = run_conf->input_duration;
-	uint32_t batch_size = run_conf->input_batches;
-	uint32_t batch_size_in = 0;
-	uint32_t batch_size_out = 0;
+	uint32_t batch_size_in = run_conf->input_batches;
+	const enum meili_latency_type latency_type = run_conf->latency_type;
+	/* chunks sent to the stages follow the load, except for the fixed batches of latency mode */
+	const bool adaptive = run_conf->adaptive_batch_us && !(flags & (RUN_F_LATENCY | RUN_F_ONLY_MAIN));
+	struct batch_ctl bc;
+	uint64_t burst_tsc;
+	/* the classes split right after rx, latency mode keeps a single class */
+	const bool prio = pl->prio_ring_in && !(flags & (RUN_F_LATENCY | RUN_F_ONLY_MAIN));
+	struct rte_mbuf *mbuf_prio[DEFAULT_ETH_BATCH_SIZE];
+	uint32_t nb_bulk, nb_prio;
+	int prio_in_index = 0;
+	const uint32_t probe_rate = (flags & (RUN_F_LATENCY | RUN_F_ONLY_MAIN)) ? 0 : run_conf->latency_probe;
+	const bool prefetch = run_conf->prefetch_dist;
+	/* per flow dispatch instead of round-robin chunks */
+	struct flow_dispatch *fd = disp->fd;
+	const struct flow_map *map;
 	int batch_cnt = 0;
 	int batch_cnt_enq = 0;
-	int batch_cnt_wait_on_enq = 0;
-	int batch_cnt_wait_on_deq = 0; /* used for throughput and latency mode. */
+	int batch_cnt_wait_on_deq = 0; /* pkts still left in the pipeline */
 	int batch_cnt_tot_enq = 0;
-	int batch_cnt_deq = 0;
-	int batch_cnt_tot_deq = 0;
-	int nb_out_ring_remain= 0;
+	/* pkts of the other dispatchers leave through the main core as well */
+	const bool drain = pl->nb_dispatchers > 1;
 	rb_stats_t *stats = run_conf->stats;
-	run_mode_stats_t *rm_stats = &stats->rm_stats[qid];
-	// TODO: rename regex_stats_t to other names
-	//regex_stats_t *regex_stats = &stats->regex_stats[qid];
+	run_mode_stats_t *rm_stats = &stats->rm_stats[stats_qid];
 
-	/* for packet transmission */	
-	uint16_t cur_rx, cur_tx, tx_port_id, rx_port_id;
-	const unsigned char *pkt;
-	pkt_stats_t *pkt_stats;
-	dpdk_egress_t *dpdk_tx;
-	bool dual_port;
+	/* for packet transmission */
+	uint16_t cur_rx, cur_tx;
 
 	/* time keeping */
-	uint64_t prev_cycles;
-	uint64_t prev_cycles_debug = 0;
 	uint64_t max_cycles;
 	uint64_t cycles;
-	double run_time;
 	uint64_t start;
-	double rate = 0;
+	struct rate_limit *rl = NULL;
 
-	bool main_lcore;
-	
 	int ret;
-	int flag = 0;
 
-	// for baseline implementation, each stage can only use one core 
 	/* special pipeline stages(have already been init in pipeline_init) */
-	struct pipeline_stage *seq_stage = &pl->seq_stage;
-	struct pipeline_stage *reorder_stage = &pl->reorder_stage;
+	struct pipeline_stage *seq_stage = &disp->seq_stage;
 
 	struct rte_mbuf *mbuf_in[MAX_PKTS_BURST];
 	struct rte_mbuf *mbuf[MAX_PKTS_BURST];
-	// debug for not reordering 
-	//struct rte_mbuf *mbuf_out[MAX_PKTS_BURST];
-	struct rte_mbuf **mbuf_out;
-	int nb_enq;
-	int to_enq;
+	struct rte_mbuf **batch;
 	int tot_enq;
 
-	int nb_deq_reorder;
-
-	int nb_tx;
-	int to_tx;
-	int tot_tx;
-
-
-	//debug
 	int ring_in_index = 0;
 	int ring_out_index = 0;
-	int nb_first_stage = pl->nb_pl_stages? pl->nb_inst_per_pl_stage[0]:1;
-	int nb_last_stage = pl->nb_pl_stages? pl->nb_inst_per_pl_stage[pl->nb_pl_stages-1]:1;
-
-	int temp;
-
-	/* Keep coverity check happy by initialising. */
-	memset(&mbuf[0], '\0', sizeof(struct rte_mbuf *) * batch_size);
-	//debug for not reordering 
-	//memset(&mbuf_out[0], '\0', sizeof(struct rte_mbuf *) * batch_size);
+	const int nb_ring_in = pl->nb_ring_in;
 
 	/* Convert duration to cycles. */
 	max_cycles = max_duration * rte_get_timer_hz();
-	prev_cycles = 0;
 	cycles = 0;
 
-	main_lcore = rte_lcore_id() == rte_get_main_lcore();
-
-
-	/* Get ports */
-	pkt_stats = &rm_stats->pkt_stats;
-	dpdk_tx = rte_malloc(NULL, sizeof(*dpdk_tx), 64);
-	if (!dpdk_tx) {
-		MEILI_LOG_ERR("Memory failure on tx queue.");
-		return -ENOMEM;
-	}
-
-
-	MEILI_LOG_INFO("Checking port %s",run_conf->port1);
-	ret = rte_eth_dev_get_port_by_name(run_conf->port1, &primary_port_id);
-	if (ret) {
-		MEILI_LOG_ERR("Cannot find port %s.", run_conf->port1);
-		return -EINVAL;
-	}
-	ret = get_port_macaddr(primary_port_id, &primary_mac_addr);
-	if(ret){
-		MEILI_LOG_ERR("Cannot get port %s eth addr.", run_conf->port1);
-		return -EINVAL;
-	}
-
-	/* second port is for sending traffic out of the pipeline */
-	dual_port = false;
-	if (run_conf->port2) {
-		MEILI_LOG_INFO("Checking port %s",run_conf->port2);
-		ret = rte_eth_dev_get_port_by_name(run_conf->port2, &second_port_id);
-		if (ret) {
-			MEILI_LOG_ERR("Cannot find port %s.", run_conf->port2);
-			return -EINVAL;
-		}
-		ret = get_port_macaddr(second_port_id, &second_mac_addr);
-		if(ret){
-			MEILI_LOG_ERR("Cannot get port %s eth addr.", run_conf->port1);
-			return -EINVAL;
-		}
-		dual_port = true;
-	}
+	ret = run_dpdk_get_ports(run_conf, &cur_rx, &cur_tx);
+	if (ret)
+		return ret;
 
-	if(dual_port){
-		MEILI_LOG_INFO("Using dual port, %s-port %d-rx, %s-port %d-tx",run_conf->port1, primary_port_id, run_conf->port2, second_port_id);
+	if (flags & RUN_F_RATE_LIMIT) {
+		ret = rate_limit_set(cur_rx, (uint64_t)run_conf->rate_limit_mbps * 1000000,
+				(uint64_t)run_conf->rate_limit_kpps * 1000, run_conf->rate_limit_burst_us);
+		if (ret)
+			return ret;
+		rl = rate_limit_get(cur_rx);
 	}
 
-	
-		
-	// dpdk_tx->port_cnt[PRIM_PORT_IDX] = 0;
-	// dpdk_tx->port_cnt[SEC_PORT_IDX] = 0;
-
-	/* Default mode ingresses and egresses on the primary port. */
-	cur_rx = primary_port_id;
-	cur_tx = second_port_id;
-	// rx_port_id = PRIM_PORT_IDX;
-	// tx_port_id = SEC_PORT_IDX;
-
-		
-	/* several different versions of batch size */
-	//batch_size_in = 1;
-	// batch_size_in = nb_first_stage? batch_size * nb_first_stage:batch_size;
-	batch_size_in = batch_size;
-
-	batch_size_out = MAX_PKTS_BURST;
-	//batch_size_out = batch_size * nb_last_stage;
-	//batch_size_out = batch_size;
-
+	/* a chunk never holds more than one rx burst */
+	if (adaptive)
+		batch_ctl_init(&bc, batch_size_in, DEFAULT_ETH_BATCH_SIZE, pl->batch_budget);
 
 	start = rte_rdtsc();
 
-	MEILI_LOG_INFO("Using test mode: ALL_REMOTE_ON_ARRIVAL");
-	MEILI_LOG_INFO("Eth batch size = %d, batch_size_in = %d, batch_size_out = %d",DEFAULT_ETH_BATCH_SIZE, batch_size_in, batch_size_out);
-
+	MEILI_LOG_INFO("Eth batch size = %d, batch_size_in = %d, batch_size_out = %d",DEFAULT_ETH_BATCH_SIZE, batch_size_in, MAX_PKTS_BURST);
 
 	/* start reading packets from eth */
-	while (!force_quit 
-			&& (!max_cycles || cycles <= max_cycles)) 
+	/* dispatchers on worker lcores also stop when the main core ends the run */
+	while (!force_quit && run_conf->running
+			&& (!max_cycles || cycles <= max_cycles))
 		{
-			batch_cnt = 0;
-			batch_cnt = rte_eth_rx_burst(cur_rx, qid, mbuf_in, DEFAULT_ETH_BATCH_SIZE);
-
-			if(batch_cnt <= 0){
-				/* no pkt received, directly goto get packets out if there is packet waiting to be dequeued */
-				continue;
+			/* the control thread published a new flow map, see pipeline_scale() */
+			if (fd && unlikely((map = __atomic_load_n(&pl->flow_map, __ATOMIC_ACQUIRE)) != fd->map)) {
+				/* pkts of moved flows wait for their state, except in latency mode which waits for every pkt */
+				flow_dispatch_remap(fd, map, pl->flow_state_rings && !(flags & RUN_F_LATENCY), rte_rdtsc());
+				trace_record(TRACE_EV_MODE, TRACE_MODE_SCALE, map->nb_active, fd->nb_inst);
+			}
+			if (fd && unlikely(fd->holding))
+				run_dpdk_flow_release(pl, fd, rm_stats, stats_qid);
+			/* Hint: rte_eth_rx_burst(dpdk_port_id, queue_id, mbuf_pointer_array, batch_size) */
+			/* for main core, queue_id is always 0 */
+			if (flags & RUN_F_RATE_LIMIT) {
+				/* limit the loading speed based on bps/pps, burst is sized to the available tokens */
+				batch_cnt = rate_limit_rx_burst(rl, cur_rx, qid, mbuf_in, DEFAULT_ETH_BATCH_SIZE);
+			}
+			else{
+				/* In latency mode, a batch is loaded only after the previous batch left the pipeline. */
+				batch_cnt = rte_eth_rx_burst(cur_rx, qid, mbuf_in, DEFAULT_ETH_BATCH_SIZE);
 			}
+			if (batch_cnt)
+				trace_record(TRACE_EV_RX_BURST, cur_rx, batch_cnt, 0);
+			if (prefetch)
+				run_dpdk_prefetch_rx(mbuf_in, batch_cnt, prio || fd);
+
+			/* start of probe time keeping, as close to rx as possible */
+			if (probe_rate && batch_cnt)
+				pkt_ts_probe_exec(pl->ts_start_offset, pl->probe_flag, probe_rate, &disp->probe_countdown,
+						  mbuf_in, batch_cnt);
 
-			
 			for(int k=0; k<batch_cnt ; k++) {
 				rm_stats->rx_buf_cnt++;
-				#ifndef ONLY_MAIN_MODE_ON
 				rm_stats->rx_buf_bytes += mbuf_in[k]->data_len;
-
-				#else
-				rm_stats->rx_buf_bytes += mbuf[k]->data_len;
-				#endif		
 			}
 
-			
-			/* Receiving packets is separated from enqueuing to pipeline stages. This inner loop is for enqueuing to pipeline stages */
-			/* Note that if latency mode is on, we must finish all processing of this batch, then proceed to next batch. 
-			 * This is done via inner-inner loop, which waits for all enqueued(a batch, for per-pkt latency, batch_size_in = 1) packets to dequeue. 
-			 */
-				
-
-			if( likely(batch_cnt > 0) ) {
-				rm_stats->tx_batch_cnt ++;
-			}
-			for (int i = 0; i < batch_cnt; i++) {
-				rm_stats->tx_buf_cnt++;
-				rm_stats->tx_buf_bytes += mbuf_in[i]->data_len;
+			/* high priority pkts go to the first stage on their own ring, ahead of the bulk chunks */
+			if (prio && batch_cnt > 0) {
+				prio_classify(&pl->prio, mbuf_in, batch_cnt);
+				nb_bulk = batch_cnt;
+				nb_prio = prio_split(mbuf_in, &nb_bulk, pl->prio.flag, mbuf_prio);
+				if (nb_prio) {
+					if (fd) {
+						rm_stats->elephant_buf_cnt += flow_dispatch_split(fd, mbuf_prio, nb_prio,
+												  rte_rdtsc(), pl->prio_ring_in);
+						run_dpdk_flow_send(pl, fd, pl->prio_ring_in, stats_qid);
+					} else {
+						run_dpdk_prio_send(pl, mbuf_prio, nb_prio, &prio_in_index);
+					}
+					rm_stats->prio_buf_cnt += nb_prio;
+					batch_cnt_wait_on_deq += nb_prio;
+					batch_cnt = nb_bulk;
+				}
 			}
 
-			/* sequencing packets that are processed locally */
-			seq_exec(seq_stage, mbuf_in, batch_cnt);
-
+			if (flags & RUN_F_ONLY_MAIN) {
+				/* debug for not lauching work threads and only run the main thread, without any enqueuing/dequeuing */
+				run_dpdk_finish(mbuf_in, batch_cnt, rm_stats, cur_tx, flags);
+			}
+			else if (batch_cnt > 0) {
+				/* Receiving packets is separated from enqueuing to pipeline stages. This inner loop is for enqueuing to pipeline stages */
+				/* Note that if latency mode is on, we must finish all processing of this batch, then proceed to next batch.
+				 * This is done via inner-inner loop, which waits for all enqueued(a batch, for per-pkt latency, batch_size_in = 1) packets to dequeue.
+				 */
+				burst_tsc = rte_rdtsc();
+				for (batch_cnt_tot_enq = 0; batch_cnt_tot_enq < batch_cnt && !force_quit && run_conf->running;
+				     batch_cnt_tot_enq += batch_cnt_enq) {
+					/* # of pkts to enqueue this round. Note that ethernet device could receive less */
+					batch_cnt_enq = RTE_MIN(batch_size_in, batch_cnt - batch_cnt_tot_enq);
+					batch = &mbuf_in[batch_cnt_tot_enq];
+
+					/* start of partition/end2end time keeping */
+					if ((flags & RUN_F_LATENCY) && latency_type != LATENCY_TYPE_AGGREGATION)
+						pkt_ts_exec(pl->ts_start_offset, batch, batch_cnt_enq);
 
+					/* sequencing packets that are processed locally */
+					seq_exec(seq_stage, batch, batch_cnt_enq);
+
+					if (fd) {
+						/* each pkt goes to the ring_in of its flow's instance */
+						rm_stats->elephant_buf_cnt += flow_dispatch_split(fd, batch, batch_cnt_enq, burst_tsc,
+												  pl->ring_in);
+						run_dpdk_flow_send(pl, fd, pl->ring_in, stats_qid);
+					} else {
+						/* put packets into first ring_in, round-robin change the stage instance for each batch_size_in */
+						tot_enq = rte_ring_enqueue_burst(pl->ring_in[ring_in_index], (void *)batch, batch_cnt_enq, NULL);
+						if (unlikely(tot_enq < batch_cnt_enq))
+							trace_record(TRACE_EV_RING_FULL, stats_qid, batch_cnt_enq - tot_enq, 0);
+						while(tot_enq < batch_cnt_enq && !force_quit && __atomic_load_n(&run_conf->running, __ATOMIC_RELAXED)){
+							tot_enq += rte_ring_enqueue_burst(pl->ring_in[ring_in_index], (void *)(&batch[tot_enq]), batch_cnt_enq - tot_enq, NULL);
+						}
+						if (unlikely(tot_enq < batch_cnt_enq))
+							rte_pktmbuf_free_bulk(&batch[tot_enq], batch_cnt_enq - tot_enq);
+						ring_in_index = (ring_in_index+1)%nb_ring_in;
+					}
+					/* pkts left over when the run ended were freed, stop before time keeping touches them */
+					if (unlikely(force_quit || !__atomic_load_n(&run_conf->running, __ATOMIC_RELAXED))) {
+						batch_cnt_tot_enq += batch_cnt_enq;
+						break;
+					}
 
-			batch_cnt_wait_on_deq += batch_cnt;
+					if (flags & RUN_F_LATENCY) {
+						/* end of partition time keeping */
+						if (latency_type == LATENCY_TYPE_PARTITION)
+							pkt_ts_exec(pl->ts_end_offset, batch, batch_cnt_enq);
+						/* start of aggregation time keeping */
+						else if (latency_type == LATENCY_TYPE_AGGREGATION)
+							pkt_ts_exec(pl->ts_start_offset, batch, batch_cnt_enq);
+					}
 
-			/* put packets into first ring_in */
-			tot_enq = 0;
-			to_enq =  batch_cnt;
-			nb_enq = 0;
-			
+					batch_cnt_wait_on_deq += batch_cnt_enq;
+
+					/* Note:
+					* In latency mode, we want to acquire per-packet latency. So we keep waiting on the packet that has been enqueued in this inner-inner loop.
+					* In throughput mode, we do not need to wait for inflight packets
+					*/
+					if (!(flags & RUN_F_DISPATCH)) {
+						do {
+							batch_cnt_wait_on_deq -= run_dpdk_egress(pl, &ring_out_index, mbuf, rm_stats,
+												 cur_tx, flags);
+						} while ((flags & RUN_F_LATENCY) && batch_cnt_wait_on_deq > 0 && !force_quit);
+					}
 
-			/* All packets should be forwarded to remote pipelines. ONLY for measurement of traffic routing throughput and latency.*/
-			/* prefetch pkts to be redirected and modify their mac */
-			for(int i=0; i<to_enq; i++){
-				//rte_prefetch0(rte_pktmbuf_mtod(mbuf_in[batch_cnt_tot_enq+i], void *));
-				//update_addr(mbuf_in[batch_cnt_tot_enq+i], cur_tx); 
-				update_addr(mbuf_in[batch_cnt_tot_enq+i], cur_rx); 
-				//printf("%d-%d ",mbuf_in[batch_cnt_tot_enq+i]->data_len, mbuf_in[batch_cnt_tot_enq+i]->pkt_len);
+					/* each dequeue moves on to the next tail ring_out holding pkts */
+				}/* End of inner loop. Proceed to process next pipeline batch. */
+				/* the rest of the burst when the run ended */
+				if (unlikely(batch_cnt_tot_enq < batch_cnt))
+					rte_pktmbuf_free_bulk(&mbuf_in[batch_cnt_tot_enq], batch_cnt - batch_cnt_tot_enq);
+				if (adaptive)
+					batch_size_in = batch_ctl_update(&bc, batch_cnt, rte_rdtsc() - burst_tsc);
 			}
-			/* Use second port to transmit packets */
-			while(tot_enq < batch_cnt){
-				//nb_enq = rte_eth_tx_burst(cur_tx, qid, &mbuf_in[tot_enq], to_enq);
-				nb_enq = rte_eth_tx_burst(cur_rx, qid, &mbuf_in[tot_enq], to_enq);
-				// //debug 
-				//printf("to_tx=%d, nb_txed=%d\n",to_enq,nb_enq);
-				tot_enq += nb_enq;
-				to_enq -= nb_enq;
+			else if (!(flags & RUN_F_DISPATCH) && (batch_cnt_wait_on_deq > 0 || drain)) {
+				/* no pkt received, get packets out if there is packet waiting to be dequeued */
+				batch_cnt_wait_on_deq -= run_dpdk_egress(pl, &ring_out_index, mbuf, rm_stats, cur_tx, flags);
 			}
 
-			/* all sent */
-			batch_cnt_wait_on_deq = 0;
-			/* pkts are all redirected to remote pipelines */
-			/* stats recording for throughput */
+			/* stats are printed by the housekeeping thread from the published snapshot */
+			cycles = rte_rdtsc() - start;
+			stats_publish(stats, stats_qid, start + cycles);
+		}/* End of outer loop. Proceed to receive and process next eth batch. */
+	printf("Exiting dispatcher %d\n", disp->id);
+	return 0;
+}
 
-			for (int i = 0; i < batch_cnt; i++) {
-				rte_pktmbuf_free(mbuf_in[i]);
-			}
+static __rte_always_inline int
+run_dpdk_meili(struct pipeline *pl, const uint32_t flags)
+{
+	return run_dpdk_ingress(&pl->dispatchers[0], flags);
+}
 
+static int
+run_dpdk_dispatch(struct pipeline_dispatcher *disp)
+{
+	return run_dpdk_ingress(disp, RUN_F_DISPATCH);
+}
 
-			/* Print pipeline stats every 1s */
-			cycles = rte_rdtsc() - start;
+/* Egress loop of the lcore draining the pipeline (--egress-lcore), runs until
+ * the main core stops, pipeline_post_search() takes what is left afterwards.
+ */
+static __rte_always_inline int
+run_dpdk_egress_loop(struct pipeline *pl, const uint32_t flags)
+{
+	pl_conf *run_conf = &pl->conf;
+	const int qid = pl->egress_qid;
+	rb_stats_t *stats = run_conf->stats;
+	run_mode_stats_t *rm_stats = &stats->rm_stats[qid];
+	struct rte_mbuf *mbuf[MAX_PKTS_BURST];
+	int ring_out_index = 0;
+	uint16_t cur_rx, cur_tx;
+	uint64_t tsc, now;
+	int nb_deq;
+	int ret;
 
-			if (!main_lcore){
-				continue;
-			}
-			
-			if (cycles - prev_cycles > STATS_INTERVAL_CYCLES) {
-				run_time = (double)cycles / rte_get_timer_hz();
-				prev_cycles = cycles;
-				stats_print_update(stats, run_conf->cores, run_time, false);
-			}
-		}/* End of outer loop. Proceed to receive and process next eth batch. */
+	ret = run_dpdk_get_ports(run_conf, &cur_rx, &cur_tx);
+	if (ret)
+		return ret;
+
+	while (!force_quit && run_conf->running) {
+		tsc = rte_rdtsc();
+		nb_deq = run_dpdk_egress(pl, &ring_out_index, mbuf, rm_stats, cur_tx, flags);
+		now = rte_rdtsc();
+		if (nb_deq) {
+			/* pkts taken from the pipeline, for the cycles per pkt of the lcore */
+			rm_stats->rx_batch_cnt++;
+			rm_stats->rx_buf_cnt += nb_deq;
+			rm_stats->busy_cycles += now - tsc;
+		} else {
+			rm_stats->idle_cycles += now - tsc;
+		}
+		stats_publish(stats, qid, now);
+	}
+	printf("Exiting egress\n");
 
 	return 0;
 }
-#endif
 
-#ifdef BASELINE_MODE
+/* Direct all traffic to remote pipelines right after receiving them. ONLY for measurement of traffic routing throughput and latency. */
 static int
-run_dpdk(struct pipeline *pl)
+run_dpdk_all_remote(struct pipeline *pl)
 {
 	pl_conf *run_conf = &pl->conf;
 	/* always run on main core */
 	int qid = 0;
 	const uint32_t max_duration = run_conf->input_duration;
-	uint32_t batch_size = run_conf->input_batches;
-	uint32_t batch_size_in = 0;
-	uint32_t batch_size_out = 0;
 	int batch_cnt = 0;
-	int batch_cnt_enq = 0;
-	int batch_cnt_wait_on_enq = 0;
-	int batch_cnt_wait_on_deq = 0; /* used for throughput and latency mode. */
-	int batch_cnt_tot_enq = 0;
-	int batch_cnt_deq = 0;
-	int batch_cnt_tot_deq = 0;
-	int nb_out_ring_remain= 0;
 	rb_stats_t *stats = run_conf->stats;
 	run_mode_stats_t *rm_stats = &stats->rm_stats[qid];
-	// TODO: rename regex_stats_t to other names
-	//regex_stats_t *regex_stats = &stats->regex_stats[qid];
 
-	/* for packet transmission */	
-	uint16_t cur_rx, cur_tx, tx_port_id, rx_port_id;
-	const unsigned char *pkt;
-	pkt_stats_t *pkt_stats;
-	dpdk_egress_t *dpdk_tx;
-	bool dual_port;
+	/* for packet transmission */
+	uint16_t cur_rx, cur_tx;
 
 	/* time keeping */
-	uint64_t prev_cycles;
-	uint64_t prev_cycles_debug = 0;
 	uint64_t max_cycles;
 	uint64_t cycles;
-	double run_time;
 	uint64_t start;
-	double rate = 0;
 
-	bool main_lcore;
-	
 	int ret;
-	int flag = 0;
 
-	// for baseline implementation, each stage can only use one core 
 	/* special pipeline stages(have already been init in pipeline_init) */
-	struct pipeline_stage *seq_stage = &pl->seq_stage;
-	struct pipeline_stage *reorder_stage = &pl->reorder_stage;
+	struct pipeline_stage *seq_stage = &pl->dispatchers[0].seq_stage;
 
 	struct rte_mbuf *mbuf_in[MAX_PKTS_BURST];
-	struct rte_mbuf *mbuf_out[MAX_PKTS_BURST];
-	struct rte_mbuf **mbuf_out_temp = mbuf_out;
-	int nb_enq;
-	int to_enq;
-	int tot_enq;
 
-	int nb_deq_reorder;
-
-	int nb_tx;
-	int to_tx;
-	int tot_tx;
+	/* Convert duration to cycles. */
+	max_cycles = max_duration * rte_get_timer_hz();
+	cycles = 0;
 
+	ret = run_dpdk_get_ports(run_conf, &cur_rx, &cur_tx);
+	if (ret)
+		return ret;
 
-	//debug
-	int ring_in_index = 0;
-	int ring_out_index = 0;
-	int nb_first_stage = pl->nb_pl_stages? pl->nb_inst_per_pl_stage[0]:1;
-	int nb_last_stage = pl->nb_pl_stages? pl->nb_inst_per_pl_stage[pl->nb_pl_stages-1]:1;
+	start = rte_rdtsc();
 
-	struct pipeline_stage *self;
+	MEILI_LOG_INFO("Using test mode: ALL_REMOTE_ON_ARRIVAL");
+	MEILI_LOG_INFO("Eth batch size = %d",DEFAULT_ETH_BATCH_SIZE);
 
+	/* start reading packets from eth */
+	while (!force_quit
+			&& (!max_cycles || cycles <= max_cycles))
+		{
+			batch_cnt = rte_eth_rx_burst(cur_rx, qid, mbuf_in, DEFAULT_ETH_BATCH_SIZE);
 
-	/* Keep coverity check happy by initialising. */
-	memset(&mbuf_in[0], '\0', sizeof(struct rte_mbuf *) * batch_size);
-	memset(&mbuf_out[0], '\0', sizeof(struct rte_mbuf *) * batch_size);
+			if(batch_cnt > 0){
+				trace_record(TRACE_EV_RX_BURST, cur_rx, batch_cnt, 0);
+				if (run_conf->prefetch_dist)
+					run_dpdk_prefetch_rx(mbuf_in, batch_cnt, false);
+				for(int k=0; k<batch_cnt ; k++) {
+					rm_stats->rx_buf_cnt++;
+					rm_stats->rx_buf_bytes += mbuf_in[k]->data_len;
+				}
 
+				/* stats recording for throughput, pkts are all redirected to remote pipelines */
+				rm_stats->tx_batch_cnt ++;
+				for (int i = 0; i < batch_cnt; i++) {
+					rm_stats->tx_buf_cnt++;
+					rm_stats->tx_buf_bytes += mbuf_in[i]->data_len;
+				}
 
+				/* sequencing packets that are processed locally */
+				seq_exec(seq_stage, mbuf_in, batch_cnt);
 
-	/* Convert duration to cycles. */
-	max_cycles = max_duration * rte_get_timer_hz();
-	prev_cycles = 0;
-	cycles = 0;
+				/* send pkts back through the rx port, the driver frees them once sent */
+				run_dpdk_tx(cur_rx, qid, mbuf_in, batch_cnt);
+			}
 
-	main_lcore = rte_lcore_id() == rte_get_main_lcore();
+			/* stats are printed by the housekeeping thread from the published snapshot */
+			cycles = rte_rdtsc() - start;
+			stats_publish(stats, qid, start + cycles);
+		}/* End of outer loop. Proceed to receive and process next eth batch. */
 
+	return 0;
+}
 
-	/* Get ports */
-	pkt_stats = &rm_stats->pkt_stats;
-	dpdk_tx = rte_malloc(NULL, sizeof(*dpdk_tx), 64);
-	if (!dpdk_tx) {
-		MEILI_LOG_ERR("Memory failure on tx queue.");
-		return -ENOMEM;
-	}
+/* Baseline: the first stage instance processes all packets on the main core. */
+static __rte_always_inline int
+run_dpdk_baseline(struct pipeline *pl, const uint32_t flags)
+{
+	pl_conf *run_conf = &pl->conf;
+	/* always run on main core */
+	int qid = 0;
+	const uint32_t max_duration = run_conf->input_duration;
+	const uint32_t batch_size_in = run_conf->input_batches;
+	int batch_cnt = 0;
+	int batch_cnt_enq = 0;
+	int batch_cnt_tot_enq = 0;
+	rb_stats_t *stats = run_conf->stats;
+	run_mode_stats_t *rm_stats = &stats->rm_stats[qid];
 
+	/* for packet transmission */
+	uint16_t cur_rx, cur_tx;
 
-	MEILI_LOG_INFO("Checking port %s",run_conf->port1);
-	ret = rte_eth_dev_get_port_by_name(run_conf->port1, &primary_port_id);
-	if (ret) {
-		MEILI_LOG_ERR("Cannot find port %s.", run_conf->port1);
-		return -EINVAL;
-	}
-	ret = get_port_macaddr(primary_port_id, &primary_mac_addr);
-	if(ret){
-		MEILI_LOG_ERR("Cannot get port %s eth addr.", run_conf->port1);
-		return -EINVAL;
-	}
+	/* time keeping */
+	uint64_t max_cycles;
+	uint64_t cycles;
+	uint64_t start;
 
-	/* second port is for sending traffic out of the pipeline */
-	dual_port = false;
-	if (run_conf->port2) {
-		MEILI_LOG_INFO("Checking port %s",run_conf->port2);
-		ret = rte_eth_dev_get_port_by_name(run_conf->port2, &second_port_id);
-		if (ret) {
-			MEILI_LOG_ERR("Cannot find port %s.", run_conf->port2);
-			return -EINVAL;
-		}
-		ret = get_port_macaddr(second_port_id, &second_mac_addr);
-		if(ret){
-			MEILI_LOG_ERR("Cannot get port %s eth addr.", run_conf->port1);
-			return -EINVAL;
-		}
-		dual_port = true;
-	}
+	int ret;
 
-	if(dual_port){
-		MEILI_LOG_INFO("Using dual port, %s-port %d-rx, %s-port %d-tx",run_conf->port1, primary_port_id, run_conf->port2, second_port_id);
-	}
+	struct rte_mbuf *mbuf_in[MAX_PKTS_BURST];
+	struct rte_mbuf **batch;
 
-	
-		
-	// dpdk_tx->port_cnt[PRIM_PORT_IDX] = 0;
-	// dpdk_tx->port_cnt[SEC_PORT_IDX] = 0;
+	struct pipeline_stage *self;
+	int (*stage_exec)(struct pipeline_stage *self, meili_pkt *pkt);
 
-	/* Default mode ingresses and egresses on the primary port. */
-	cur_rx = primary_port_id;
-	cur_tx = second_port_id;
-	// rx_port_id = PRIM_PORT_IDX;
-	// tx_port_id = SEC_PORT_IDX;
+	if (!pl->nb_pl_stages || !pl->nb_inst_per_pl_stage[0]) {
+		MEILI_LOG_ERR("Baseline mode requires at least one pipeline stage instance.");
+		return -EINVAL;
+	}
 
-		
-	/* several different versions of batch size */
-	//batch_size_in = 1;
-	// batch_size_in = nb_first_stage? batch_size * nb_first_stage:batch_size;
-	batch_size_in = batch_size;
+	/* each stage can only use one core */
+	self = pl->stages[0][0];
+	stage_exec = self->funcs->pipeline_stage_exec;
+	if (!stage_exec) {
+		MEILI_LOG_ERR("Invalid execution function");
+		return -EINVAL;
+	}
 
-	batch_size_out = MAX_PKTS_BURST;
-	//batch_size_out = batch_size * nb_last_stage;
-	//batch_size_out = batch_size;
+	/* Convert duration to cycles. */
+	max_cycles = max_duration * rte_get_timer_hz();
+	cycles = 0;
 
+	ret = run_dpdk_get_ports(run_conf, &cur_rx, &cur_tx);
+	if (ret)
+		return ret;
 
 	start = rte_rdtsc();
 
 	MEILI_LOG_INFO("Using test mode: BASELINE MODE");
-	MEILI_LOG_INFO("Eth batch size = %d, batch_size_in = %d, batch_size_out = %d",DEFAULT_ETH_BATCH_SIZE, batch_size_in, batch_size_out);
+	MEILI_LOG_INFO("Eth batch size = %d, batch_size_in = %d",DEFAULT_ETH_BATCH_SIZE, batch_size_in);
 
-	self = pl->stages[0][0];
 	/* start reading packets from eth */
-	while (!force_quit 
-			&& (!max_cycles || cycles <= max_cycles)) 
+	while (!force_quit
+			&& (!max_cycles || cycles <= max_cycles))
 		{
-			batch_cnt = 0;
-			batch_cnt_tot_enq = 0;
 			batch_cnt = rte_eth_rx_burst(cur_rx, qid, mbuf_in, DEFAULT_ETH_BATCH_SIZE);
+			if (batch_cnt)
+				trace_record(TRACE_EV_RX_BURST, cur_rx, batch_cnt, 0);
+			if ((flags & RUN_F_LATENCY) && run_conf->prefetch_dist)
+				run_dpdk_prefetch_rx(mbuf_in, batch_cnt, false);
 
-			batch_cnt_wait_on_enq = batch_cnt;
 			for(int k=0; k<batch_cnt ; k++) {
 				rm_stats->rx_buf_cnt++;
 				rm_stats->rx_buf_bytes += mbuf_in[k]->data_len;
 			}
 
-			if(batch_cnt <= 0){
-				/* no pkt received */
-				continue;
-			}
-			#ifdef LATENCY_END2END
-			while(batch_cnt_wait_on_enq > 0){
-			#endif
-				nb_enq = RTE_MIN(batch_size_in, batch_cnt_wait_on_enq);
-				batch_cnt_wait_on_deq += nb_enq;
-				batch_cnt_wait_on_enq -= nb_enq;
+			for (batch_cnt_tot_enq = 0; batch_cnt_tot_enq < batch_cnt; batch_cnt_tot_enq += batch_cnt_enq) {
+				batch_cnt_enq = RTE_MIN(batch_size_in, batch_cnt - batch_cnt_tot_enq);
+				batch = &mbuf_in[batch_cnt_tot_enq];
 
+				if (flags & RUN_F_LATENCY)
+					pkt_ts_exec(pl->ts_start_offset, batch, batch_cnt_enq);
 
-			#ifdef LATENCY_END2END
-			pkt_ts_exec(pl->ts_start_offset, &mbuf_in[batch_cnt_tot_enq], nb_enq);
-			#endif
 				/* directly processing packets */
-				#ifdef LATENCY_END2END
-				while(batch_cnt_wait_on_deq > 0){
-				#endif
-				pipeline_stage_exec_safe(self, &mbuf_in[batch_cnt_tot_enq], nb_enq, &mbuf_out_temp, &batch_cnt_deq);
-				batch_cnt_wait_on_deq -= batch_cnt_deq;
-				nb_enq = 0;
-				#ifdef LATENCY_END2END
+				pipeline_prefetch_start(batch, batch_cnt_enq, self->prefetch);
+				for (int i = 0; i < batch_cnt_enq; i++) {
+					pipeline_prefetch_ahead(batch, i, batch_cnt_enq, self->prefetch);
+					stage_exec(self, batch[i]);
 				}
-				#endif
-				
-				//printf("batch_cnt_deq=%d\n",batch_cnt_deq);
-				#ifdef LATENCY_END2END
-				pkt_ts_exec(pl->ts_end_offset, mbuf_out_temp, batch_cnt_deq);
-				stats_update_time_main(mbuf_out_temp, batch_cnt_deq, pl);
-				#endif
-				if( likely(batch_cnt_deq > 0) ) {
-					rm_stats->tx_batch_cnt ++;
-				}
-				for (int i = 0; i < batch_cnt_deq; i++) {
-					rm_stats->tx_buf_cnt++;
-					rm_stats->tx_buf_bytes += mbuf_out_temp[i]->data_len;
-					rte_pktmbuf_free(mbuf_out_temp[i]);
+
+				if (flags & RUN_F_LATENCY) {
+					pkt_ts_exec(pl->ts_end_offset, batch, batch_cnt_enq);
+					stats_update_time_main(batch, batch_cnt_enq, pl);
 				}
-				batch_cnt_tot_enq += nb_enq;
-			#ifdef LATENCY_END2END
-			}
-			#endif
 
+				run_dpdk_finish(batch, batch_cnt_enq, rm_stats, cur_tx, flags);
+			}
 
-			/* Print pipeline stats every 1s */
+			/* stats are printed by the housekeeping thread from the published snapshot */
 			cycles = rte_rdtsc() - start;
-
-			if (!main_lcore){
-				continue;
-			}
-			
-			if (cycles - prev_cycles > STATS_INTERVAL_CYCLES) {
-				run_time = (double)cycles / rte_get_timer_hz();
-				prev_cycles = cycles;
-				stats_print_update(stats, run_conf->cores, run_time, false);
-			}
+			stats_publish(stats, qid, start + cycles);
 		}/* End of outer loop. Proceed to receive and process next eth batch. */
 
 	return 0;
 }
-#endif
 
+/* Instantiate one main loop per valid combination of run mode flags. */
+#define RUN_DPDK_VARIANT(loop, name, flags)		\
+static int						\
+run_dpdk_##loop##_##name(struct pipeline *pl)		\
+{							\
+	return run_dpdk_##loop(pl, flags);		\
+}
+
+RUN_DPDK_VARIANT(meili, tput, 0)
+RUN_DPDK_VARIANT(meili, tput_tx, RUN_F_REMOTE_TX)
+RUN_DPDK_VARIANT(meili, lat, RUN_F_LATENCY)
+RUN_DPDK_VARIANT(meili, lat_tx, RUN_F_LATENCY | RUN_F_REMOTE_TX)
+RUN_DPDK_VARIANT(meili, main, RUN_F_ONLY_MAIN)
+RUN_DPDK_VARIANT(meili, main_tx, RUN_F_ONLY_MAIN | RUN_F_REMOTE_TX)
+RUN_DPDK_VARIANT(meili, rl, RUN_F_RATE_LIMIT)
+RUN_DPDK_VARIANT(meili, rl_tx, RUN_F_RATE_LIMIT | RUN_F_REMOTE_TX)
+RUN_DPDK_VARIANT(meili, disp, RUN_F_DISPATCH)
+RUN_DPDK_VARIANT(meili, rl_disp, RUN_F_RATE_LIMIT | RUN_F_DISPATCH)
+RUN_DPDK_VARIANT(egress_loop, tput, 0)
+RUN_DPDK_VARIANT(egress_loop, tput_tx, RUN_F_REMOTE_TX)
+RUN_DPDK_VARIANT(baseline, tput, 0)
+RUN_DPDK_VARIANT(baseline, lat, RUN_F_LATENCY)
+
+struct run_dpdk_variant {
+	uint32_t flags;
+	int (*run)(struct pipeline *pl);
+};
+
+static const struct run_dpdk_variant run_dpdk_meili_variants[] = {
+	{0,						run_dpdk_meili_tput},
+	{RUN_F_REMOTE_TX,				run_dpdk_meili_tput_tx},
+	{RUN_F_LATENCY,					run_dpdk_meili_lat},
+	{RUN_F_LATENCY | RUN_F_REMOTE_TX,		run_dpdk_meili_lat_tx},
+	{RUN_F_ONLY_MAIN,				run_dpdk_meili_main},
+	{RUN_F_ONLY_MAIN | RUN_F_REMOTE_TX,		run_dpdk_meili_main_tx},
+	{RUN_F_RATE_LIMIT,				run_dpdk_meili_rl},
+	{RUN_F_RATE_LIMIT | RUN_F_REMOTE_TX,		run_dpdk_meili_rl_tx},
+	{RUN_F_DISPATCH,				run_dpdk_meili_disp},
+	{RUN_F_RATE_LIMIT | RUN_F_DISPATCH,		run_dpdk_meili_rl_disp},
+};
 
 void
-run_dpdk_reg(run_func_t *funcs)
+run_dpdk_reg(run_func_t *funcs, pl_conf *run_conf)
 {
-	funcs->run = run_dpdk;
+	uint32_t flags = 0;
+	uint32_t i;
+
+	if (run_conf->run_mode == RUN_MODE_ALL_REMOTE_ON_ARRIVAL) {
+		funcs->run = run_dpdk_all_remote;
+		return;
+	}
+
+	if (run_conf->run_mode == RUN_MODE_BASELINE) {
+		funcs->run = run_conf->latency_mode ? run_dpdk_baseline_lat : run_dpdk_baseline_tput;
+		return;
+	}
+
+	if (run_conf->latency_mode)
+		flags |= RUN_F_LATENCY;
+	if (run_conf->only_main_mode)
+		flags |= RUN_F_ONLY_MAIN;
+	if (run_conf->remote_after_processing)
+		flags |= RUN_F_REMOTE_TX;
+	if (run_conf->rate_limit_mbps || run_conf->rate_limit_kpps)
+		flags |= RUN_F_RATE_LIMIT;
+
+	/* conf validation only allows more dispatchers in throughput mode, they never transmit */
+	funcs->dispatch = run_dpdk_dispatch;
+
+	/* the egress lcore transmits, the main core only receives */
+	if (run_conf->egress_lcore) {
+		funcs->egress = (flags & RUN_F_REMOTE_TX) ? run_dpdk_egress_loop_tput_tx : run_dpdk_egress_loop_tput;
+		flags = (flags & ~RUN_F_REMOTE_TX) | RUN_F_DISPATCH;
+	}
+
+	/* conf validation rejects exclusive flags, fall back to plain throughput mode */
+	funcs->run = run_dpdk_meili_tput;
+	for (i = 0; i < RTE_DIM(run_dpdk_meili_variants); i++) {
+		if (run_dpdk_meili_variants[i].flags == flags) {
+			funcs->run = run_dpdk_meili_variants[i].run;
+			break;
+		}
+	}
 }
@@ -29,50 +29,12 @@
 
 #define DEFAULT_ETH_BATCH_SIZE 64
 
-/* rte ring working mode */
-//#define SHARED_BUFFER
-
-/* defines in set 0 is compatible with defines in set 1 */
-/* exclusvie runing modes set 0 */
-//#define RATE_LIMIT_BPS_ON 	/* throughput mode with bps rate limit on */ 
-//#define RATE_LIMIT_PPS_ON		/* throughput mode with pps rate limit on */  
-//#define LATENCY_MODE_ON 		/* per pkt latency measurement mode */  
-//#define ONLY_MAIN_MODE_ON		/* only running main loop without enqueue/dequeue */ 
-
-/* exclusvie runing modes set 1 */
-// #define ALL_REMOTE_ON_ARRIVAL 			/* direct all traffic to remote pipelines right after receiving them */
-//#define ALL_REMOTE_AFTER_PROCESSING		/* direct all traffic to remote pipelines after processing them locally */
-#define MEILI_MODE
-// #define BASELINE_MODE
-
-#ifdef RATE_LIMIT_BPS_ON   
-#define RATE_Gbps 10
-#endif
-
-#ifdef RATE_LIMIT_PPS_ON  
-#define RATE_Mpps 1
-#endif
-
-#ifdef LATENCY_MODE_ON
-	/* which latency to record */
-	#define LATENCY_END2END
-	//#define LATENCY_PARTITION
-	//#define LATENCY_AGGREGATION 
-
-	/* latency sampling mode to view tail latency */
-	#define PKT_LATENCY_SAMPLE_ON
-	//#define PKT_LATENCY_BREAKDOWN_ON
-
-	/* batch size - per-pkt processing */
-	#define DEFAULT_BATCH_SIZE 1
-#else
-	//test
-	//#define LATENCY_END2END
-	//#define LATENCY_PARTITION
-	//#define LATENCY_AGGREGATION
-	//#define PKT_LATENCY_SAMPLE_ON
-	#define DEFAULT_BATCH_SIZE 64
-#endif
+/* Run modes (shared buffer, rate limit, latency, only main, remote tx, baseline...)
+ * are selected at runtime through pl_conf, see --run-mode and related options. */
+
+/* batch size - per-pkt processing in latency mode */
+#define LATENCY_BATCH_SIZE 1
+#define DEFAULT_BATCH_SIZE 64
 
 
 
@@ -80,11 +42,15 @@ extern volatile bool force_quit;
 
 typedef struct run_func {
 	int (*run)(struct pipeline *pl);
+	/* ingress loop of the dispatchers other than the main core, NULL if the run mode has a single one */
+	int (*dispatch)(struct pipeline_dispatcher *disp);
+	/* egress loop of the lcore draining the pipeline, NULL if the main core drains it */
+	int (*egress)(struct pipeline *pl);
 } run_func_t;
 
 void run_local_reg(run_func_t *funcs);
 
-void run_dpdk_reg(run_func_t *funcs);
+void run_dpdk_reg(run_func_t *funcs, pl_conf *run_conf);
 
 /* Register run mode functions as dicatated by input mode selected. */
 static inline int
@@ -108,7 +74,8 @@ run_mode_register(struct pipeline *pl)
 		break;
 
 	case INPUT_LIVE:
-		run_dpdk_reg(funcs);
+	case INPUT_SYNTHETIC:
+		run_dpdk_reg(funcs, run_conf);
 		break;
 
 	default:
@@ -133,4 +100,26 @@ run_mode_launch(struct pipeline *pl)
 	return -EINVAL;
 }
 
+static inline int
+run_mode_dispatch(struct pipeline_dispatcher *disp)
+{
+	run_func_t *funcs = ((struct pipeline *)disp->pl)->conf.run_funcs;
+
+	if (funcs->dispatch)
+		return funcs->dispatch(disp);
+
+	return -EINVAL;
+}
+
+static inline int
+run_mode_egress(struct pipeline *pl)
+{
+	run_func_t *funcs = pl->conf.run_funcs;
+
+	if (funcs->egress)
+		return funcs->egress(pl);
+
+	return -EINVAL;
+}
+
 #endif /* _INCLUDE_RUN_H_ */
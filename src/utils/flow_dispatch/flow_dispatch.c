@@ -0,0 +1,108 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* Flow affinity dispatch, see flow_dispatch.h.
+ *
+ * example:
+ * ./build/meili ... --flow-affinity --elephant-kpps 500 --control /tmp/meili.ctl
+ * echo "scale 4" | socat - UNIX-CONNECT:/tmp/meili.ctl
+ */
+
+#include <rte_cycles.h>
+#include <rte_malloc.h>
+
+#include "flow_dispatch.h"
+
+#define FLOW_MAP_SEED_OFFSET	0x5bd1e995
+#define FLOW_MAP_SEED_SKIP	0x1b873593
+
+struct flow_dispatch *
+flow_dispatch_create(uint32_t nb_inst, uint32_t elephant_kpps, const struct flow_map *map)
+{
+	struct flow_dispatch *fd;
+
+	fd = rte_zmalloc("flow_dispatch", sizeof(*fd), RTE_CACHE_LINE_SIZE);
+	if (!fd)
+		return NULL;
+	fd->nb = rte_zmalloc("flow_dispatch_nb", nb_inst * sizeof(*fd->nb), RTE_CACHE_LINE_SIZE);
+	fd->bucket = rte_zmalloc("flow_dispatch_bucket", nb_inst * FLOW_DISPATCH_BURST * sizeof(*fd->bucket),
+				 RTE_CACHE_LINE_SIZE);
+	fd->hold = rte_zmalloc("flow_dispatch_hold", FLOW_DISPATCH_HOLD * sizeof(*fd->hold), RTE_CACHE_LINE_SIZE);
+	if (!fd->nb || !fd->bucket || !fd->hold) {
+		flow_dispatch_free(fd);
+		return NULL;
+	}
+
+	fd->nb_inst = nb_inst;
+	fd->map = map;
+	/* kpps are pkts per ms */
+	fd->threshold = elephant_kpps ? RTE_MAX((uint64_t)elephant_kpps * FLOW_DISPATCH_EPOCH_US / 1000, 1) : 0;
+	fd->epoch_cycles = rte_get_timer_hz() * FLOW_DISPATCH_EPOCH_US / US_PER_S;
+	fd->flowlet_cycles = rte_get_timer_hz() * FLOW_DISPATCH_FLOWLET_US / US_PER_S;
+	fd->hold_cycles = rte_get_timer_hz() * FLOW_DISPATCH_HOLD_US / US_PER_S;
+
+	return fd;
+}
+
+void
+flow_dispatch_free(struct flow_dispatch *fd)
+{
+	if (!fd)
+		return;
+	/* pkts still held when the run stopped */
+	if (fd->nb_hold > fd->hold_head)
+		rte_pktmbuf_free_bulk(&fd->hold[fd->hold_head], fd->nb_hold - fd->hold_head);
+	rte_free(fd->hold);
+	rte_free(fd->nb);
+	rte_free(fd->bucket);
+	rte_free(fd);
+}
+
+struct flow_map *
+flow_map_create(uint32_t nb_active)
+{
+	struct flow_map *map;
+	uint32_t *pos, *skip;
+	uint32_t filled = 0;
+	uint32_t i, slot;
+
+	if (!nb_active || nb_active >= FLOW_MAP_EMPTY)
+		return NULL;
+
+	map = rte_zmalloc("flow_map", sizeof(*map), RTE_CACHE_LINE_SIZE);
+	pos = rte_malloc(NULL, 2 * nb_active * sizeof(*pos), 0);
+	if (!map || !pos) {
+		rte_free(map);
+		rte_free(pos);
+		return NULL;
+	}
+	skip = pos + nb_active;
+
+	/* the permutation of an instance only depends on its id, not on nb_active */
+	for (i = 0; i < nb_active; i++) {
+		pos[i] = rte_hash_crc_4byte(i, FLOW_MAP_SEED_OFFSET) % FLOW_MAP_SIZE;
+		skip[i] = rte_hash_crc_4byte(i, FLOW_MAP_SEED_SKIP) % (FLOW_MAP_SIZE - 1) + 1;
+	}
+	memset(map->entry, 0xff, sizeof(map->entry));
+
+	/* instances take turns claiming the next free slot of their permutation */
+	while (filled < FLOW_MAP_SIZE) {
+		for (i = 0; i < nb_active && filled < FLOW_MAP_SIZE; i++) {
+			do {
+				slot = pos[i];
+				pos[i] = (pos[i] + skip[i]) % FLOW_MAP_SIZE;
+			} while (map->entry[slot] != FLOW_MAP_EMPTY);
+			map->entry[slot] = i;
+			filled++;
+		}
+	}
+	map->nb_active = nb_active;
+	rte_free(pos);
+
+	return map;
+}
+
+void
+flow_map_free(struct flow_map *map)
+{
+	rte_free(map);
+}
@@ -0,0 +1,292 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_FLOW_DISPATCH_H_
+#define _INCLUDE_FLOW_DISPATCH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <rte_byteorder.h>
+#include <rte_common.h>
+#include <rte_debug.h>
+#include <rte_ether.h>
+#include <rte_hash_crc.h>
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+
+/* Flow affinity dispatch (--flow-affinity). A dispatcher hands every pkt to the
+ * first stage instance its flow hashes to instead of round-robin chunks, so
+ * the state of a flow stays on one instance. A heavy hitter would pin its
+ * instance though, so with --elephant-kpps each dispatcher also counts pkts
+ * per flow in a count-min sketch over epochs of FLOW_DISPATCH_EPOCH_US. A flow
+ * above the rate in the current or the last epoch is an elephant and is
+ * sprayed flowlet by flowlet: after an idle gap of FLOW_DISPATCH_FLOWLET_US
+ * its next pkts go to the instance with the shortest input ring. As long as
+ * the gap exceeds the difference in queueing delay between instances the pkts
+ * of an elephant still leave in order. Mice keep strict affinity.
+ *
+ * Flows map to instances through a Maglev lookup table: each instance fills
+ * the slots of its own permutation of the table in turn, so changing the num
+ * of active instances (the scale control command) only moves about 1/N of the
+ * flows. Maps are built by the control thread and read-only once published,
+ * the other dispatch state is private to its dispatcher.
+ *
+ * When stages keep per flow state (see meili_flow_state.h) a dispatcher holds
+ * the pkts of the flows a new map moves until their state reached the new
+ * instance, at most FLOW_DISPATCH_HOLD pkts for FLOW_DISPATCH_HOLD_US.
+ */
+
+#define FLOW_DISPATCH_BURST		64	/* max pkts split at once */
+#define FLOW_DISPATCH_SKETCH_ROWS	4
+#define FLOW_DISPATCH_SKETCH_BITS	11	/* 2048 counters per row */
+#define FLOW_DISPATCH_EPOCH_US		1000
+#define FLOW_DISPATCH_FLOWLET_US	50
+#define FLOW_DISPATCH_FLOWLETS		256	/* elephants tracked at once, power of 2 */
+#define FLOW_DISPATCH_HOLD		4096	/* pkts of moved flows held at once */
+#define FLOW_DISPATCH_HOLD_US		10000
+#define FLOW_MAP_SIZE			8191	/* slots of a map, prime */
+#define FLOW_MAP_EMPTY			UINT16_MAX
+
+struct flow_map {
+	uint32_t nb_active;			/* instances 0 to nb_active - 1 take flows */
+	uint32_t gen;				/* scale events before this map */
+	uint16_t entry[FLOW_MAP_SIZE];		/* instance per slot */
+};
+
+struct flow_dispatch_flowlet {
+	uint32_t hash;
+	uint32_t inst;		/* instance of the current flowlet */
+	uint64_t last_tsc;	/* last pkt of the flow */
+};
+
+struct flow_dispatch {
+	uint32_t nb_inst;
+	const struct flow_map *map;		/* read by the control thread, see flow_dispatch_remap() */
+	const struct flow_map *prev;		/* map before the last scale event, NULL if none */
+	uint32_t threshold;			/* pkts per epoch making an elephant, 0 = no detection */
+	uint64_t epoch_cycles;
+	uint64_t flowlet_cycles;
+	uint64_t epoch_tsc;			/* start of the current epoch */
+	uint32_t cur;				/* sketch of the current epoch, the other one holds the last */
+	uint16_t *nb;				/* pkts per instance in bucket */
+	struct rte_mbuf **bucket;		/* FLOW_DISPATCH_BURST slots per instance */
+	bool holding;				/* pkts of flows moved by the last remap are held */
+	uint64_t hold_cycles;
+	uint64_t hold_deadline;			/* tsc the held pkts go out at the latest */
+	uint32_t hold_head;			/* next held pkt to release */
+	uint32_t nb_hold;
+	struct rte_mbuf **hold;			/* FLOW_DISPATCH_HOLD slots, in arrival order */
+	struct flow_dispatch_flowlet flowlets[FLOW_DISPATCH_FLOWLETS];
+	uint32_t sketch[2][FLOW_DISPATCH_SKETCH_ROWS][1 << FLOW_DISPATCH_SKETCH_BITS];
+};
+
+/* Dispatch state for nb_inst first stage instances mapped by map, elephants
+ * are flows above elephant_kpps (0 = none).
+ */
+struct flow_dispatch *flow_dispatch_create(uint32_t nb_inst, uint32_t elephant_kpps, const struct flow_map *map);
+void flow_dispatch_free(struct flow_dispatch *fd);
+
+/* Maglev table spreading flows over nb_active instances. */
+struct flow_map *flow_map_create(uint32_t nb_active);
+void flow_map_free(struct flow_map *map);
+
+static const uint32_t flow_dispatch_seeds[FLOW_DISPATCH_SKETCH_ROWS] = {
+	0x9e3779b1, 0x85ebca77, 0xc2b2ae3d, 0x27d4eb2f,
+};
+
+/* Symmetric flow hash of a pkt. The rss hash is taken when the port (or the
+ * synthetic input) provides one, live ports hash the ip addresses and tcp/udp
+ * ports with a symmetric key (see input_dpdk_port_init()). The 5-tuple is
+ * hashed otherwise, non-ipv4 pkts all share one flow. Either way it is mixed,
+ * rss hashes of a queue share their low bits and synthetic ones are small flow
+ * ids.
+ */
+static inline uint32_t
+flow_dispatch_hash(struct rte_mbuf *m)
+{
+	struct rte_ether_hdr *eth;
+	struct rte_ipv4_hdr *ip;
+	rte_be16_t *l4;
+	uint32_t ports = 0;
+	uint32_t ihl;
+
+	if (m->ol_flags & PKT_RX_RSS_HASH)
+		return rte_hash_crc_4byte(m->hash.rss, 0);
+
+	eth = rte_pktmbuf_mtod(m, struct rte_ether_hdr *);
+	if (m->data_len < sizeof(*eth) + sizeof(*ip) || eth->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
+		return 0;
+	ip = (struct rte_ipv4_hdr *)(eth + 1);
+	ihl = (ip->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+	if ((ip->next_proto_id == IPPROTO_TCP || ip->next_proto_id == IPPROTO_UDP) &&
+	    m->data_len >= sizeof(*eth) + ihl + 2 * sizeof(*l4)) {
+		l4 = (rte_be16_t *)((char *)ip + ihl);
+		ports = l4[0] ^ l4[1];
+	}
+
+	/* xor keeps both directions of a flow together */
+	return rte_hash_crc_4byte(ip->src_addr ^ ip->dst_addr, rte_hash_crc_4byte(ports | ip->next_proto_id << 16, 0));
+}
+
+static inline uint32_t
+flow_map_lookup(const struct flow_map *map, uint32_t hash)
+{
+	return map->entry[hash % FLOW_MAP_SIZE];
+}
+
+/* Instance a mouse flow is pinned to. */
+static inline uint32_t
+flow_dispatch_inst(const struct flow_dispatch *fd, uint32_t hash)
+{
+	return flow_map_lookup(fd->map, hash);
+}
+
+/* Switch to a map published by the control thread. The store tells it the
+ * dispatcher let go of the map before prev, which may be freed then. With hold
+ * set, pkts of moved flows are held from now on, see flow_dispatch_release().
+ */
+static inline void
+flow_dispatch_remap(struct flow_dispatch *fd, const struct flow_map *map, bool hold, uint64_t now)
+{
+	fd->prev = fd->map;
+	__atomic_store_n(&fd->map, map, __ATOMIC_RELEASE);
+	fd->holding = hold;
+	fd->hold_deadline = now + fd->hold_cycles;
+}
+
+/* Start a new epoch once the current one is over, the last one is kept. */
+static inline void
+flow_dispatch_epoch(struct flow_dispatch *fd, uint64_t now)
+{
+	uint64_t elapsed = now - fd->epoch_tsc;
+
+	if (likely(elapsed < fd->epoch_cycles))
+		return;
+	fd->cur ^= 1;
+	memset(fd->sketch[fd->cur], 0, sizeof(fd->sketch[0]));
+	/* nothing was counted during the last epoch */
+	if (elapsed >= 2 * fd->epoch_cycles)
+		memset(fd->sketch[fd->cur ^ 1], 0, sizeof(fd->sketch[0]));
+	fd->epoch_tsc = now;
+}
+
+/* Count a pkt of the flow, returns true if the flow is an elephant. */
+static inline bool
+flow_dispatch_count(struct flow_dispatch *fd, uint32_t hash)
+{
+	uint32_t est = UINT32_MAX;
+	uint32_t last = UINT32_MAX;
+	uint32_t idx;
+	int r;
+
+	for (r = 0; r < FLOW_DISPATCH_SKETCH_ROWS; r++) {
+		idx = (hash * flow_dispatch_seeds[r]) >> (32 - FLOW_DISPATCH_SKETCH_BITS);
+		est = RTE_MIN(est, ++fd->sketch[fd->cur][r][idx]);
+		last = RTE_MIN(last, fd->sketch[fd->cur ^ 1][r][idx]);
+	}
+
+	return est >= fd->threshold || last >= fd->threshold;
+}
+
+/* Instance of the current flowlet of an elephant, a new flowlet starts on the
+ * active instance with the fewest pkts queued after an idle gap, or at once if
+ * its instance was scaled in. A flow just detected stays on its own instance
+ * until its first gap. Two elephants in the same slot keep evicting each other
+ * and fall back to affinity.
+ */
+static inline uint32_t
+flow_dispatch_flowlet(struct flow_dispatch *fd, uint32_t hash, uint64_t now, struct rte_ring **rings)
+{
+	struct flow_dispatch_flowlet *fl = &fd->flowlets[hash & (FLOW_DISPATCH_FLOWLETS - 1)];
+	uint32_t count, min = UINT32_MAX;
+	uint32_t i;
+
+	if (fl->hash != hash) {
+		fl->hash = hash;
+		fl->inst = flow_dispatch_inst(fd, hash);
+	} else if (now - fl->last_tsc > fd->flowlet_cycles || fl->inst >= fd->map->nb_active) {
+		for (i = 0; i < fd->map->nb_active; i++) {
+			count = rte_ring_count(rings[i]) + fd->nb[i];
+			if (count < min) {
+				min = count;
+				fl->inst = i;
+			}
+		}
+	}
+	fl->last_tsc = now;
+
+	return fl->inst;
+}
+
+/* True if the hold slots cannot take nb more pkts. Callers release the held pkts
+ * before splitting pkts that may not fit, new pkts never pass held ones.
+ */
+static inline bool
+flow_dispatch_hold_full(const struct flow_dispatch *fd, uint32_t nb)
+{
+	return fd->nb_hold + nb > FLOW_DISPATCH_HOLD;
+}
+
+/* Sort nb pkts (at most FLOW_DISPATCH_BURST) into the buckets of their
+ * instances, rings are the input rings of the instances the buckets are sent
+ * to. Pkts of mice the last remap moved are held instead while holding, see
+ * flow_dispatch_hold_full(). Returns the num of pkts of elephants.
+ */
+static inline uint32_t
+flow_dispatch_split(struct flow_dispatch *fd, struct rte_mbuf **pkts, uint32_t nb, uint64_t now,
+		    struct rte_ring **rings)
+{
+	uint32_t nb_elephant = 0;
+	uint32_t hash, inst;
+	uint32_t i;
+
+	if (fd->threshold)
+		flow_dispatch_epoch(fd, now);
+
+	for (i = 0; i < nb; i++) {
+		hash = flow_dispatch_hash(pkts[i]);
+		if (fd->threshold && flow_dispatch_count(fd, hash)) {
+			inst = flow_dispatch_flowlet(fd, hash, now, rings);
+			nb_elephant++;
+		} else {
+			inst = flow_dispatch_inst(fd, hash);
+			if (unlikely(fd->holding) && flow_map_lookup(fd->prev, hash) != inst) {
+				RTE_ASSERT(fd->nb_hold < FLOW_DISPATCH_HOLD);
+				fd->hold[fd->nb_hold++] = pkts[i];
+				continue;
+			}
+		}
+		fd->bucket[inst * FLOW_DISPATCH_BURST + fd->nb[inst]++] = pkts[i];
+	}
+
+	return nb_elephant;
+}
+
+/* Stop holding and sort the next FLOW_DISPATCH_BURST held pkts into the
+ * buckets of their instances. Returns the num of pkts taken, 0 once all left.
+ * Callers send the buckets in between and release all held pkts before new
+ * ones of the same flows, which the map sends straight on now.
+ */
+static inline uint32_t
+flow_dispatch_release(struct flow_dispatch *fd)
+{
+	uint32_t nb = RTE_MIN(fd->nb_hold - fd->hold_head, (uint32_t)FLOW_DISPATCH_BURST);
+	struct rte_mbuf *m;
+	uint32_t inst;
+	uint32_t i;
+
+	fd->holding = false;
+	for (i = 0; i < nb; i++) {
+		m = fd->hold[fd->hold_head++];
+		inst = flow_dispatch_inst(fd, flow_dispatch_hash(m));
+		fd->bucket[inst * FLOW_DISPATCH_BURST + fd->nb[inst]++] = m;
+	}
+	if (fd->hold_head == fd->nb_hold)
+		fd->hold_head = fd->nb_hold = 0;
+
+	return nb;
+}
+
+#endif /* _INCLUDE_FLOW_DISPATCH_H_ */
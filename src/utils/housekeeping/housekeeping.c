@@ -0,0 +1,398 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* Housekeeping thread, see housekeeping.h.
+ *
+ * Control commands are one line per connection, answered with "ok" or
+ * "error: <reason>":
+ *   stats                               print the per core stats now
+ *   rate <port> <mbps> <kpps> [burst_us] change the ingress limit of a port
+ *   scale <n>                           map flows to n of the first stage instances
+ *   trace                               dump the flight recorder
+ *   stop                                end the run
+ *
+ * example:
+ * ./build/meili ... --control /tmp/meili.ctl
+ * echo "rate 0 0 1000" | socat - UNIX-CONNECT:/tmp/meili.ctl
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+
+#include "housekeeping.h"
+#include "../utils.h"
+#include "../rate_limit/rate_limit.h"
+#include "../trace/trace.h"
+#include "../../runtime/run_mode.h"
+
+struct hk_timer {
+	uint64_t period;	/* timer cycles */
+	uint64_t next;
+	hk_timer_cb *cb;
+	void *arg;
+};
+
+static struct {
+	pthread_t tid;
+	bool running;
+	volatile bool quit;
+	struct pipeline *pl;
+
+	struct pollfd pfds[HK_MAX_FDS];
+	hk_fd_cb *fd_cbs[HK_MAX_FDS];
+	void *fd_args[HK_MAX_FDS];
+	int nb_fds;
+
+	struct hk_timer timers[HK_MAX_TIMERS];
+	int nb_timers;
+
+	/* stats print */
+	uint64_t run_start;
+
+	/* control socket */
+	int ctl_fd;
+	char ctl_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+} hk = {.ctl_fd = -1};
+
+static bool
+hk_addr_is_port(const char *addr)
+{
+	for (; *addr; addr++)
+		if (!isdigit((unsigned char)*addr))
+			return false;
+
+	return true;
+}
+
+int
+housekeeping_listen(const char *addr, char *unix_path, size_t len)
+{
+	struct sockaddr_un un = {.sun_family = AF_UNIX};
+	struct sockaddr_in in = {.sin_family = AF_INET};
+	int one = 1;
+	long port;
+	int fd;
+
+	if (hk_addr_is_port(addr)) {
+		port = strtol(addr, NULL, 10);
+		if (port <= 0 || port > UINT16_MAX) {
+			MEILI_LOG_ERR("Invalid port %s.", addr);
+			return -EINVAL;
+		}
+		in.sin_port = htons(port);
+		in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return -errno;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(fd, (struct sockaddr *)&in, sizeof(in)))
+			goto err;
+	} else {
+		if (strlen(addr) >= sizeof(un.sun_path) || strlen(addr) >= len) {
+			MEILI_LOG_ERR("Socket path %s too long.", addr);
+			return -EINVAL;
+		}
+		strcpy(un.sun_path, addr);
+
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return -errno;
+		/* a stale socket of a previous run */
+		unlink(addr);
+		if (bind(fd, (struct sockaddr *)&un, sizeof(un)))
+			goto err;
+		strcpy(unix_path, addr);
+	}
+
+	if (listen(fd, HK_BACKLOG))
+		goto err;
+
+	return fd;
+err:
+	MEILI_LOG_ERR("Failed to listen on %s: %s.", addr, strerror(errno));
+	close(fd);
+
+	return -EINVAL;
+}
+
+int
+housekeeping_fd_add(int fd, hk_fd_cb *cb, void *arg)
+{
+	if (hk.running || hk.nb_fds == HK_MAX_FDS)
+		return -EINVAL;
+
+	hk.pfds[hk.nb_fds].fd = fd;
+	hk.pfds[hk.nb_fds].events = POLLIN;
+	hk.fd_cbs[hk.nb_fds] = cb;
+	hk.fd_args[hk.nb_fds] = arg;
+	hk.nb_fds++;
+
+	return 0;
+}
+
+int
+housekeeping_timer_add(uint32_t period_ms, hk_timer_cb *cb, void *arg)
+{
+	struct hk_timer *t;
+
+	if (hk.running || hk.nb_timers == HK_MAX_TIMERS || !period_ms)
+		return -EINVAL;
+
+	t = &hk.timers[hk.nb_timers++];
+	t->period = rte_get_timer_hz() / 1000 * period_ms;
+	t->next = rte_get_timer_cycles() + t->period;
+	t->cb = cb;
+	t->arg = arg;
+
+	return 0;
+}
+
+/* Print the per core stats every STATS_INTERVAL_SEC while the pipeline runs.
+ * Stages are assigned to cores once running is set, the main core last.
+ */
+static void
+hk_stats_print(uint64_t now, void *arg)
+{
+	struct pipeline *pl = arg;
+	pl_conf *run_conf = &pl->conf;
+	rb_stats_t *stats = run_conf->stats;
+
+	if (!run_conf->running || !__atomic_load_n(&stats->rm_stats[0].self, __ATOMIC_ACQUIRE)) {
+		hk.run_start = 0;
+		return;
+	}
+	if (!hk.run_start) {
+		hk.run_start = now;
+		return;
+	}
+
+	stats_print_update(stats, run_conf->cores, (double)(now - hk.run_start) / rte_get_timer_hz(), false);
+}
+
+static void
+hk_reply(int fd, const char *msg)
+{
+	size_t len = strlen(msg);
+	ssize_t n;
+
+	while (len) {
+		n = send(fd, msg, len, MSG_NOSIGNAL);
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			return;
+		}
+		msg += n;
+		len -= n;
+	}
+}
+
+static const char *
+hk_cmd_rate(char *args)
+{
+	unsigned long port, mbps, kpps, burst_us = 0;
+	struct rate_limit *rl;
+	int n;
+
+	n = sscanf(args, "%lu %lu %lu %lu", &port, &mbps, &kpps, &burst_us);
+	if (n < 3 || port > UINT16_MAX || burst_us > UINT32_MAX)
+		return "error: usage: rate <port> <mbps> <kpps> [burst_us]\n";
+	/* only the rx loop of a run started with a limit polls for new settings */
+	rl = rate_limit_get(port);
+	if (!rl || !__atomic_load_n(&rl->gen, __ATOMIC_ACQUIRE))
+		return "error: port was not started with a rate limit\n";
+	if (rate_limit_set(port, (uint64_t)mbps * 1000000, (uint64_t)kpps * 1000, burst_us))
+		return "error: invalid rate limit\n";
+
+	return "ok\n";
+}
+
+static const char *
+hk_cmd_scale(char *args)
+{
+	unsigned long nb_active;
+	int ret;
+
+	if (sscanf(args, "%lu", &nb_active) != 1 || nb_active > UINT32_MAX)
+		return "error: usage: scale <first stage instances>\n";
+	ret = pipeline_scale(hk.pl, nb_active);
+	if (ret == -ENOTSUP)
+		return "error: flows are only mapped with --flow-affinity\n";
+	if (ret == -EAGAIN)
+		return "error: not running\n";
+	if (ret == -EBUSY)
+		return "error: flow state of the last scale event still migrating\n";
+	if (ret)
+		return "error: invalid num of instances\n";
+
+	return "ok\n";
+}
+
+static const char *
+hk_cmd_exec(char *cmd)
+{
+	pl_conf *run_conf = &hk.pl->conf;
+	char *args;
+
+	cmd[strcspn(cmd, "\r\n")] = '\0';
+	args = cmd + strcspn(cmd, " ");
+	if (*args)
+		*args++ = '\0';
+
+	if (!strcmp(cmd, "stats")) {
+		if (!run_conf->running)
+			return "error: not running\n";
+		hk_stats_print(rte_get_timer_cycles(), hk.pl);
+		return "ok\n";
+	}
+	if (!strcmp(cmd, "rate"))
+		return hk_cmd_rate(args);
+	if (!strcmp(cmd, "scale"))
+		return hk_cmd_scale(args);
+	if (!strcmp(cmd, "trace")) {
+		if (!run_conf->trace_file)
+			return "error: flight recorder is off\n";
+		trace_dump();
+		return "ok\n";
+	}
+	if (!strcmp(cmd, "stop")) {
+		force_quit = true;
+		return "ok\n";
+	}
+
+	return "error: unknown command, expected stats, rate, scale, trace or stop\n";
+}
+
+static void
+hk_control(int lfd, void *arg __rte_unused)
+{
+	struct timeval timeout = {.tv_sec = 1};
+	char cmd[HK_CMD_LEN];
+	ssize_t n;
+	int fd;
+
+	fd = accept(lfd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	n = recv(fd, cmd, sizeof(cmd) - 1, 0);
+	if (n > 0) {
+		cmd[n] = '\0';
+		hk_reply(fd, hk_cmd_exec(cmd));
+	}
+	close(fd);
+}
+
+static void *
+hk_thread(void *arg __rte_unused)
+{
+	const uint64_t hz = rte_get_timer_hz();
+	struct hk_timer *t;
+	uint64_t now;
+	int timeout;
+	int i;
+
+	while (!hk.quit) {
+		now = rte_get_timer_cycles();
+		timeout = HK_POLL_MS;
+		for (i = 0; i < hk.nb_timers; i++) {
+			t = &hk.timers[i];
+			if (now >= t->next) {
+				t->cb(now, t->arg);
+				t->next += t->period;
+				/* skip periods missed while blocked in a callback */
+				if (t->next <= now)
+					t->next = now + t->period;
+			}
+			timeout = RTE_MIN(timeout, (int)((t->next - now) * 1000 / hz));
+		}
+
+		if (poll(hk.pfds, hk.nb_fds, timeout) <= 0)
+			continue;
+		for (i = 0; i < hk.nb_fds; i++) {
+			if (hk.pfds[i].revents & POLLIN)
+				hk.fd_cbs[i](hk.pfds[i].fd, hk.fd_args[i]);
+		}
+	}
+
+	return NULL;
+}
+
+int
+housekeeping_start(struct pipeline *pl)
+{
+	pl_conf *run_conf = &pl->conf;
+	int ret;
+
+	if (hk.running)
+		return 0;
+	hk.pl = pl;
+	hk.run_start = 0;
+
+	ret = housekeeping_timer_add(STATS_INTERVAL_SEC * 1000, hk_stats_print, pl);
+	if (ret)
+		goto err;
+
+	if (run_conf->control_addr) {
+		ret = housekeeping_listen(run_conf->control_addr, hk.ctl_path, sizeof(hk.ctl_path));
+		if (ret < 0)
+			goto err;
+		hk.ctl_fd = ret;
+		ret = housekeeping_fd_add(hk.ctl_fd, hk_control, NULL);
+		if (ret)
+			goto err;
+		MEILI_LOG_INFO("Accepting control commands on %s.", run_conf->control_addr);
+	}
+
+	hk.quit = false;
+	ret = rte_ctrl_thread_create(&hk.tid, "meili-hk", NULL, hk_thread, NULL);
+	if (ret) {
+		MEILI_LOG_ERR("Failed to create housekeeping thread.");
+		ret = -ret;
+		goto err;
+	}
+	hk.running = true;
+
+	return 0;
+err:
+	housekeeping_stop();
+
+	return ret;
+}
+
+void
+housekeeping_stop(void)
+{
+	if (hk.running) {
+		hk.quit = true;
+		pthread_join(hk.tid, NULL);
+		hk.running = false;
+	}
+	if (hk.ctl_fd >= 0) {
+		close(hk.ctl_fd);
+		hk.ctl_fd = -1;
+	}
+	if (hk.ctl_path[0]) {
+		unlink(hk.ctl_path);
+		hk.ctl_path[0] = '\0';
+	}
+	hk.nb_fds = 0;
+	hk.nb_timers = 0;
+}
@@ -0,0 +1,47 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_HOUSEKEEPING_H_
+#define _INCLUDE_HOUSEKEEPING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../../runtime/pipeline.h"
+
+/* Housekeeping: a single DPDK control thread, i.e. on the cores left to the
+ * OS, that owns everything periodic or interactive: stats printing, metrics
+ * export, control commands and timers. Data plane cores only update their
+ * own counters and publish them with stats_publish().
+ */
+
+/* Upper bound of a poll, bounds the delay of housekeeping_stop(). */
+#define HK_POLL_MS		100
+#define HK_MAX_FDS		4
+#define HK_MAX_TIMERS		8
+#define HK_BACKLOG		8
+#define HK_CMD_LEN		256
+
+/* Called when fd is readable, e.g. a listening socket has a connection. */
+typedef void (hk_fd_cb)(int fd, void *arg);
+/* Called every period with the current timer cycles. */
+typedef void (hk_timer_cb)(uint64_t now, void *arg);
+
+/* Listen on a unix socket path or a tcp port bound to 127.0.0.1 (an all digit
+ * addr). The path of a unix socket is copied to unix_path for unlinking.
+ * Returns the socket or a negative errno.
+ */
+int housekeeping_listen(const char *addr, char *unix_path, size_t len);
+
+/* Register a fd or timer, only before housekeeping_start(). */
+int housekeeping_fd_add(int fd, hk_fd_cb *cb, void *arg);
+int housekeeping_timer_add(uint32_t period_ms, hk_timer_cb *cb, void *arg);
+
+/* Start the thread, with the periodic stats print and, if run_conf->control_addr
+ * is set, the control socket.
+ */
+int housekeeping_start(struct pipeline *pl);
+
+/* Stop the thread and drop all registrations, a no-op if it was not started. */
+void housekeeping_stop(void);
+
+#endif /* _INCLUDE_HOUSEKEEPING_H_ */
@@ -43,6 +43,8 @@ void input_job_format_reg(input_func_t *funcs);
 
 void input_remote_mmap_reg(input_func_t *funcs);
 
+void input_synthetic_reg(input_func_t *funcs);
+
 static inline int
 input_register(pl_conf *run_conf)
 {
@@ -67,6 +69,10 @@ input_register(pl_conf *run_conf)
 		input_dpdk_port_reg(funcs);
 		break;
 
+	case INPUT_SYNTHETIC:
+		input_synthetic_reg(funcs);
+		break;
+
 	default:
 		rte_free(funcs);
 		return -ENOTSUP;
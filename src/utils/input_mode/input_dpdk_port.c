@@ -27,6 +27,7 @@
 //#define NUM_MBUFS		8191
 #define NUM_MBUFS		65535
 #define MBUF_CACHE_SIZE		256
+#define RSS_KEY_MAX_LEN		64
 
 struct rte_mempool ***mbuf_pools;
 
@@ -47,7 +48,7 @@ rte_eth_conf port_conf_default = {
 	.rx_adv_conf = {
 		.rss_conf = {
 			.rss_key = NULL,
-			.rss_hf = ETH_RSS_IP,
+			.rss_hf = ETH_RSS_IP | ETH_RSS_TCP | ETH_RSS_UDP,
 		},
 	},
 	.txmode = {
@@ -97,12 +98,15 @@ input_dpdk_port_init(uint16_t port_id, uint32_t num_queues, int port_idx)
 	uint16_t num_tx_queues = num_queues;
 	uint16_t nb_rxd = RX_RING_SIZE;
 	uint16_t nb_txd = TX_RING_SIZE;
+	uint8_t rss_key[RSS_KEY_MAX_LEN];
+	uint8_t rss_key_len;
 	struct rte_eth_rxconf rxconf;
 	struct rte_eth_txconf txconf;
 	unsigned int lcore_id;
 	unsigned int numa_id;
 	uint16_t queue_id;
 	int ret;
+	int i;
 
 	/* Returns 1 on success. */
 	if (!rte_eth_dev_is_valid_port(port_id)) {
@@ -122,6 +126,20 @@ input_dpdk_port_init(uint16_t port_id, uint32_t num_queues, int port_idx)
 
 	port_conf.rx_adv_conf.rss_conf.rss_hf &= dev_info.flow_type_rss_offloads;
 
+	/* 0x6d5a repeated makes toeplitz symmetric: both directions of a flow get one
+	 * rss hash and one queue, which flow affinity and the dispatchers rely on
+	 */
+	rss_key_len = dev_info.hash_key_size ? dev_info.hash_key_size : 40;
+	if (rss_key_len <= RSS_KEY_MAX_LEN) {
+		for (i = 0; i < rss_key_len; i++)
+			rss_key[i] = i & 1 ? 0x5a : 0x6d;
+		port_conf.rx_adv_conf.rss_conf.rss_key = rss_key;
+		port_conf.rx_adv_conf.rss_conf.rss_key_len = rss_key_len;
+	} else {
+		MEILI_LOG_WARN("Rss key of dev %u is %u bytes, the default key is kept and is not symmetric.", port_id,
+			       rss_key_len);
+	}
+
 	ret = rte_eth_dev_configure(port_id, num_rx_queues, num_tx_queues, &port_conf);
 	if (ret) {
 		MEILI_LOG_ERR("Failed to configure eth dev %u: %s,", port_id, strerror(-ret));
@@ -148,19 +166,18 @@ input_dpdk_port_init(uint16_t port_id, uint32_t num_queues, int port_idx)
 	if (ret)
 		return ret;
 
-	/* Only init queues for main thread here */
-	// /* Assign mbufs and queues based on numa ports. */
-	// RTE_LCORE_FOREACH_WORKER(lcore_id)
-	// {
-	// 	queue_id++;
-	// 	if (queue_id >= num_queues)
-	// 		break;
-	// 	numa_id = rte_lcore_to_socket_id(lcore_id);
-	// 	ret = input_dpdk_port_init_queues(port_id, queue_id, port_idx, numa_id, nb_rxd, &rxconf, nb_txd,
-	// 					  &txconf);
-	// 	if (ret)
-	// 		return ret;
-	// }
+	/* The other queues belong to the dispatchers (--dispatchers), which take the first worker lcores. */
+	RTE_LCORE_FOREACH_WORKER(lcore_id)
+	{
+		queue_id++;
+		if (queue_id >= num_queues)
+			break;
+		numa_id = rte_lcore_to_socket_id(lcore_id);
+		ret = input_dpdk_port_init_queues(port_id, queue_id, port_idx, numa_id, nb_rxd, &rxconf, nb_txd,
+						  &txconf);
+		if (ret)
+			return ret;
+	}
 
 	ret = rte_eth_dev_start(port_id);
 	if (ret) {
@@ -246,7 +263,7 @@ input_dpdk_port_init_ports(pl_conf *run_conf)
 static void
 input_dpdk_port_clean(pl_conf *run_conf)
 {
-	const uint32_t num_queues = run_conf->cores;
+	const uint32_t num_queues = run_conf->nb_queues_per_port;
 	uint16_t num_ports = 1;
 	uint32_t j;
 	uint16_t i;
@@ -0,0 +1,458 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* In-process synthetic traffic source.
+ * Pkts received on the primary port (typically --vdev net_null0) are rewritten
+ * from a template in an rx callback, so generated traffic takes exactly the same
+ * rx/ring/stage path as live traffic without any NIC.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_errno.h>
+#include <rte_ethdev.h>
+#include <rte_ip.h>
+#include <rte_malloc.h>
+#include <rte_memcpy.h>
+#include <rte_udp.h>
+
+#include "input.h"
+#include "../str/str_helpers.h"
+
+#define SYNTH_MIN_FRAME_LEN	60
+#define SYNTH_MAX_FRAME_LEN	1514
+#define SYNTH_HDR_LEN		(sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr))
+#define SYNTH_SIZE_TABLE	256	/* size mix granularity, must be 2^n */
+#define SYNTH_FLOW_TABLE_MIN	(1 << 16)
+#define SYNTH_FLOW_TABLE_MAX	(1 << 22)
+#define SYNTH_MAX_SIZES		16
+
+/* template addresses, same as traffic_generator/trafgen configs */
+#define SYNTH_SRC_IP		RTE_IPV4(100, 100, 100, 91)
+#define SYNTH_DST_IP		RTE_IPV4(100, 100, 100, 1)
+#define SYNTH_UDP_PORT		1234
+
+struct synth_state {
+	uint64_t rnd;			/* xorshift64* state */
+	uint64_t nb_gen;
+
+	/* flow popularity: uniform random index -> flow id */
+	uint32_t nb_flows;
+	uint32_t *flow_table;
+	uint32_t flow_mask;
+
+	/* size mix: uniform random index -> frame length */
+	uint16_t size_table[SYNTH_SIZE_TABLE];
+
+	/* payload corpus, one entry per line of the input file */
+	char *corpus_data;
+	char **corpus;
+	uint16_t *corpus_len;
+	uint32_t nb_corpus;
+	uint32_t corpus_idx;
+
+	uint8_t tmpl[SYNTH_MAX_FRAME_LEN];
+} __rte_cache_aligned;
+
+/* One generator per rx queue, each polled by its own dispatcher (--dispatchers).
+ * They share the flow, size and corpus tables of the first one.
+ */
+static struct synth_state *synth;
+static const struct rte_eth_rxtx_callback **synth_cb;
+static uint16_t synth_nb_queues;
+static input_func_t synth_port_funcs;
+
+static const char synth_http_64[] = "GET / HTTP/1.1\r\nHost: www.ab.com\r\n\r\n";
+static const char synth_http_1500[] = "GET / HTTP/1.1\r\nHost: www.ab.com\r\n"
+				      "Content-Type: text/plain\r\nContent-Length: 1386\r\n\r\n";
+
+static inline uint64_t
+synth_rand(struct synth_state *st)
+{
+	st->rnd ^= st->rnd >> 12;
+	st->rnd ^= st->rnd << 25;
+	st->rnd ^= st->rnd >> 27;
+
+	return st->rnd * 0x2545F4914F6CDD1DULL;
+}
+
+/* Build the template frame at max length, profile payload followed by 'A' fill. */
+static uint16_t
+synth_build_template(struct synth_state *st, enum meili_gen_profile profile)
+{
+	struct rte_ether_hdr *eth = (struct rte_ether_hdr *)st->tmpl;
+	struct rte_ipv4_hdr *ip = (struct rte_ipv4_hdr *)(eth + 1);
+	struct rte_udp_hdr *udp = (struct rte_udp_hdr *)(ip + 1);
+	uint8_t *payload = (uint8_t *)(udp + 1);
+	uint16_t frame_len;
+
+	memset(st->tmpl, 0x41, sizeof(st->tmpl));
+
+	/* da=08:c0:eb:8e:d6:86, sa=b8:ce:f6:83:b8:fc */
+	memcpy(eth->d_addr.addr_bytes, "\x08\xc0\xeb\x8e\xd6\x86", RTE_ETHER_ADDR_LEN);
+	memcpy(eth->s_addr.addr_bytes, "\xb8\xce\xf6\x83\xb8\xfc", RTE_ETHER_ADDR_LEN);
+	eth->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+
+	memset(ip, 0, sizeof(*ip));
+	ip->version_ihl = RTE_IPV4_VHL_DEF;
+	ip->time_to_live = 64;
+	ip->next_proto_id = IPPROTO_UDP;
+	ip->src_addr = rte_cpu_to_be_32(SYNTH_SRC_IP);
+	ip->dst_addr = rte_cpu_to_be_32(SYNTH_DST_IP);
+
+	udp->src_port = rte_cpu_to_be_16(SYNTH_UDP_PORT);
+	udp->dst_port = rte_cpu_to_be_16(SYNTH_UDP_PORT);
+	udp->dgram_cksum = 0;
+
+	switch (profile) {
+	case GEN_PROFILE_HTTP_1500:
+		memcpy(payload, synth_http_1500, strlen(synth_http_1500));
+		/* headers + 1386 byte body + CRLF */
+		frame_len = SYNTH_MAX_FRAME_LEN;
+		st->tmpl[frame_len - 2] = '\r';
+		st->tmpl[frame_len - 1] = '\n';
+		break;
+	case GEN_PROFILE_MICROBENCHMARK:
+		frame_len = SYNTH_MAX_FRAME_LEN;
+		break;
+	case GEN_PROFILE_HTTP_64:
+	default:
+		memcpy(payload, synth_http_64, strlen(synth_http_64));
+		frame_len = SYNTH_HDR_LEN + strlen(synth_http_64);
+		break;
+	}
+
+	return frame_len;
+}
+
+/* Parse a size mix such as "64:7,570:4,1514:1" (frame length:weight). */
+static int
+synth_init_sizes(struct synth_state *st, const char *mix, uint16_t default_len)
+{
+	uint32_t lens[SYNTH_MAX_SIZES];
+	uint32_t weights[SYNTH_MAX_SIZES];
+	uint32_t nb_sizes = 0;
+	uint64_t tot_weight = 0;
+	uint64_t acc = 0;
+	const char *p = mix;
+	uint32_t i, j;
+	char *end;
+
+	if (!mix) {
+		for (i = 0; i < SYNTH_SIZE_TABLE; i++)
+			st->size_table[i] = default_len;
+		return 0;
+	}
+
+	while (*p) {
+		if (nb_sizes == SYNTH_MAX_SIZES) {
+			MEILI_LOG_ERR("gen-sizes supports at most %u entries.", SYNTH_MAX_SIZES);
+			return -EINVAL;
+		}
+		lens[nb_sizes] = strtoul(p, &end, 10);
+		weights[nb_sizes] = 1;
+		if (end == p)
+			goto parse_err;
+		p = end;
+		if (*p == ':') {
+			weights[nb_sizes] = strtoul(p + 1, &end, 10);
+			if (end == p + 1)
+				goto parse_err;
+			p = end;
+		}
+		if (*p == ',')
+			p++;
+		else if (*p)
+			goto parse_err;
+
+		if (lens[nb_sizes] < SYNTH_MIN_FRAME_LEN || lens[nb_sizes] > SYNTH_MAX_FRAME_LEN) {
+			MEILI_LOG_ERR("gen-sizes frame length %u out of range [%u, %u].", lens[nb_sizes],
+				      SYNTH_MIN_FRAME_LEN, SYNTH_MAX_FRAME_LEN);
+			return -EINVAL;
+		}
+		tot_weight += weights[nb_sizes];
+		nb_sizes++;
+	}
+
+	if (!nb_sizes || !tot_weight)
+		goto parse_err;
+
+	/* spread sizes over the table proportionally to their weights */
+	for (i = 0, j = 0; i < SYNTH_SIZE_TABLE; i++) {
+		while (j < nb_sizes - 1 && (acc + weights[j]) * SYNTH_SIZE_TABLE <= i * tot_weight) {
+			acc += weights[j];
+			j++;
+		}
+		st->size_table[i] = lens[j];
+	}
+
+	return 0;
+
+parse_err:
+	MEILI_LOG_ERR("Invalid gen-sizes %s.", mix);
+	return -EINVAL;
+}
+
+/* Zipf(s) popularity over flows, s = 0 gives uniform flows. */
+static int
+synth_init_flows(struct synth_state *st, uint32_t nb_flows, double s)
+{
+	uint32_t table_size = SYNTH_FLOW_TABLE_MIN;
+	double norm = 0.0;
+	double cdf = 0.0;
+	uint32_t flow = 0;
+	uint32_t i;
+
+	st->nb_flows = nb_flows;
+	if (nb_flows <= 1 || s <= 0.0)
+		return 0;
+
+	while (table_size < nb_flows && table_size < SYNTH_FLOW_TABLE_MAX)
+		table_size <<= 1;
+
+	st->flow_table = rte_malloc(NULL, sizeof(uint32_t) * table_size, 0);
+	if (!st->flow_table) {
+		MEILI_LOG_ERR("Memory failure on synthetic flow table.");
+		return -ENOMEM;
+	}
+	st->flow_mask = table_size - 1;
+
+	for (i = 0; i < nb_flows; i++)
+		norm += 1.0 / pow(i + 1, s);
+
+	/* entry i holds the flow whose cdf interval contains (i + 0.5) / table_size */
+	cdf = 1.0 / norm;
+	for (i = 0; i < table_size; i++) {
+		while (flow < nb_flows - 1 && cdf < (i + 0.5) / table_size) {
+			flow++;
+			cdf += 1.0 / pow(flow + 1, s) / norm;
+		}
+		st->flow_table[i] = flow;
+	}
+
+	return 0;
+}
+
+static int
+synth_init_corpus(struct synth_state *st, pl_conf *run_conf)
+{
+	uint64_t data_len;
+	uint32_t nb_lines = 0;
+	char *line;
+	uint64_t i;
+	int ret;
+
+	if (!run_conf->input_file)
+		return 0;
+
+	ret = util_load_file_to_buffer(run_conf->input_file, &st->corpus_data, &data_len, 0);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < data_len; i++)
+		if (st->corpus_data[i] == '\n')
+			nb_lines++;
+	nb_lines++;
+
+	st->corpus = rte_malloc(NULL, sizeof(char *) * nb_lines, 0);
+	st->corpus_len = rte_malloc(NULL, sizeof(uint16_t) * nb_lines, 0);
+	if (!st->corpus || !st->corpus_len) {
+		MEILI_LOG_ERR("Memory failure on synthetic payload corpus.");
+		return -ENOMEM;
+	}
+
+	line = st->corpus_data;
+	for (i = 0; i <= data_len; i++) {
+		if (i < data_len && st->corpus_data[i] != '\n')
+			continue;
+		if (&st->corpus_data[i] > line) {
+			st->corpus[st->nb_corpus] = line;
+			st->corpus_len[st->nb_corpus] = RTE_MIN((uint64_t)(&st->corpus_data[i] - line),
+								 (uint64_t)(SYNTH_MAX_FRAME_LEN - SYNTH_HDR_LEN));
+			st->nb_corpus++;
+		}
+		line = &st->corpus_data[i + 1];
+	}
+
+	MEILI_LOG_INFO("Loaded %u payloads from %s.", st->nb_corpus, run_conf->input_file);
+
+	return 0;
+}
+
+/* Overwrite received pkts with generated frames. */
+static uint16_t
+synth_rx_cb(uint16_t port_id __rte_unused, uint16_t queue __rte_unused, struct rte_mbuf *pkts[], uint16_t nb_pkts,
+	    uint16_t max_pkts __rte_unused, void *user_param)
+{
+	struct synth_state *st = user_param;
+	struct rte_ipv4_hdr *ip;
+	struct rte_udp_hdr *udp;
+	struct rte_mbuf *m;
+	uint32_t flow;
+	uint64_t rnd;
+	uint16_t len;
+	uint8_t *data;
+	uint16_t i;
+
+	for (i = 0; i < nb_pkts; i++) {
+		m = pkts[i];
+		rnd = synth_rand(st);
+
+		len = st->size_table[rnd & (SYNTH_SIZE_TABLE - 1)];
+		len = RTE_MIN(len, (uint16_t)(m->buf_len - m->data_off));
+
+		if (st->nb_flows <= 1)
+			flow = 0;
+		else if (st->flow_table)
+			flow = st->flow_table[(rnd >> 8) & st->flow_mask];
+		else
+			flow = (rnd >> 8) % st->nb_flows;
+
+		data = rte_pktmbuf_mtod(m, uint8_t *);
+		rte_memcpy(data, st->tmpl, len);
+		if (st->nb_corpus) {
+			uint32_t idx = st->corpus_idx++ % st->nb_corpus;
+
+			rte_memcpy(data + SYNTH_HDR_LEN, st->corpus[idx],
+				   RTE_MIN(st->corpus_len[idx], (uint16_t)(len - SYNTH_HDR_LEN)));
+		}
+
+		ip = (struct rte_ipv4_hdr *)(data + sizeof(struct rte_ether_hdr));
+		ip->total_length = rte_cpu_to_be_16(len - sizeof(struct rte_ether_hdr));
+		ip->packet_id = rte_cpu_to_be_16((uint16_t)st->nb_gen);
+		ip->src_addr = rte_cpu_to_be_32(SYNTH_SRC_IP + flow);
+		ip->hdr_checksum = 0;
+		ip->hdr_checksum = rte_ipv4_cksum(ip);
+		udp = (struct rte_udp_hdr *)(ip + 1);
+		udp->dgram_len = rte_cpu_to_be_16(len - sizeof(struct rte_ether_hdr) - sizeof(struct rte_ipv4_hdr));
+
+		m->data_len = len;
+		m->pkt_len = len;
+		m->nb_segs = 1;
+		m->packet_type = RTE_PTYPE_L2_ETHER | RTE_PTYPE_L3_IPV4 | RTE_PTYPE_L4_UDP;
+		/* flow id doubles as rss hash so flow aware dispatching works without a NIC */
+		m->hash.rss = flow;
+		m->ol_flags |= PKT_RX_RSS_HASH;
+
+		st->nb_gen++;
+	}
+
+	return nb_pkts;
+}
+
+static void
+input_synthetic_clean(pl_conf *run_conf)
+{
+	uint16_t port_id;
+	uint16_t q;
+
+	if (synth_cb && !rte_eth_dev_get_port_by_name(run_conf->port1, &port_id)) {
+		for (q = 0; q < synth_nb_queues; q++)
+			if (synth_cb[q])
+				rte_eth_remove_rx_callback(port_id, q, synth_cb[q]);
+	}
+	rte_free(synth_cb);
+	synth_cb = NULL;
+
+	if (synth) {
+		rte_free(synth->flow_table);
+		rte_free(synth->corpus);
+		rte_free(synth->corpus_len);
+		rte_free(synth->corpus_data);
+		rte_free(synth);
+		synth = NULL;
+	}
+	synth_nb_queues = 0;
+
+	if (synth_port_funcs.clean)
+		synth_port_funcs.clean(run_conf);
+}
+
+static int
+input_synthetic_init(pl_conf *run_conf)
+{
+	uint16_t frame_len;
+	uint16_t port_id;
+	uint16_t q;
+	int ret;
+
+	/* ports (e.g. net_null vdev) are set up as in live mode */
+	input_dpdk_port_reg(&synth_port_funcs);
+	ret = synth_port_funcs.init(run_conf);
+	if (ret)
+		return ret;
+
+	ret = rte_eth_dev_get_port_by_name(run_conf->port1, &port_id);
+	if (ret) {
+		MEILI_LOG_ERR("Cannot find port %s.", run_conf->port1);
+		goto clean;
+	}
+
+	synth_nb_queues = run_conf->nb_queues_per_port;
+	synth = rte_zmalloc(NULL, sizeof(*synth) * synth_nb_queues, RTE_CACHE_LINE_SIZE);
+	synth_cb = rte_zmalloc(NULL, sizeof(*synth_cb) * synth_nb_queues, 0);
+	if (!synth || !synth_cb) {
+		MEILI_LOG_ERR("Memory failure on synthetic traffic source.");
+		ret = -ENOMEM;
+		goto clean;
+	}
+	synth->rnd = rte_rdtsc() | 1;
+
+	frame_len = synth_build_template(synth, run_conf->gen_profile);
+
+	ret = synth_init_sizes(synth, run_conf->gen_sizes, frame_len);
+	if (ret)
+		goto clean;
+
+	ret = synth_init_flows(synth, run_conf->gen_flows, run_conf->gen_zipf);
+	if (ret)
+		goto clean;
+
+	ret = synth_init_corpus(synth, run_conf);
+	if (ret)
+		goto clean;
+
+	/* the other queues get a copy with a random stream of their own */
+	for (q = 1; q < synth_nb_queues; q++) {
+		synth[q] = synth[0];
+		synth[q].rnd = synth_rand(&synth[q - 1]) | 1;
+	}
+
+	/* dispatcher q takes queue q, the main core queue 0 */
+	for (q = 0; q < synth_nb_queues; q++) {
+		synth_cb[q] = rte_eth_add_rx_callback(port_id, q, synth_rx_cb, &synth[q]);
+		if (!synth_cb[q]) {
+			MEILI_LOG_ERR("Failed to add synthetic rx callback on port %s queue %u.", run_conf->port1, q);
+			ret = -rte_errno;
+			goto clean;
+		}
+	}
+
+	MEILI_LOG_INFO("Synthetic traffic on %s: %u flow(s), zipf %.2f, template frame %u bytes.", run_conf->port1,
+		       run_conf->gen_flows, run_conf->gen_zipf, frame_len);
+
+	return 0;
+
+clean:
+	input_synthetic_clean(run_conf);
+	return ret;
+}
+
+static int
+input_synthetic_get_rx_buffer(uint16_t q_id, int port_idx, void **start_addr, uint32_t *size)
+{
+	if (synth_port_funcs.get_rx_buffer)
+		return synth_port_funcs.get_rx_buffer(q_id, port_idx, start_addr, size);
+
+	return -EINVAL;
+}
+
+void
+input_synthetic_reg(input_func_t *funcs)
+{
+	funcs->init = input_synthetic_init;
+	funcs->get_rx_buffer = input_synthetic_get_rx_buffer;
+	funcs->clean = input_synthetic_clean;
+}
@@ -0,0 +1,477 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* Prometheus text exposition of the runtime counters over http.
+ * Per core counters come from the snapshots each data plane core publishes
+ * every STATS_PUBLISH_MS (see stats_publish), so a scrape never reads the
+ * lines the cores write. Port, ring and mempool state is read through the
+ * regular DPDK getters.
+ *
+ * example:
+ * ./build/meili ... --metrics /tmp/meili.sock
+ * curl --unix-socket /tmp/meili.sock http://localhost/metrics
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+#include <rte_lcore.h>
+#include <rte_mempool.h>
+#include <rte_ring.h>
+
+#include "metrics.h"
+#include "../utils.h"
+#include "../rate_limit/rate_limit.h"
+#include "../housekeeping/housekeeping.h"
+
+/* Counters exported per core (meili_core_*) and summed per stage (meili_stage_*). */
+struct metrics_counter {
+	const char *name;
+	const char *help;
+	size_t off;		/* offset in stats_snapshot_t */
+	bool cycles;		/* exported in seconds */
+	bool perf;		/* only with --perf-counters */
+};
+
+static const struct metrics_counter metrics_counters[] = {
+	{"rx_packets_total", "Packets received.", offsetof(stats_snapshot_t, rx_buf_cnt), false},
+	{"rx_bytes_total", "Bytes received.", offsetof(stats_snapshot_t, rx_buf_bytes), false},
+	{"tx_packets_total", "Packets sent to the next stage or port.", offsetof(stats_snapshot_t, tx_buf_cnt), false},
+	{"tx_bytes_total", "Bytes sent to the next stage or port.", offsetof(stats_snapshot_t, tx_buf_bytes), false},
+	{"tx_batches_total", "Batches sent to a port.", offsetof(stats_snapshot_t, tx_batch_cnt), false},
+	{"busy_seconds_total", "Time spent on bursts carrying packets.", offsetof(stats_snapshot_t, busy_cycles), true},
+	{"idle_seconds_total", "Time spent polling empty input rings.", offsetof(stats_snapshot_t, idle_cycles), true},
+	{"stalled_seconds_total", "Time spent retrying enqueue to full output rings.",
+	 offsetof(stats_snapshot_t, stall_cycles), true},
+	{"regex_responses_total", "Valid regex responses.", offsetof(stats_snapshot_t, regex_rx_valid), false},
+	{"regex_errors_total", "Regex responses with error flags.", offsetof(stats_snapshot_t, regex_rx_invalid), false},
+	{"regex_matched_buffers_total", "Buffers with at least one regex match.",
+	 offsetof(stats_snapshot_t, regex_buf_match_cnt), false},
+	{"regex_matches_total", "Regex matches.", offsetof(stats_snapshot_t, regex_total_match), false},
+	{"pmu_cycles_total", "Cpu cycles of bursts carrying packets.",
+	 offsetof(stats_snapshot_t, perf[PERF_CYCLES]), false, true},
+	{"pmu_instructions_total", "Instructions retired in bursts carrying packets.",
+	 offsetof(stats_snapshot_t, perf[PERF_INSTRUCTIONS]), false, true},
+	{"pmu_llc_misses_total", "Last level cache misses in bursts carrying packets.",
+	 offsetof(stats_snapshot_t, perf[PERF_LLC_MISSES]), false, true},
+	{"pmu_branch_misses_total", "Branch mispredictions in bursts carrying packets.",
+	 offsetof(stats_snapshot_t, perf[PERF_BRANCH_MISSES]), false, true},
+	{"pmu_dtlb_misses_total", "Data tlb misses in bursts carrying packets.",
+	 offsetof(stats_snapshot_t, perf[PERF_DTLB_MISSES]), false, true},
+};
+
+static struct {
+	int fd;
+	char unix_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+} metrics = {.fd = -1};
+
+/* Labels of the core owning stats position qid, false if no stage runs on it. */
+static bool
+metrics_core_labels(struct pipeline *pl, int qid, char *labels, size_t len)
+{
+	struct pipeline_stage *self;
+	char type[32];
+	int i, j;
+
+	if (!qid) {
+		snprintf(labels, len, "lcore=\"%u\",qid=\"0\",stage=\"main\"", rte_get_main_lcore());
+		return true;
+	}
+	for (i = 1; i < pl->nb_dispatchers; i++) {
+		if (pl->dispatchers[i].worker_qid != qid)
+			continue;
+		snprintf(labels, len, "lcore=\"%d\",qid=\"%d\",stage=\"dispatcher\",instance=\"%d\"",
+			 pl->dispatchers[i].core_id, qid, i);
+		return true;
+	}
+	if (pl->conf.egress_lcore && qid == pl->egress_qid) {
+		snprintf(labels, len, "lcore=\"%d\",qid=\"%d\",stage=\"egress\"", pl->egress_core_id, qid);
+		return true;
+	}
+
+	for (i = 0; i < pl->nb_pl_stages; i++) {
+		for (j = 0; j < pl->nb_inst_per_pl_stage[i]; j++) {
+			self = pl->stages[i][j];
+			if (!self || self->worker_qid != qid)
+				continue;
+			GET_STAGE_TYPE_STRING(self->type, type);
+			snprintf(labels, len, "lcore=\"%d\",qid=\"%d\",stage=\"%s\",instance=\"%d\"", self->core_id, qid,
+				 type, j);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static double
+metrics_counter_value(const struct metrics_counter *c, const stats_snapshot_t *snap)
+{
+	uint64_t v = *(const uint64_t *)((const char *)snap + c->off);
+
+	return c->cycles ? (double)v / rte_get_tsc_hz() : (double)v;
+}
+
+static void
+metrics_write_header(FILE *f, const char *name, const char *help, const char *type)
+{
+	fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void
+metrics_write_cores(FILE *f, struct pipeline *pl, stats_snapshot_t *snaps, int nq)
+{
+	const struct metrics_counter *c;
+	struct pipeline_stage *self;
+	char labels[128];
+	char type[32];
+	char name[64];
+	double sum;
+	unsigned int k;
+	int qid, i, j;
+
+	for (k = 0; k < RTE_DIM(metrics_counters); k++) {
+		c = &metrics_counters[k];
+		if (c->perf && !pl->conf.perf_counters)
+			continue;
+
+		snprintf(name, sizeof(name), "meili_core_%s", c->name);
+		metrics_write_header(f, name, c->help, "counter");
+		for (qid = 0; qid < nq; qid++) {
+			if (metrics_core_labels(pl, qid, labels, sizeof(labels)))
+				fprintf(f, "%s{%s} %.17g\n", name, labels, metrics_counter_value(c, &snaps[qid]));
+		}
+
+		snprintf(name, sizeof(name), "meili_stage_%s", c->name);
+		metrics_write_header(f, name, c->help, "counter");
+		for (i = 0; i < pl->nb_pl_stages; i++) {
+			sum = 0;
+			for (j = 0; j < pl->nb_inst_per_pl_stage[i]; j++) {
+				self = pl->stages[i][j];
+				if (self && self->worker_qid > 0 && self->worker_qid < nq)
+					sum += metrics_counter_value(c, &snaps[self->worker_qid]);
+			}
+			GET_STAGE_TYPE_STRING(pl->stage_types[i], type);
+			fprintf(f, "%s{stage=\"%s\",index=\"%d\"} %.17g\n", name, type, i, sum);
+		}
+	}
+}
+
+static void
+metrics_write_hist(FILE *f, const char *name, const char *labels, const uint64_t *hist, uint64_t sum)
+{
+	uint64_t cum = 0;
+	int i;
+
+	for (i = 0; i < STATS_HIST_BUCKETS - 1; i++) {
+		cum += hist[i];
+		fprintf(f, "%s_bucket{%s,le=\"%" PRIu64 "\"} %" PRIu64 "\n", name, labels, (UINT64_C(1) << i) - 1, cum);
+	}
+	cum += hist[i];
+	fprintf(f, "%s_bucket{%s,le=\"+Inf\"} %" PRIu64 "\n", name, labels, cum);
+	fprintf(f, "%s_sum{%s} %" PRIu64 "\n%s_count{%s} %" PRIu64 "\n", name, labels, sum, name, labels, cum);
+}
+
+/* Burst size and per pkt cost distributions of the stage cores. */
+static void
+metrics_write_hists(FILE *f, struct pipeline *pl, stats_snapshot_t *snaps, int nq)
+{
+	char labels[128];
+	int qid;
+
+	metrics_write_header(f, "meili_core_burst_packets", "Packets per dequeued burst.", "histogram");
+	for (qid = 1; qid < nq; qid++) {
+		if (metrics_core_labels(pl, qid, labels, sizeof(labels)))
+			metrics_write_hist(f, "meili_core_burst_packets", labels, snaps[qid].burst_hist,
+					   snaps[qid].rx_buf_cnt);
+	}
+
+	metrics_write_header(f, "meili_core_packet_cycles", "Busy cycles per packet of a burst.", "histogram");
+	for (qid = 1; qid < nq; qid++) {
+		if (metrics_core_labels(pl, qid, labels, sizeof(labels)))
+			metrics_write_hist(f, "meili_core_packet_cycles", labels, snaps[qid].cpp_hist, snaps[qid].cpp_sum);
+	}
+}
+
+static void
+metrics_add_ring(struct rte_ring **rings, int *nb_rings, struct rte_ring *r)
+{
+	int i;
+
+	if (!r)
+		return;
+	/* shared rings appear in the ring arrays of several stages */
+	for (i = 0; i < *nb_rings; i++)
+		if (rings[i] == r)
+			return;
+	rings[(*nb_rings)++] = r;
+}
+
+/* Ring occupancy only reads the head/tail indexes, once per scrape. */
+static void
+metrics_write_rings(FILE *f, struct pipeline *pl)
+{
+	struct rte_ring **rings;
+	struct pipeline_stage *self;
+	int nb_rings = 0;
+	int i, j, k;
+
+	/* ring arrays are sized by the topology, every ring is in at least one of them */
+	k = pl->nb_ring_in + pl->nb_ring_out;
+	for (i = 0; i < pl->nb_pl_stages; i++) {
+		for (j = 0; j < pl->nb_inst_per_pl_stage[i]; j++) {
+			self = pl->stages[i][j];
+			if (self)
+				k += self->nb_ring_in + self->nb_ring_out;
+		}
+	}
+	rings = malloc(RTE_MAX(k, 1) * sizeof(*rings));
+	if (!rings)
+		return;
+
+	for (k = 0; k < pl->nb_ring_in; k++)
+		metrics_add_ring(rings, &nb_rings, pl->ring_in[k]);
+	for (k = 0; k < pl->nb_ring_out; k++)
+		metrics_add_ring(rings, &nb_rings, pl->ring_out[k]);
+	for (i = 0; i < pl->nb_pl_stages; i++) {
+		for (j = 0; j < pl->nb_inst_per_pl_stage[i]; j++) {
+			self = pl->stages[i][j];
+			if (!self)
+				continue;
+			for (k = 0; k < self->nb_ring_in; k++)
+				metrics_add_ring(rings, &nb_rings, self->ring_in[k]);
+			for (k = 0; k < self->nb_ring_out; k++)
+				metrics_add_ring(rings, &nb_rings, self->ring_out[k]);
+		}
+	}
+
+	metrics_write_header(f, "meili_ring_used", "Entries in the ring.", "gauge");
+	for (k = 0; k < nb_rings; k++)
+		fprintf(f, "meili_ring_used{ring=\"%s\"} %u\n", rings[k]->name, rte_ring_count(rings[k]));
+	metrics_write_header(f, "meili_ring_capacity", "Usable size of the ring.", "gauge");
+	for (k = 0; k < nb_rings; k++)
+		fprintf(f, "meili_ring_capacity{ring=\"%s\"} %u\n", rings[k]->name, rte_ring_get_capacity(rings[k]));
+
+	free(rings);
+}
+
+static void
+metrics_mempool_avail(struct rte_mempool *mp, void *arg)
+{
+	fprintf(arg, "meili_mempool_available{pool=\"%s\"} %u\n", mp->name, rte_mempool_avail_count(mp));
+}
+
+static void
+metrics_mempool_in_use(struct rte_mempool *mp, void *arg)
+{
+	fprintf(arg, "meili_mempool_in_use{pool=\"%s\"} %u\n", mp->name, rte_mempool_in_use_count(mp));
+}
+
+static void
+metrics_write_mempools(FILE *f)
+{
+	metrics_write_header(f, "meili_mempool_available", "Free objects, including per lcore caches.", "gauge");
+	rte_mempool_walk(metrics_mempool_avail, f);
+	metrics_write_header(f, "meili_mempool_in_use", "Allocated objects.", "gauge");
+	rte_mempool_walk(metrics_mempool_in_use, f);
+}
+
+static void
+metrics_write_ports(FILE *f, pl_conf *run_conf)
+{
+	static const struct {
+		const char *name;
+		const char *help;
+		size_t off;
+	} port_counters[] = {
+		{"meili_port_rx_packets_total", "Packets received by the port.", offsetof(struct rte_eth_stats, ipackets)},
+		{"meili_port_rx_bytes_total", "Bytes received by the port.", offsetof(struct rte_eth_stats, ibytes)},
+		{"meili_port_tx_packets_total", "Packets sent by the port.", offsetof(struct rte_eth_stats, opackets)},
+		{"meili_port_tx_bytes_total", "Bytes sent by the port.", offsetof(struct rte_eth_stats, obytes)},
+		{"meili_port_rx_missed_total", "Packets dropped by the port, rx queues full.",
+		 offsetof(struct rte_eth_stats, imissed)},
+		{"meili_port_rx_nombuf_total", "Rx mbuf allocation failures.", offsetof(struct rte_eth_stats, rx_nombuf)},
+	};
+	struct rte_eth_stats eth_stats[RTE_MAX_ETHPORTS];
+	bool valid[RTE_MAX_ETHPORTS] = {0};
+	char name[RTE_ETH_NAME_MAX_LEN];
+	struct rate_limit *rl;
+	uint16_t port_id;
+	unsigned int k;
+
+	RTE_ETH_FOREACH_DEV(port_id)
+		valid[port_id] = !rte_eth_stats_get(port_id, &eth_stats[port_id]);
+
+	for (k = 0; k < RTE_DIM(port_counters); k++) {
+		metrics_write_header(f, port_counters[k].name, port_counters[k].help, "counter");
+		RTE_ETH_FOREACH_DEV(port_id) {
+			if (!valid[port_id] || rte_eth_dev_get_name_by_port(port_id, name))
+				continue;
+			fprintf(f, "%s{port=\"%s\"} %" PRIu64 "\n", port_counters[k].name, name,
+				*(uint64_t *)((char *)&eth_stats[port_id] + port_counters[k].off));
+		}
+	}
+
+	/* only a synthetic source always offers traffic, see rate_limit_refill() */
+	if (run_conf->input_mode != INPUT_SYNTHETIC)
+		return;
+	metrics_write_header(f, "meili_port_rx_limited_total", "Offered packets dropped by the ingress rate limiter.",
+			     "counter");
+	RTE_ETH_FOREACH_DEV(port_id) {
+		rl = rate_limit_get(port_id);
+		if (!rl || rte_eth_dev_get_name_by_port(port_id, name))
+			continue;
+		fprintf(f, "meili_port_rx_limited_total{port=\"%s\"} %" PRIu64 "\n", name,
+			__atomic_load_n(&rl->missed_pkts, __ATOMIC_RELAXED));
+	}
+}
+
+/* Render all metrics into a malloc'ed buffer. */
+static int
+metrics_render(struct pipeline *pl, char **buf, size_t *len)
+{
+	pl_conf *run_conf = &pl->conf;
+	const int nq = run_conf->cores;
+	stats_snapshot_t *snaps;
+	FILE *f;
+	int qid;
+
+	snaps = calloc(nq, sizeof(*snaps));
+	if (!snaps)
+		return -ENOMEM;
+	for (qid = 0; qid < nq; qid++)
+		stats_snapshot_read(run_conf->stats, qid, &snaps[qid]);
+
+	f = open_memstream(buf, len);
+	if (!f) {
+		free(snaps);
+		return -ENOMEM;
+	}
+
+	metrics_write_header(f, "meili_running", "1 while the pipeline processes traffic.", "gauge");
+	fprintf(f, "meili_running %d\n", run_conf->running ? 1 : 0);
+	metrics_write_cores(f, pl, snaps, nq);
+	metrics_write_hists(f, pl, snaps, nq);
+	metrics_write_rings(f, pl);
+	metrics_write_mempools(f);
+	metrics_write_ports(f, run_conf);
+
+	fclose(f);
+	free(snaps);
+
+	return 0;
+}
+
+static void
+metrics_send(int fd, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = send(fd, data, len, MSG_NOSIGNAL);
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			return;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+static void
+metrics_serve(int fd, struct pipeline *pl)
+{
+	static const char not_found[] = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+	struct timeval timeout = {.tv_sec = 1};
+	char req[METRICS_REQ_LEN];
+	char hdr[256];
+	size_t body_len;
+	char *body;
+	ssize_t n;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	n = recv(fd, req, sizeof(req) - 1, 0);
+	if (n <= 0)
+		return;
+	req[n] = '\0';
+
+	if (strncmp(req, "GET / ", 6) && strncmp(req, "GET /metrics ", 13)) {
+		metrics_send(fd, not_found, strlen(not_found));
+		return;
+	}
+
+	if (metrics_render(pl, &body, &body_len))
+		return;
+
+	snprintf(hdr, sizeof(hdr),
+		 "HTTP/1.0 200 OK\r\n"
+		 "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+		 "Content-Length: %zu\r\n"
+		 "Connection: close\r\n\r\n",
+		 body_len);
+	metrics_send(fd, hdr, strlen(hdr));
+	metrics_send(fd, body, body_len);
+	free(body);
+}
+
+/* Called by the housekeeping thread when the listening socket is readable. */
+static void
+metrics_accept(int lfd, void *arg)
+{
+	int fd;
+
+	fd = accept(lfd, NULL, NULL);
+	if (fd < 0)
+		return;
+	metrics_serve(fd, arg);
+	close(fd);
+}
+
+int
+metrics_init(struct pipeline *pl)
+{
+	pl_conf *run_conf = &pl->conf;
+	int ret;
+
+	if (!run_conf->metrics_addr || metrics.fd >= 0)
+		return 0;
+
+	ret = housekeeping_listen(run_conf->metrics_addr, metrics.unix_path, sizeof(metrics.unix_path));
+	if (ret < 0)
+		return ret;
+	metrics.fd = ret;
+
+	ret = housekeeping_fd_add(metrics.fd, metrics_accept, pl);
+	if (ret) {
+		metrics_clean();
+		return ret;
+	}
+
+	MEILI_LOG_INFO("Serving metrics on %s.", run_conf->metrics_addr);
+
+	return 0;
+}
+
+void
+metrics_clean(void)
+{
+	if (metrics.fd >= 0) {
+		close(metrics.fd);
+		metrics.fd = -1;
+	}
+	if (metrics.unix_path[0]) {
+		unlink(metrics.unix_path);
+		metrics.unix_path[0] = '\0';
+	}
+}
@@ -0,0 +1,19 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_METRICS_H_
+#define _INCLUDE_METRICS_H_
+
+#include "../../runtime/pipeline.h"
+
+#define METRICS_REQ_LEN		1024
+
+/* Serve metrics of pl on run_conf->metrics_addr (see housekeeping_listen), a
+ * no-op if it is not set. Scrapes are answered by the housekeeping thread, so
+ * call before housekeeping_start().
+ */
+int metrics_init(struct pipeline *pl);
+
+/* Close the metrics socket, after housekeeping_stop(). */
+void metrics_clean(void);
+
+#endif /* _INCLUDE_METRICS_H_ */
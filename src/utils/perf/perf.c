@@ -0,0 +1,141 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* Per stage hardware counters, see perf.h.
+ *
+ * Needs kernel.perf_event_paranoid <= 2 (user space only counting) or
+ * CAP_PERFMON. Each read is a syscall, so --perf-counters adds roughly a
+ * microsecond per burst and is meant for profiling runs only.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf.h"
+#include "../../lib/log/meili_log.h"
+
+/* read_format of the group: nr, time_enabled, time_running, values[nr] */
+#define PERF_READ_HDR	3
+
+struct perf_event_def {
+	uint32_t type;
+	uint64_t config;
+};
+
+static const struct perf_event_def perf_events[PERF_NB_COUNTERS] = {
+	[PERF_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	[PERF_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	[PERF_LLC_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	[PERF_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	[PERF_DTLB_MISSES] = {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+						  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+
+static const char *perf_counter_names[PERF_NB_COUNTERS] = {
+	[PERF_CYCLES] = "cycles",
+	[PERF_INSTRUCTIONS] = "instructions",
+	[PERF_LLC_MISSES] = "llc_misses",
+	[PERF_BRANCH_MISSES] = "branch_misses",
+	[PERF_DTLB_MISSES] = "dtlb_misses",
+};
+
+const char *
+perf_counter_name(enum perf_counter c)
+{
+	return c < PERF_NB_COUNTERS ? perf_counter_names[c] : "-";
+}
+
+static int
+perf_event_open(struct perf_event_attr *attr, int group_fd)
+{
+	/* this thread, any cpu */
+	return syscall(__NR_perf_event_open, attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+int
+perf_group_open(struct perf_group *g)
+{
+	struct perf_event_attr attr;
+	int leader;
+	int err;
+	int i;
+
+	memset(g, 0, sizeof(*g));
+	for (i = 0; i < PERF_NB_COUNTERS; i++)
+		g->fd[i] = -1;
+
+	for (i = 0; i < PERF_NB_COUNTERS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = perf_events[i].type;
+		attr.config = perf_events[i].config;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		/* the leader starts the whole group */
+		attr.disabled = i == PERF_CYCLES;
+
+		g->fd[i] = perf_event_open(&attr, i == PERF_CYCLES ? -1 : g->fd[PERF_CYCLES]);
+		if (g->fd[i] < 0) {
+			err = errno;
+			if (i == PERF_CYCLES) {
+				MEILI_LOG_ERR("Failed to open cpu cycles counter: %s.", strerror(err));
+				return -err;
+			}
+			MEILI_LOG_WARN("Counter %s not available: %s.", perf_counter_names[i], strerror(err));
+			continue;
+		}
+		g->pos[i] = g->nb++;
+	}
+
+	leader = g->fd[PERF_CYCLES];
+	ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	if (ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP)) {
+		MEILI_LOG_ERR("Failed to enable counters: %s.", strerror(errno));
+		perf_group_close(g);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int
+perf_group_read(struct perf_group *g, uint64_t *val)
+{
+	uint64_t buf[PERF_READ_HDR + PERF_NB_COUNTERS];
+	ssize_t len = (PERF_READ_HDR + g->nb) * sizeof(uint64_t);
+	int i;
+
+	if (read(g->fd[PERF_CYCLES], buf, len) != len)
+		return -EIO;
+
+	g->enabled = buf[1];
+	g->running = buf[2];
+	for (i = 0; i < PERF_NB_COUNTERS; i++)
+		val[i] = g->fd[i] < 0 ? 0 : buf[PERF_READ_HDR + g->pos[i]];
+
+	return 0;
+}
+
+void
+perf_group_close(struct perf_group *g)
+{
+	int i;
+
+	if (g->fd[PERF_CYCLES] >= 0)
+		ioctl(g->fd[PERF_CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+	/* the group shared the PMU with other users, counts only cover part of the run */
+	if (g->running < g->enabled)
+		MEILI_LOG_WARN("Counters were multiplexed, active %.1f%% of the time.",
+			       100.0 * g->running / g->enabled);
+
+	for (i = 0; i < PERF_NB_COUNTERS; i++) {
+		if (g->fd[i] >= 0)
+			close(g->fd[i]);
+		g->fd[i] = -1;
+	}
+}
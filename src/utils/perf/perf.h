@@ -0,0 +1,66 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_PERF_H_
+#define _INCLUDE_PERF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Hardware counters of a stage core, read with perf_event_open(2) around each
+ * burst. All counters form one group so they are scheduled on the PMU
+ * together and can be divided by each other (e.g. ipc).
+ */
+
+/* Keep in sync with perf_counter_names in perf.c. */
+enum perf_counter {
+	PERF_CYCLES,		/* group leader */
+	PERF_INSTRUCTIONS,
+	PERF_LLC_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_DTLB_MISSES,
+	PERF_NB_COUNTERS,
+};
+
+struct perf_group {
+	int fd[PERF_NB_COUNTERS];	/* -1 if the PMU lacks the event */
+	int pos[PERF_NB_COUNTERS];	/* position in the group read */
+	int nb;
+	uint64_t begin[PERF_NB_COUNTERS];
+	uint64_t enabled;
+	uint64_t running;
+};
+
+const char *perf_counter_name(enum perf_counter c);
+
+/* Open and start the group counting the calling thread in user space. Fails
+ * only if the leader cannot be opened, missing events are skipped.
+ */
+int perf_group_open(struct perf_group *g);
+/* Stop the group, warns if the counters were multiplexed. */
+void perf_group_close(struct perf_group *g);
+
+/* Read all counters, val is indexed by enum perf_counter. */
+int perf_group_read(struct perf_group *g, uint64_t *val);
+
+/* Start of a burst. */
+static inline void
+perf_group_begin(struct perf_group *g)
+{
+	if (perf_group_read(g, g->begin))
+		g->begin[PERF_CYCLES] = UINT64_MAX;
+}
+
+/* End of a burst, adds the counts since perf_group_begin() to sum. */
+static inline void
+perf_group_end(struct perf_group *g, uint64_t *sum)
+{
+	uint64_t val[PERF_NB_COUNTERS];
+	int i;
+
+	if (g->begin[PERF_CYCLES] == UINT64_MAX || perf_group_read(g, val))
+		return;
+	for (i = 0; i < PERF_NB_COUNTERS; i++)
+		sum[i] += val[i] - g->begin[i];
+}
+
+#endif /* _INCLUDE_PERF_H_ */
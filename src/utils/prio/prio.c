@@ -0,0 +1,88 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* Traffic classes, see prio.h.
+ *
+ * example:
+ * ./build/meili ... --prio dscp:46,port:22,port:53
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_errno.h>
+#include <rte_mbuf_dyn.h>
+
+#include "prio.h"
+#include "../../lib/log/meili_log.h"
+#include "../../lib/net/meili_pkt.h"
+
+static int
+prio_parse_term(struct prio_classifier *pc, const char *term)
+{
+	unsigned long val;
+	char *end;
+
+	if (!strcmp(term, "flag"))
+		return 0;
+
+	if (!strncmp(term, "dscp:", 5)) {
+		val = strtoul(term + 5, &end, 10);
+		if (end == term + 5 || *end || val > 63) {
+			MEILI_LOG_ERR("prio dscp must be in [0, 63]: %s.", term);
+			return -EINVAL;
+		}
+		pc->dscp_mask |= 1ULL << val;
+		return 0;
+	}
+
+	if (!strncmp(term, "port:", 5)) {
+		val = strtoul(term + 5, &end, 10);
+		if (end == term + 5 || *end || !val || val > UINT16_MAX) {
+			MEILI_LOG_ERR("prio port must be in [1, 65535]: %s.", term);
+			return -EINVAL;
+		}
+		if (pc->nb_ports == PRIO_MAX_PORTS) {
+			MEILI_LOG_ERR("prio supports at most %u ports.", PRIO_MAX_PORTS);
+			return -EINVAL;
+		}
+		pc->ports[pc->nb_ports++] = rte_cpu_to_be_16(val);
+		return 0;
+	}
+
+	MEILI_LOG_ERR("Unknown prio classifier %s, expected dscp:N, port:N or flag.", term);
+	return -EINVAL;
+}
+
+int
+prio_init(struct prio_classifier *pc, const char *spec)
+{
+	static const struct rte_mbuf_dynflag desc = {
+		.name = PRIO_FLAG_NAME,
+	};
+	char *buf, *term, *save;
+	int bit;
+	int ret = 0;
+
+	memset(pc, 0, sizeof(*pc));
+
+	buf = strdup(spec);
+	if (!buf)
+		return -ENOMEM;
+	for (term = strtok_r(buf, ",", &save); term && !ret; term = strtok_r(NULL, ",", &save))
+		ret = prio_parse_term(pc, term);
+	free(buf);
+	if (ret)
+		return ret;
+
+	bit = rte_mbuf_dynflag_register(&desc);
+	if (bit < 0) {
+		MEILI_LOG_ERR("Failed to register mbuf flag for priority class, rte_errno: %i", rte_errno);
+		return -ENOMEM;
+	}
+	pc->flag = 1ULL << bit;
+	/* lets apps promote pkts, see meili_pkt_set_prio() */
+	meili_pkt_prio_flag = pc->flag;
+
+	return 0;
+}
@@ -0,0 +1,103 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_PRIO_H_
+#define _INCLUDE_PRIO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_byteorder.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+
+/* Two traffic classes (--prio). The main core classifies pkts on arrival by
+ * DSCP or l4 port, apps may also promote the pkts of a flow they track with
+ * meili_pkt_set_prio(). Pkts of the high priority class carry an ol_flags bit
+ * and travel on rings of their own between stages, which every stage polls
+ * first and in small bursts, while bulk traffic keeps its large batches.
+ */
+
+#define PRIO_MAX_PORTS		16
+/* pkts taken from a high priority ring per poll */
+#define PRIO_BURST_SIZE		8
+#define PRIO_RING_SIZE		1024
+#define PRIO_FLAG_NAME		"meili_dynflag_prio"
+
+struct prio_classifier {
+	uint64_t dscp_mask;			/* bit n set: DSCP n is high priority */
+	rte_be16_t ports[PRIO_MAX_PORTS];	/* src or dst tcp/udp port, network order */
+	uint32_t nb_ports;
+	uint64_t flag;				/* ol_flags bit of the class */
+};
+
+/* Parse spec, a comma separated list of dscp:N, port:N and flag (pkts are
+ * only promoted by apps), and register the ol_flags bit of the class.
+ */
+int prio_init(struct prio_classifier *pc, const char *spec);
+
+static inline bool
+prio_match(const struct prio_classifier *pc, struct rte_mbuf *m)
+{
+	struct rte_ether_hdr *eth = rte_pktmbuf_mtod(m, struct rte_ether_hdr *);
+	struct rte_ipv4_hdr *ip;
+	rte_be16_t *l4;
+	uint32_t ihl;
+	uint32_t i;
+
+	if (m->data_len < sizeof(*eth) + sizeof(*ip) || eth->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
+		return false;
+	ip = (struct rte_ipv4_hdr *)(eth + 1);
+
+	if (pc->dscp_mask & (1ULL << (ip->type_of_service >> 2)))
+		return true;
+
+	if (!pc->nb_ports || (ip->next_proto_id != IPPROTO_TCP && ip->next_proto_id != IPPROTO_UDP))
+		return false;
+	ihl = (ip->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+	/* src and dst port open both the tcp and the udp header */
+	if (m->data_len < sizeof(*eth) + ihl + 2 * sizeof(*l4))
+		return false;
+	l4 = (rte_be16_t *)((char *)ip + ihl);
+	for (i = 0; i < pc->nb_ports; i++)
+		if (l4[0] == pc->ports[i] || l4[1] == pc->ports[i])
+			return true;
+
+	return false;
+}
+
+/* Mark the high priority pkts of a received burst. */
+static inline void
+prio_classify(const struct prio_classifier *pc, struct rte_mbuf **pkts, uint32_t nb)
+{
+	uint32_t i;
+
+	if (!pc->dscp_mask && !pc->nb_ports)
+		return;
+	for (i = 0; i < nb; i++)
+		if (prio_match(pc, pkts[i]))
+			pkts[i]->ol_flags |= pc->flag;
+}
+
+/* Move the pkts carrying flag from pkts to prio, the others keep their order
+ * in pkts. Returns the num of pkts moved, *nb is left with the rest.
+ */
+static inline uint32_t
+prio_split(struct rte_mbuf **pkts, uint32_t *nb, uint64_t flag, struct rte_mbuf **prio)
+{
+	uint32_t nb_prio = 0;
+	uint32_t nb_bulk = 0;
+	uint32_t i;
+
+	for (i = 0; i < *nb; i++) {
+		if (pkts[i]->ol_flags & flag)
+			prio[nb_prio++] = pkts[i];
+		else
+			pkts[nb_bulk++] = pkts[i];
+	}
+	*nb = nb_bulk;
+
+	return nb_prio;
+}
+
+#endif /* _INCLUDE_PRIO_H_ */
@@ -0,0 +1,92 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* TSC based token bucket limiting the ingress rate of an input port */
+
+#include <errno.h>
+
+#include "rate_limit.h"
+#include "../../lib/log/meili_log.h"
+#include "../trace/trace.h"
+
+#define US_PER_SEC 1000000
+
+static struct rate_limit rate_limits[RTE_MAX_ETHPORTS];
+
+static void
+rate_limit_bucket_init(struct rate_limit_bucket *b, uint64_t rate, uint32_t burst_us, uint64_t hz)
+{
+	uint64_t burst_cycles = hz / US_PER_SEC * burst_us;
+
+	b->rate = rate;
+	if (!rate) {
+		b->credit = 0;
+		b->depth = 0;
+		return;
+	}
+
+	/* a bucket holds at least one token */
+	b->depth = (int64_t)RTE_MAX(rate * burst_cycles, hz);
+	/* start with a full bucket */
+	b->credit = b->depth;
+}
+
+/* Pick up the settings last written by rate_limit_set. Only called by the rx loop. */
+void
+rate_limit_apply(struct rate_limit *rl)
+{
+	rte_spinlock_lock(&rl->lock);
+
+	rl->hz = rte_get_timer_hz();
+	rl->last_tsc = rte_rdtsc();
+	if (!rl->avg_pkt_len)
+		rl->avg_pkt_len = RATE_LIMIT_INIT_PKT_LEN;
+
+	rate_limit_bucket_init(&rl->pkts, rl->new_pps, rl->new_burst_us, rl->hz);
+	/* bps bucket counts bytes */
+	rate_limit_bucket_init(&rl->bytes, rl->new_bps / 8, rl->new_burst_us, rl->hz);
+
+	rl->applied_gen = rl->gen;
+	trace_record(TRACE_EV_MODE, TRACE_MODE_RATE_LIMIT, rl->new_pps, rl->new_bps);
+
+	rte_spinlock_unlock(&rl->lock);
+}
+
+int
+rate_limit_set(uint16_t port_id, uint64_t bps, uint64_t pps, uint32_t burst_us)
+{
+	struct rate_limit *rl;
+
+	if (port_id >= RTE_MAX_ETHPORTS) {
+		MEILI_LOG_ERR("Invalid port %u for rate limit.", port_id);
+		return -EINVAL;
+	}
+
+	if (!burst_us)
+		burst_us = RATE_LIMIT_DEFAULT_BURST_US;
+	if (burst_us > RATE_LIMIT_MAX_BURST_US) {
+		MEILI_LOG_ERR("Rate limit burst %u us exceeds max of %u us.", burst_us, RATE_LIMIT_MAX_BURST_US);
+		return -EINVAL;
+	}
+
+	rl = &rate_limits[port_id];
+
+	rte_spinlock_lock(&rl->lock);
+	rl->new_bps = bps;
+	rl->new_pps = pps;
+	rl->new_burst_us = burst_us;
+	__atomic_add_fetch(&rl->gen, 1, __ATOMIC_RELEASE);
+	rte_spinlock_unlock(&rl->lock);
+
+	MEILI_LOG_INFO("Port %u rate limit set to %lu bps, %lu pps, burst %u us.", port_id, bps, pps, burst_us);
+
+	return 0;
+}
+
+struct rate_limit *
+rate_limit_get(uint16_t port_id)
+{
+	if (port_id >= RTE_MAX_ETHPORTS)
+		return NULL;
+
+	return &rate_limits[port_id];
+}
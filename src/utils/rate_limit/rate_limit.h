@@ -0,0 +1,139 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_RATE_LIMIT_H_
+#define _INCLUDE_RATE_LIMIT_H_
+
+#include <stdint.h>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+#include <rte_mbuf.h>
+#include <rte_spinlock.h>
+
+/* Default bucket depth, expressed as time of traffic at the configured rate. */
+#define RATE_LIMIT_DEFAULT_BURST_US	10
+#define RATE_LIMIT_MAX_BURST_US		10000
+/* Initial estimate of pkt size used to size rx bursts under a bps limit. */
+#define RATE_LIMIT_INIT_PKT_LEN		64
+
+/* One token bucket. Credit is kept in token * timer_hz units so refilling
+ * only needs a multiplication: credit += elapsed_cycles * rate.
+ */
+struct rate_limit_bucket {
+	uint64_t rate;			/* tokens per second, 0 = unlimited */
+	int64_t credit;			/* may go negative when a burst overshoots */
+	int64_t depth;			/* bucket depth in token * hz units */
+};
+
+/* Per input port ingress limiter in pkts (pps) and bytes (bps). */
+struct rate_limit {
+	struct rate_limit_bucket pkts;
+	struct rate_limit_bucket bytes;
+	uint64_t hz;
+	uint64_t last_tsc;
+	uint32_t avg_pkt_len;		/* EWMA of received pkt size in bytes */
+	uint32_t applied_gen;
+	uint64_t missed_pkts;		/* tokens lost to a full bucket, pkts lost if the source always offers */
+
+	/* pending settings written by control threads */
+	rte_spinlock_t lock;
+	uint32_t gen;
+	uint64_t new_bps;
+	uint64_t new_pps;
+	uint32_t new_burst_us;
+} __rte_cache_aligned;
+
+/* Set the limits of an input port. Safe to call from any thread while the
+ * port is running, the rx loop applies the new limits on its next burst.
+ * A rate of 0 removes that limit.
+ */
+int rate_limit_set(uint16_t port_id, uint64_t bps, uint64_t pps, uint32_t burst_us);
+
+/* Get the limiter of an input port, used by the rx loop. */
+struct rate_limit *rate_limit_get(uint16_t port_id);
+
+void rate_limit_apply(struct rate_limit *rl);
+
+/* Refill a bucket, returns the number of tokens that did not fit. With a source
+ * that always offers pkts (synthetic input) a bucket that overflows means the rx
+ * loop fell behind the offered rate, which a NIC would see as rx ring overflow.
+ * A live port may just offer less than the limit, so it says nothing there.
+ */
+static __rte_always_inline uint64_t
+rate_limit_refill(struct rate_limit_bucket *b, uint64_t elapsed, uint64_t hz)
+{
+	uint64_t room_cycles;
+	uint64_t over;
+
+	if (!b->rate)
+		return 0;
+
+	/* cycles needed to fill the bucket up, credit may be negative */
+	room_cycles = (uint64_t)(b->depth - b->credit) / b->rate;
+	if (elapsed <= room_cycles) {
+		b->credit += (int64_t)(elapsed * b->rate);
+		return 0;
+	}
+
+	b->credit = b->depth;
+	over = elapsed - room_cycles;
+
+	return over / hz * b->rate + over % hz * b->rate / hz;
+}
+
+/* Receive at most as many pkts as the buckets allow. The pps bucket gives an
+ * exact pkt budget, the bps bucket estimates one from the average pkt size and
+ * is then charged with the real bytes, carrying any overshoot as debt.
+ */
+static __rte_always_inline uint16_t
+rate_limit_rx_burst(struct rate_limit *rl, uint16_t port_id, uint16_t queue_id,
+		struct rte_mbuf **mbufs, uint16_t nb_pkts)
+{
+	uint64_t now = rte_rdtsc();
+	uint64_t budget = nb_pkts;
+	uint64_t nb_bytes = 0;
+	uint64_t missed;
+	uint16_t nb_rx;
+
+	if (unlikely(__atomic_load_n(&rl->gen, __ATOMIC_ACQUIRE) != rl->applied_gen))
+		rate_limit_apply(rl);
+
+	missed = rate_limit_refill(&rl->pkts, now - rl->last_tsc, rl->hz);
+	missed = RTE_MAX(missed, rate_limit_refill(&rl->bytes, now - rl->last_tsc, rl->hz) / rl->avg_pkt_len);
+	rl->missed_pkts += missed;
+	rl->last_tsc = now;
+
+	if (rl->pkts.rate) {
+		if (rl->pkts.credit <= 0)
+			return 0;
+		budget = RTE_MIN(budget, (uint64_t)rl->pkts.credit / rl->hz);
+	}
+	if (rl->bytes.rate) {
+		if (rl->bytes.credit <= 0)
+			return 0;
+		/* always allow one pkt when in credit so big pkts are not starved */
+		budget = RTE_MIN(budget, RTE_MAX((uint64_t)1, (uint64_t)rl->bytes.credit / rl->hz / rl->avg_pkt_len));
+	}
+	if (!budget)
+		return 0;
+
+	nb_rx = rte_eth_rx_burst(port_id, queue_id, mbufs, budget);
+	if (!nb_rx)
+		return 0;
+
+	if (rl->pkts.rate)
+		rl->pkts.credit -= (int64_t)nb_rx * rl->hz;
+	if (rl->bytes.rate) {
+		for (uint16_t i = 0; i < nb_rx; i++)
+			nb_bytes += mbufs[i]->data_len;
+		rl->bytes.credit -= (int64_t)(nb_bytes * rl->hz);
+		rl->avg_pkt_len = (rl->avg_pkt_len * 7 + nb_bytes / nb_rx) / 8;
+		if (!rl->avg_pkt_len)
+			rl->avg_pkt_len = 1;
+	}
+
+	return nb_rx;
+}
+
+#endif /* _INCLUDE_RATE_LIMIT_H_ */
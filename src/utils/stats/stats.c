@@ -13,21 +13,26 @@
 /* Modified by Meili Authors */ 
 /* Copyright (c) 2024, Meili Authors */
 
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <rte_ethdev.h>
 #include <rte_malloc.h>
 #include <rte_timer.h>
 #include <rte_mbuf.h>
 #include <rte_mbuf_dyn.h>
+#include <rte_pause.h>
 
 #include "../../lib/log/meili_log.h"
+#include "../../thirdparty/cJSON/cJSON.h"
 #include "stats.h"
 
 #include "../timestamp/timestamp.h"
 #include "../rte_reorder/rte_reorder.h"
+#include "../rate_limit/rate_limit.h"
 
 #include "../../runtime/meili_runtime.h"
 #include "../../packet_ordering/packet_ordering.h"
@@ -119,9 +124,32 @@ stats_init(pl_conf *run_conf)
 	if (!stats->lat_stats)
 		goto err_lat_stats;
 
+	stats->prio_lat_stats = rte_zmalloc(NULL, sizeof(lat_stats_t), 64);
+	if (!stats->prio_lat_stats)
+		goto err_prio_lat_stats;
+
+	stats->regex_stats = rte_zmalloc(NULL, sizeof(regex_stats_t) * nq, 64);
+	if (!stats->regex_stats)
+		goto err_regex_stats;
+
+	stats->rxp_stats = rte_zmalloc(NULL, sizeof(rxp_stats_t) * nq, 64);
+	if (!stats->rxp_stats)
+		goto err_rxp_stats;
+
+	for (i = 0; i < nq; i++)
+		stats->regex_stats[i].custom = &stats->rxp_stats[i];
+
+	stats->snapshots = rte_zmalloc(NULL, sizeof(stats_snapshot_t) * nq, 64);
+	if (!stats->snapshots)
+		goto err_snapshots;
+
+	stats->print_stats = rte_zmalloc(NULL, sizeof(run_mode_stats_t) * nq, 128);
+	if (!stats->print_stats)
+		goto err_print_stats;
 
 	stats->lat_stats->min_lat = UINT64_MAX;
 	stats->lat_stats->max_lat = 0;
+	stats->prio_lat_stats->min_lat = UINT64_MAX;
 		
 	run_conf->stats = stats;
 
@@ -137,6 +165,16 @@ stats_init(pl_conf *run_conf)
 	return 0;
 
 
+err_print_stats:
+	rte_free(stats->snapshots);
+err_snapshots:
+	rte_free(stats->rxp_stats);
+err_rxp_stats:
+	rte_free(stats->regex_stats);
+err_regex_stats:
+	rte_free(stats->prio_lat_stats);
+err_prio_lat_stats:
+	rte_free(stats->lat_stats);
 err_lat_stats:
 	rte_free(stats->rm_stats);
 err_rm_stats:
@@ -184,6 +222,8 @@ stats_input_type_to_str(enum rxpbench_input_type input)
 		return "DPDK Live";
 	if (input == INPUT_REMOTE_MMAP)
 		return "Remote mmap";
+	if (input == INPUT_SYNTHETIC)
+		return "Synthetic";
 
 	return "-";
 }
@@ -216,7 +256,7 @@ stats_print_config(pl_conf *run_conf)
 	buf_length = run_conf->input_buf_len;
 	slid_win = run_conf->sliding_window;
 
-	if (run_conf->input_mode == INPUT_LIVE) {
+	if (run_conf->input_mode == INPUT_LIVE || run_conf->input_mode == INPUT_SYNTHETIC) {
 		buf_length = 0;
 		iterations = 0;
 	}
@@ -234,9 +274,10 @@ stats_print_config(pl_conf *run_conf)
 	regex = stats_regex_dev_to_str(run_conf->regex_dev_type);
 	input = stats_input_type_to_str(run_conf->input_mode);
 
-	input_file = run_conf->input_mode != INPUT_LIVE ? run_conf->input_file : "-";
-	port1 = run_conf->input_mode == INPUT_LIVE ? run_conf->port1 : "-";
-	port2 = run_conf->input_mode == INPUT_LIVE && run_conf->port2 ? run_conf->port2 : "-";
+	input_file = run_conf->input_mode != INPUT_LIVE && run_conf->input_file ? run_conf->input_file : "-";
+	port1 = run_conf->input_mode == INPUT_LIVE || run_conf->input_mode == INPUT_SYNTHETIC ? run_conf->port1 : "-";
+	port2 = (run_conf->input_mode == INPUT_LIVE || run_conf->input_mode == INPUT_SYNTHETIC) && run_conf->port2 ?
+		run_conf->port2 : "-";
 	dpdk_app_mode = run_conf->input_mode == INPUT_LIVE && run_conf->input_app_mode ? "True" : "False";
 	rules_file = run_conf->raw_rules_file ? run_conf->raw_rules_file : run_conf->compiled_rules_file;
 
@@ -496,6 +537,33 @@ stats_print_update_single(run_mode_stats_t *rm1, run_mode_stats_t *rm2, bool tot
 #endif
 
 
+/* Refresh the printer's copy of core qid. While the cores run only their
+ * published snapshot is read, at the end of the run the counters themselves.
+ */
+static void
+stats_print_refresh(rb_stats_t *stats, int qid, bool end)
+{
+	run_mode_stats_t *rm = &stats->rm_stats[qid];
+	run_mode_stats_t *view = &stats->print_stats[qid];
+	stats_snapshot_t snap;
+
+	view->lcore_id = rm->lcore_id;
+	view->self = rm->self;
+	if (end) {
+		view->rx_buf_cnt = rm->rx_buf_cnt;
+		view->rx_buf_bytes = rm->rx_buf_bytes;
+		view->tx_buf_cnt = rm->tx_buf_cnt;
+		view->tx_buf_bytes = rm->tx_buf_bytes;
+		return;
+	}
+
+	stats_snapshot_read(stats, qid, &snap);
+	view->rx_buf_cnt = snap.rx_buf_cnt;
+	view->rx_buf_bytes = snap.rx_buf_bytes;
+	view->tx_buf_cnt = snap.tx_buf_cnt;
+	view->tx_buf_bytes = snap.tx_buf_bytes;
+}
+
 void
 stats_print_update(rb_stats_t *stats, int num_queues, double time, bool end)
 {
@@ -503,9 +571,12 @@ stats_print_update(rb_stats_t *stats, int num_queues, double time, bool end)
 
 	memset(&total_rm, 0, sizeof(run_mode_stats_t));
 
-	run_mode_stats_t *rm_stats = stats->rm_stats;
+	run_mode_stats_t *rm_stats = stats->print_stats;
 	int i;
 
+	for (i = 0; i < num_queues; i++)
+		stats_print_refresh(stats, i, end);
+
 	/* Clear terminal and move cursor to (0, 0). */
 	// fprintf(stdout, "\033[2J");
 	// fprintf(stdout, "\033[%d;%dH", 0, 0);
@@ -543,15 +614,21 @@ stats_print_update(rb_stats_t *stats, int num_queues, double time, bool end)
 	//stats_print_update_single(&total_rm, , NULL, true, time);
 }
 
-int cmpfunc (const void * a, const void * b)
+/* Samples are 64 bit cycle counts, comparing them as int truncates and overflows. */
+static int
+stats_cmp_u64(const void *a, const void *b)
 {
-   return ( *(int*)a - *(int*)b );
+	const uint64_t x = *(const uint64_t *)a;
+	const uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
 }
 
 
 
 static void
-stats_print_lat(rb_stats_t *stats, int num_queues, enum meili_regex_dev dev __rte_unused, uint32_t batches, bool lat_mode)
+stats_print_lat(rb_stats_t *stats, int num_queues, enum meili_regex_dev dev __rte_unused, uint32_t batches, bool lat_mode,
+		uint32_t probe)
 {
 	lat_stats_t *lat_stats = stats->lat_stats;
 	run_mode_stats_t *run_stats = stats->rm_stats;
@@ -570,9 +647,10 @@ stats_print_lat(rb_stats_t *stats, int num_queues, enum meili_regex_dev dev __rt
 	
 	nb_samples = RTE_MIN(lat_stats->nb_sampled, NUMBER_OF_SAMPLE);
 	/* sort time_diff_sample */
-	qsort(lat_stats->time_diff_sample,nb_samples,sizeof(uint64_t),cmpfunc);
+	qsort(lat_stats->time_diff_sample,nb_samples,sizeof(uint64_t),stats_cmp_u64);
 
-	total_bufs = run_stats->tx_buf_cnt;
+	/* all pkts in latency mode, the probes in throughput mode */
+	total_bufs = lat_stats->nb_lat;
 
 	lat_total.tot_lat = lat_stats->tot_lat;
 	lat_total.tot_in_lat = lat_stats->tot_in_lat;
@@ -591,7 +669,12 @@ stats_print_lat(rb_stats_t *stats, int num_queues, enum meili_regex_dev dev __rt
 
 	stats_print_banner("PACKET LATENCY STATS", STATS_BANNER_LEN);
 
-	if (!lat_mode)
+	if (probe)
+		fprintf(stdout,
+			"| ** NOTE: SAMPLED 1 IN %-10u PKTS AT FULL BATCH SIZE (--latency-probe) **|\n"
+			"|%*s|\n",
+			probe, 78, "");
+	else if (!lat_mode)
 		fprintf(stdout,
 			"| ** NOTE: NOT RUNNING IN LATENCY MODE (CAN TURN ON WITH --latency-mode) **    |\n"
 			"|%*s|\n",
@@ -659,13 +742,159 @@ stats_print_lat(rb_stats_t *stats, int num_queues, enum meili_regex_dev dev __rt
 }
 
 
+/* Where each stage instance spent its cycles: busy says saturated, idle says
+ * starved and stalled says the next stage is the bottleneck.
+ */
+static void
+stats_print_cycles(rb_stats_t *stats, int num_queues, double run_time)
+{
+	run_mode_stats_t *rm;
+	double run_cycles;
+	char type[24];
+	int i;
+
+	run_cycles = (run_time > 0 ? run_time : 1) * rte_get_timer_hz();
+
+	stats_print_banner("STAGE CYCLE STATS", STATS_BANNER_LEN);
+	fprintf(stdout, "| %-5s %-21s %8s %8s %8s %10s %10s |\n", "CORE", "STAGE", "BUSY%", "IDLE%", "STALL%",
+		"CYC/PKT", "PKT/BURST");
+	for (i = 1; i < num_queues; i++) {
+		rm = &stats->rm_stats[i];
+		if (!rm->self)
+			continue;
+		GET_STAGE_TYPE_STRING(rm->self->type, type);
+		fprintf(stdout, "| %-5d %-21s %8.2f %8.2f %8.2f %10.1f %10.1f |\n", rm->lcore_id, type,
+			100.0 * rm->busy_cycles / run_cycles, 100.0 * rm->idle_cycles / run_cycles,
+			100.0 * rm->stall_cycles / run_cycles,
+			rm->rx_buf_cnt ? (double)rm->busy_cycles / rm->rx_buf_cnt : 0.0,
+			rm->rx_batch_cnt ? (double)rm->rx_buf_cnt / rm->rx_batch_cnt : 0.0);
+	}
+	fprintf(stdout, STATS_BORDER "\n");
+}
+
+static double
+stats_perf_ratio(const run_mode_stats_t *rm, enum perf_counter c, uint64_t div)
+{
+	return div ? (double)rm->perf[c] / div : 0.0;
+}
+
+/* Hardware counters of the busy bursts of each stage core. Low ipc with many
+ * llc or dtlb misses per pkt points at memory, high ipc at compute, and llc
+ * misses on data only the stage itself writes at false sharing.
+ */
+static void
+stats_print_perf(rb_stats_t *stats, int num_queues)
+{
+	run_mode_stats_t *rm;
+	char type[24];
+	int i;
+
+	stats_print_banner("STAGE PMU STATS", STATS_BANNER_LEN);
+	fprintf(stdout, "| %-5s %-21s %8s %8s %8s %10s %10s |\n", "CORE", "STAGE", "IPC", "INS/PKT", "LLC/PKT",
+		"BRMISS/PKT", "DTLB/PKT");
+	for (i = 1; i < num_queues; i++) {
+		rm = &stats->rm_stats[i];
+		if (!rm->self)
+			continue;
+		GET_STAGE_TYPE_STRING(rm->self->type, type);
+		fprintf(stdout, "| %-5d %-21s %8.2f %8.1f %8.3f %10.3f %10.3f |\n", rm->lcore_id, type,
+			stats_perf_ratio(rm, PERF_INSTRUCTIONS, rm->perf[PERF_CYCLES]),
+			stats_perf_ratio(rm, PERF_INSTRUCTIONS, rm->rx_buf_cnt),
+			stats_perf_ratio(rm, PERF_LLC_MISSES, rm->rx_buf_cnt),
+			stats_perf_ratio(rm, PERF_BRANCH_MISSES, rm->rx_buf_cnt),
+			stats_perf_ratio(rm, PERF_DTLB_MISSES, rm->rx_buf_cnt));
+	}
+	fprintf(stdout, STATS_BORDER "\n");
+}
+
+/* Stage state allocated with meili_malloc(), all on hugepages of the node
+ * in the NODE column unless the node ran out.
+ */
+static void
+stats_print_mem(rb_stats_t *stats, int num_queues)
+{
+	struct meili_arena *arena;
+	run_mode_stats_t *rm;
+	bool any = false;
+	char type[24];
+	int i;
+
+	for (i = 1; i < num_queues; i++)
+		any |= stats->rm_stats[i].self && stats->rm_stats[i].self->arena.reserved;
+	if (!any)
+		return;
+
+	stats_print_banner("STAGE MEMORY STATS", STATS_BANNER_LEN);
+	fprintf(stdout, "| %-5s %-21s %8s %8s %8s %10s %10s |\n", "CORE", "STAGE", "NODE", "ALLOCS", "CHUNKS",
+		"USED KB", "RSVD KB");
+	for (i = 1; i < num_queues; i++) {
+		rm = &stats->rm_stats[i];
+		if (!rm->self)
+			continue;
+		arena = &rm->self->arena;
+		GET_STAGE_TYPE_STRING(rm->self->type, type);
+		fprintf(stdout, "| %-5d %-21s %8d %8u %8u %10.1f %10.1f |\n", rm->lcore_id, type, arena->socket_id,
+			arena->nb_allocs, arena->nb_chunks, arena->used / 1024.0, arena->reserved / 1024.0);
+	}
+	fprintf(stdout, STATS_BORDER "\n");
+}
+
+/* Pkts of the high priority class per core and, with --latency-probe, the
+ * latency of its probes next to that of all probes.
+ */
+static void
+stats_print_prio(rb_stats_t *stats, int num_queues)
+{
+	const double us_per_cycle = 1000000.0 / rte_get_timer_hz();
+	lat_stats_t *lat = stats->prio_lat_stats;
+	run_mode_stats_t *rm;
+	int nb_samples;
+	char type[24];
+	int i;
+
+	stats_print_banner("PRIORITY CLASS STATS", STATS_BANNER_LEN);
+	fprintf(stdout, "| %-5s %-21s %23s %24s |\n", "CORE", "STAGE", "PRIO PKTS", "PRIO%");
+	for (i = 0; i < num_queues; i++) {
+		rm = &stats->rm_stats[i];
+		if (i && !rm->self)
+			continue;
+		if (i) {
+			GET_STAGE_TYPE_STRING(rm->self->type, type);
+		} else {
+			snprintf(type, sizeof(type), "MAIN");
+		}
+		fprintf(stdout, "| %-5d %-21s %23" PRIu64 " %24.2f |\n", rm->lcore_id, type, rm->prio_buf_cnt,
+			rm->rx_buf_cnt ? 100.0 * rm->prio_buf_cnt / rm->rx_buf_cnt : 0.0);
+	}
+
+	nb_samples = RTE_MIN(lat->nb_sampled, NUMBER_OF_SAMPLE);
+	if (nb_samples) {
+		qsort(lat->time_diff_sample, nb_samples, sizeof(uint64_t), stats_cmp_u64);
+		fprintf(stdout,
+			"|%*s|\n"
+			"| - # OF HIGH PRIORITY PROBES:      %-42" PRIu64 " |\n"
+			"| - AVERAGE LATENCY:                %-42.4f |\n"
+			"| - 99th TAIL LATENCY:              %-42.4f |\n",
+			78, "", lat->nb_lat, (double)lat->tot_lat / lat->nb_lat * us_per_cycle,
+			lat->time_diff_sample[nb_samples * 99 / 100] * us_per_cycle);
+	}
+	fprintf(stdout, STATS_BORDER "\n");
+}
+
 void
 stats_print_end_of_run(pl_conf *run_conf, double run_time)
 {
 	rb_stats_t *stats = run_conf->stats;
 
 	stats_print_update(stats, run_conf->cores, run_time, true);
-	stats_print_lat(stats, run_conf->cores, run_conf->regex_dev_type, run_conf->input_batches, run_conf->latency_mode);
+	stats_print_cycles(stats, run_conf->cores, run_time);
+	if (run_conf->perf_counters)
+		stats_print_perf(stats, run_conf->cores);
+	stats_print_mem(stats, run_conf->cores);
+	if (run_conf->prio)
+		stats_print_prio(stats, run_conf->cores);
+	stats_print_lat(stats, run_conf->cores, run_conf->regex_dev_type, run_conf->input_batches, run_conf->latency_mode,
+			run_conf->latency_probe);
 	// stats_print_config(run_conf);
 	// stats_print_common_stats(stats, run_conf->cores, run_time);
 
@@ -676,6 +905,303 @@ stats_print_end_of_run(pl_conf *run_conf, double run_time)
 	
 }
 
+static const char *
+stats_run_mode_to_str(enum meili_run_mode mode)
+{
+	if (mode == RUN_MODE_MEILI)
+		return "meili";
+	if (mode == RUN_MODE_BASELINE)
+		return "baseline";
+	if (mode == RUN_MODE_ALL_REMOTE_ON_ARRIVAL)
+		return "all_remote";
+
+	return "-";
+}
+
+/* Offered pkts that never entered the pipeline: rate limiter overflow plus NIC drops. */
+static uint64_t
+stats_get_rx_missed(pl_conf *run_conf)
+{
+	struct rte_eth_stats eth_stats;
+	struct rate_limit *rl;
+	uint64_t missed = 0;
+	uint16_t port_id;
+
+	if (run_conf->input_mode != INPUT_LIVE && run_conf->input_mode != INPUT_SYNTHETIC)
+		return 0;
+	if (rte_eth_dev_get_port_by_name(run_conf->port1, &port_id))
+		return 0;
+
+	/* a synthetic source always offers traffic, tokens overflowing the bucket are pkts it lost;
+	 * a live port may simply offer less than the limit, its own counters tell what was dropped
+	 */
+	rl = rate_limit_get(port_id);
+	if (run_conf->input_mode == INPUT_SYNTHETIC && rl)
+		return __atomic_load_n(&rl->missed_pkts, __ATOMIC_RELAXED);
+	if (!rte_eth_stats_get(port_id, &eth_stats))
+		missed = eth_stats.imissed + eth_stats.rx_nombuf;
+
+	return missed;
+}
+
+/* Log2 histogram as an array of STATS_HIST_BUCKETS counts. */
+static cJSON *
+stats_json_hist(const uint64_t *hist)
+{
+	cJSON *arr;
+	int i;
+
+	arr = cJSON_CreateArray();
+	for (i = 0; arr && i < STATS_HIST_BUCKETS; i++)
+		cJSON_AddItemToArray(arr, cJSON_CreateNumber(hist[i]));
+
+	return arr;
+}
+
+static cJSON *
+stats_json_latency(lat_stats_t *lat_stats, uint64_t total_bufs)
+{
+	const double us_per_cycle = 1000000.0 / rte_get_timer_hz();
+	int nb_samples;
+	cJSON *lat;
+
+	nb_samples = RTE_MIN(lat_stats->nb_sampled, NUMBER_OF_SAMPLE);
+	if (!nb_samples)
+		return cJSON_CreateNull();
+
+	qsort(lat_stats->time_diff_sample, nb_samples, sizeof(uint64_t), stats_cmp_u64);
+
+	lat = cJSON_CreateObject();
+	if (!lat)
+		return NULL;
+
+	cJSON_AddNumberToObject(lat, "samples", nb_samples);
+	cJSON_AddNumberToObject(lat, "avg", total_bufs ? (double)lat_stats->tot_lat / total_bufs * us_per_cycle : 0);
+	cJSON_AddNumberToObject(lat, "min", lat_stats->min_lat == UINT64_MAX ? 0 : lat_stats->min_lat * us_per_cycle);
+	cJSON_AddNumberToObject(lat, "max", lat_stats->max_lat * us_per_cycle);
+	cJSON_AddNumberToObject(lat, "p50", lat_stats->time_diff_sample[nb_samples * 50 / 100] * us_per_cycle);
+	cJSON_AddNumberToObject(lat, "p90", lat_stats->time_diff_sample[nb_samples * 90 / 100] * us_per_cycle);
+	cJSON_AddNumberToObject(lat, "p99", lat_stats->time_diff_sample[nb_samples * 99 / 100] * us_per_cycle);
+	cJSON_AddNumberToObject(lat, "p999", lat_stats->time_diff_sample[nb_samples * 999 / 1000] * us_per_cycle);
+
+	return lat;
+}
+
+/* Read a consistent copy of the counters published by core qid, retrying
+ * while the writer is in the middle of an update.
+ */
+void
+stats_snapshot_read(rb_stats_t *stats, int qid, stats_snapshot_t *out)
+{
+	const stats_snapshot_t *snap = &stats->snapshots[qid];
+	uint32_t seq;
+
+	do {
+		seq = __atomic_load_n(&snap->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			rte_pause();
+			continue;
+		}
+		*out = *snap;
+		rte_smp_rmb();
+	} while ((seq & 1) || seq != __atomic_load_n(&snap->seq, __ATOMIC_RELAXED));
+}
+
+/* Write the end of run summary as json, used by benchmark drivers (see src/control). */
+int
+stats_write_json(pl_conf *run_conf, double run_time)
+{
+	rb_stats_t *stats = run_conf->stats;
+	run_mode_stats_t *rm_stats = stats->rm_stats;
+	cJSON *root, *conf, *rx, *tx, *stages, *stage;
+	double run_cycles;
+	uint64_t missed;
+	uint64_t rx_pkts = 0, rx_bytes = 0, prio_pkts = 0, elephant_pkts = 0, hold_full = 0;
+	/* the egress lcore takes the queue after the dispatchers */
+	const uint32_t tx_qid = run_conf->egress_lcore ? run_conf->dispatchers : 0;
+	char type[24];
+	char name[32];
+	char *out;
+	FILE *fp;
+	int ret = 0;
+	uint32_t i;
+	int c;
+
+	if (run_time <= 0)
+		run_time = 1;
+	run_cycles = run_time * rte_get_timer_hz();
+
+	root = cJSON_CreateObject();
+	if (!root)
+		goto err_mem;
+
+	conf = cJSON_AddObjectToObject(root, "config");
+	if (!conf)
+		goto err_json;
+	cJSON_AddStringToObject(conf, "input_mode", stats_input_type_to_str(run_conf->input_mode));
+	cJSON_AddStringToObject(conf, "run_mode", stats_run_mode_to_str(run_conf->run_mode));
+	cJSON_AddNumberToObject(conf, "cores", run_conf->cores);
+	cJSON_AddNumberToObject(conf, "input_batches", run_conf->input_batches);
+	cJSON_AddNumberToObject(conf, "stage_batch_size", run_conf->stage_batch_size);
+	cJSON_AddNumberToObject(conf, "adaptive_batch_us", run_conf->adaptive_batch_us);
+	cJSON_AddNumberToObject(conf, "fan_in", run_conf->fan_in);
+	cJSON_AddNumberToObject(conf, "prefetch", run_conf->prefetch_dist);
+	cJSON_AddNumberToObject(conf, "dispatchers", run_conf->dispatchers);
+	cJSON_AddBoolToObject(conf, "egress_lcore", run_conf->egress_lcore);
+	cJSON_AddBoolToObject(conf, "flow_affinity", run_conf->flow_affinity);
+	cJSON_AddNumberToObject(conf, "elephant_kpps", run_conf->elephant_kpps);
+	cJSON_AddBoolToObject(conf, "graph_mode", run_conf->graph_mode);
+	cJSON_AddStringToObject(conf, "prio", run_conf->prio ? run_conf->prio : "-");
+	cJSON_AddBoolToObject(conf, "latency_mode", run_conf->latency_mode);
+	cJSON_AddNumberToObject(conf, "latency_probe", run_conf->latency_probe);
+	cJSON_AddNumberToObject(conf, "rate_limit_mbps", run_conf->rate_limit_mbps);
+	cJSON_AddNumberToObject(conf, "rate_limit_kpps", run_conf->rate_limit_kpps);
+	if (run_conf->input_mode == INPUT_SYNTHETIC) {
+		cJSON_AddStringToObject(conf, "gen_sizes", run_conf->gen_sizes ? run_conf->gen_sizes : "-");
+		cJSON_AddNumberToObject(conf, "gen_flows", run_conf->gen_flows);
+		cJSON_AddNumberToObject(conf, "gen_zipf", run_conf->gen_zipf);
+	}
+
+	cJSON_AddNumberToObject(root, "duration", run_time);
+
+	/* the dispatchers (queues 0 to dispatchers - 1) see all pkts entering the pipeline, the egress lcore
+	 * or else the main core all leaving it
+	 */
+	for (i = 0; i < run_conf->dispatchers; i++) {
+		rx_pkts += rm_stats[i].rx_buf_cnt;
+		rx_bytes += rm_stats[i].rx_buf_bytes;
+		prio_pkts += rm_stats[i].prio_buf_cnt;
+		elephant_pkts += rm_stats[i].elephant_buf_cnt;
+		hold_full += rm_stats[i].hold_full_cnt;
+	}
+	missed = stats_get_rx_missed(run_conf);
+	rx = cJSON_AddObjectToObject(root, "rx");
+	tx = cJSON_AddObjectToObject(root, "tx");
+	if (!rx || !tx)
+		goto err_json;
+	cJSON_AddNumberToObject(rx, "pkts", rx_pkts);
+	cJSON_AddNumberToObject(rx, "bytes", rx_bytes);
+	cJSON_AddNumberToObject(rx, "missed", missed);
+	cJSON_AddNumberToObject(tx, "pkts", rm_stats[tx_qid].tx_buf_cnt);
+	cJSON_AddNumberToObject(tx, "bytes", rm_stats[tx_qid].tx_buf_bytes);
+	cJSON_AddNumberToObject(tx, "mpps", rm_stats[tx_qid].tx_buf_cnt / run_time / MEGA);
+	cJSON_AddNumberToObject(tx, "gbps", rm_stats[tx_qid].tx_buf_bytes * 8 / run_time / GIGA);
+	cJSON_AddNumberToObject(root, "loss_ratio",
+				missed ? (double)missed / (missed + rx_pkts) : 0.0);
+
+	cJSON_AddItemToObject(root, "latency_us", stats_json_latency(stats->lat_stats, stats->lat_stats->nb_lat));
+	if (run_conf->prio) {
+		cJSON_AddNumberToObject(root, "prio_pkts", prio_pkts);
+		cJSON_AddItemToObject(root, "prio_latency_us",
+				      stats_json_latency(stats->prio_lat_stats, stats->prio_lat_stats->nb_lat));
+	}
+	if (run_conf->elephant_kpps)
+		cJSON_AddNumberToObject(root, "elephant_pkts", elephant_pkts);
+	if (run_conf->flow_affinity)
+		cJSON_AddNumberToObject(root, "hold_full", hold_full);
+
+	stages = cJSON_AddArrayToObject(root, "stages");
+	if (!stages)
+		goto err_json;
+	for (i = 1; i < run_conf->cores; i++) {
+		stage = cJSON_CreateObject();
+		if (!stage)
+			goto err_json;
+		GET_STAGE_TYPE_STRING(rm_stats[i].self ? rm_stats[i].self->type : PL_MAIN, type);
+		cJSON_AddNumberToObject(stage, "lcore", rm_stats[i].lcore_id);
+		cJSON_AddStringToObject(stage, "type", type);
+		cJSON_AddNumberToObject(stage, "pkts", rm_stats[i].tx_buf_cnt);
+		cJSON_AddNumberToObject(stage, "mpps", rm_stats[i].tx_buf_cnt / run_time / MEGA);
+		if (run_conf->prio)
+			cJSON_AddNumberToObject(stage, "prio_pkts", rm_stats[i].prio_buf_cnt);
+		cJSON_AddNumberToObject(stage, "utilization", RTE_MIN(rm_stats[i].busy_cycles / run_cycles, 1.0));
+		cJSON_AddNumberToObject(stage, "idle", RTE_MIN(rm_stats[i].idle_cycles / run_cycles, 1.0));
+		cJSON_AddNumberToObject(stage, "stalled", RTE_MIN(rm_stats[i].stall_cycles / run_cycles, 1.0));
+		cJSON_AddNumberToObject(stage, "cycles_per_pkt",
+					rm_stats[i].rx_buf_cnt ? (double)rm_stats[i].busy_cycles / rm_stats[i].rx_buf_cnt : 0.0);
+		cJSON_AddItemToObject(stage, "burst_hist", stats_json_hist(rm_stats[i].burst_hist));
+		cJSON_AddItemToObject(stage, "cycles_per_pkt_hist", stats_json_hist(rm_stats[i].cpp_hist));
+		if (rm_stats[i].self) {
+			cJSON_AddNumberToObject(stage, "state_bytes", rm_stats[i].self->arena.used);
+			cJSON_AddNumberToObject(stage, "state_reserved_bytes", rm_stats[i].self->arena.reserved);
+		}
+		if (run_conf->perf_counters) {
+			cJSON_AddNumberToObject(stage, "ipc", stats_perf_ratio(&rm_stats[i], PERF_INSTRUCTIONS,
+									   rm_stats[i].perf[PERF_CYCLES]));
+			for (c = 0; c < PERF_NB_COUNTERS; c++) {
+				snprintf(name, sizeof(name), "%s_per_pkt", perf_counter_name(c));
+				cJSON_AddNumberToObject(stage, name, stats_perf_ratio(&rm_stats[i], c, rm_stats[i].rx_buf_cnt));
+			}
+		}
+		cJSON_AddItemToArray(stages, stage);
+	}
+
+	out = cJSON_Print(root);
+	if (!out)
+		goto err_json;
+
+	fp = fopen(run_conf->stats_json_file, "w");
+	if (!fp) {
+		MEILI_LOG_ERR("Failed to open stats json file %s.", run_conf->stats_json_file);
+		ret = -EINVAL;
+	} else {
+		fprintf(fp, "%s\n", out);
+		fclose(fp);
+	}
+
+	cJSON_free(out);
+	cJSON_Delete(root);
+
+	return ret;
+
+err_json:
+	cJSON_Delete(root);
+err_mem:
+	MEILI_LOG_ERR("Memory failure when writing stats json.");
+
+	return -ENOMEM;
+}
+
+static inline void
+stats_lat_record(lat_stats_t *lat_stats, uint64_t time_diff, bool sample)
+{
+	lat_stats->tot_lat += time_diff;
+	lat_stats->nb_lat++;
+	if (time_diff < lat_stats->min_lat)
+		lat_stats->min_lat = time_diff;
+	if (time_diff > lat_stats->max_lat)
+		lat_stats->max_lat = time_diff;
+
+	if (sample) {
+		lat_stats->time_diff_sample[lat_stats->nb_sampled & (NUMBER_OF_SAMPLE - 1)] = time_diff;
+		lat_stats->nb_sampled++;
+	}
+}
+
+/* Latency of the probes marked by pkt_ts_probe_exec, other pkts are skipped. */
+void
+stats_update_probe(struct rte_mbuf **mbuf, int nb_mbuf, struct pipeline *pl)
+{
+	lat_stats_t *lat_stats = pl->conf.stats->lat_stats;
+	const uint64_t flag = pl->probe_flag;
+	uint64_t now = 0;
+	uint64_t time_start;
+	int i;
+
+	for (i = 0; i < nb_mbuf; i++) {
+		if (!(mbuf[i]->ol_flags & flag))
+			continue;
+		if (!now)
+			now = rte_get_timer_cycles();
+		time_start = *RTE_MBUF_DYNFIELD(mbuf[i], pl->ts_start_offset, uint64_t *);
+		stats_lat_record(lat_stats, now - time_start, true);
+		if (mbuf[i]->ol_flags & pl->prio.flag)
+			stats_lat_record(pl->conf.stats->prio_lat_stats, now - time_start, true);
+		/* the mbuf may be sent on, do not leak the mark to the peer */
+		mbuf[i]->ol_flags &= ~flag;
+	}
+}
+
 void 
 stats_update_time_main(struct rte_mbuf **mbuf, int nb_mbuf, struct pipeline *pl)
 {
@@ -712,16 +1238,7 @@ stats_update_time_main(struct rte_mbuf **mbuf, int nb_mbuf, struct pipeline *pl)
 		
 		time_diff = (time_end - time_start);
 
-		lat_stats->tot_lat += time_diff;
-		if (time_diff < lat_stats->min_lat)
-			lat_stats->min_lat = time_diff;
-		if (time_diff > lat_stats->max_lat)
-			lat_stats->max_lat = time_diff;
-        
-        #ifdef PKT_LATENCY_SAMPLE_ON
-        lat_stats->time_diff_sample[lat_stats->nb_sampled & NUMBER_OF_SAMPLE] = time_diff;
-        lat_stats->nb_sampled++;  
-        #endif
+		stats_lat_record(lat_stats, time_diff, run_conf->latency_sample);
         
     //     #ifdef PKT_LATENCY_BREAKDOWN_ON
     //     /* record breakdown latency of pipeline stages */
@@ -792,6 +1309,11 @@ void
 stats_clean(pl_conf *run_conf)
 {
 	rb_stats_t *stats = run_conf->stats;
+	rte_free(stats->print_stats);
+	rte_free(stats->snapshots);
+	rte_free(stats->rxp_stats);
+	rte_free(stats->regex_stats);
+	rte_free(stats->prio_lat_stats);
 	rte_free(stats->rm_stats);
 	rte_free(stats);
 	rte_free(run_conf->input_pkt_stats);
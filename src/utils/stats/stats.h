@@ -4,7 +4,9 @@
 #define _INCLUDE_STATS_H_
 
 #include <stdint.h>
+#include <string.h>
 
+#include <rte_atomic.h>
 #include <rte_cycles.h>
 #include <rte_ether.h>
 #include <rte_ip.h>
@@ -12,14 +14,22 @@
 #include <rte_udp.h>
 
 #include "../../lib/conf/meili_conf.h"
+#include "../../lib/regex/meili_regex_stats.h"
 #include "../../runtime/meili_runtime.h"
+#include "../perf/perf.h"
 
 // #define ONLY_SPLIT_THROUGHPUT
 
 #define STATS_INTERVAL_SEC	1
 #define STATS_INTERVAL_CYCLES	STATS_INTERVAL_SEC * rte_get_timer_hz()
 
-#define NUMBER_OF_SAMPLE ((1<<14) - 1) /* should be 2^n-1 for speed */ 
+/* Period of counter snapshots published for readers off the data plane. */
+#define STATS_PUBLISH_MS	10
+
+/* Log2 histograms: bucket 0 counts 0, bucket i counts [2^(i-1), 2^i), the last bucket everything above. */
+#define STATS_HIST_BUCKETS	16
+
+#define NUMBER_OF_SAMPLE (1<<14) /* latest samples kept, should be 2^n for speed */
 
 typedef struct pkt_stats {
 	uint64_t valid_pkts;	   /* Successfully parsed. */
@@ -53,6 +63,18 @@ typedef struct run_mode_stats {
 			uint64_t split_tx_buf_bytes;  /* Bytes last recorded. */
 			uint64_t split_tx_buf_cnt;  /* Buf last recorded. */
 			double split_duration;  /* per core duration recording. */
+			/* Stage cycle accounting, busy + idle + stall covers the whole run. */
+			uint64_t busy_cycles;  /* Dequeue, processing and enqueue of bursts carrying pkts. */
+			uint64_t idle_cycles;  /* Polls of empty input rings. */
+			uint64_t stall_cycles; /* Retrying enqueue to a full output ring. */
+			uint64_t burst_hist[STATS_HIST_BUCKETS]; /* Pkts per dequeued burst. */
+			uint64_t cpp_hist[STATS_HIST_BUCKETS];   /* Busy cycles per pkt of a burst. */
+			uint64_t cpp_sum;      /* Sum of the cycles per pkt observations. */
+			uint64_t perf[PERF_NB_COUNTERS]; /* Hardware counters of busy bursts, see --perf-counters. */
+			uint64_t prio_buf_cnt; /* Pkts of the high priority class, see --prio. */
+			uint64_t elephant_buf_cnt; /* Pkts of elephant flows, see --elephant-kpps. */
+			uint64_t hold_full_cnt; /* Scale events whose held pkts left early, the hold slots ran out. */
+			uint64_t next_publish; /* Tsc of the next snapshot. */
 
 			pkt_stats_t pkt_stats; /* Packet stats. */
 
@@ -61,7 +83,7 @@ typedef struct run_mode_stats {
 		/* Ensure multiple cores don't access the same cache line. */
 		unsigned char cache_align[CACHE_LINE_SIZE * 2];
 	};
-} run_mode_stats_t;
+} __rte_cache_aligned run_mode_stats_t;
 
 
 typedef struct lat_stats {
@@ -73,13 +95,92 @@ typedef struct lat_stats {
 	// sample 
 	uint64_t time_diff_sample[NUMBER_OF_SAMPLE];
 	int nb_sampled;
+	uint64_t nb_lat;	/* pkts whose latency was measured */
 } lat_stats_t;
 
+/* Copy of the counters of one core, written by that core under a seqlock.
+ * Threads outside the data plane (i.e. the metrics exporter) only read this
+ * copy and never touch the cache lines of run_mode_stats_t.
+ */
+typedef struct stats_snapshot {
+	uint32_t seq;		/* odd while the writer is updating */
+	uint64_t tsc;
+	uint64_t rx_buf_cnt;
+	uint64_t rx_buf_bytes;
+	uint64_t tx_buf_cnt;
+	uint64_t tx_buf_bytes;
+	uint64_t tx_batch_cnt;
+	uint64_t busy_cycles;
+	uint64_t idle_cycles;
+	uint64_t stall_cycles;
+	uint64_t burst_hist[STATS_HIST_BUCKETS];
+	uint64_t cpp_hist[STATS_HIST_BUCKETS];
+	uint64_t cpp_sum;
+	uint64_t perf[PERF_NB_COUNTERS];
+	uint64_t regex_rx_valid;
+	uint64_t regex_rx_invalid;
+	uint64_t regex_buf_match_cnt;
+	uint64_t regex_total_match;
+} __rte_cache_aligned stats_snapshot_t;
+
 typedef struct rxpbench_stats {
 	run_mode_stats_t *rm_stats;
 	lat_stats_t *lat_stats;
+	lat_stats_t *prio_lat_stats;	/* probes of the high priority class */
+	regex_stats_t *regex_stats;	/* per core regex counters */
+	rxp_stats_t *rxp_stats;		/* device specific part of regex_stats */
+	stats_snapshot_t *snapshots;	/* per core published counters */
+	run_mode_stats_t *print_stats;	/* copies owned by the periodic printer, keeps its split state */
 } rb_stats_t;
 
+/* Publish the counters of core qid if the last snapshot is older than
+ * STATS_PUBLISH_MS. Called by the owning core only, once per burst.
+ */
+static __rte_always_inline void
+stats_publish(rb_stats_t *stats, int qid, uint64_t tsc)
+{
+	run_mode_stats_t *rm_stats = &stats->rm_stats[qid];
+	regex_stats_t *regex_stats = &stats->regex_stats[qid];
+	stats_snapshot_t *snap = &stats->snapshots[qid];
+	uint32_t seq;
+
+	if (tsc < rm_stats->next_publish)
+		return;
+	rm_stats->next_publish = tsc + rte_get_tsc_hz() / 1000 * STATS_PUBLISH_MS;
+
+	seq = snap->seq;
+	__atomic_store_n(&snap->seq, seq + 1, __ATOMIC_RELAXED);
+	rte_smp_wmb();
+
+	snap->tsc = tsc;
+	snap->rx_buf_cnt = rm_stats->rx_buf_cnt;
+	snap->rx_buf_bytes = rm_stats->rx_buf_bytes;
+	snap->tx_buf_cnt = rm_stats->tx_buf_cnt;
+	snap->tx_buf_bytes = rm_stats->tx_buf_bytes;
+	snap->tx_batch_cnt = rm_stats->tx_batch_cnt;
+	snap->busy_cycles = rm_stats->busy_cycles;
+	snap->idle_cycles = rm_stats->idle_cycles;
+	snap->stall_cycles = rm_stats->stall_cycles;
+	memcpy(snap->burst_hist, rm_stats->burst_hist, sizeof(snap->burst_hist));
+	memcpy(snap->cpp_hist, rm_stats->cpp_hist, sizeof(snap->cpp_hist));
+	snap->cpp_sum = rm_stats->cpp_sum;
+	memcpy(snap->perf, rm_stats->perf, sizeof(snap->perf));
+	snap->regex_rx_valid = regex_stats->rx_valid;
+	snap->regex_rx_invalid = stats->rxp_stats[qid].rx_invalid;
+	snap->regex_buf_match_cnt = regex_stats->rx_buf_match_cnt;
+	snap->regex_total_match = regex_stats->rx_total_match;
+
+	__atomic_store_n(&snap->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static __rte_always_inline unsigned int
+stats_hist_bucket(uint64_t v)
+{
+	unsigned int b = v ? 64 - __builtin_clzll(v) : 0;
+
+	return RTE_MIN(b, STATS_HIST_BUCKETS - 1u);
+}
+
 /* Modify packet stats (common to live and pcap modes). */
 static inline void
 stats_update_pkt_stats(pkt_stats_t *pkt_stats, int rte_ptype)
@@ -106,6 +207,9 @@ void stats_clean(pl_conf *run_conf);
 void stats_print_update(rb_stats_t *stats, int num_queues, double time, bool end);
 void stats_print_end_of_run(pl_conf *run_conf, double run_time);
 void stats_update_time_main(struct rte_mbuf **mbuf, int nb_mbuf, struct pipeline *pl);
+void stats_update_probe(struct rte_mbuf **mbuf, int nb_mbuf, struct pipeline *pl);
+int stats_write_json(pl_conf *run_conf, double run_time);
+void stats_snapshot_read(rb_stats_t *stats, int qid, stats_snapshot_t *out);
 
 
 #endif /* _INCLUDE_STATS_H_ */
@@ -0,0 +1,177 @@
+/* Copyright (c) 2024, Meili Authors */
+
+/* Per lcore flight recorder, see trace.h.
+ *
+ * example:
+ * ./build/meili ... --trace /tmp/meili.trc
+ * kill -USR1 <pid>
+ * python3 ./src/control/trace_decode.py /tmp/meili.trc
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rte_malloc.h>
+
+#include "trace.h"
+#include "../../lib/log/meili_log.h"
+
+struct trace_file_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t nb_rings;
+	uint64_t tsc_hz;
+	uint32_t ring_size;
+	uint32_t rec_size;
+};
+
+struct trace_ring_hdr {
+	uint32_t lcore_id;
+	uint32_t reserved;
+	uint64_t head;
+};
+
+struct trace_ring *trace_rings[RTE_MAX_LCORE];
+
+static char trace_path[PATH_MAX];
+static const int trace_fatal_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+static int
+trace_write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+void
+trace_dump(void)
+{
+	struct trace_file_hdr hdr = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.tsc_hz = rte_get_tsc_hz(),
+		.ring_size = TRACE_RING_SIZE,
+		.rec_size = sizeof(struct trace_rec),
+	};
+	struct trace_ring_hdr ring_hdr = {0};
+	struct trace_ring *ring;
+	unsigned int i;
+	int fd;
+
+	if (!trace_path[0])
+		return;
+
+	for (i = 0; i < RTE_MAX_LCORE; i++)
+		if (trace_rings[i])
+			hdr.nb_rings++;
+
+	fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return;
+
+	if (trace_write_all(fd, &hdr, sizeof(hdr)))
+		goto out;
+	for (i = 0; i < RTE_MAX_LCORE; i++) {
+		ring = trace_rings[i];
+		if (!ring)
+			continue;
+		ring_hdr.lcore_id = ring->lcore_id;
+		ring_hdr.head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (trace_write_all(fd, &ring_hdr, sizeof(ring_hdr)) ||
+		    trace_write_all(fd, ring->recs, sizeof(ring->recs)))
+			goto out;
+	}
+out:
+	close(fd);
+}
+
+static void
+trace_signal_handler(int signum)
+{
+	trace_dump();
+
+	/* fatal signals were installed with SA_RESETHAND, rerun the default action */
+	if (signum != SIGUSR1)
+		raise(signum);
+}
+
+int
+trace_init(pl_conf *run_conf)
+{
+	struct sigaction sa;
+	unsigned int lcore_id;
+	unsigned int i;
+
+	if (!run_conf->trace_file)
+		return 0;
+
+	if (strlen(run_conf->trace_file) >= sizeof(trace_path)) {
+		MEILI_LOG_ERR("Trace file path %s too long.", run_conf->trace_file);
+		return -EINVAL;
+	}
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		trace_rings[lcore_id] = rte_zmalloc_socket(NULL, sizeof(struct trace_ring), RTE_CACHE_LINE_SIZE,
+							   rte_lcore_to_socket_id(lcore_id));
+		if (!trace_rings[lcore_id]) {
+			MEILI_LOG_ERR("Memory failure when allocating trace rings.");
+			trace_clean();
+			return -ENOMEM;
+		}
+		trace_rings[lcore_id]->lcore_id = lcore_id;
+	}
+	strcpy(trace_path, run_conf->trace_file);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = trace_signal_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+
+	sa.sa_flags = SA_RESETHAND;
+	for (i = 0; i < RTE_DIM(trace_fatal_signals); i++)
+		sigaction(trace_fatal_signals[i], &sa, NULL);
+
+	MEILI_LOG_INFO("Flight recorder on, %u records per lcore, dumped to %s on SIGUSR1 and exit.",
+		       TRACE_RING_SIZE, trace_path);
+
+	return 0;
+}
+
+void
+trace_clean(void)
+{
+	struct sigaction sa = {.sa_handler = SIG_DFL};
+	struct trace_ring *ring;
+	unsigned int i;
+
+	if (trace_path[0]) {
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGUSR1, &sa, NULL);
+		for (i = 0; i < RTE_DIM(trace_fatal_signals); i++)
+			sigaction(trace_fatal_signals[i], &sa, NULL);
+		trace_path[0] = '\0';
+	}
+
+	for (i = 0; i < RTE_MAX_LCORE; i++) {
+		ring = trace_rings[i];
+		trace_rings[i] = NULL;
+		rte_free(ring);
+	}
+}
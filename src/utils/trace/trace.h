@@ -0,0 +1,114 @@
+/* Copyright (c) 2024, Meili Authors */
+
+#ifndef _INCLUDE_TRACE_H_
+#define _INCLUDE_TRACE_H_
+
+#include <stdint.h>
+
+#include <rte_branch_prediction.h>
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+
+#include "../../lib/conf/meili_conf.h"
+
+/* Flight recorder: one fixed size ring of binary records per lcore that keeps
+ * the latest TRACE_RING_SIZE events, overwriting the oldest. Rings are dumped
+ * to run_conf->trace_file on SIGUSR1, on fatal signals and at exit, and are
+ * decoded offline with src/control/trace_decode.py.
+ */
+
+#define TRACE_RING_SIZE		4096	/* records per lcore, power of 2 */
+#define TRACE_RING_MASK		(TRACE_RING_SIZE - 1)
+#define TRACE_MAGIC		"MEILITRC"
+#define TRACE_VERSION		1
+
+/* Keep in sync with TRACE_EVENTS in src/control/trace_decode.py. */
+enum trace_event {
+	TRACE_EV_NONE,
+	TRACE_EV_RX_BURST,	/* a: port, b: pkts received */
+	TRACE_EV_TX_BURST,	/* a: port, b: pkts sent, c: pkts dropped */
+	TRACE_EV_STAGE_BURST,	/* a: qid, b: pkts dequeued, c: busy cycles */
+	TRACE_EV_RING_FULL,	/* a: qid, b: pkts left to enqueue, c: ring free count */
+	TRACE_EV_REORDER_GAP,	/* a: reason, b: seqn received, c: seqn expected */
+	TRACE_EV_REGEX_ENQ,	/* a: qid, b: ops enqueued, c: ops requested */
+	TRACE_EV_REGEX_DEQ,	/* a: qid, b: ops dequeued */
+	TRACE_EV_MODE,		/* a: enum trace_mode, b/c: mode specific */
+	TRACE_EV_MAX,
+};
+
+/* Reasons of TRACE_EV_REORDER_GAP. */
+enum trace_reorder_gap {
+	TRACE_REORDER_EARLY,	/* seqn beyond the reorder window */
+	TRACE_REORDER_NO_SPACE,	/* reorder buffer full */
+	TRACE_REORDER_OUT_OF_ORDER,	/* drained seqn not consecutive */
+};
+
+/* Transitions of TRACE_EV_MODE. */
+enum trace_mode {
+	TRACE_MODE_RUN_START,	/* b: run mode, c: input mode */
+	TRACE_MODE_RUN_STOP,	/* b: force_quit */
+	TRACE_MODE_RATE_LIMIT,	/* b: pps, c: bps */
+	TRACE_MODE_SCALE,	/* b: active first stage instances, c: first stage instances */
+	TRACE_MODE_MIGRATE,	/* b: worker qid, c: flow state entries sent to other instances */
+	TRACE_MODE_HOLD_FULL,	/* b: worker qid, c: held pkts released before their state moved */
+};
+
+/* 32B record, two per cache line. */
+struct trace_rec {
+	uint64_t tsc;
+	uint16_t event;
+	uint16_t lcore;
+	uint32_t a;
+	uint64_t b;
+	uint64_t c;
+};
+
+struct trace_ring {
+	uint64_t head;			/* records written so far */
+	uint32_t lcore_id;
+	struct trace_rec recs[TRACE_RING_SIZE] __rte_cache_aligned;
+} __rte_cache_aligned;
+
+/* Ring of each lcore, NULL when tracing is off. */
+extern struct trace_ring *trace_rings[RTE_MAX_LCORE];
+
+int trace_init(pl_conf *run_conf);
+/* Write all rings to the trace file. Only uses async signal safe calls. */
+void trace_dump(void);
+void trace_clean(void);
+
+/* Record an event on the calling lcore with a tsc the caller already read.
+ * Single writer per ring, so a plain store of head is enough; a concurrent
+ * dump may see the record being written torn, which the decoder tolerates.
+ */
+static __rte_always_inline void
+trace_record_tsc(uint64_t tsc, uint16_t event, uint32_t a, uint64_t b, uint64_t c)
+{
+	const unsigned int lcore_id = rte_lcore_id();
+	struct trace_ring *ring;
+	struct trace_rec *rec;
+
+	if (unlikely(lcore_id >= RTE_MAX_LCORE))
+		return;
+	ring = trace_rings[lcore_id];
+	if (!ring)
+		return;
+
+	rec = &ring->recs[ring->head & TRACE_RING_MASK];
+	rec->tsc = tsc;
+	rec->event = event;
+	rec->lcore = lcore_id;
+	rec->a = a;
+	rec->b = b;
+	rec->c = c;
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+static __rte_always_inline void
+trace_record(uint16_t event, uint32_t a, uint64_t b, uint64_t c)
+{
+	trace_record_tsc(rte_rdtsc(), event, a, b, c);
+}
+
+#endif /* _INCLUDE_TRACE_H_ */